@@ -56,5 +56,21 @@ struct resource_alloc {
 	uint16_t compute_units;
 };
 
+///////////////////////////////////////////////////////////////////////////////
+// Priority classes
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Priority classes for resource requests.  Waiting interactive kernels are
+ * started before normal kernels, which are started before batch kernels.
+ * Requests which don't specify a class are normal.
+ */
+enum aira_priority {
+	AIRA_PRIORITY_NORMAL = 0,
+	AIRA_PRIORITY_INTERACTIVE,
+	AIRA_PRIORITY_BATCH,
+	AIRA_NUM_PRIORITIES // Not a real priority class!
+};
+
 #endif /* _AIRA_DEFINITIONS */
 
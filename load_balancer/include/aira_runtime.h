@@ -19,9 +19,35 @@ extern "C" {
 
 typedef struct _aira_conn* aira_conn;
 
+/* Maximum number of kernels in a batched allocation request */
+#define AIRA_MAX_BATCH 16
+
+/* Status of an asynchronous allocation request */
+enum aira_alloc_status {
+	AIRA_ALLOC_ERROR = -1, /* Request failed, default allocations returned */
+	AIRA_ALLOC_PENDING = 0, /* Server has not yet assigned all resources */
+	AIRA_ALLOC_READY = 1 /* All resources have been assigned */
+};
+
+/*
+ * Called as each kernel of an asynchronous request is assigned resources.
+ * Runs on a helper thread owned by the library.
+ *
+ * @param conn the connection on which the request was made
+ * @param index the kernel's position in the request (0 for single requests)
+ * @param alloc the kernel's resource allocation
+ * @param data user data passed when registering the callback
+ */
+typedef void (*aira_alloc_callback)(aira_conn conn, int index,
+																		struct resource_alloc alloc, void* data);
+
 /*
  * Initialize data for a connection to the load-balancer.  Can be used by a
- * single process to get multiple connections to the server.
+ * single process to get multiple connections to the server.  The connection
+ * is kept open across requests until it is freed.  Setting the environment
+ * variable AIRA_LB_TRANSPORT=shm selects the shared-memory transport, which
+ * falls back to sockets if the server can't provide it.  AIRA_LB_SOCKET
+ * selects the server's socket if it isn't listening on the default.
  *
  * @return a connection handle used for communication with server or NULL if
  *         something went wrong
@@ -37,6 +63,21 @@ aira_conn aira_init_conn();
  */
 void aira_free_conn(aira_conn conn);
 
+/*
+ * Set the priority class & deadline of subsequent requests on a connection.
+ * Within a class, kernels with deadlines are started earliest deadline first,
+ * before kernels without.  Kernels which would miss their deadline waiting
+ * for their preferred device are moved to the device on which they're
+ * predicted to finish soonest.  Connections start out as normal priority
+ * without a deadline.
+ *
+ * @param conn a previously opened connection
+ * @param priority the priority class (enum aira_priority)
+ * @param deadline_us time in microseconds by which the kernel should finish,
+ *                    counted from the request, or 0 for no deadline
+ */
+void aira_set_priority(aira_conn conn, int priority, unsigned deadline_us);
+
 /*
  * Notify the load balancer that the application is going to run a compute
  * kernel on the specifed resource allocation.
@@ -58,17 +99,108 @@ void aira_notify(aira_conn conn, struct resource_alloc alloc);
 struct resource_alloc aira_alloc_resources(aira_conn conn,
 																					 struct kernel_features* features);
 
+/*
+ * Submit a request for a resource allocation without waiting for the server
+ * to answer.  Use aira_alloc_poll(), aira_alloc_wait() or
+ * aira_alloc_set_callback() to retrieve the allocation.  A connection can have
+ * only one outstanding request.
+ *
+ * @param conn a previously opened connection
+ * @param features feature vector describing the kernel to be executed
+ * @return AIRA_ALLOC_PENDING if submitted, AIRA_ALLOC_ERROR otherwise
+ */
+int aira_alloc_resources_async(aira_conn conn,
+															 struct kernel_features* features);
+
+/*
+ * Submit features for several upcoming kernels in a single request so the
+ * server can place them together.  Kernels are assigned resources as devices
+ * become available, so some may need to finish before others are assigned --
+ * use aira_alloc_next() or a callback to start each kernel as soon as it has
+ * been assigned.  Each kernel must be finished with aira_kernel_finish_batch().
+ *
+ * @param conn a previously opened connection
+ * @param num number of kernels (at most AIRA_MAX_BATCH)
+ * @param features feature vector describing each kernel
+ * @return AIRA_ALLOC_PENDING if submitted, AIRA_ALLOC_ERROR otherwise
+ */
+int aira_alloc_resources_batch_async(aira_conn conn, int num,
+																		 struct kernel_features* features);
+
+/*
+ * Check whether all kernels of the outstanding request have been assigned
+ * resources without blocking.
+ *
+ * @param conn a connection with an outstanding request
+ * @param allocs storage for each kernel's resource allocation, populated when
+ *               the request is ready (or failed)
+ * @return the request's status
+ */
+int aira_alloc_poll(aira_conn conn, struct resource_alloc* allocs);
+
+/*
+ * Wait for all kernels of the outstanding request to be assigned resources.
+ *
+ * @param conn a connection with an outstanding request
+ * @param timeout_ms milliseconds to wait, or a negative value to block
+ * @param allocs storage for each kernel's resource allocation, populated when
+ *               the request is ready (or failed)
+ * @return the request's status
+ */
+int aira_alloc_wait(aira_conn conn, int timeout_ms,
+										struct resource_alloc* allocs);
+
+/*
+ * Wait for the next kernel of the outstanding request to be assigned
+ * resources.  Kernels are returned in the order in which they were assigned.
+ *
+ * @param conn a connection with an outstanding request
+ * @param timeout_ms milliseconds to wait, or a negative value to block
+ * @param index set to the kernel's position in the request, or -1 if none
+ * @param alloc storage for the kernel's resource allocation
+ * @return AIRA_ALLOC_READY if a kernel was assigned, AIRA_ALLOC_PENDING on
+ *         timeout or AIRA_ALLOC_ERROR if all kernels have already been
+ *         returned (index is -1) or the server could not be reached (the
+ *         default allocation is returned)
+ */
+int aira_alloc_next(aira_conn conn, int timeout_ms, int* index,
+										struct resource_alloc* alloc);
+
+/*
+ * Register a function to be called as each kernel of the outstanding request
+ * is assigned resources.  Until the next request is submitted, the connection
+ * may only be used to finish kernels with aira_kernel_finish_batch(), which
+ * may be called from any thread (including the callback).
+ *
+ * @param conn a connection with an outstanding request
+ * @param callback function to call with the resource allocations
+ * @param data passed through to the callback
+ * @return AIRA_ALLOC_PENDING if registered, AIRA_ALLOC_ERROR otherwise
+ */
+int aira_alloc_set_callback(aira_conn conn, aira_alloc_callback callback,
+														void* data);
+
 /*
  * Cleanup after a kernel finishes.
  */
 void aira_kernel_finish(aira_conn conn);
 
+/*
+ * Cleanup after one kernel of a batched request finishes.  Safe to call
+ * concurrently for different kernels of the same request.
+ *
+ * @param conn the connection on which the batch was requested
+ * @param index the kernel's position in the batch
+ */
+void aira_kernel_finish_batch(aira_conn conn, int index);
+
 /*
  * Get the number of resource allocations for all devices in the platform.
  * Application must pass storage (and indicate how many entries are available)
  * which will be filled by the library.  If user passes a null pointer,
  * num_entries will be populated with the number of total entries that can be
- * populated by the library.
+ * populated by the library.  Assignments for an outstanding asynchronous
+ * request which arrive meanwhile are kept; must not be called from a callback.
  *
  * @param num_entries number of entries available for populating in entries
  * @param entries vector of ints (storage provided by application)
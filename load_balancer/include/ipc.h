@@ -15,7 +15,20 @@ extern "C" {
 /* Socket definitions */
 #define UNIX_DOMAIN_SOCK_TEXT "sockets"
 #define SOCKET_FILE "/var/run/aira-lb.sock"
+#define SOCKET_ENV "AIRA_LB_SOCKET" /* Overrides SOCKET_FILE if set */
+#define SOCKET_ABSTRACT '@' /* Prefix of names in the abstract namespace */
 #define SERVER_QUEUE_SIZE 128
+#define SERVER_MAX_EVENTS 64
+
+/* Shared-memory transport definitions */
+#define TRANSPORT_ENV "AIRA_LB_TRANSPORT" /* Set to "shm" to use shared memory */
+#define SHM_MAX_CLIENTS 64
+#define SHM_MAX_FDS 65536
+#define SHM_RING_SIZE 32 /* Power of two, > MAX_BATCH (see ipc.c) */
+#define SHM_SPIN_ITERS 2000
+#define SHM_WAIT_MS 100
+#define SHM_ATTACH_TIMEOUT_MS 1000
+#define SHM_SEND_TIMEOUT_MS 1000 /* Give up if the request ring stays full */
 
 typedef struct _client_channel* client_channel;
 typedef struct _server_channel* server_channel;
@@ -24,16 +37,21 @@ typedef struct _server_channel* server_channel;
 server_channel open_server_channel(const char* socket_fname);
 int close_server_channel(server_channel chan);
 int server_listen(const server_channel chan, struct connection* conn);
-int server_send(const struct connection* conn);
-int server_close_connection(struct connection* conn);
+int server_send(const server_channel chan, const struct connection* conn);
+int server_close_connection(server_channel chan, struct connection* conn);
+int server_wakeup_fd(const server_channel chan);
 
 /* Client interface */
 client_channel open_client_channel(const char* socket_fname);
 int reopen_client_conn(client_channel chan);
 int close_client_connection(client_channel chan);
 int close_client_channel(client_channel chan);
+int client_attach_shm(client_channel chan);
 int client_send(client_channel chan, struct message* msg);
+int client_send_many(client_channel chan, struct message* msgs, int num);
 int client_receive(client_channel chan, struct message* msg);
+int client_receive_timeout(client_channel chan, struct message* msg,
+													 int timeout_ms);
 
 #ifdef __cplusplus
 }
@@ -6,6 +6,7 @@
  */
 
 #include <unistd.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "config.h"
@@ -16,6 +17,9 @@
 
 #define MAX_ARCHES 5
 
+/* Maximum number of kernels in a batched request (see AIRA_MAX_BATCH) */
+#define MAX_BATCH 16
+
 #define MESSAGE_TYPES \
 	X(HW_REQUEST = 0, "hardware request") \
 	X(HW_NOTIFY, "hardware notification") \
@@ -24,7 +28,13 @@
 	X(GET_QUEUES, "get queue sizes") \
 	X(RET_QUEUES, "return queue sizes") \
 	X(CLR_QUEUES, "clear queues") \
-	X(STOP_SERVER, "stop the daemon")
+	X(STOP_SERVER, "stop the daemon") \
+	X(SHM_ATTACH, "attach shared-memory channel") \
+	X(HW_REQUEST_BATCH, "batched hardware request") \
+	X(RELOAD_SERVER, "reload model & configuration") \
+	X(CLIENT_HANGUP, "client hung up") \
+	X(HW_ASSIGN_BATCH, "allocate resources to a batched kernel") \
+	X(HW_REQUEST_CLASS, "hardware request with priority class")
 
 /* Types of messages */
 enum message_type {
@@ -35,6 +45,32 @@ MESSAGE_TYPES
 
 extern const char* message_type_str[];
 
+/*
+ * Priority class & deadline of a resource request.  The deadline is relative
+ * to when the server receives the request.
+ */
+struct request_class {
+	uint8_t priority; // enum aira_priority
+	uint32_t deadline_us; // 0 if none
+};
+
+/*
+ * Fields added since the original protocol.  They follow the message body &
+ * are only sent with the message types which use them (see message_size()),
+ * so messages of the original types keep their size on the wire & clients
+ * built against it keep working.  Requests in the default class are sent as
+ * HW_REQUEST, others as HW_REQUEST_CLASS.
+ *
+ * A batch of 'batch_count' kernels is sent as 'batch_count' consecutive
+ * HW_REQUEST_BATCH messages; the server answers each with an HW_ASSIGN_BATCH
+ * carrying the kernel's index.
+ */
+struct message_ext {
+	struct request_class rclass; // HW_REQUEST_CLASS & HW_REQUEST_BATCH
+	uint16_t batch_index; // HW_REQUEST_BATCH & HW_ASSIGN_BATCH
+	uint16_t batch_count; // HW_REQUEST_BATCH
+};
+
 /* Message format for communication between client & load balancer daemon */
 struct message {
 	pid_t sender_pid; // PID of process sending the message
@@ -42,12 +78,33 @@ struct message {
 
 	/* Message body, dependent on message type */
 	union {
-		struct kernel_features features; // HW_REQUEST
-		struct resource_alloc alloc; // HW_NOTIFY & HW_ASSIGN
+		struct kernel_features features; // HW_REQUEST(_CLASS, _BATCH)
+		struct resource_alloc alloc; // HW_NOTIFY, HW_ASSIGN & HW_ASSIGN_BATCH
 		int num_allocs[MAX_ARCHES]; // RET_TABLE
+		int channel; // SHM_ATTACH
 	} body;
+
+	struct message_ext ext;
 };
 
+/* Size on the wire of messages without the extension */
+#define MESSAGE_BASE_SIZE offsetof(struct message, ext)
+
+/*
+ * Size of a message of the specified type on the wire.
+ */
+static inline size_t message_size(enum message_type type)
+{
+	switch(type) {
+	case HW_REQUEST_CLASS:
+	case HW_REQUEST_BATCH:
+	case HW_ASSIGN_BATCH:
+		return sizeof(struct message);
+	default:
+		return MESSAGE_BASE_SIZE;
+	}
+}
+
 /*
  * Encapsulates a connection, meaning the file-descriptor & message associated
  * with a connection.
@@ -26,6 +26,8 @@
 	X(IPC_SEND_ERR, "IPC send error") \
 	X(RECV_ERR, "message receive error") \
 	X(ALLOC_ERR, "allocation error") \
+	X(IPC_HANGUP, "IPC peer closed the connection") \
+	X(IPC_TIMEOUT, "timed out waiting for IPC message") \
 	X(FAILURE = 255, "general failure")
 
 /* Return codes */
@@ -0,0 +1,89 @@
+/*
+ * Online predictor calibration.  The server learns the observed runtime of
+ * each kernel signature (kernel & exact feature vector) on each prediction
+ * slot from finished jobs, & corrects the predictor's output for signatures
+ * it has seen before ranking devices.  Kernels which run repeatedly therefore
+ * converge to placements based on measured rather than predicted runtimes,
+ * even where the offline model is wrong for them.  Learned state can be saved
+ * & reloaded so it survives server restarts.
+ *
+ * Predictions are speedups relative to the default CPU.  A signature's
+ * corrected speedup on slot s is unit / runtime(s), where unit is its
+ * observed runtime on the default CPU, or if it has never run there, the
+ * geometric mean of runtime(s) / predicted relative runtime(s) over the slots
+ * it has run on.  Slots without enough observations keep the prediction.
+ */
+
+#ifndef _CALIBRATION_H
+#define _CALIBRATION_H
+
+#include <cstdint>
+#include <string>
+#include <mutex>
+#include <unordered_map>
+
+/* State file identification */
+#define CALIBRATION_MAGIC "aira-lb-calibration"
+#define CALIBRATION_VERSION 1
+
+/* Weight of the newest observation in a signature's runtime average */
+#define CALIBRATION_WEIGHT 0.25f
+
+/* Observations needed before a slot's prediction is corrected */
+#define CALIBRATION_MIN_SAMPLES 2
+
+/* Maximum number of signatures learned (later ones are not calibrated) */
+#define CALIBRATION_MAX_SIGNATURES 65536
+
+class Calibration
+{
+public:
+	Calibration() : numCorrected(0), numObserved(0) {}
+
+	/* Signature of a kernel's features */
+	static uint64_t signature(const struct kernel_features& feats);
+
+	/*
+	 * Correct a job's predictions using what has been observed for its
+	 * signature (any thread).
+	 *
+	 * @param job the job, with the predictor's output filled in
+	 * @return true if any prediction was corrected, false otherwise
+	 */
+	bool correct(Job* job);
+
+	/*
+	 * Learn from a finished job (any thread).
+	 *
+	 * @param job the job, with start & end times filled in
+	 * @param slot the prediction slot of the queue on which it ran
+	 */
+	void observe(const Job* job, size_t slot);
+
+	/*
+	 * Load or save learned state.  State saved with a different number of
+	 * prediction slots is ignored.
+	 *
+	 * @param filename state file
+	 * @return true if successful, false otherwise
+	 */
+	bool load(const std::string& filename);
+	bool save(const std::string& filename);
+
+	size_t numSignatures();
+	uint64_t numCorrections() const { return numCorrected; }
+	uint64_t numObservations() const { return numObserved; }
+
+private:
+	/* Observed runtimes of one signature */
+	struct Entry {
+		float runtime[MAX_PREDICTION_SLOTS]; /* Average runtime, ns */
+		uint32_t count[MAX_PREDICTION_SLOTS];
+	};
+
+	std::mutex lock;
+	std::unordered_map<uint64_t, Entry> entries;
+	uint64_t numCorrected, numObserved;
+};
+
+#endif /* _CALIBRATION_H */
@@ -0,0 +1,101 @@
+/*
+ * Device energy measurement using the power management library (powerlib).
+ * Powerlib samples each device's energy counters periodically on its own
+ * thread, which reserves SIGALRM.  Whenever the set of jobs running on a
+ * device changes, the energy it consumed since the previous change is
+ * attributed to the jobs which were running, in proportion to their compute
+ * units.  A job's energy is therefore only as accurate as the sampling period
+ * allows, & includes its share of the device's idle power.
+ *
+ * OpenCL devices are matched to powerlib devices by type & enumeration order,
+ * i.e. the n-th OpenCL CPU is measured by the n-th CPU for which powerlib
+ * supports measurement.
+ *
+ * Devices may be given a power cap.  While starting another job on one of a
+ * device's HW queues is expected to exceed its cap, the queue is throttled &
+ * jobs wait rather than start.  A job's draw is estimated from the device's
+ * recent power & the compute units already running, so a device with nothing
+ * running is never throttled.
+ *
+ * Only the scheduler thread may use the meter once it has started.
+ */
+
+#ifndef _ENERGY_H
+#define _ENERGY_H
+
+#include <vector>
+
+#include "PowerMeasurement.h"
+
+/* Energy counter sampling period (ms) */
+#define ENERGY_PERIOD_MS 50
+
+/* Number of sampling periods over which a device's power is averaged */
+#define ENERGY_POWER_WINDOW 4
+
+class EnergyMeter
+{
+public:
+	EnergyMeter() : handle(NULL) {}
+	~EnergyMeter() { stop(); }
+
+	/*
+	 * Match OpenCL devices to powerlib devices & start sampling.
+	 *
+	 * @param periodMS sampling period in milliseconds
+	 * @return the number of OpenCL devices measured, 0 if none (in which case
+	 *         nothing is sampled)
+	 */
+	size_t start(unsigned long periodMS = ENERGY_PERIOD_MS);
+	void stop();
+
+	/*
+	 * Cap a measured device's power draw.
+	 *
+	 * @param platform OpenCL platform
+	 * @param device OpenCL device
+	 * @param watts the cap, or 0 for none
+	 * @return true if the device is measured, false otherwise
+	 */
+	bool setCap(size_t platform, size_t device, double watts);
+
+	/*
+	 * Attribute the energy a device consumed since it was last updated to the
+	 * jobs running on it.  Call before the device's running jobs change.
+	 */
+	void attribute(size_t platform, size_t device);
+
+	/*
+	 * Re-evaluate whether a device's HW queues are throttled by its power cap.
+	 * Call after the device's running jobs change.
+	 *
+	 * @return true if a queue stopped being throttled, false otherwise
+	 */
+	bool throttle(size_t platform, size_t device);
+
+	/* Print measured devices, their caps & energy consumed so far */
+	void printConfiguration() const;
+	void printStatistics() const;
+
+private:
+	struct Device {
+		size_t platform, device; /* OpenCL device */
+		size_t manager, index;   /* powerlib device */
+		double cap;              /* Power cap (W), 0 if none */
+		double counter;          /* Energy counter at the last update (J) */
+		double attributed;       /* Energy attributed to jobs (J) */
+		double power;            /* Average power over the last window (W) */
+		double windowEnergy;     /* Energy counter at the start of the window */
+		unsigned long windowStart; /* Start of the power averaging window (ns) */
+	};
+
+	powerlib_t handle;
+	unsigned long period; /* Sampling period (ns) */
+	std::vector<Device> devices;
+
+	Device* find(size_t platform, size_t device);
+	void sample(Device& dev);
+	unsigned runningUnits(const Device& dev) const;
+};
+
+#endif /* _ENERGY_H */
@@ -0,0 +1,129 @@
+/*
+ * Per-job lifecycle event log.  Server threads record events into a
+ * fixed-size, lock-free ring in memory which a background thread flushes to
+ * a compact binary file.  Recording never blocks or allocates -- if the
+ * flusher falls behind, events are dropped & counted.  See utility/lb-events
+ * to convert logs into Chrome traces or CSV.
+ *
+ * Log format: a struct event_log_header followed by struct event records in
+ * the order in which they were flushed (roughly, but not strictly, by time).
+ */
+
+#ifndef _EVENT_LOG_H
+#define _EVENT_LOG_H
+
+#include <cstdio>
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <string>
+
+/* Log file identification */
+#define EVENT_LOG_MAGIC "AIRALOG"
+#define EVENT_LOG_VERSION 1
+
+/* Number of events buffered in memory (must be a power of 2) */
+#define EVENT_LOG_SIZE 65536
+
+/* Interval at which buffered events are written to the file */
+#define EVENT_LOG_FLUSH_MS 10
+
+/* Queue index for events not associated with a HW queue */
+#define EVENT_NO_QUEUE 0xff
+
+/* Job lifecycle events */
+#define EVENT_TYPES \
+	X(EVENT_RECEIVED = 0, "received") \
+	X(EVENT_PREDICTED, "predicted") \
+	X(EVENT_ENQUEUED, "enqueued") \
+	X(EVENT_STARTED, "started") \
+	X(EVENT_FINISHED, "finished")
+
+enum event_type {
+#define X(a, b) a,
+EVENT_TYPES
+#undef X
+NUM_EVENT_TYPES
+};
+
+/* Start of a log file */
+struct event_log_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t event_size; /* sizeof(struct event) */
+	uint64_t realtime;   /* CLOCK_REALTIME when the log was opened (ns) */
+	uint64_t monotonic;  /* CLOCK_MONOTONIC at the same time (ns) */
+};
+
+/* A single event */
+struct event {
+	uint64_t time;          /* CLOCK_MONOTONIC (ns) */
+	int32_t pid;            /* Client PID */
+	uint16_t batch_index;   /* Position within a batched request */
+	uint8_t type;           /* enum event_type */
+	uint8_t queue;          /* HW queue index, or EVENT_NO_QUEUE */
+	int16_t kernel;         /* Kernel from the job's features */
+	uint8_t platform;       /* Device allocated to the job (started/finished) */
+	uint8_t device;
+	uint16_t compute_units;
+	uint16_t reserved;
+};
+
+class Job;
+
+class EventLog
+{
+public:
+	EventLog();
+	~EventLog();
+
+	/*
+	 * Start logging to a file, replacing its contents.
+	 *
+	 * @param file name of the log file
+	 * @return true if the file was opened, false otherwise
+	 */
+	bool open(const std::string& file);
+
+	/* Stop logging, writing all buffered events */
+	void close();
+
+	/*
+	 * Record an event for a job.  Safe to call from any thread.
+	 *
+	 * @param type the event
+	 * @param job the job
+	 * @param time time at which the event happened
+	 * @param queue index of the job's HW queue, if any
+	 */
+	void record(enum event_type type, const Job* job,
+							const struct timespec& time, size_t queue = EVENT_NO_QUEUE);
+
+	/* Number of events written to the file & dropped because the ring was full */
+	uint64_t numWritten() const { return written; }
+	uint64_t numDropped() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+	/* Ring slot, whose sequence number says whether it's free or filled */
+	struct Cell {
+		std::atomic<uint64_t> seq;
+		struct event ev;
+	};
+
+	/* Producers & the flusher update the ring's ends on separate cache lines */
+	Cell* ring;
+	std::atomic<uint64_t> head; /* Next slot to fill */
+	char pad[64 - sizeof(std::atomic<uint64_t>)];
+	uint64_t tail;              /* Next slot to flush */
+	std::atomic<uint64_t> dropped;
+	uint64_t written;
+
+	FILE* fp;
+	std::atomic<bool> running;
+	std::thread flusher;
+
+	void flush();
+	size_t drain(struct event* buf, size_t max);
+};
+
+#endif /* _EVENT_LOG_H */
@@ -1,6 +1,9 @@
 #ifndef _HW_QUEUE_H
 #define _HW_QUEUE_H
 
+/* Queue without a predictor output slot */
+#define NO_PREDICTION_SLOT ((size_t)-1)
+
 /*
  * Generic queue used to maintain current information about compute kernel
  * executions.
@@ -8,7 +11,9 @@
 class HWQueue
 {
 public:
-	HWQueue(HWQueueConfig* p_config) : config(p_config) {}
+	HWQueue(HWQueueConfig* p_config)
+		: config(p_config), idx(0), predSlot(NO_PREDICTION_SLOT), draining(false),
+			throttled(false), waitingTime(0.0) {}
 	virtual ~HWQueue()
 	{
 		clear();
@@ -23,37 +28,118 @@ public:
 	virtual size_t maxRunning() const { return config->maxRunning; }
 	virtual bool canPartition() const = 0;
 
+	/* Position of this queue in the server's list of HW queues */
+	size_t index() const { return idx; }
+	void setIndex(size_t p_idx) { idx = p_idx; }
+
+	/* Predictor output slot for this queue's device */
+	size_t slot() const { return predSlot; }
+	void setSlot(size_t p_slot) { predSlot = p_slot; }
+
+	/*
+	 * Predicted runtime of a job on this queue, relative to the default CPU.
+	 * Unusable predictions count as no work.
+	 */
+	float work(const Job* job) const;
+
+	/* Sum of the allocation policy's runtime estimates for waiting jobs (ns) */
+	double queuedEstimate() const { return waitingTime; }
+
 	/* Return the number of running or queued jobs */
 	size_t numRunning() const { return runningJobs.size(); }
 	size_t numQueued() const { return waitingJobs.size(); }
 
 	/* Return whether or not the queue wants to run the specified job */
-	bool canRun(Job* job) const;
+	bool canRun(const Job* job) const;
+
+	/*
+	 * Stop starting new jobs, e.g. so the device can be repartitioned once
+	 * running jobs finish.  Jobs can still be enqueued.
+	 */
+	bool isDraining() const { return draining; }
+	void setDraining(bool p_draining) { draining = p_draining; }
+
+	/*
+	 * Stop starting new jobs because the device would exceed its power cap
+	 * (see include/server/energy.h).
+	 */
+	bool isThrottled() const { return throttled; }
+	void setThrottled(bool p_throttled) { throttled = p_throttled; }
 
-	/* Add jobs to the running list or waiting queue */
+	/* Add jobs to the running list or waiting queue (in priority order) */
 	void running(Job* job);
 	void enqueue(Job* job);
 
-	Job* queued(size_t num) { return waitingJobs[num]; }
-	Job* operator[](size_t num) { return queued(num); }
+	/*
+	 * Move a job running on another queue to this queue, e.g. when the queues
+	 * are replaced.  The job keeps its allocation & start time.
+	 */
+	void adopt(Job* job);
+
+	/*
+	 * Access waiting jobs.  Waiting jobs are kept in a heap (see JobHeap), so
+	 * only the first is in any particular order -- it's the next to run.
+	 */
+	Job* queued(size_t num) const { return waitingJobs.at(num); }
+	Job* operator[](size_t num) const { return queued(num); }
+	Job* firstQueued() const { return waitingJobs.top(); }
+	const JobHeap& waiting() const { return waitingJobs; }
+
+	/*
+	 * Return the waiting job in a priority class which slows down least if
+	 * stolen by another queue (see StealIndex).
+	 *
+	 * @param slot prediction slot of the stealing queue
+	 * @param rank priority class rank (see JobHeap::rank())
+	 * @param slowdown set to the job's slowdown
+	 * @return the job, or NULL if none can be stolen
+	 */
+	Job* leastSlowdown(size_t slot, unsigned rank, float& slowdown) const
+	{ return stealIndex.least(slot, rank, slowdown); }
+	Job* firstRunning() const { return runningJobs.front(); }
 
 	/* Return whether or not the job for the specified PID is running */
 	bool isRunning(pid_t clientPID) const;
 
+	/*
+	 * Find a running job for the specified PID on any queue, preferring the
+	 * job running on the specified allocation.
+	 */
+	static Job* findRunning(pid_t clientPID, const struct resource_alloc& alloc);
+
 	/* Remove entries from the running list */
 	Job* finished(pid_t clientPID);
+	Job* finished(Job* job);
 
 	/* Remove entries from the waiting queue */
 	Job* dequeue();
 	Job* remove(size_t num);
+	Job* remove(Job* job);
 
 	/* Clear all entries from the ready list & waiting queue */
 	void clear();
 
 protected:
 	HWQueueConfig* config;
-	std::vector<Job*> runningJobs;
-	std::vector<Job*> waitingJobs;
+	size_t idx;
+	size_t predSlot;
+	bool draining;
+	bool throttled;
+	double waitingTime;
+	JobList runningJobs;
+	JobHeap waitingJobs;
+	StealIndex stealIndex;
+
+	/* Running jobs of all queues, by client PID */
+	static JobIndex runningByPID;
+
+	/* Account for a job leaving the waiting queue */
+	void removedWork(const Job* job)
+	{
+		// Reset when empty so rounding errors don't accumulate
+		if(waitingJobs.empty()) waitingTime = 0.0;
+		else waitingTime -= job->estimate;
+	}
 };
 
 /* Class that models interference for CPUs. */
@@ -0,0 +1,47 @@
+/*
+ * Fixed-capacity vector with inline storage.  Used on the request path so
+ * that handling a request doesn't touch the heap.  Callers must check sizes
+ * against the capacity, overflowing is only caught by assertions.
+ */
+
+#ifndef _INLINE_VECTOR_H
+#define _INLINE_VECTOR_H
+
+#include <cassert>
+
+template<typename T, size_t N>
+class InlineVector
+{
+public:
+	InlineVector() : num(0) {}
+	explicit InlineVector(size_t p_num) : num(p_num)
+	{
+		assert(num <= N && "too many elements for inline vector");
+		for(size_t i = 0; i < num; i++) vals[i] = T();
+	}
+
+	size_t size() const { return num; }
+	size_t capacity() const { return N; }
+	bool empty() const { return num == 0; }
+	void clear() { num = 0; }
+
+	void push_back(const T& val)
+	{
+		assert(num < N && "inline vector is full");
+		vals[num++] = val;
+	}
+
+	T& operator[](size_t i) { return vals[i]; }
+	const T& operator[](size_t i) const { return vals[i]; }
+
+	T* begin() { return vals; }
+	T* end() { return vals + num; }
+	const T* begin() const { return vals; }
+	const T* end() const { return vals + num; }
+
+private:
+	size_t num;
+	T vals[N];
+};
+
+#endif /* _INLINE_VECTOR_H */
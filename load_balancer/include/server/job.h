@@ -12,6 +12,14 @@
 /* Timespec/unsigned long conversions */
 #define toNS( ts ) ((ts.tv_sec * 1000000000) + ts.tv_nsec)
 
+/* Maximum number of predictor output slots supported by the server */
+#define MAX_PREDICTION_SLOTS 16
+
+/* Per-device predictions, stored inline in the job */
+typedef InlineVector<float, MAX_PREDICTION_SLOTS> Predictions;
+
+class HWQueue;
+
 class Job
 {
 public:
@@ -25,14 +33,41 @@ public:
 
 	struct kernel_features features; /* Kernel features for model evaluation */
 	struct resource_alloc alloc;     /* Resources allocated */
+	uint16_t batchIndex;             /* Position within a batched request */
+	uint16_t batchSize;              /* Number of kernels in the batch */
+
+	uint8_t priority;       /* Priority class (enum aira_priority) */
+	unsigned long arrival;  /* Time the request was received (ns) */
+	unsigned long deadline; /* Time by which it should finish (ns), 0 if none */
+	uint64_t order;         /* Arrival order, breaks ties between equal jobs */
 
-	std::vector<float> predictions; /* Predictions for each architecture */
+	Predictions predictions;        /* Predictions for each architecture */
+	bool predicted;                 /* Predictions have been filled in */
+	float work;                     /* Predicted runtime on its queue */
+	float estimate;                 /* Policy's runtime estimate (ns) */
+	float energy;                   /* Measured energy attributed to it (J) */
+	float slowdown;                 /* Slowdown accepted if stolen, 0 if not */
+
+	/* Intrusive links, managed by the HW queue holding the job */
+	HWQueue* queue; /* Queue on which the job is running or waiting */
+	Job* prev;      /* Neighbours in the queue's running/waiting list */
+	Job* next;
+	Job* nextByPID; /* Next job in the same PID index bucket */
+	size_t heapIndex; /* Position in the queue's waiting heap */
+	uint32_t stealPos[MAX_PREDICTION_SLOTS]; /* Positions in its steal index */
 
 	/* API */
 	Job(struct connection conn);
+
+	/* Jobs are carved out of slabs & recycled rather than freed */
+	static void* operator new(size_t size);
+	static void operator delete(void* ptr);
 	unsigned long queuedTime() const { return toNS(queued); };
 	unsigned long startTime() const { return toNS(start); };
 	unsigned long endTime() const { return toNS(end); };
+
+	/* Whether the job finished (or is still running) past its deadline */
+	bool missedDeadline() const { return deadline && endTime() > deadline; }
 };
 
 #endif /* _JOB_H */
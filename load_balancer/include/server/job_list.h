@@ -0,0 +1,420 @@
+/*
+ * Intrusive containers for jobs.  Jobs carry their own links, so adding,
+ * removing & looking up jobs never walks a queue.  Only the heaps allocate,
+ * & only when they grow past their largest size so far.
+ */
+
+#ifndef _JOB_LIST_H
+#define _JOB_LIST_H
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+
+/* Number of buckets in the PID index, must be a power of 2 */
+#define JOB_INDEX_BUCKETS 4096
+
+/* Steal index position of a job which can't be stolen by a slot's queues */
+#define STEAL_INDEX_NONE UINT32_MAX
+
+/*
+ * Doubly-linked list of jobs, ordered by insertion.  A job can be in at most
+ * one list at a time.
+ */
+class JobList
+{
+public:
+	JobList() : head(NULL), tail(NULL), count(0) {}
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	Job* front() const { return head; }
+
+	/* Walk the list, i.e. for(j = list.front(); j; j = list.next(j)) */
+	static Job* next(const Job* job) { return job->next; }
+
+	/* Return the job at a given position (walks the list) */
+	Job* at(size_t num) const
+	{
+		Job* job = head;
+		for(; job && num > 0; num--) job = job->next;
+		return job;
+	}
+
+	void push_back(Job* job)
+	{
+		job->prev = tail;
+		job->next = NULL;
+		if(tail) tail->next = job;
+		else head = job;
+		tail = job;
+		count++;
+	}
+
+	Job* pop_front()
+	{
+		Job* job = head;
+		if(job) erase(job);
+		return job;
+	}
+
+	void erase(Job* job)
+	{
+		if(job->prev) job->prev->next = job->next;
+		else head = job->next;
+		if(job->next) job->next->prev = job->prev;
+		else tail = job->prev;
+		job->prev = job->next = NULL;
+		count--;
+	}
+
+private:
+	Job* head;
+	Job* tail;
+	size_t count;
+};
+
+/*
+ * Binary min-heap of waiting jobs, most urgent first.  Jobs are ordered by
+ * priority class, then by deadline (jobs without one last), then by arrival,
+ * so jobs which are all in the same class & have no deadlines are in FIFO
+ * order.  A job can be in at most one heap at a time.
+ */
+class JobHeap
+{
+public:
+	size_t size() const { return heap.size(); }
+	bool empty() const { return heap.empty(); }
+	Job* top() const { return heap.empty() ? NULL : heap[0]; }
+
+	/*
+	 * Return the job at a position in the heap.  Only the first job is in any
+	 * particular order, but a job is always more urgent than those after it at
+	 * positions 2n+1 & 2n+2.
+	 */
+	Job* at(size_t num) const { return num < heap.size() ? heap[num] : NULL; }
+
+	void push(Job* job)
+	{
+		job->heapIndex = heap.size();
+		heap.push_back(job);
+		up(job->heapIndex);
+	}
+
+	Job* pop()
+	{
+		Job* job = top();
+		if(job) erase(job);
+		return job;
+	}
+
+	void erase(Job* job)
+	{
+		size_t idx = job->heapIndex;
+		Job* last = heap.back();
+		heap.pop_back();
+		if(last == job) return;
+		heap[idx] = last;
+		last->heapIndex = idx;
+		down(idx);
+		up(last->heapIndex);
+	}
+
+	/*
+	 * Find the most urgent job satisfying a predicate.  Subtrees whose root
+	 * isn't more urgent than the best job found so far are skipped.
+	 */
+	template<typename Predicate>
+	Job* find(Predicate pred) const
+	{
+		Job* best = NULL;
+		find(0, pred, best);
+		return best;
+	}
+
+	/* Whether job a is more urgent than job b */
+	static bool before(const Job* a, const Job* b)
+	{
+		if(a->priority != b->priority) return rank(a) < rank(b);
+		if(a->deadline != b->deadline)
+			return b->deadline == 0 || (a->deadline && a->deadline < b->deadline);
+		return a->order < b->order;
+	}
+
+	/* Whether job a is more urgent than job b, ignoring arrival order */
+	static bool urgent(const Job* a, const Job* b)
+	{
+		if(a->priority != b->priority) return rank(a) < rank(b);
+		return a->deadline != b->deadline &&
+			(b->deadline == 0 || (a->deadline && a->deadline < b->deadline));
+	}
+
+	/* Order of priority classes, most urgent first */
+	static unsigned rank(const Job* job)
+	{
+		switch(job->priority)
+		{
+		case AIRA_PRIORITY_INTERACTIVE: return 0;
+		case AIRA_PRIORITY_BATCH: return 2;
+		default: return 1;
+		}
+	}
+
+private:
+	std::vector<Job*> heap;
+
+	void swap(size_t a, size_t b)
+	{
+		Job* tmp = heap[a];
+		heap[a] = heap[b];
+		heap[b] = tmp;
+		heap[a]->heapIndex = a;
+		heap[b]->heapIndex = b;
+	}
+
+	void up(size_t idx)
+	{
+		while(idx && before(heap[idx], heap[(idx - 1) / 2]))
+		{
+			swap(idx, (idx - 1) / 2);
+			idx = (idx - 1) / 2;
+		}
+	}
+
+	void down(size_t idx)
+	{
+		size_t child;
+		while((child = 2 * idx + 1) < heap.size())
+		{
+			if(child + 1 < heap.size() && before(heap[child + 1], heap[child]))
+				child++;
+			if(!before(heap[child], heap[idx])) break;
+			swap(idx, child);
+			idx = child;
+		}
+	}
+
+	template<typename Predicate>
+	void find(size_t idx, Predicate& pred, Job*& best) const
+	{
+		if(idx >= heap.size() || (best && !before(heap[idx], best))) return;
+		if(pred(heap[idx]))
+		{
+			best = heap[idx];
+			return;
+		}
+		find(2 * idx + 1, pred, best);
+		find(2 * idx + 2, pred, best);
+	}
+};
+
+/*
+ * Index of a queue's waiting jobs by how much they'd slow down if stolen, i.e.
+ * their predicted performance on the queue they're waiting on relative to
+ * their predicted performance on the queue stealing them.  There's a min-heap
+ * per prediction slot & priority class, so the job in a class which slows
+ * down least on a slot's queues is found in constant time & removed in
+ * O(log n).  Jobs without a usable prediction for a slot can't be stolen by
+ * its queues; jobs without one for the queue they're waiting on don't slow
+ * down when stolen.
+ */
+class StealIndex
+{
+public:
+	/*
+	 * Add a job waiting on a queue.
+	 *
+	 * @param job the job, with predictions filled in
+	 * @param slot prediction slot of the queue the job is waiting on
+	 */
+	void insert(Job* job, size_t slot)
+	{
+		unsigned rank = JobHeap::rank(job);
+		for(size_t to = 0; to < MAX_PREDICTION_SLOTS; to++)
+		{
+			float cost = to < job->predictions.size() ?
+				slowdown(job, slot, to) : INFINITY;
+			if(std::isinf(cost))
+			{
+				job->stealPos[to] = STEAL_INDEX_NONE;
+				continue;
+			}
+			std::vector<Entry>& heap = heaps[to][rank];
+			job->stealPos[to] = heap.size();
+			heap.push_back(Entry(cost, job));
+			up(heap, to, heap.size() - 1);
+		}
+	}
+
+	void erase(Job* job)
+	{
+		unsigned rank = JobHeap::rank(job);
+		for(size_t to = 0; to < MAX_PREDICTION_SLOTS; to++)
+		{
+			if(job->stealPos[to] == STEAL_INDEX_NONE) continue;
+			std::vector<Entry>& heap = heaps[to][rank];
+			size_t idx = job->stealPos[to];
+			job->stealPos[to] = STEAL_INDEX_NONE;
+			Entry last = heap.back();
+			heap.pop_back();
+			if(last.job == job) continue;
+			heap[idx] = last;
+			last.job->stealPos[to] = idx;
+			down(heap, to, idx);
+			up(heap, to, last.job->stealPos[to]);
+		}
+	}
+
+	void clear()
+	{
+		for(size_t to = 0; to < MAX_PREDICTION_SLOTS; to++)
+			for(size_t rank = 0; rank < AIRA_NUM_PRIORITIES; rank++)
+				heaps[to][rank].clear();
+	}
+
+	/*
+	 * Return the job in a priority class which slows down least if stolen by a
+	 * slot's queues, or NULL if none can be.
+	 *
+	 * @param slot prediction slot of the stealing queue
+	 * @param rank priority class rank (see JobHeap::rank())
+	 * @param cost set to the job's slowdown
+	 */
+	Job* least(size_t slot, unsigned rank, float& cost) const
+	{
+		const std::vector<Entry>& heap = heaps[slot][rank];
+		if(heap.empty()) return NULL;
+		cost = heap[0].slowdown;
+		return heap[0].job;
+	}
+
+	/*
+	 * Slowdown of a job moving between prediction slots, INFINITY if it has no
+	 * usable prediction for the destination.
+	 */
+	static float slowdown(const Job* job, size_t from, size_t to)
+	{
+		float dest = job->predictions[to], src;
+		if(!std::isfinite(dest) || dest <= 0.0f) return INFINITY;
+		if(from >= job->predictions.size()) return 1.0f;
+		src = job->predictions[from];
+		if(!std::isfinite(src) || src <= 0.0f) return 1.0f;
+		return src / dest;
+	}
+
+private:
+	struct Entry {
+		Entry(float p_slowdown, Job* p_job) : slowdown(p_slowdown), job(p_job) {}
+		float slowdown;
+		Job* job;
+	};
+
+	std::vector<Entry> heaps[MAX_PREDICTION_SLOTS][AIRA_NUM_PRIORITIES];
+
+	/* Equal slowdowns are stolen in arrival order */
+	static bool before(const Entry& a, const Entry& b)
+	{
+		if(a.slowdown != b.slowdown) return a.slowdown < b.slowdown;
+		return a.job->order < b.job->order;
+	}
+
+	static void swap(std::vector<Entry>& heap, size_t to, size_t a, size_t b)
+	{
+		Entry tmp = heap[a];
+		heap[a] = heap[b];
+		heap[b] = tmp;
+		heap[a].job->stealPos[to] = a;
+		heap[b].job->stealPos[to] = b;
+	}
+
+	static void up(std::vector<Entry>& heap, size_t to, size_t idx)
+	{
+		while(idx && before(heap[idx], heap[(idx - 1) / 2]))
+		{
+			swap(heap, to, idx, (idx - 1) / 2);
+			idx = (idx - 1) / 2;
+		}
+	}
+
+	static void down(std::vector<Entry>& heap, size_t to, size_t idx)
+	{
+		size_t child;
+		while((child = 2 * idx + 1) < heap.size())
+		{
+			if(child + 1 < heap.size() && before(heap[child + 1], heap[child]))
+				child++;
+			if(!before(heap[child], heap[idx])) break;
+			swap(heap, to, idx, child);
+			idx = child;
+		}
+	}
+};
+
+/*
+ * Hash of jobs keyed by client PID.  Clients may have several jobs (e.g.
+ * multiple threads or batched requests), so lookups can narrow the search by
+ * the queue or allocation on which the job is running.
+ */
+class JobIndex
+{
+public:
+	JobIndex() { for(size_t i = 0; i < JOB_INDEX_BUCKETS; i++) buckets[i] = NULL; }
+
+	void insert(Job* job)
+	{
+		Job*& bucket = buckets[hash(job->client)];
+		job->nextByPID = bucket;
+		bucket = job;
+	}
+
+	void erase(Job* job)
+	{
+		Job** cur = &buckets[hash(job->client)];
+		for(; *cur; cur = &(*cur)->nextByPID)
+		{
+			if(*cur == job)
+			{
+				*cur = job->nextByPID;
+				job->nextByPID = NULL;
+				return;
+			}
+		}
+	}
+
+	/* Find a client's job running on a particular queue */
+	Job* find(pid_t client, const HWQueue* queue) const
+	{
+		Job* job = buckets[hash(client)];
+		for(; job; job = job->nextByPID)
+			if(job->client == client && job->queue == queue) return job;
+		return NULL;
+	}
+
+	/*
+	 * Find a client's job, preferring one running on the given allocation.
+	 */
+	Job* find(pid_t client, const struct resource_alloc& alloc) const
+	{
+		Job* job = buckets[hash(client)], *any = NULL;
+		for(; job; job = job->nextByPID)
+		{
+			if(job->client != client) continue;
+			if(job->alloc.platform == alloc.platform &&
+				 job->alloc.device == alloc.device &&
+				 job->alloc.compute_units == alloc.compute_units)
+				return job;
+			if(!any) any = job;
+		}
+		return any;
+	}
+
+private:
+	static size_t hash(pid_t client)
+	{
+		return (size_t)client & (JOB_INDEX_BUCKETS - 1);
+	}
+
+	Job* buckets[JOB_INDEX_BUCKETS];
+};
+
+#endif /* _JOB_LIST_H */
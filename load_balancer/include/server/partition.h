@@ -0,0 +1,91 @@
+/*
+ * Dynamic partitioning (device fission) of CPU devices.  A partitionable
+ * device is exposed to the scheduler as one or more equally-sized logical
+ * HW queues, e.g. a 12-core CPU as 1x12C, 2x6C or 3x4C.  The number of
+ * partitions is chosen by comparing the predicted throughput of the jobs
+ * queued on the device under each partitioning.
+ */
+
+#ifndef _PARTITION_H
+#define _PARTITION_H
+
+/* Minimum predicted throughput gain required to repartition a device */
+#define PARTITION_MIN_GAIN 0.1f
+
+/*
+ * Number of consecutive scheduling decisions which must agree on a new
+ * partitioning before the device is repartitioned
+ */
+#define PARTITION_HYSTERESIS 8
+
+/* Minimum time between repartitionings of a device, in milliseconds */
+#define PARTITION_MIN_INTERVAL_MS 100
+
+/* Maximum number of waiting jobs sampled when estimating throughput */
+#define PARTITION_WINDOW 16
+
+/* Maximum number of partitionings per device */
+#define MAX_PARTITIONINGS 8
+
+class PartitionedDevice
+{
+public:
+	PartitionedDevice(size_t p_platform, size_t p_device, size_t p_computeUnits,
+										size_t p_maxRunning, size_t p_partitions);
+
+	/* Find CPU devices whose queues allow dynamic partitioning */
+	static std::vector<PartitionedDevice*> discover();
+
+	/* Device information */
+	size_t platform() const { return plat; }
+	size_t device() const { return dev; }
+	size_t computeUnits() const { return units; }
+	void printConfiguration() const;
+
+	/* Allow splitting the device into the specified number of partitions */
+	bool allow(size_t partitions);
+	size_t numPartitionings() const { return numAllowed; }
+
+	/* Current & desired number of partitions */
+	size_t numPartitions() const { return current; }
+	size_t targetPartitions() const { return target; }
+	bool pending() const { return target != current; }
+
+	/* Return whether or not a queue is one of this device's partitions */
+	bool owns(const HWQueue* queue) const;
+
+	/* Return whether or not any jobs are running on the device */
+	bool idle() const;
+
+	/*
+	 * Re-evaluate the device's partitioning.  Returns true if the target
+	 * partitioning changed, i.e. the device should start or stop draining.
+	 */
+	bool evaluate(const struct timespec& now);
+
+	/*
+	 * Replace the device's queues with the target partitioning.  The device
+	 * must be idle.  Waiting jobs are removed from the old queues & returned,
+	 * oldest first, so they can be placed again.
+	 */
+	void apply(const struct timespec& now, std::vector<Job*>& waiting);
+
+	/* Predicted throughput of the device's jobs if split into 'partitions' */
+	float throughput(size_t partitions) const;
+
+private:
+	size_t plat, dev, units, maxRunning;
+
+	/* Allowed numbers of partitions & the corresponding prediction slots */
+	size_t allowed[MAX_PARTITIONINGS];
+	size_t slots[MAX_PARTITIONINGS];
+	size_t numAllowed;
+
+	/* Hysteresis state */
+	size_t current, target, proposal, streak;
+	struct timespec lastChange;
+
+	size_t slot(size_t partitions) const;
+};
+
+#endif /* _PARTITION_H */
@@ -0,0 +1,181 @@
+/*
+ * Resource allocation policy interface.  Policies decide on which HW queue an
+ * incoming job runs (or waits), and which waiting job a queue starts when one
+ * of its jobs finishes.
+ */
+
+#ifndef _POLICY_H
+#define _POLICY_H
+
+/* Available policies */
+#define POLICIES \
+	X(FIRST_FIT = 0, "first available candidate") \
+	X(SHORTEST_COMPLETION, "shortest predicted completion time") \
+	X(MIN_EDP, "minimum measured energy-delay product")
+
+enum policy {
+#define X(a, b) a,
+POLICIES
+#undef X
+NUM_POLICIES
+};
+
+extern const char* policyNames[];
+
+/*
+ * Number of per-kernel runtime scales learned by backlog-aware policies;
+ * kernels outside this range share a single scale.
+ */
+#define POLICY_SCALES 64
+
+/* Assumed runtime of one unit of predicted work (ns) until jobs finish */
+#define POLICY_INITIAL_SCALE 1e9f
+
+/* Weight of the newest observation when learning runtime scales */
+#define POLICY_SCALE_WEIGHT 0.125f
+
+/* Weight of the newest observation when learning energy & power */
+#define POLICY_ENERGY_WEIGHT 0.25f
+
+class Policy
+{
+public:
+	Policy() {};
+	virtual ~Policy() {};
+
+	/*
+	 * Choose the HW queue for a job.  The job starts if the queue can run it,
+	 * otherwise it waits on the queue.
+	 *
+	 * @param job the job, with predictions filled in
+	 * @param candidates HW queues within the performance threshold, best first
+	 * @param now current time, in nanoseconds
+	 * @return index of the chosen HW queue
+	 */
+	virtual size_t place(Job* job, const Candidates& candidates,
+											 unsigned long now) = 0;
+
+	/*
+	 * Choose a waiting job to start on a queue which has finished a job.  By
+	 * default the queue's own waiting jobs run in priority order, unless a job
+	 * waiting on another queue is more urgent & runs nearly as well on this
+	 * queue (see JobHeap), in which case it's stolen.  Queues without waiting
+	 * jobs steal (see steal()).  Stolen jobs record the slowdown accepted.
+	 *
+	 * @param q index of the HW queue with a free slot
+	 * @return the job, removed from its waiting queue, or NULL if none
+	 */
+	virtual Job* next(size_t q);
+
+	/* Observe a job which finished running (called before it's deleted) */
+	virtual void finished(const Job* job) {};
+
+	/*
+	 * Predicted completion time (ns from now) of a job if placed on a queue.
+	 * By default a job completes immediately if the queue can run it, & never
+	 * if it has to wait.
+	 */
+	virtual float completion(const Job* job, size_t q, unsigned long now) const;
+
+	/* Predicted runtime (ns) of a job on a queue, 0 if unknown */
+	virtual float runtime(const Job* job, size_t q) const { return 0.0f; }
+
+	/*
+	 * Move a job with a deadline which it would miss on its chosen queue to the
+	 * queue on which it's predicted to complete earliest.
+	 *
+	 * @param job the job, placed by place()
+	 * @param q index of the chosen HW queue
+	 * @param candidates HW queues within the performance threshold, best first
+	 * @param now current time, in nanoseconds
+	 * @return index of the HW queue on which the job should run or wait
+	 */
+	size_t expedite(Job* job, size_t q, const Candidates& candidates,
+									unsigned long now);
+
+protected:
+	/*
+	 * Steal a job waiting on another queue for an idle queue.  Jobs are stolen
+	 * in priority class order, & within a class the job which slows down least
+	 * on the idle queue is stolen, as long as it runs nearly as well on the
+	 * idle queue (see StealIndex & utility::within_threshold()).
+	 *
+	 * @param q index of the idle HW queue
+	 * @return the job, removed from its waiting queue, or NULL if none
+	 */
+	Job* steal(size_t q);
+};
+
+/*
+ * Start on the first candidate with a free slot.  If all are busy, wait on
+ * the copy of the preferred device with the fewest waiting jobs.
+ */
+class FirstFitPolicy : public Policy
+{
+public:
+	virtual size_t place(Job* job, const Candidates& candidates,
+											 unsigned long now);
+};
+
+/*
+ * Place jobs where their predicted completion time is earliest, taking into
+ * account the predicted remaining runtime of jobs running & waiting on each
+ * queue.  Predictions are relative to the default CPU, so the policy learns
+ * the runtime of one unit of predicted work from finished jobs.  Running a
+ * job on a slower device than necessary is charged for the capacity it takes
+ * away from later jobs, so that the policy doesn't trade throughput for
+ * latency under heavy load.
+ */
+class ShortestCompletionPolicy : public Policy
+{
+public:
+	ShortestCompletionPolicy();
+	virtual size_t place(Job* job, const Candidates& candidates,
+											 unsigned long now);
+	virtual void finished(const Job* job);
+	virtual float completion(const Job* job, size_t q, unsigned long now) const;
+	virtual float runtime(const Job* job, size_t q) const;
+
+protected:
+	/* Runtime of one unit of predicted work in nanoseconds, by kernel */
+	float scales[POLICY_SCALES + 1];
+
+	static size_t scaleIndex(const Job* job);
+};
+
+/*
+ * Place jobs where the product of their energy & predicted completion time is
+ * lowest.  Completion times are predicted as by shortest-completion.  Energy
+ * is learned from jobs' measured energy (see include/server/energy.h), per
+ * kernel & prediction slot.  Before a kernel has finished on a slot, it's
+ * assumed to draw the slot's average power over its predicted runtime, &
+ * slots without any measurements are assumed to draw the average power of
+ * those with, so without measurements all devices draw the same power.
+ */
+class MinEDPPolicy : public ShortestCompletionPolicy
+{
+public:
+	MinEDPPolicy();
+	virtual size_t place(Job* job, const Candidates& candidates,
+											 unsigned long now);
+	virtual void finished(const Job* job);
+
+	/*
+	 * Predicted energy of a job if placed on a queue.
+	 *
+	 * @param job the job
+	 * @param q index of the HW queue
+	 * @param fallback power (W) assumed for slots without measurements
+	 * @return the energy in joules, or 0 if the job can't run on the queue
+	 */
+	float energy(const Job* job, size_t q, float fallback) const;
+
+private:
+	/* Average energy (J) of kernels on each slot, 0 until measured */
+	float joules[POLICY_SCALES + 1][MAX_PREDICTION_SLOTS];
+
+	/* Average power (W) of jobs on each slot, 0 until measured */
+	float watts[MAX_PREDICTION_SLOTS];
+};
+
+#endif /* _POLICY_H */
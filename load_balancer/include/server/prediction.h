@@ -8,6 +8,7 @@
 #ifndef _MACHINE_LEARNING
 #define _MACHINE_LEARNING
 
+#include <vector>
 #include <opencv/cv.h>
 #include <opencv/ml.h>
 
@@ -44,7 +45,7 @@ public:
 	Predictor(int p_numDevices) : numDevices(p_numDevices) {}
 	virtual ~Predictor() {}
 	virtual void predict(struct kernel_features& feats,
-											 std::vector<float>& predictions) = 0;
+											 Predictions& predictions) = 0;
 
 protected:
 	int numDevices;
@@ -60,7 +61,7 @@ public:
 	AlwaysCPU(int p_numDevices = prediction_slots)
 		: Predictor(p_numDevices) {}
 	virtual void predict(struct kernel_features& feats,
-											 std::vector<float>& predictions);
+											 Predictions& predictions);
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -73,7 +74,7 @@ public:
 	AlwaysGPU(int p_numDevices = prediction_slots)
 		: Predictor(p_numDevices) {}
 	virtual void predict(struct kernel_features& feats,
-											 std::vector<float>& predictions);
+											 Predictions& predictions);
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -86,7 +87,7 @@ public:
 	ExactRuntime(int p_numDevices = prediction_slots)
 		: Predictor(p_numDevices) {}
 	virtual void predict(struct kernel_features& feats,
-											 std::vector<float>& predictions);
+											 Predictions& predictions);
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -99,7 +100,7 @@ public:
 	ExactEnergy(int p_numDevices = prediction_slots)
 		: Predictor(p_numDevices) {}
 	virtual void predict(struct kernel_features& feats,
-											 std::vector<float>& predictions);
+											 Predictions& predictions);
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -112,26 +113,42 @@ public:
 	ExactEDP(int p_numDevices = prediction_slots)
 		: Predictor(p_numDevices) {}
 	virtual void predict(struct kernel_features& feats,
-											 std::vector<float>& predictions);
+											 Predictions& predictions);
 };
 
 ///////////////////////////////////////////////////////////////////////////////
 // OpenMP (version 1) functionality
 ///////////////////////////////////////////////////////////////////////////////
 
+/*
+ * Where a neural net's predictions come from.  Models are trained for the
+ * compiled-in system, whose slots may have been replaced by a runtime profile
+ * (see profile.h), so each prediction slot names the model output for the
+ * same device.  Outputs are scaled to seconds with the runtime statistics of
+ * the system the model was trained for.
+ */
+#define NO_MODEL_OUTPUT ((size_t)-1)
+
+struct ModelOutputs {
+	std::vector<size_t> slots; /* Model output of each prediction slot */
+	float mean, max, min; /* Training system's runtime statistics */
+};
+
 class NeuralNetPredictor : public Predictor {
 public:
+	/* Throws if the model lacks an output for any prediction slot */
 	NeuralNetPredictor(std::string& modelFN,
 										 std::string& transFN,
-										 int numDevices = prediction_slots);
+										 const ModelOutputs& p_layout);
 	virtual void predict(struct kernel_features& feats,
-											 std::vector<float>& predictions);
+											 Predictions& predictions);
 
 private:
 	int numInputs;
 	int numLayers;
 	TransformManager trans;
 	NeuralNetwork model;
+	ModelOutputs layout;
 };
 
 #endif /* _MACHINE_LEARNING */
@@ -0,0 +1,97 @@
+/*
+ * Memoizes predictor output by kernel feature vector.  Clients typically
+ * submit the same kernel with the same features many times, so rather than
+ * re-running the transforms & model for each request, the predictions for
+ * recently seen feature vectors are kept in a bounded table with LRU
+ * eviction.  All storage is allocated up front; lookups & insertions never
+ * touch the heap.
+ *
+ * Features are quantized before comparison.  With a tolerance of 0 only
+ * identical feature vectors match; otherwise each feature is bucketed on a
+ * logarithmic grid whose buckets are a factor of (1 + tolerance) wide, so
+ * features within roughly that relative difference share predictions (values
+ * straddling a bucket boundary don't).
+ *
+ * The cache must be cleared whenever the predictor changes.
+ */
+
+#ifndef _PREDICTION_CACHE_H
+#define _PREDICTION_CACHE_H
+
+#include <cstdint>
+#include <vector>
+#include <mutex>
+
+/* Default number of cached feature vectors */
+#define PREDICTION_CACHE_SIZE 4096
+
+class PredictionCache
+{
+public:
+	/*
+	 * @param capacity maximum number of cached feature vectors
+	 * @param tolerance relative difference between features which are
+	 *                  considered the same (0 for an exact match)
+	 */
+	PredictionCache(size_t capacity = PREDICTION_CACHE_SIZE,
+									double tolerance = 0.0);
+
+	/*
+	 * Look up predictions for a feature vector, marking them most recently
+	 * used.
+	 *
+	 * @param feats kernel features
+	 * @param predictions filled in on a hit
+	 * @return true if the features were cached, false otherwise
+	 */
+	bool lookup(const struct kernel_features& feats, Predictions& predictions);
+
+	/* Cache predictions, evicting the least recently used entry if full */
+	void insert(const struct kernel_features& feats,
+							const Predictions& predictions);
+
+	/* Drop all cached predictions */
+	void clear();
+
+	size_t capacity() const { return entries.size(); }
+	double tolerance() const { return tol; }
+	size_t size() const { return used; }
+	uint64_t numHits() const { return hits; }
+	uint64_t numMisses() const { return misses; }
+	uint64_t numEvictions() const { return evictions; }
+
+private:
+	/* Quantized features */
+	struct Key {
+		int64_t kernel;
+		int64_t feature[NUM_FEATURES];
+		bool operator==(const Key& rhs) const;
+	};
+
+	struct Entry {
+		Key key;
+		uint64_t hash;
+		Predictions predictions;
+		uint32_t prev, next; /* LRU list, most recent first */
+	};
+
+	std::mutex lock;
+	double tol, logStep;
+
+	/* Entries & open-addressing hash table of entry indices */
+	std::vector<Entry> entries;
+	std::vector<uint32_t> table;
+	size_t mask, used;
+	uint32_t head, tail;
+
+	uint64_t hits, misses, evictions;
+
+	void makeKey(const struct kernel_features& feats, Key& key,
+							 uint64_t& hash) const;
+	size_t find(const Key& key, uint64_t hash) const;
+	void remove(size_t bucket);
+	void unlink(uint32_t entry);
+	void pushFront(uint32_t entry);
+};
+
+#endif /* _PREDICTION_CACHE_H */
@@ -0,0 +1,128 @@
+/*
+ * Runtime system profiling.  Rather than using the system tables compiled in
+ * with 'make system=<file>', the server can describe the devices it finds at
+ * startup.  Each OpenCL CPU & GPU gets a prediction slot, and CPUs which
+ * support device fission get a slot for every even split of their compute
+ * units into sub-devices of at least two units (e.g. 12, 6, 4, 3 & 2 units
+ * for a 12 unit CPU).  A short suite of micro-kernels is timed on each slot:
+ *
+ *   compute - dependent multiply-adds, giving arithmetic throughput
+ *   stream  - a vector triad, giving memory bandwidth
+ *   launch  - an empty kernel, giving launch & completion latency
+ *
+ * NPB runtimes are then estimated per slot from each benchmark's arithmetic
+ * intensity, data volume & number of kernel launches, which are hand-picked
+ * rather than measured.  The estimates are coarse, but the hard-coded
+ * predictors & policies only compare a kernel's runtimes across slots.
+ * Energy is not measured, so energy tables assume every slot draws the same
+ * power.
+ *
+ * Neural-net models are trained for the compiled-in system, so their outputs
+ * are matched to profiled slots by device & compute units; the server refuses
+ * to use a model which has no output for a profiled slot.
+ *
+ * Profiles are cached in a file together with a fingerprint of the devices
+ * (platform, name, driver & compute units) & are re-profiled when it changes.
+ * Delete the file to force re-profiling.
+ */
+
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "cl_rt.h"
+
+/* Cache file identification */
+#define PROFILE_MAGIC "aira-lb-system"
+#define PROFILE_VERSION 1
+
+/* Micro-kernel sizes & repetitions (the fastest repetition is kept) */
+#define PROFILE_COMPUTE_ITEMS (1 << 18)
+#define PROFILE_COMPUTE_ITERS 256
+#define PROFILE_STREAM_ITEMS (1 << 22)
+#define PROFILE_LAUNCHES 32
+#define PROFILE_REPS 3
+
+class SystemProfile
+{
+public:
+	/* A prediction slot & its measured performance */
+	struct Slot {
+		cl_uint platform;
+		cl_uint device;
+		cl_uint units;
+		cl_device_type type;
+		double gflops; /* Arithmetic throughput */
+		double gbps; /* Memory bandwidth */
+		double launch; /* Launch latency, seconds */
+	};
+
+	SystemProfile() : fingerprint(0) {}
+
+	/*
+	 * Fingerprint the OpenCL devices & generate their slots.
+	 *
+	 * @param rt an initialized OpenCL runtime
+	 * @return the number of slots
+	 */
+	size_t discover(cl_runtime rt);
+
+	/*
+	 * Add a device's slots.  Fissionable CPUs get a slot per even split.
+	 *
+	 * @param platform OpenCL platform
+	 * @param device OpenCL device
+	 * @param type OpenCL device type, only CPUs & GPUs are used
+	 * @param units the device's compute units
+	 * @param fission whether the device can be split into sub-devices
+	 */
+	void addDevice(cl_uint platform, cl_uint device, cl_device_type type,
+								 cl_uint units, bool fission);
+
+	/*
+	 * Time the micro-kernels on each slot.  Slots which can't run them are
+	 * dropped.
+	 *
+	 * @param rt an initialized OpenCL runtime
+	 * @return true if any slot was profiled, false otherwise
+	 */
+	bool calibrate(cl_runtime rt);
+
+	/*
+	 * Load or save a cached profile.  Profiles taken on other devices are
+	 * ignored.
+	 *
+	 * @param filename cache file
+	 * @param rt an initialized OpenCL runtime, used to check the fingerprint
+	 * @return true if successful, false otherwise
+	 */
+	bool load(const std::string& filename, cl_runtime rt);
+	bool save(const std::string& filename) const;
+
+	/*
+	 * Overwrite the system tables (see system.h) with the profile.
+	 */
+	void install() const;
+
+	/* Print the profiled slots */
+	void print() const;
+
+	/* Estimated runtime of an NPB benchmark on a slot, in seconds */
+	static float estimate(const Slot& slot, size_t benchmark);
+
+	const std::vector<Slot>& slots() const { return profiled; }
+
+	/* Fingerprint of the OpenCL devices present */
+	static uint64_t devices(cl_runtime rt);
+
+private:
+	bool time(cl_runtime rt, Slot& slot);
+
+	uint64_t fingerprint;
+	std::vector<Slot> profiled;
+};
+
+#endif /* _PROFILE_H */
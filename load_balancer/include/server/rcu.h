@@ -0,0 +1,78 @@
+/*
+ * Read-copy-update for a pointer shared by a fixed set of reader threads.
+ * Readers bracket each use of the pointed-to object with read() & done(),
+ * which cost a couple of uncontended atomic stores.  A writer publishes a new
+ * object with exchange() & calls synchronize() before deleting the old one,
+ * which waits until no reader can still be using it.  Readers never block.
+ *
+ * Each reader thread uses its own slot, numbered from 0.  There must be only
+ * one writer at a time.
+ */
+
+#ifndef _RCU_H
+#define _RCU_H
+
+#include <cstdint>
+#include <atomic>
+#include <thread>
+
+template<typename T>
+class RCUPointer
+{
+public:
+	RCUPointer(size_t p_numReaders, T* p_ptr = NULL)
+		: ptr(p_ptr), epoch(1), numReaders(p_numReaders),
+			readers(new Reader[p_numReaders]) {}
+	~RCUPointer() { delete [] readers; }
+
+	/*
+	 * Enter a read-side critical section.
+	 *
+	 * @param reader the calling thread's slot
+	 * @return the current object, valid until done() is called
+	 */
+	T* read(size_t reader)
+	{
+		readers[reader].epoch.store(epoch.load());
+		return ptr.load();
+	}
+
+	/* Leave a read-side critical section */
+	void done(size_t reader)
+	{
+		readers[reader].epoch.store(0, std::memory_order_release);
+	}
+
+	/* The current object, for the writer or when there are no readers */
+	T* get() const { return ptr.load(); }
+
+	/* Publish a new object, returning the old one (don't delete it yet!) */
+	T* exchange(T* p_ptr) { return ptr.exchange(p_ptr); }
+
+	/*
+	 * Wait until all readers which could have read objects replaced before
+	 * this call have left their critical sections.
+	 */
+	void synchronize()
+	{
+		uint64_t cur = epoch.fetch_add(1) + 1, reader;
+		for(size_t i = 0; i < numReaders; i++)
+			while((reader = readers[i].epoch.load()) && reader < cur)
+				std::this_thread::yield();
+	}
+
+private:
+	/* Epoch in which a reader entered its critical section, 0 if outside */
+	struct Reader {
+		Reader() : epoch(0) {}
+		std::atomic<uint64_t> epoch;
+		char pad[64 - sizeof(std::atomic<uint64_t>)]; // Avoid false sharing
+	};
+
+	std::atomic<T*> ptr;
+	std::atomic<uint64_t> epoch;
+	size_t numReaders;
+	Reader* readers;
+};
+
+#endif /* _RCU_H */
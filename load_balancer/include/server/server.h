@@ -19,21 +19,29 @@
 #include "aira_definitions.h"
 #include "config.h"
 
+#include "server/inline_vector.h"
 #include "server/job.h"
+#include "server/job_list.h"
 #include "server/prediction.h"
 #include "server/hw_queue_config.h"
 #include "server/hw_queue.h"
+#include "server/partition.h"
 #include "server/config_parser.h"
 
-/* Hardcoded per-system information */
+/* Per-system information, compiled-in or profiled */
 #include "server/system.h"
 
+/* Maximum number of HW queues (including sub-devices) */
+#define MAX_QUEUES 32
+
 /* Filename which contains the server's PID */
 #define SERVER_PID_FILE "/var/run/aira-lb.pid"
+#define PID_ENV "AIRA_LB_PID" /* Overrides SERVER_PID_FILE if set */
 
 /* Signals */
 #define EXIT_SIG SIGINT /* Cleanup & terminate */
 #define CLEAR_SIG SIGUSR1 /* Clear run queues */
+#define RELOAD_SIG SIGUSR2 /* Reload model, transforms & queue configuration */
 
 /* Hardware queues & OpenCL runtime */
 extern std::vector<HWQueue*> queues;
@@ -0,0 +1,183 @@
+/*
+ * Live statistics page.  The server publishes queue state, latency histograms
+ * per queue & priority class, & predictor accuracy in a named shared-memory
+ * page which monitoring tools (e.g. utility/lb-top) map read-only & poll.
+ * The server never blocks on readers: counters are updated with atomic
+ * operations, & the queue table is published under a sequence lock which
+ * readers retry on.
+ */
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <cstdint>
+#include <string>
+
+/* Name of the shared-memory page */
+#define STATS_SHM_NAME "/aira-lb-stats"
+#define STATS_SHM_ENV "AIRA_LB_STATS" /* Overrides STATS_SHM_NAME if set */
+#define STATS_VERSION 4
+
+/*
+ * Latency histograms have power-of-2 buckets: bucket 0 counts 0ns, bucket
+ * b > 0 counts [2^(b-1), 2^b) ns & the last bucket everything longer.
+ */
+#define STATS_HIST_BUCKETS 48
+
+/* Table sizes (match the server's MAX_QUEUES & MAX_PREDICTION_SLOTS) */
+#define STATS_MAX_QUEUES 32
+#define STATS_MAX_SLOTS 16
+
+/* Number of priority classes (matches AIRA_NUM_PRIORITIES) */
+#define STATS_CLASSES 3
+
+/* Number of per-kernel runtime scales used to measure prediction accuracy */
+#define STATS_KERNELS 64
+
+/* Weight of the newest observation when learning runtime scales */
+#define STATS_SCALE_WEIGHT 0.125
+
+/* Relative errors at or below these count as accurate predictions */
+#define STATS_ERROR_LOW 0.1
+#define STATS_ERROR_HIGH 0.25
+
+struct stats_histogram {
+	uint64_t count;
+	uint64_t sum; /* ns */
+	uint64_t buckets[STATS_HIST_BUCKETS];
+};
+
+/* Per-queue state, published under the page's sequence lock */
+struct stats_queue {
+	uint32_t platform;
+	uint32_t device;
+	uint32_t compute_units;
+	uint32_t max_running;
+	uint32_t running;
+	uint32_t queued;
+};
+
+/*
+ * Per-queue counters & histograms, indexed like the queue table.  Jobs stolen
+ * from other queues count towards the queue which stole them.
+ */
+struct stats_queue_times {
+	uint64_t started;
+	uint64_t finished;
+	uint64_t stolen;
+	uint64_t sum_slowdown_ppm; /* Sum of stolen jobs' slowdowns */
+	struct stats_histogram wait;    /* Time spent waiting on the queue */
+	struct stats_histogram service; /* Time from start to finish */
+};
+
+/*
+ * Per-priority class counters & histograms, indexed by enum aira_priority.
+ * Turnaround is the time from the server receiving a request to the kernel
+ * finishing.  Only jobs with deadlines count towards deadlines met & missed.
+ */
+struct stats_class {
+	uint64_t started;
+	uint64_t finished;
+	uint64_t deadlines_met;
+	uint64_t deadlines_missed;
+	struct stats_histogram wait;       /* Time spent waiting on a queue */
+	struct stats_histogram turnaround;
+};
+
+/*
+ * Accuracy of predictions for one prediction slot.  Predictions are relative
+ * to the default CPU, so a job's predicted runtime is its predicted relative
+ * runtime times the runtime of one unit of work, learned per kernel from
+ * previously finished jobs.  Errors are relative to the observed runtime.
+ */
+struct stats_accuracy {
+	uint64_t count;
+	uint64_t sum_error_ppm;  /* Sum of |predicted - observed| / observed */
+	uint64_t sum_ratio_ppm;  /* Sum of predicted / observed */
+	uint64_t within_low;     /* Errors <= STATS_ERROR_LOW */
+	uint64_t within_high;    /* Errors <= STATS_ERROR_HIGH */
+};
+
+struct stats_page {
+	uint32_t version;
+	int32_t server_pid;
+	uint64_t start_time;       /* CLOCK_MONOTONIC when the server started */
+	char predictor[64];
+
+	/* Sequence lock protecting the queue table (odd while being written) */
+	uint64_t seq;
+	uint64_t update_time;      /* CLOCK_MONOTONIC of the last update */
+	uint32_t num_queues;
+	struct stats_queue queues[STATS_MAX_QUEUES];
+
+	uint64_t requests;         /* Messages handled by the scheduler */
+	struct stats_queue_times times[STATS_MAX_QUEUES];
+	struct stats_histogram prediction;    /* Predictor latency */
+	uint64_t cache_hits;       /* Predictions served by the prediction cache */
+	uint64_t cache_misses;
+	uint32_t num_slots;
+	struct stats_accuracy accuracy[STATS_MAX_SLOTS];
+	struct stats_class classes[STATS_CLASSES];
+};
+
+/* Name of a priority class */
+static inline const char* stats_class_name(size_t cls)
+{
+	static const char* names[STATS_CLASSES] = { "normal", "interactive", "batch" };
+	return cls < STATS_CLASSES ? names[cls] : "unknown";
+}
+
+/* Histogram bucket for a duration */
+static inline size_t stats_bucket(uint64_t ns)
+{
+	size_t bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+	return bucket < STATS_HIST_BUCKETS ? bucket : STATS_HIST_BUCKETS - 1;
+}
+
+class Job;
+
+/* Server side of the statistics page */
+class StatsPage
+{
+public:
+	StatsPage();
+	~StatsPage();
+
+	/*
+	 * Create the page, replacing any left behind by a server which has exited.
+	 * Fails if the page belongs to a running server.
+	 *
+	 * @param name shared-memory object name
+	 * @param predictor name of the predictor in use
+	 * @return true if the page was created, false otherwise
+	 */
+	bool open(const std::string& name, const char* predictor);
+	void close();
+
+	/* Publish the queues' configuration & job counts (scheduler thread) */
+	void publishQueues(uint64_t requests);
+
+	/* Account for a job starting or finishing on a queue (scheduler thread) */
+	void started(const Job* job, size_t queue);
+	void finished(const Job* job, size_t queue);
+
+	/* Account for a queue stealing a job (scheduler thread) */
+	void stolen(const Job* job, size_t queue);
+
+	/* Account for a predictor evaluation (any thread) */
+	void predicted(uint64_t ns);
+
+	/* Account for a prediction cache lookup (any thread) */
+	void cached(bool hit);
+
+private:
+	struct stats_page* page;
+	std::string shmName;
+
+	/* Runtime of one unit of predicted work (ns) by kernel, 0 if unknown */
+	double scales[STATS_KERNELS + 1];
+
+	static void add(struct stats_histogram& hist, uint64_t ns);
+};
+
+#endif /* _STATS_H */
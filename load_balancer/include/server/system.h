@@ -14,44 +14,53 @@ extern "C" {
  * at compile time using:
  *
  *   make system=<filename>
+ *
+ * The compiled-in system is the default.  The server can instead profile the
+ * devices it finds at startup & overwrite these tables (see profile.h).
  */
 
+/* Maximum number of predictor output slots */
+#define SYSTEM_MAX_SLOTS 16
+
+/* Number of NPB benchmarks (8 benchmarks x 5 classes, see kernels.h) */
+#define SYSTEM_NUM_BENCHMARKS 40
+
 ///////////////////////////////////////////////////////////////////////////////
 // Predictor output slot information
 ///////////////////////////////////////////////////////////////////////////////
 
 /* Number of predictor output slots */
-extern const size_t prediction_slots;
+extern size_t prediction_slots;
 
 /* Default CPU device in the system (used to convert statistics into ratios) */
-extern const size_t default_cpu;
+extern size_t default_cpu;
 
 /* Device types of predictor output slots */
-extern const cl_device_type device_types[];
+extern cl_device_type device_types[SYSTEM_MAX_SLOTS];
 
 /* Map prediction output slots to struct resource_allocation */
-extern const struct resource_alloc system_devices[];
+extern struct resource_alloc system_devices[SYSTEM_MAX_SLOTS];
 
 ///////////////////////////////////////////////////////////////////////////////
 // Benchmark statistics
 ///////////////////////////////////////////////////////////////////////////////
 
 /* NPB runtime statistics */
-extern const float rt_mean;
-extern const float rt_max;
-extern const float rt_min;
+extern float rt_mean;
+extern float rt_max;
+extern float rt_min;
 
 /* NPB benchmark runtimes on each architecture -- values are in seconds. */
-extern const float runtime [][40];
+extern float runtime [SYSTEM_MAX_SLOTS][SYSTEM_NUM_BENCHMARKS];
 
 /* NPB energy consumption statistics */
-extern const float energy_mean;
-extern const float energy_max;
-extern const float energy_min;
+extern float energy_mean;
+extern float energy_max;
+extern float energy_min;
 
 /* NPB benchmark energy consumption on each architecture -- values are in
  * joules. */
-extern const float energy [][40];
+extern float energy [SYSTEM_MAX_SLOTS][SYSTEM_NUM_BENCHMARKS];
 
 #ifdef __cplusplus
 }
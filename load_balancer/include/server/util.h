@@ -8,6 +8,9 @@
 #ifndef _UTIL_H
 #define _UTIL_H
 
+/* Candidate HW queues for a job, best first */
+typedef InlineVector<size_t, MAX_QUEUES> Candidates;
+
 namespace utility
 {
 
@@ -18,13 +21,17 @@ bool better_candidate(const std::pair<int, float>& a,
 											const std::pair<int, float>& b);
 
 /* Queue & prediction utilities */
+void build_slot_tables();
 bool is_available(size_t prediction_slot);
 bool same_device(size_t q1, size_t q2);
 std::string queue_sizes();
 std::vector<size_t> alloc_to_index(struct resource_alloc alloc);
+size_t alloc_to_queue(struct resource_alloc alloc);
+size_t alloc_to_slot(const struct resource_alloc& alloc);
 struct resource_alloc index_to_alloc(size_t index);
 float get_prediction(size_t q, size_t j, size_t q_to_predict);
-std::vector<size_t> get_candidates(Job* job);
+float get_prediction(Job* job, size_t q_to_predict);
+void get_candidates(Job* job, Candidates& candidates);
 
 };
 
@@ -0,0 +1,70 @@
+/*
+ * Blocking FIFO used to hand work between server threads.  Producers never
+ * block; consumers sleep until an item is available.  Items are kept in a
+ * ring buffer which only grows, so a queue which has reached its high-water
+ * mark never allocates.
+ */
+
+#ifndef _WORK_QUEUE_H
+#define _WORK_QUEUE_H
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+#define WORK_QUEUE_INIT_SIZE 64
+
+template<typename T>
+class WorkQueue
+{
+public:
+	WorkQueue() : items(WORK_QUEUE_INIT_SIZE), head(0), count(0) {}
+
+	/* Append an item & wake a waiting consumer */
+	void push(const T& item)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			if(count == items.size()) grow();
+			items[(head + count) % items.size()] = item;
+			count++;
+		}
+		available.notify_one();
+	}
+
+	/* Remove the oldest item, waiting until one is available */
+	T pop()
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		available.wait(lock, [this]{ return count != 0; });
+		T item = items[head];
+		head = (head + 1) % items.size();
+		count--;
+		return item;
+	}
+
+	/* Number of items currently queued */
+	size_t size()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		return count;
+	}
+
+private:
+	/* Double the ring's capacity, unwrapping items to the front */
+	void grow()
+	{
+		std::vector<T> bigger(items.size() * 2);
+		for(size_t i = 0; i < count; i++)
+			bigger[i] = items[(head + i) % items.size()];
+		items.swap(bigger);
+		head = 0;
+	}
+
+	std::vector<T> items;
+	size_t head, count;
+	std::mutex mtx;
+	std::condition_variable available;
+};
+
+#endif /* _WORK_QUEUE_H */
@@ -0,0 +1,668 @@
+/*
+ * Trace-driven simulator for comparing resource allocation policies offline.
+ * Replays a trace of kernels arriving at the load balancer on the server's HW
+ * queues under each policy in virtual time.  Each job runs for its true
+ * runtime on the device on which it's placed, so the simulator needs neither
+ * clients nor OpenCL devices.
+ *
+ * Traces are either read from a file or generated from the system's
+ * hard-coded runtimes.  Trace files are plain text, one job per line (lines
+ * starting with '#' are ignored):
+ *
+ *   <arrival (ns)> <PID> <kernel> <NUM_FEATURES features> \
+ *     <true runtime (s) on each prediction slot>
+ *
+ * A runtime of 0 means the job can't run on that slot.
+ *
+ * Jobs consume the system's hard-coded average power for their kernel on the
+ * slot on which they run, which is what the min-edp policy learns from.
+ */
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <cmath>
+#include <ctime>
+#include <vector>
+#include <string>
+#include <queue>
+#include <unordered_map>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "kernels.h"
+#include "message.h"
+#include "server/server.h"
+#include "server/util.h"
+#include "server/policy.h"
+
+/* Required by the server's utility functions */
+std::vector<HWQueue*> queues;
+cl_runtime cl_rt = NULL;
+
+static const char* help =
+"lb-sim - compare resource allocation policies by simulating a job trace\n\n"
+"Usage: ./lb-sim [ OPTIONS ]\n"
+"Options:\n"
+"  -h           : print help & exit\n"
+"  -f trace     : replay a recorded trace (default: generate one)\n"
+"  -o trace     : save the generated trace to a file\n"
+"  -n num       : number of jobs to generate (default: 10000)\n"
+"  -u load      : offered load of the generated trace, relative to the"
+" system's throughput (default: 0.9)\n"
+"  -r seed      : random seed used to generate the trace (default: 1)\n"
+"  -p predictor : type of predictor, as for aira-lb (default: exact-rt)\n"
+"  -m model     : model file for the nn predictor (default: model.xml)\n"
+"  -t transform : transform file for the nn predictor (default: trans.xml)\n"
+"  -c config    : queue configuration file (default: one queue per device)\n"
+"  -s policy    : simulate only this policy, as for aira-lb (default: all)\n";
+
+///////////////////////////////////////////////////////////////////////////////
+// Configuration
+///////////////////////////////////////////////////////////////////////////////
+
+static std::string trace_fn = "";
+static std::string save_fn = "";
+static size_t num_jobs = 10000;
+static double load = 0.9;
+static unsigned long seed = 1;
+static enum predictor predictor_type = EXACT_RT;
+static std::string model_fn = "model.xml";
+static std::string transform_fn = "trans.xml";
+static std::string config_fn = "n/a";
+static int policy_type = -1;
+
+static void parse_args(int argc, char** argv)
+{
+	int c;
+
+	while((c = getopt(argc, argv, "hf:o:n:u:r:p:m:t:c:s:")) != -1)
+	{
+		switch(c)
+		{
+		case 'h':
+			printf("%s", help);
+			exit(0);
+		case 'f':
+			trace_fn = optarg;
+			break;
+		case 'o':
+			save_fn = optarg;
+			break;
+		case 'n':
+			num_jobs = strtoul(optarg, NULL, 10);
+			break;
+		case 'u':
+			load = atof(optarg);
+			break;
+		case 'r':
+			seed = strtoul(optarg, NULL, 10);
+			break;
+		case 'p':
+			if(!strcmp("nn", optarg)) predictor_type = NN;
+			else if(!strcmp("always-cpu", optarg)) predictor_type = ALWAYS_CPU;
+			else if(!strcmp("always-gpu", optarg)) predictor_type = ALWAYS_GPU;
+			else if(!strcmp("exact-rt", optarg)) predictor_type = EXACT_RT;
+			else if(!strcmp("exact-energy", optarg)) predictor_type = EXACT_ENERGY;
+			else if(!strcmp("exact-edp", optarg)) predictor_type = EXACT_EDP;
+			else printf("Unknown predictor '%s', reverting to 'exact-rt'\n", optarg);
+			break;
+		case 'm':
+			model_fn = optarg;
+			break;
+		case 't':
+			transform_fn = optarg;
+			break;
+		case 'c':
+			config_fn = optarg;
+			break;
+		case 's':
+			if(!strcmp("first-fit", optarg)) policy_type = FIRST_FIT;
+			else if(!strcmp("shortest-completion", optarg))
+				policy_type = SHORTEST_COMPLETION;
+			else if(!strcmp("min-edp", optarg)) policy_type = MIN_EDP;
+			else printf("Unknown policy '%s', simulating all\n", optarg);
+			break;
+		default:
+			printf("Warning: unknown argument '%c'\n", c);
+			break;
+		}
+	}
+
+	if(trace_fn == "" && (!num_jobs || load <= 0.0))
+	{
+		fprintf(stderr, "Error: need at least one job & a positive load\n");
+		exit(1);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// System setup
+///////////////////////////////////////////////////////////////////////////////
+
+/* Prediction slot describing a device as a whole, i.e. its first slot */
+static size_t device_slot(size_t platform, size_t device)
+{
+	for(size_t s = 0; s < prediction_slots; s++)
+		if(system_devices[s].platform == platform &&
+			 system_devices[s].device == device)
+			return s;
+	return NO_PREDICTION_SLOT;
+}
+
+static void add_queue(HWQueueConfig* config)
+{
+	size_t slot = device_slot(config->platform, config->device);
+	assert(slot != NO_PREDICTION_SLOT && "device not in system description");
+	if(device_types[slot] == CL_DEVICE_TYPE_GPU)
+		queues.push_back(new GPUQueue(config));
+	else
+		queues.push_back(new CPUQueue(config));
+	queues.back()->setIndex(queues.size() - 1);
+}
+
+/*
+ * Create the HW queues, either from a configuration file or one per device
+ * in the system description (using the device's first prediction slot).
+ */
+static void initialize_queues()
+{
+	if(config_fn != "n/a")
+	{
+		for(HWQueueConfig* config : ConfigParser::parseConfig(config_fn))
+			add_queue(config);
+	}
+	else
+	{
+		for(size_t s = 0; s < prediction_slots; s++)
+		{
+			if(device_slot(system_devices[s].platform,
+										 system_devices[s].device) != s) continue;
+			HWQueueConfig* config = new HWQueueConfig();
+			config->platform = system_devices[s].platform;
+			config->device = system_devices[s].device;
+			config->computeUnits = system_devices[s].compute_units;
+			config->maxRunning = 1;
+			config->dynamicPartitioning = false;
+			add_queue(config);
+		}
+	}
+	assert(queues.size() && queues.size() <= MAX_QUEUES &&
+				 "invalid number of queues");
+	utility::build_slot_tables();
+	for(HWQueue* queue : queues)
+		assert(queue->slot() != NO_PREDICTION_SLOT &&
+					 "queue has no prediction slot");
+}
+
+static Predictor* new_predictor()
+{
+	ModelOutputs layout;
+
+	switch(predictor_type)
+	{
+	case NN:
+		// The simulator always uses the compiled-in system
+		for(size_t s = 0; s < prediction_slots; s++) layout.slots.push_back(s);
+		layout.mean = rt_mean;
+		layout.max = rt_max;
+		layout.min = rt_min;
+		return new NeuralNetPredictor(model_fn, transform_fn, layout);
+	case ALWAYS_CPU: return new AlwaysCPU();
+	case ALWAYS_GPU: return new AlwaysGPU();
+	case EXACT_RT: return new ExactRuntime();
+	case EXACT_ENERGY: return new ExactEnergy();
+	case EXACT_EDP: return new ExactEDP();
+	default: assert(false && "Shouldn't be in here...\n");
+	}
+	return NULL;
+}
+
+static Policy* new_policy(int type)
+{
+	switch(type)
+	{
+	case FIRST_FIT: return new FirstFitPolicy();
+	case SHORTEST_COMPLETION: return new ShortestCompletionPolicy();
+	case MIN_EDP: return new MinEDPPolicy();
+	default: assert(false && "Shouldn't be in here...\n");
+	}
+	return NULL;
+}
+
+static inline double elapsed(const struct timespec& start)
+{
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (toNS(end) - toNS(start)) / 1e9;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Trace
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Jobs of a trace, stored column-wise.  Predictors are deterministic, so
+ * predictions are evaluated once when the trace is loaded rather than for
+ * every simulated policy, & the feature vectors are then dropped.
+ */
+class Trace
+{
+public:
+	size_t size() const { return arrivals.size(); }
+
+	void add(unsigned long arrival, pid_t pid, struct kernel_features& features,
+					 const float* runtimes, Predictor* model);
+
+	unsigned long arrival(size_t i) const { return arrivals[i]; }
+	pid_t pid(size_t i) const { return pids[i]; }
+	int kernel(size_t i) const { return kernels[i]; }
+	const float* predictions(size_t i) const
+	{ return &preds[i * prediction_slots]; }
+
+	/* True runtime of a job on a queue, in nanoseconds */
+	unsigned long runtime(size_t i, const HWQueue* queue) const
+	{ return (unsigned long)(times[i * prediction_slots + queue->slot()] * 1e9); }
+
+	/* Energy a job consumes on a queue in joules, 0 if unknown */
+	float joules(size_t i, const HWQueue* queue) const;
+
+private:
+	std::vector<unsigned long> arrivals;
+	std::vector<pid_t> pids;
+	std::vector<int> kernels;
+	std::vector<float> preds;
+	std::vector<float> times;
+};
+
+float Trace::joules(size_t i, const HWQueue* queue) const
+{
+	int k = kernels[i];
+	size_t s = queue->slot();
+	if(k < 0 || k >= 40 || ::runtime[s][k] <= 0.0f) return 0.0f;
+	return energy[s][k] / ::runtime[s][k] * times[i * prediction_slots + s];
+}
+
+void Trace::add(unsigned long arrival, pid_t pid,
+								struct kernel_features& features, const float* runtimes,
+								Predictor* model)
+{
+	Predictions predictions(prediction_slots);
+	model->predict(features, predictions);
+
+	arrivals.push_back(arrival);
+	pids.push_back(pid);
+	kernels.push_back(features.kernel);
+	for(size_t s = 0; s < prediction_slots; s++)
+	{
+		preds.push_back(predictions[s]);
+		times.push_back(runtimes[s]);
+	}
+}
+
+/* Return whether or not a job has a true runtime on every queue */
+static bool runs_everywhere(const float* runtimes)
+{
+	for(HWQueue* queue : queues)
+		if(!(runtimes[queue->slot()] > 0.0f)) return false;
+	return true;
+}
+
+static void write_entry(FILE* fp, unsigned long arrival, pid_t pid,
+												const struct kernel_features& features,
+												const float* runtimes)
+{
+	fprintf(fp, "%lu %d %d", arrival, pid, features.kernel);
+	for(size_t f = 0; f < NUM_FEATURES; f++)
+		fprintf(fp, " %g", features.feature[f]);
+	for(size_t s = 0; s < prediction_slots; s++)
+		fprintf(fp, " %g", runtimes[s]);
+	fprintf(fp, "\n");
+}
+
+/*
+ * Read a trace file.  Jobs must arrive in order, & jobs without a runtime on
+ * every queue are skipped as the policies could place them anywhere.
+ */
+static void read_trace(Trace& trace, Predictor* model)
+{
+	FILE* fp = fopen(trace_fn.c_str(), "r");
+	if(!fp)
+	{
+		fprintf(stderr, "Error: could not open trace '%s'\n", trace_fn.c_str());
+		exit(1);
+	}
+
+	char* line = NULL, *cur, *end;
+	size_t len = 0, lineNum = 0, skipped = 0, s, f;
+	unsigned long arrival, last = 0;
+	pid_t pid;
+	struct kernel_features features;
+	float runtimes[MAX_PREDICTION_SLOTS];
+
+	while(getline(&line, &len, fp) > 0)
+	{
+		lineNum++;
+		cur = line;
+		while(*cur == ' ' || *cur == '\t') cur++;
+		if(*cur == '#' || *cur == '\n' || *cur == '\0') continue;
+
+		arrival = strtoul(cur, &end, 10);
+		if(end == cur) goto malformed;
+		pid = (pid_t)strtol(cur = end, &end, 10);
+		if(end == cur) goto malformed;
+		features.kernel = (int)strtol(cur = end, &end, 10);
+		if(end == cur) goto malformed;
+		for(f = 0; f < NUM_FEATURES; f++)
+		{
+			features.feature[f] = strtod(cur = end, &end);
+			if(end == cur) goto malformed;
+		}
+		for(s = 0; s < prediction_slots; s++)
+		{
+			runtimes[s] = strtof(cur = end, &end);
+			if(end == cur) goto malformed;
+		}
+		if(arrival < last)
+		{
+			fprintf(stderr, "Error: %s:%lu: arrivals out of order\n",
+							trace_fn.c_str(), lineNum);
+			exit(1);
+		}
+		last = arrival;
+
+		if(runs_everywhere(runtimes)) trace.add(arrival, pid, features, runtimes,
+																						model);
+		else skipped++;
+		continue;
+
+malformed:
+		fprintf(stderr, "Error: %s:%lu: expected arrival, PID, kernel, %d "
+						"feature(s) & %lu runtime(s)\n", trace_fn.c_str(), lineNum,
+						NUM_FEATURES, prediction_slots);
+		exit(1);
+	}
+	free(line);
+	fclose(fp);
+
+	if(!trace.size())
+	{
+		fprintf(stderr, "Error: no usable jobs in '%s'\n", trace_fn.c_str());
+		exit(1);
+	}
+	printf("Trace: %lu job(s) from '%s'", trace.size(), trace_fn.c_str());
+	if(skipped) printf(", skipped %lu without a runtime on every queue", skipped);
+	printf("\n");
+}
+
+/*
+ * Generate a trace with Poisson arrivals of kernels drawn uniformly from those
+ * which have a runtime on every queue.  The arrival rate is chosen so that
+ * the offered load is the requested fraction of the rate at which the queues
+ * could finish an even mix of the kernels.
+ */
+static void generate_trace(Trace& trace, Predictor* model)
+{
+	std::vector<int> kernels;
+	float runtimes[MAX_PREDICTION_SLOTS];
+	double throughput = 0.0;
+	size_t s;
+
+	for(int k = 0; k < 40; k++)
+	{
+		for(s = 0; s < prediction_slots; s++) runtimes[s] = runtime[s][k];
+		if(runs_everywhere(runtimes)) kernels.push_back(k);
+	}
+	assert(kernels.size() && "no kernels with runtimes on all queues");
+
+	for(HWQueue* queue : queues)
+	{
+		double mean = 0.0;
+		for(int k : kernels) mean += runtime[queue->slot()][k] * 1e9;
+		throughput += queue->maxRunning() * kernels.size() / mean;
+	}
+
+	FILE* fp = NULL;
+	if(save_fn != "")
+	{
+		if(!(fp = fopen(save_fn.c_str(), "w")))
+		{
+			fprintf(stderr, "Error: could not open '%s'\n", save_fn.c_str());
+			exit(1);
+		}
+		fprintf(fp, "# arrival (ns), PID, kernel, %d feature(s), runtime (s) on "
+								"%lu prediction slot(s)\n", NUM_FEATURES, prediction_slots);
+	}
+
+	double rate = load * throughput, now = 0.0;
+	std::mt19937_64 gen(seed);
+	std::exponential_distribution<double> interarrival(rate);
+	std::uniform_int_distribution<size_t> pick(0, kernels.size() - 1);
+	struct kernel_features features;
+	memset(&features, 0, sizeof(struct kernel_features));
+
+	for(size_t i = 0; i < num_jobs; i++)
+	{
+		now += interarrival(gen);
+		features.kernel = kernels[pick(gen)];
+		for(s = 0; s < prediction_slots; s++)
+			runtimes[s] = runtime[s][features.kernel];
+		trace.add((unsigned long)now, (pid_t)(i + 1), features, runtimes, model);
+		if(fp) write_entry(fp, (unsigned long)now, (pid_t)(i + 1), features,
+											 runtimes);
+	}
+	if(fp) fclose(fp);
+
+	printf("Trace: %lu job(s), %lu kernel(s), %.2f job(s)/s (offered load "
+				 "%.2f), seed %lu\n", num_jobs, kernels.size(), rate * 1e9, load, seed);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Simulation
+///////////////////////////////////////////////////////////////////////////////
+
+static inline struct timespec to_timespec(unsigned long ns)
+{
+	struct timespec ts = { (time_t)(ns / 1000000000), (long)(ns % 1000000000) };
+	return ts;
+}
+
+/* Running job, ordered by completion time */
+typedef std::pair<unsigned long, Job*> Completion;
+typedef std::priority_queue<Completion, std::vector<Completion>,
+														std::greater<Completion> > Completions;
+
+struct Results {
+	unsigned long makespan;
+	double meanTurnaround;
+	unsigned long p99Turnaround;
+	double energy;                  /* Energy consumed by all jobs (J) */
+	size_t steals;                  /* Jobs stolen by idle queues */
+	double meanSlowdown;            /* Mean slowdown accepted by steals */
+	double utilization[MAX_QUEUES]; /* Busy fraction of each queue's slots */
+	double time;                    /* Wall-clock time to simulate (s) */
+};
+
+class Simulation
+{
+public:
+	Simulation(const Trace& p_trace, Policy* p_policy)
+		: trace(p_trace), policy(p_policy), now(0) {}
+
+	Results run();
+
+private:
+	const Trace& trace;
+	Policy* policy;
+	Completions completions;
+	unsigned long now;
+	std::vector<unsigned long> turnarounds;
+	unsigned long busy[MAX_QUEUES];
+	double energy;
+	size_t steals;
+	double slowdown;
+	std::unordered_map<const Job*, size_t> entries; /* Trace entry of each job */
+
+	size_t entry(const Job* job) const { return entries.at(job); }
+
+	void start(Job* job, size_t q);
+	void submit(size_t i);
+	void finish();
+};
+
+void Simulation::start(Job* job, size_t q)
+{
+	unsigned long runtime = trace.runtime(entry(job), queues[q]);
+	queues[q]->running(job);
+	job->start = to_timespec(now);
+	busy[q] += runtime;
+	completions.push(Completion(now + runtime, job));
+}
+
+void Simulation::submit(size_t i)
+{
+	struct connection conn;
+	memset(&conn, 0, sizeof(struct connection));
+	conn.fd = -1;
+	conn.msg.sender_pid = trace.pid(i);
+	conn.msg.type = HW_REQUEST;
+	conn.msg.body.features.kernel = trace.kernel(i);
+
+	Job* job = new Job(conn);
+	entries[job] = i;
+	const float* predictions = trace.predictions(i);
+	for(size_t s = 0; s < prediction_slots; s++)
+		job->predictions[s] = predictions[s];
+	job->predicted = true;
+
+	Candidates candidates;
+	utility::get_candidates(job, candidates);
+	size_t q = policy->place(job, candidates, now);
+	if(queues[q]->canRun(job)) start(job, q);
+	else queues[q]->enqueue(job);
+	job->queued = to_timespec(now);
+}
+
+void Simulation::finish()
+{
+	Job* job = completions.top().second;
+	now = completions.top().first;
+	completions.pop();
+
+	size_t q = job->queue->index();
+	job->energy = trace.joules(entry(job), queues[q]);
+	energy += job->energy;
+	queues[q]->finished(job);
+	job->end = to_timespec(now);
+	turnarounds.push_back(now - job->queuedTime());
+	policy->finished(job);
+	entries.erase(job);
+	delete job;
+
+	if(!(job = policy->next(q))) return;
+	if(job->slowdown > 0.0f)
+	{
+		steals++;
+		slowdown += job->slowdown;
+	}
+	start(job, q);
+}
+
+Results Simulation::run()
+{
+	Results results;
+	struct timespec begin;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	turnarounds.reserve(trace.size());
+	for(size_t q = 0; q < queues.size(); q++) busy[q] = 0;
+	energy = 0.0;
+	steals = 0;
+	slowdown = 0.0;
+
+	for(size_t i = 0; i < trace.size(); i++)
+	{
+		while(!completions.empty() && completions.top().first <= trace.arrival(i))
+			finish();
+		now = trace.arrival(i);
+		submit(i);
+	}
+	while(!completions.empty()) finish();
+
+	for(HWQueue* queue : queues)
+		assert(!queue->numRunning() && !queue->numQueued() && "jobs left over");
+	assert(turnarounds.size() == trace.size() && "not all jobs finished");
+
+	double sum = 0.0;
+	for(unsigned long turnaround : turnarounds) sum += turnaround;
+	size_t p99 = (size_t)std::ceil(turnarounds.size() * 0.99) - 1;
+	std::nth_element(turnarounds.begin(), turnarounds.begin() + p99,
+									 turnarounds.end());
+
+	results.makespan = now - trace.arrival(0);
+	results.meanTurnaround = sum / turnarounds.size();
+	results.p99Turnaround = turnarounds[p99];
+	results.energy = energy;
+	results.steals = steals;
+	results.meanSlowdown = steals ? slowdown / steals : 0.0;
+	for(size_t q = 0; q < queues.size(); q++)
+		results.utilization[q] = results.makespan ? (double)busy[q] /
+			((double)results.makespan * queues[q]->maxRunning()) : 0.0;
+	results.time = elapsed(begin);
+	return results;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Driver
+///////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv)
+{
+	Trace trace;
+	struct timespec begin;
+	size_t q;
+
+	parse_args(argc, argv);
+	initialize_queues();
+	printf("Queues:\n");
+	for(HWQueue* queue : queues) queue->printConfiguration();
+
+	Predictor* model = new_predictor();
+	printf("Predictor: %s\n", predictorNames[predictor_type]);
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	if(trace_fn != "") read_trace(trace, model);
+	else generate_trace(trace, model);
+	printf("Loaded & predicted in %.3f s\n\n", elapsed(begin));
+
+	printf("%-36s %14s %14s %14s %12s %8s %9s %10s", "Policy", "Makespan (s)",
+				 "Mean turn. (s)", "p99 turn. (s)", "Energy (kJ)", "Steals",
+				 "Slowdown", "Sim. (s)");
+	for(q = 0; q < queues.size(); q++)
+		printf("  %2lu/%lu %2luC", queues[q]->platform(), queues[q]->device(),
+					 queues[q]->computeUnits());
+	printf("\n");
+
+	for(int p = 0; p < NUM_POLICIES; p++)
+	{
+		if(policy_type >= 0 && p != policy_type) continue;
+		Policy* policy = new_policy(p);
+		Simulation sim(trace, policy);
+		Results results = sim.run();
+		printf("%-36s %14.3f %14.3f %14.3f %12.3f %8lu %9.3f %10.3f",
+					 policyNames[p], results.makespan / 1e9, results.meanTurnaround / 1e9,
+					 results.p99Turnaround / 1e9, results.energy / 1e3, results.steals,
+					 results.meanSlowdown, results.time);
+		for(q = 0; q < queues.size(); q++)
+			printf("  %9.1f%%", results.utilization[q] * 100.0);
+		printf("\n");
+		delete policy;
+	}
+
+	delete model;
+	for(HWQueue* queue : queues) delete queue;
+	return 0;
+}
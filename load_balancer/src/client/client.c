@@ -9,7 +9,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <time.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "aira_definitions.h"
 #include "aira_runtime.h"
@@ -23,8 +25,26 @@
 
 struct _aira_conn {
 	bool open;
+	bool use_shm; /* Use the shared-memory transport if available */
 	client_channel channel;
+	pthread_mutex_t send_lock; /* Serializes sends & reconnects */
 	struct resource_alloc alloc;
+	struct request_class rclass; /* Priority class of requests */
+
+	/* Asynchronous request state */
+	int num_requested; /* Kernels in the latest request (0 if none) */
+	int num_pending;   /* Kernels not yet assigned resources */
+	int num_reported;  /* Assignments handed out by aira_alloc_next() */
+	bool failed;       /* Communication with the server failed */
+	bool assigned[AIRA_MAX_BATCH];
+	int order[AIRA_MAX_BATCH]; /* Kernel indexes in order of assignment */
+	struct resource_alloc allocs[AIRA_MAX_BATCH];
+
+	/* Completion callback, run on a helper thread */
+	bool has_waiter;
+	pthread_t waiter;
+	aira_alloc_callback callback;
+	void* callback_data;
 };
 
 static pid_t client_pid = -1;
@@ -40,6 +60,21 @@ init_client()
 	client_pid = getpid();
 }
 
+/*
+ * Try to switch the connection to shared memory, otherwise keep using the
+ * socket.
+ */
+static void attach_shm(aira_conn conn)
+{
+	if(client_attach_shm(conn->channel) != SUCCESS)
+	{
+#ifdef _CLIENT_VERBOSE
+		fprintf(stderr, "Warning: could not attach shared-memory transport, "
+										"falling back to sockets\n");
+#endif
+	}
+}
+
 /*
  * Open a new connection to the server (if one has not been previously opened)
  * or re-open a previously established connection.
@@ -56,10 +91,274 @@ static int establish_conn(aira_conn conn)
 			return -1;
 		}
 		conn->open = true;
+		if(conn->use_shm) attach_shm(conn);
 	}
 	return 0;
 }
 
+/*
+ * Drop a broken connection so that it is re-established on the next message.
+ */
+static void drop_conn(aira_conn conn)
+{
+	close_client_connection(conn->channel);
+	conn->open = false;
+}
+
+/*
+ * Drop a broken connection from a thread that isn't sending.
+ */
+static void drop_conn_locked(aira_conn conn)
+{
+	pthread_mutex_lock(&conn->send_lock);
+	drop_conn(conn);
+	pthread_mutex_unlock(&conn->send_lock);
+}
+
+/*
+ * Send messages over the connection, which is kept open between messages.
+ * If the send fails the server may have dropped the connection (e.g. it was
+ * restarted), so reconnect & retry once -- the messages were never delivered
+ * so it's safe to resend.  Callbacks may finish kernels while another thread
+ * sends, so senders are serialized.
+ */
+static int send_to_server(aira_conn conn, struct message* msgs, int num)
+{
+	int retval = SUCCESS;
+
+	pthread_mutex_lock(&conn->send_lock);
+	if(establish_conn(conn)) retval = IPC_SETUP_ERR;
+	else if(client_send_many(conn->channel, msgs, num) != SUCCESS)
+	{
+		drop_conn(conn);
+		if(establish_conn(conn)) retval = IPC_SETUP_ERR;
+		else if(client_send_many(conn->channel, msgs, num) != SUCCESS)
+		{
+			drop_conn(conn);
+			retval = IPC_SEND_ERR;
+		}
+	}
+	pthread_mutex_unlock(&conn->send_lock);
+	return retval;
+}
+
+/*
+ * Receive a reply from the server over a previously-used connection.
+ */
+static int receive_from_server(aira_conn conn, struct message* msg)
+{
+	if(client_receive(conn->channel, msg) == SUCCESS) return SUCCESS;
+	drop_conn_locked(conn);
+	return IPC_RECV_ERR;
+}
+
+/*
+ * Fill in a request for a single kernel.  Requests in the default class are
+ * sent as plain HW_REQUESTs, exactly as before priority classes existed.
+ */
+static inline void init_request(aira_conn conn, struct message* msg,
+																const struct kernel_features* features)
+{
+	msg->sender_pid = client_pid;
+	if(conn->rclass.priority == AIRA_PRIORITY_NORMAL &&
+		 !conn->rclass.deadline_us)
+		msg->type = HW_REQUEST;
+	else
+	{
+		msg->type = HW_REQUEST_CLASS;
+		msg->ext.rclass = conn->rclass;
+	}
+	memcpy(&msg->body.features, features, sizeof(struct kernel_features));
+}
+
+/*
+ * Allocation used when the server can't be reached.
+ */
+static inline void default_alloc(struct resource_alloc* alloc)
+{
+	alloc->platform = 0;
+	alloc->device = 0;
+	alloc->compute_units = 1;
+}
+
+/*
+ * Wait for the callback helper thread to exit.
+ */
+static void join_waiter(aira_conn conn)
+{
+	if(!conn->has_waiter) return;
+	pthread_join(conn->waiter, NULL);
+	conn->has_waiter = false;
+}
+
+/*
+ * Send an allocation request for one or more kernels without waiting for the
+ * server's answer.
+ */
+static int submit_request(aira_conn conn, struct message* msgs, int num)
+{
+	int i;
+
+	join_waiter(conn);
+	if(conn->num_pending)
+	{
+#ifdef _CLIENT_VERBOSE
+		fprintf(stderr, "Warning: connection already has an outstanding request\n");
+#endif
+		return AIRA_ALLOC_ERROR;
+	}
+
+	conn->num_requested = conn->num_pending = num;
+	conn->num_reported = 0;
+	conn->failed = false;
+	default_alloc(&conn->alloc);
+	for(i = 0; i < num; i++)
+	{
+		conn->assigned[i] = false;
+		default_alloc(&conn->allocs[i]);
+	}
+
+	if(send_to_server(conn, msgs, num) != SUCCESS)
+	{
+#ifdef _CLIENT_VERBOSE
+		fprintf(stderr, "Warning: problem requesting allocation from daemon\n");
+#endif
+		conn->num_pending = 0;
+		conn->failed = true;
+		for(i = 0; i < num; i++) conn->order[i] = i;
+		return AIRA_ALLOC_ERROR;
+	}
+	return AIRA_ALLOC_PENDING;
+}
+
+/*
+ * Calculate an absolute deadline timeout_ms from now.
+ */
+static inline void get_deadline(int timeout_ms, struct timespec* deadline)
+{
+	clock_gettime(CLOCK_MONOTONIC, deadline);
+	deadline->tv_sec += timeout_ms / 1000;
+	deadline->tv_nsec += (timeout_ms % 1000) * 1000000;
+}
+
+/*
+ * Milliseconds left until a deadline (negative timeouts never expire).
+ */
+static inline int remaining_ms(int timeout_ms, const struct timespec* deadline)
+{
+	struct timespec now;
+	long remaining;
+
+	if(timeout_ms <= 0) return timeout_ms;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	remaining = (deadline->tv_sec - now.tv_sec) * 1000 +
+							(deadline->tv_nsec - now.tv_nsec) / 1000000;
+	return remaining > 0 ? remaining : 0;
+}
+
+/*
+ * Give all unassigned kernels of the outstanding request the default
+ * allocation after losing the server.
+ */
+static void fail_pending(aira_conn conn)
+{
+	int index;
+
+	drop_conn_locked(conn);
+	if(!conn->num_pending) return;
+	conn->failed = true;
+	for(index = 0; index < conn->num_requested; index++)
+		if(!conn->assigned[index])
+			conn->order[conn->num_requested - conn->num_pending--] = index;
+}
+
+/*
+ * Record an assignment for the outstanding request.  Other messages are
+ * ignored.
+ */
+static void record_alloc(aira_conn conn, const struct message* msg)
+{
+	int index;
+
+	if(msg->type != HW_ASSIGN && msg->type != HW_ASSIGN_BATCH) return;
+	index = msg->type == HW_ASSIGN_BATCH ? msg->ext.batch_index : 0;
+	if(index < conn->num_requested && !conn->assigned[index])
+	{
+		conn->assigned[index] = true;
+		conn->allocs[index] = msg->body.alloc;
+		conn->order[conn->num_requested - conn->num_pending--] = index;
+		if(conn->num_requested == 1) conn->alloc = conn->allocs[0];
+	}
+}
+
+/*
+ * Receive a single assignment for the outstanding request.  If the server
+ * can't be reached, all remaining kernels get the default allocation.
+ */
+static int receive_alloc(aira_conn conn, int timeout_ms)
+{
+	struct message msg;
+	int retval;
+
+	retval = client_receive_timeout(conn->channel, &msg, timeout_ms);
+	if(retval == IPC_TIMEOUT) return retval;
+	if(retval != SUCCESS)
+	{
+#ifdef _CLIENT_VERBOSE
+		fprintf(stderr, "Warning: problem receiving allocation from daemon\n");
+#endif
+		fail_pending(conn);
+		return retval;
+	}
+
+	record_alloc(conn, &msg);
+	return SUCCESS;
+}
+
+/*
+ * Receive assignments for the outstanding request, waiting at most timeout_ms
+ * in total (negative to block until all kernels are assigned).
+ */
+static int collect_allocs(aira_conn conn, int timeout_ms)
+{
+	struct timespec deadline;
+
+	if(!conn->num_requested) return AIRA_ALLOC_ERROR;
+	get_deadline(timeout_ms, &deadline);
+	while(conn->num_pending)
+		if(receive_alloc(conn, remaining_ms(timeout_ms, &deadline)) == IPC_TIMEOUT)
+			return AIRA_ALLOC_PENDING;
+	return conn->failed ? AIRA_ALLOC_ERROR : AIRA_ALLOC_READY;
+}
+
+/*
+ * Copy the outstanding request's allocations to user storage.
+ */
+static inline int copy_allocs(aira_conn conn, int status,
+															struct resource_alloc* allocs)
+{
+	if(allocs && status != AIRA_ALLOC_PENDING)
+		memcpy(allocs, conn->allocs,
+					 sizeof(struct resource_alloc) * conn->num_requested);
+	return status;
+}
+
+/*
+ * Helper thread which calls the user's callback as each kernel of the
+ * outstanding request is assigned resources.
+ */
+static void* wait_for_callback(void* arg)
+{
+	aira_conn conn = (aira_conn)arg;
+	struct resource_alloc alloc;
+	int index;
+
+	while(aira_alloc_next(conn, -1, &index, &alloc) != AIRA_ALLOC_PENDING &&
+				index >= 0)
+		conn->callback(conn, index, alloc, conn->callback_data);
+	return NULL;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Client-side API implementation
 ///////////////////////////////////////////////////////////////////////////////
@@ -69,10 +368,13 @@ static int establish_conn(aira_conn conn)
  */
 aira_conn aira_init_conn()
 {
+	const char* transport, *socket_fname;
 	aira_conn conn = (aira_conn)malloc(sizeof(struct _aira_conn));
 	if(!conn) return NULL;
 
-	conn->channel = open_client_channel(SOCKET_FILE);
+	socket_fname = getenv(SOCKET_ENV);
+	if(!socket_fname || !*socket_fname) socket_fname = SOCKET_FILE;
+	conn->channel = open_client_channel(socket_fname);
 	if(!conn->channel)
 	{
 #ifdef _CLIENT_VERBOSE
@@ -82,9 +384,17 @@ aira_conn aira_init_conn()
     return NULL;
 	}
 	conn->open = true;
-	conn->alloc.platform = 0;
-	conn->alloc.device = 0;
-	conn->alloc.compute_units = 1;
+	pthread_mutex_init(&conn->send_lock, NULL);
+	default_alloc(&conn->alloc);
+	conn->rclass.priority = AIRA_PRIORITY_NORMAL;
+	conn->rclass.deadline_us = 0;
+	conn->num_requested = conn->num_pending = 0;
+	conn->failed = false;
+	conn->has_waiter = false;
+
+	transport = getenv(TRANSPORT_ENV);
+	conn->use_shm = transport && !strcmp(transport, "shm");
+	if(conn->use_shm) attach_shm(conn);
 
 	return conn;
 }
@@ -96,11 +406,23 @@ void aira_free_conn(aira_conn conn)
 {
   if(conn)
   {
+		join_waiter(conn);
 		close_client_channel(conn->channel);
+		pthread_mutex_destroy(&conn->send_lock);
 		free(conn);
   }
 }
 
+/*
+ * Set the priority class & deadline sent with subsequent requests.  Unknown
+ * classes are sent as-is, the server treats them as normal priority.
+ */
+void aira_set_priority(aira_conn conn, int priority, unsigned deadline_us)
+{
+	conn->rclass.priority = (uint8_t)priority;
+	conn->rclass.deadline_us = deadline_us;
+}
+
 /*
  * Notify the load balancer that a kernel in the current application is going
  * to run on the specified resource allocation.
@@ -114,25 +436,14 @@ void aira_notify(aira_conn conn, struct resource_alloc alloc)
 	msg.body.alloc = alloc;
 	conn->alloc = alloc;
 
-	if(establish_conn(conn))
-	{
-#ifdef _CLIENT_VERBOSE
-		fprintf(stderr, "Warning: could not open IPC channel\n");
-#endif
-		return;
-	}
-
-	if(client_send(conn->channel, &msg) != SUCCESS ||
-		 client_receive(conn->channel, &msg) != SUCCESS)
+	if(send_to_server(conn, &msg, 1) != SUCCESS ||
+		 receive_from_server(conn, &msg) != SUCCESS)
 	{
 #ifdef _CLIENT_VERBOSE
 		fprintf(stderr, "Warning: problem notifying server\n");
 #endif
 		return;
 	}
-
-	close_client_connection(conn->channel);
-	conn->open = false;
 }
 
 /*
@@ -144,22 +455,12 @@ struct resource_alloc aira_alloc_resources(aira_conn conn,
 {
 	struct message msg;
 
-	msg.sender_pid = client_pid;
-	msg.type = HW_REQUEST;
-	memcpy(&msg.body.features, features, sizeof(struct kernel_features));
+	init_request(conn, &msg, features);
 	conn->alloc.platform = 0;
 	conn->alloc.device = 0;
 	conn->alloc.compute_units = 1;
 
-	if(establish_conn(conn))
-	{
-#ifdef _CLIENT_VERBOSE
-		fprintf(stderr, "Warning: could not open IPC channel\n");
-#endif
-		return conn->alloc;
-	}
-
-	if(client_send(conn->channel, &msg) != SUCCESS)
+	if(send_to_server(conn, &msg, 1) != SUCCESS)
 	{
 #ifdef _CLIENT_VERBOSE
 		fprintf(stderr, "Warning: problem requesting allocation from daemon\n");
@@ -167,7 +468,7 @@ struct resource_alloc aira_alloc_resources(aira_conn conn,
 		return conn->alloc;
 	}
 
-	if(client_receive(conn->channel, &msg) != SUCCESS)
+	if(receive_from_server(conn, &msg) != SUCCESS)
 	{
 #ifdef _CLIENT_VERBOSE
 		fprintf(stderr, "Warning: problem receiving allocation from daemon\n");
@@ -175,47 +476,154 @@ struct resource_alloc aira_alloc_resources(aira_conn conn,
 		return conn->alloc;
 	}
 
-	close_client_connection(conn->channel);
-	conn->open = false;
 	conn->alloc = msg.body.alloc;
 	return conn->alloc;
 }
 
 /*
- * Cleanup after a kernel has finished.
+ * Submit a request for a resource allocation without waiting for the answer.
  */
-void aira_kernel_finish(aira_conn conn)
+int aira_alloc_resources_async(aira_conn conn,
+															 struct kernel_features* features)
 {
 	struct message msg;
 
-	msg.sender_pid = client_pid;
-	msg.type = KERNEL_FINISH;
-	msg.body.alloc = conn->alloc;
+	init_request(conn, &msg, features);
+	return submit_request(conn, &msg, 1);
+}
+
+/*
+ * Submit a request for resource allocations for several kernels without
+ * waiting for the answer.
+ */
+int aira_alloc_resources_batch_async(aira_conn conn, int num,
+																		 struct kernel_features* features)
+{
+	struct message msgs[AIRA_MAX_BATCH];
+	int i;
+
+	if(num <= 0 || AIRA_MAX_BATCH < num) return AIRA_ALLOC_ERROR;
+	if(num == 1) return aira_alloc_resources_async(conn, features);
+
+	for(i = 0; i < num; i++)
+	{
+		msgs[i].sender_pid = client_pid;
+		msgs[i].type = HW_REQUEST_BATCH;
+		msgs[i].ext.rclass = conn->rclass;
+		msgs[i].ext.batch_index = i;
+		msgs[i].ext.batch_count = num;
+		memcpy(&msgs[i].body.features, &features[i],
+					 sizeof(struct kernel_features));
+	}
+	return submit_request(conn, msgs, num);
+}
 
-	if(establish_conn(conn))
+/*
+ * Check if the outstanding request has been answered.
+ */
+int aira_alloc_poll(aira_conn conn, struct resource_alloc* allocs)
+{
+	return copy_allocs(conn, collect_allocs(conn, 0), allocs);
+}
+
+/*
+ * Wait (up to a timeout) for the outstanding request to be answered.
+ */
+int aira_alloc_wait(aira_conn conn, int timeout_ms,
+										struct resource_alloc* allocs)
+{
+	return copy_allocs(conn, collect_allocs(conn, timeout_ms), allocs);
+}
+
+/*
+ * Get the next kernel of the outstanding request to be assigned resources.
+ */
+int aira_alloc_next(aira_conn conn, int timeout_ms, int* index,
+										struct resource_alloc* alloc)
+{
+	struct timespec deadline;
+
+	*index = -1;
+	if(conn->num_reported >= conn->num_requested) return AIRA_ALLOC_ERROR;
+
+	get_deadline(timeout_ms, &deadline);
+	while(conn->num_reported == conn->num_requested - conn->num_pending)
+		if(receive_alloc(conn, remaining_ms(timeout_ms, &deadline)) == IPC_TIMEOUT)
+			return AIRA_ALLOC_PENDING;
+
+	*index = conn->order[conn->num_reported++];
+	*alloc = conn->allocs[*index];
+	return conn->failed ? AIRA_ALLOC_ERROR : AIRA_ALLOC_READY;
+}
+
+/*
+ * Call a function as each kernel of the outstanding request is assigned
+ * resources.
+ */
+int aira_alloc_set_callback(aira_conn conn, aira_alloc_callback callback,
+														void* data)
+{
+	if(!callback || !conn->num_requested || conn->has_waiter)
+		return AIRA_ALLOC_ERROR;
+
+	conn->callback = callback;
+	conn->callback_data = data;
+	if(pthread_create(&conn->waiter, NULL, wait_for_callback, conn))
 	{
 #ifdef _CLIENT_VERBOSE
-		fprintf(stderr, "Warning: could not open IPC channel\n");
+		fprintf(stderr, "Warning: could not start callback thread\n");
 #endif
-		return;
+		return AIRA_ALLOC_ERROR;
 	}
+	conn->has_waiter = true;
+	return AIRA_ALLOC_PENDING;
+}
+
+/*
+ * Tell the server the kernel using an allocation has finished.  Only reads the
+ * connection's state, so it's safe to call from callbacks.
+ */
+static void send_finish(aira_conn conn, const struct resource_alloc* alloc)
+{
+	struct message msg;
+
+	msg.sender_pid = client_pid;
+	msg.type = KERNEL_FINISH;
+	msg.body.alloc = *alloc;
 
-	if(client_send(conn->channel, &msg) != SUCCESS)
+	if(send_to_server(conn, &msg, 1) != SUCCESS)
 	{
 #ifdef _CLIENT_VERBOSE
 		fprintf(stderr, "Warning: problem cleaning up with server\n");
 #endif
 		return;
 	}
+}
 
-	close_client_connection(conn->channel);
-	conn->open = false;
-	return;	
+/*
+ * Cleanup after a kernel has finished.
+ */
+void aira_kernel_finish(aira_conn conn)
+{
+	send_finish(conn, &conn->alloc);
+}
+
+/*
+ * Cleanup after one kernel of a batched request has finished.  The kernel's
+ * allocation tells the server which device was freed up.
+ */
+void aira_kernel_finish_batch(aira_conn conn, int index)
+{
+	if(index < 0 || conn->num_requested <= index) return;
+	send_finish(conn, &conn->allocs[index]);
 }
 
 /*
  * Get the current information regarding the runtime queues maintained by the
- * server.
+ * server.  Assignments for an outstanding request may arrive before the
+ * server's answer, so they're recorded as they would be by aira_alloc_next().
+ * A callback thread is the only other receiver on the connection; wait for it
+ * to finish, or fail if called from the callback itself.
  */
 void aira_get_current_alloc(aira_conn conn, int* num_entries, int* entries)
 {
@@ -228,18 +636,19 @@ void aira_get_current_alloc(aira_conn conn, int* num_entries, int* entries)
 		return;
 	}
 
-	msg.sender_pid = client_pid;
-	msg.type = GET_QUEUES;
-
-	if(establish_conn(conn))
+	if(conn->has_waiter && pthread_equal(conn->waiter, pthread_self()))
 	{
 #ifdef _CLIENT_VERBOSE
-		fprintf(stderr, "Warning: could not open IPC channel\n");
+		fprintf(stderr, "Warning: can't request resource usage from a callback\n");
 #endif
 		success = 0;
 	}
+	else join_waiter(conn);
+
+	msg.sender_pid = client_pid;
+	msg.type = GET_QUEUES;
 
-	if(success && client_send(conn->channel, &msg) != SUCCESS)
+	if(success && send_to_server(conn, &msg, 1) != SUCCESS)
 	{
 #ifdef _CLIENT_VERBOSE
 		fprintf(stderr, "Warning: could not request resource usage from server\n");
@@ -247,17 +656,18 @@ void aira_get_current_alloc(aira_conn conn, int* num_entries, int* entries)
 		success = 0;
 	}
 
-	if(success && client_receive(conn->channel, &msg) != SUCCESS)
+	while(success)
 	{
+		if(client_receive(conn->channel, &msg) != SUCCESS)
+		{
 #ifdef _CLIENT_VERBOSE
-		fprintf(stderr, "Warning could not receive resource usage from server\n");
+			fprintf(stderr, "Warning could not receive resource usage from server\n");
 #endif
-		success = 0;
-	}
-
-	if(success) {
-		close_client_connection(conn->channel);
-		conn->open = false;
+			fail_pending(conn);
+			success = 0;
+		}
+		else if(msg.type == RET_QUEUES) break;
+		else record_alloc(conn, &msg);
 	}
 
 	int i;
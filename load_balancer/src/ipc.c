@@ -5,16 +5,31 @@
  * Date: 8/8/2015
  */
 
+#define _GNU_SOURCE /* struct ucred */
 #include <stdlib.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
+#include <stdbool.h>
 #include <unistd.h>
+#include <errno.h>
 #include <assert.h>
 
 /* Unix domain socket headers */
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/epoll.h>
+
+/* Shared-memory transport headers */
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "message.h"
 #include "ipc.h"
@@ -24,10 +39,69 @@
 // Struct definitions
 ///////////////////////////////////////////////////////////////////////////////
 
+/*
+ * A client's response ring must hold the HW_ASSIGNs of a whole batch plus a
+ * control reply (e.g., RET_QUEUES) it hasn't read yet.  Ring indexes wrap
+ * around, so the size must also be a power of two.
+ */
+#if SHM_RING_SIZE <= MAX_BATCH || (SHM_RING_SIZE & (SHM_RING_SIZE - 1))
+#error "SHM_RING_SIZE must be a power of two larger than MAX_BATCH"
+#endif
+
+/*
+ * Single-producer/single-consumer ring of messages in shared memory.  The
+ * producer & consumer indexes live on separate cache lines so the two sides
+ * don't bounce a line back & forth.  The tail doubles as the futex word on
+ * which an idle consumer sleeps.
+ */
+struct shm_ring
+{
+	uint32_t head __attribute__((aligned(64))); /* Next message to consume */
+	uint32_t waiting;                           /* Consumer is asleep */
+	uint32_t tail __attribute__((aligned(64))); /* Next free message slot */
+	struct message msgs[SHM_RING_SIZE] __attribute__((aligned(64)));
+};
+
+/* Per-client request & response rings */
+struct shm_slot
+{
+	struct shm_ring request;  /* Client -> server */
+	struct shm_ring response; /* Server -> client */
+};
+
+/*
+ * Region shared between the server & one shared-memory client.  Each client
+ * gets a new region when it attaches, so a client can only ever scribble on
+ * its own rings.
+ */
+struct shm_region
+{
+	uint32_t server_sleeping; /* Server is blocked in the event loop */
+	struct shm_slot slot;
+};
+
 struct _server_channel
 {
 	int listen_fd;
 	struct sockaddr_un addr;
+
+	/* Event loop state -- all client connections are multiplexed on one fd */
+	int epoll_fd;
+	int wakeup_fd; /* Interrupts server_listen(), e.g. from signal handlers */
+	int num_ready;
+	int next_ready;
+	struct epoll_event ready[SERVER_MAX_EVENTS];
+
+	/* Shared-memory transport state */
+	bool shm;                       /* Transport is available */
+	int doorbell_fd;                /* Clients kick this when server sleeps */
+	struct shm_region* shm_region[SHM_MAX_CLIENTS]; /* Per-client regions */
+	int shm_owner[SHM_MAX_CLIENTS]; /* Socket of client owning slot, or -1 */
+	pid_t shm_pid[SHM_MAX_CLIENTS]; /* Process on the other end of the socket */
+	int shm_active;                 /* Number of slots in use */
+	int shm_next;                   /* Slot at which to start polling */
+	int* fd_slot;                   /* Socket -> slot map (-1 if socket-only) */
+	int fd_slot_size;
 };
 
 struct _client_channel
@@ -35,6 +109,12 @@ struct _client_channel
 	int conn_fd;
 	struct sockaddr_un addr;
 	socklen_t addr_size;
+
+	/* Shared-memory transport (if attached) */
+	struct shm_region* shm;
+	struct shm_slot* slot;
+	int doorbell_fd;
+	int spin_iters; /* How long to spin before sleeping on a response */
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -54,65 +134,137 @@ static inline int open_socket()
 	return fd;
 }
 
+/*
+ * Set up a socket address.  Names starting with SOCKET_ABSTRACT are in the
+ * abstract namespace, i.e. there's no socket file.
+ *
+ * @return the size of the address, or 0 if the name is too long
+ */
 static inline socklen_t setup_sockaddr(struct sockaddr_un* addr,
 																			 const char* fname)
 {
-	// TODO check copied string size
+	size_t len = strlen(fname);
+
+	memset(addr, 0, sizeof(struct sockaddr_un));
 	addr->sun_family = AF_UNIX;
-	strncpy(addr->sun_path, fname, sizeof(addr->sun_path));
-	return sizeof(addr->sun_family) + strlen(addr->sun_path);
+	if(len >= sizeof(addr->sun_path))
+	{
+		errno = ENAMETOOLONG;
+		return 0;
+	}
+	memcpy(addr->sun_path, fname, len);
+	if(fname[0] == SOCKET_ABSTRACT) addr->sun_path[0] = '\0';
+	return offsetof(struct sockaddr_un, sun_path) + len;
 }
 
-static inline int send_message(int fd, const struct message* msg)
+static inline int send_bytes(int fd, const void* buf, size_t size)
 {
 	ssize_t send_size;
+	size_t sent = 0;
 
-	send_size = send(fd, msg, sizeof(struct message), 0);
-	if(send_size == -1)
+	// Keep sending until the entire buffer is on the stream.  Don't raise
+	// SIGPIPE if the other end has hung up, the caller handles the error.
+	while(sent < size)
 	{
+		send_size = send(fd, (const char*)buf + sent, size - sent, MSG_NOSIGNAL);
+		if(send_size == -1)
+		{
+			if(errno == EINTR) continue;
 #ifdef _VERBOSE
-		perror("Could not send message");
+			perror("Could not send message");
 #endif
-		return IPC_SEND_ERR;
+			return IPC_SEND_ERR;
+		}
+		sent += send_size;
 	}
 
-	if(send_size != sizeof(struct message))
+	return SUCCESS;
+}
+
+/*
+ * Send messages, each framed by the size of its type (see message_size()).
+ * They're packed back-to-back so that a batch goes out in one call.
+ */
+static inline int send_messages(int fd, const struct message* msgs, int num)
+{
+	char buf[sizeof(struct message) * MAX_BATCH];
+	size_t size, msg_size;
+	int i;
+
+	while(num > 0)
 	{
-#ifdef _VERBOSE
-		fprintf(stderr, "Sent incorrect number of bytes (%lu vs %ld)\n",
-						sizeof(struct message), send_size);
-#endif
-		return IPC_SEND_ERR;
+		for(i = 0, size = 0; i < num && i < MAX_BATCH; i++, size += msg_size)
+		{
+			msg_size = message_size(msgs[i].type);
+			memcpy(buf + size, &msgs[i], msg_size);
+		}
+		if(send_bytes(fd, buf, size) != SUCCESS) return IPC_SEND_ERR;
+		msgs += i;
+		num -= i;
 	}
 
 	return SUCCESS;
 }
 
-static inline int receive_message(int fd, struct message* msg)
+static inline int send_message(int fd, const struct message* msg)
+{
+	return send_bytes(fd, msg, message_size(msg->type));
+}
+
+static inline int receive_bytes(int fd, void* buf, size_t size)
 {
 	ssize_t receive_size;
+	size_t received = 0;
 
-	receive_size = recv(fd, msg, sizeof(struct message), 0);
-	if(receive_size == -1)
+	while(received < size)
 	{
+		receive_size = recv(fd, (char*)buf + received, size - received, 0);
+		if(receive_size == -1)
+		{
+			if(errno == EINTR) continue;
 #ifdef _VERBOSE
-		perror("Could not receive message");
+			perror("Could not receive message");
 #endif
-		return IPC_RECV_ERR;
-	}
+			return IPC_RECV_ERR;
+		}
 
-	if(receive_size != sizeof(struct message))
-	{
+		if(receive_size == 0)
+		{
 #ifdef _VERBOSE
-		fprintf(stderr, "Received incorrect message size (%lu vs %ld)\n",
-						sizeof(struct message), receive_size);
+			if(received)
+				fprintf(stderr, "Received incorrect message size (%lu vs %lu)\n",
+								size, received);
 #endif
-		return IPC_RECV_ERR;
+			return IPC_HANGUP;
+		}
+		received += receive_size;
 	}
 
 	return SUCCESS;
 }
 
+/*
+ * Receive a message, reading the extension only if its type has one.
+ * Otherwise the extension is zeroed.
+ */
+static inline int receive_message(int fd, struct message* msg)
+{
+	size_t size;
+	int retval;
+
+	retval = receive_bytes(fd, msg, MESSAGE_BASE_SIZE);
+	if(retval != SUCCESS) return retval;
+
+	size = message_size(msg->type);
+	if(size == MESSAGE_BASE_SIZE)
+	{
+		memset(&msg->ext, 0, sizeof(struct message_ext));
+		return SUCCESS;
+	}
+	return receive_bytes(fd, (char*)msg + MESSAGE_BASE_SIZE,
+											 size - MESSAGE_BASE_SIZE);
+}
+
 static inline int close_socket(int socket_fd)
 {
 	int retval = close(socket_fd);
@@ -125,6 +277,7 @@ static inline int close_socket(int socket_fd)
 
 static inline int close_ipc_file(const struct sockaddr_un* addr)
 {
+	if(!addr->sun_path[0]) return 0; // Abstract, no file
 	int retval = remove(addr->sun_path);
 #ifdef _VERBOSE
 	if(retval)
@@ -133,6 +286,435 @@ static inline int close_ipc_file(const struct sockaddr_un* addr)
 	return retval;
 }
 
+static inline int watch_fd(int epoll_fd, int fd)
+{
+	struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+	return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/*
+ * Remove a connection from the event loop, including any pending readiness
+ * notifications so we don't read from the descriptor once it's been recycled.
+ */
+static inline void forget_fd(server_channel chan, int fd)
+{
+	int i;
+	epoll_ctl(chan->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	for(i = chan->next_ready; i < chan->num_ready; i++)
+		if(chan->ready[i].data.fd == fd)
+			chan->ready[i].data.fd = -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Shared-memory transport internals
+///////////////////////////////////////////////////////////////////////////////
+
+#if defined(__x86_64__) || defined(__i386__)
+# define cpu_relax() __builtin_ia32_pause()
+#else
+# define cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
+
+static inline int futex_wait(uint32_t* addr, uint32_t val,
+														 const struct timespec* timeout)
+{
+	return syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+static inline int futex_wake(uint32_t* addr)
+{
+	return syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+static inline bool ring_empty(struct shm_ring* ring)
+{
+	return __atomic_load_n(&ring->head, __ATOMIC_RELAXED) ==
+				 __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+static inline void ring_reset(struct shm_ring* ring)
+{
+	__atomic_store_n(&ring->head, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&ring->tail, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&ring->waiting, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Add a message to the ring, waking the consumer only if it went to sleep.
+ * Returns false if the ring is full.
+ */
+static inline bool ring_push(struct shm_ring* ring, const struct message* msg)
+{
+	uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+	if(tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) >= SHM_RING_SIZE)
+		return false;
+
+	memcpy(&ring->msgs[tail % SHM_RING_SIZE], msg, sizeof(struct message));
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&ring->waiting, __ATOMIC_SEQ_CST))
+		futex_wake(&ring->tail);
+	return true;
+}
+
+/*
+ * Remove a message from the ring.  Returns false if the ring is empty.
+ */
+static inline bool ring_pop(struct shm_ring* ring, struct message* msg)
+{
+	uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	if(head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) return false;
+
+	memcpy(msg, &ring->msgs[head % SHM_RING_SIZE], sizeof(struct message));
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+/*
+ * Wait for a message in the ring.  Spin for a while (the server usually
+ * responds quickly), then sleep on the futex.  Sleeps are bounded so we can
+ * notice if the server went away.  A negative timeout waits forever.
+ */
+static inline int ring_wait_pop(struct shm_ring* ring, struct message* msg,
+																int conn_fd, int spin_iters, int timeout_ms)
+{
+	struct timespec timeout = { 0, SHM_WAIT_MS * 1000000 }, now, deadline;
+	struct pollfd pfd = { .fd = conn_fd, .events = POLLIN };
+	long remaining_ns;
+	uint32_t head;
+	int i;
+
+	if(ring_pop(ring, msg)) return SUCCESS;
+	if(!timeout_ms) return IPC_TIMEOUT;
+	if(timeout_ms > 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout_ms / 1000;
+		deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+		if(deadline.tv_nsec >= 1000000000)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+	}
+
+	while(true)
+	{
+		for(i = 0; i < spin_iters; i++)
+		{
+			cpu_relax();
+			if(ring_pop(ring, msg)) return SUCCESS;
+		}
+
+		if(timeout_ms > 0)
+		{
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			remaining_ns = (deadline.tv_sec - now.tv_sec) * 1000000000L +
+										 (deadline.tv_nsec - now.tv_nsec);
+			if(remaining_ns <= 0) return IPC_TIMEOUT;
+			if(remaining_ns < SHM_WAIT_MS * 1000000L)
+				timeout.tv_nsec = remaining_ns;
+		}
+
+		head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+		__atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+		if(__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == head)
+			futex_wait(&ring->tail, head, &timeout);
+		__atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+
+		// The server never writes to the socket once we've attached, so any
+		// activity means it hung up
+		if(ring_empty(ring) && poll(&pfd, 1, 0) > 0) return IPC_HANGUP;
+		if(ring_pop(ring, msg)) return SUCCESS;
+	}
+}
+
+/*
+ * Send a message & file descriptors over a socket.
+ */
+static inline int send_message_fds(int fd, const struct message* msg,
+																	 const int* fds, int num_fds)
+{
+	char buf[CMSG_SPACE(sizeof(int) * 2)];
+	struct iovec iov = { .iov_base = (void*)msg, .iov_len = MESSAGE_BASE_SIZE };
+	struct msghdr hdr = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = buf,
+		.msg_controllen = CMSG_SPACE(sizeof(int) * num_fds)
+	};
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+
+	assert(num_fds <= 2);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * num_fds);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * num_fds);
+
+	if(sendmsg(fd, &hdr, MSG_NOSIGNAL) != MESSAGE_BASE_SIZE) return IPC_SEND_ERR;
+	return SUCCESS;
+}
+
+/*
+ * Receive a message & file descriptors from a socket.
+ */
+static inline int receive_message_fds(int fd, struct message* msg,
+																			int* fds, int num_fds)
+{
+	char buf[CMSG_SPACE(sizeof(int) * 2)];
+	struct iovec iov = { .iov_base = msg, .iov_len = MESSAGE_BASE_SIZE };
+	struct msghdr hdr = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = buf,
+		.msg_controllen = sizeof(buf)
+	};
+	struct cmsghdr* cmsg;
+
+	assert(num_fds <= 2);
+	if(recvmsg(fd, &hdr, MSG_CMSG_CLOEXEC) != MESSAGE_BASE_SIZE) return IPC_RECV_ERR;
+	cmsg = CMSG_FIRSTHDR(&hdr);
+	if(!cmsg || cmsg->cmsg_type != SCM_RIGHTS ||
+		 cmsg->cmsg_len != CMSG_LEN(sizeof(int) * num_fds))
+		return IPC_RECV_ERR;
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * num_fds);
+	return SUCCESS;
+}
+
+/*
+ * Set up the shared-memory transport's doorbell & socket -> slot map.  Regions
+ * are created per client as they attach.
+ */
+static int open_shm(server_channel chan)
+{
+	struct rlimit limit;
+	int i;
+
+	chan->shm = false;
+	chan->shm_active = chan->shm_next = 0;
+	for(i = 0; i < SHM_MAX_CLIENTS; i++)
+	{
+		chan->shm_region[i] = NULL;
+		chan->shm_owner[i] = -1;
+	}
+
+	// Size the socket -> slot map up front so replies can be routed without
+	// synchronizing with the thread accepting connections
+	if(getrlimit(RLIMIT_NOFILE, &limit) || limit.rlim_cur > SHM_MAX_FDS)
+		chan->fd_slot_size = SHM_MAX_FDS;
+	else
+		chan->fd_slot_size = limit.rlim_cur;
+	chan->fd_slot = (int*)malloc(sizeof(int) * chan->fd_slot_size);
+	if(!chan->fd_slot) return IPC_SETUP_ERR;
+	for(i = 0; i < chan->fd_slot_size; i++) chan->fd_slot[i] = -1;
+
+	chan->doorbell_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(chan->doorbell_fd == -1) goto free_map;
+	if(watch_fd(chan->epoll_fd, chan->doorbell_fd)) goto close_doorbell;
+
+	chan->shm = true;
+	return SUCCESS;
+
+close_doorbell:
+	close(chan->doorbell_fd);
+free_map:
+	free(chan->fd_slot);
+	return IPC_SETUP_ERR;
+}
+
+static void close_shm(server_channel chan)
+{
+	int i;
+
+	if(!chan->shm) return;
+	for(i = 0; i < SHM_MAX_CLIENTS; i++)
+		if(chan->shm_region[i])
+			munmap(chan->shm_region[i], sizeof(struct shm_region));
+	close(chan->doorbell_fd);
+	free(chan->fd_slot);
+	chan->shm = false;
+}
+
+static inline int shm_slot_of(server_channel chan, int fd)
+{
+	if(!chan->shm || fd < 0 || chan->fd_slot_size <= fd) return -1;
+	return __atomic_load_n(&chan->fd_slot[fd], __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Create a new region for a client.  The region is unlinked immediately, the
+ * client receives it over its socket.
+ *
+ * @return the region's file descriptor, or -1 if it couldn't be created
+ */
+static int create_shm_region(server_channel chan, int slot)
+{
+	struct shm_region* region;
+	char name[64];
+	int fd;
+
+	snprintf(name, sizeof(name), "/aira-lb.%d.%d", getpid(), slot);
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+	if(fd == -1) return -1;
+	shm_unlink(name);
+
+	if(ftruncate(fd, sizeof(struct shm_region))) goto close_fd;
+	region = (struct shm_region*)mmap(NULL, sizeof(struct shm_region),
+																		PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(region == MAP_FAILED) goto close_fd;
+	__atomic_store_n(&chan->shm_region[slot], region, __ATOMIC_RELAXED);
+	return fd;
+
+close_fd:
+	close(fd);
+	return -1;
+}
+
+/*
+ * Hand a shared-memory region to the client on the other end of the socket.
+ * Replies with the slot number (or -1 if none are available) along with the
+ * region & doorbell file descriptors.  Messages from the client's rings are
+ * stamped with the PID the kernel reports for the socket, so clients can't
+ * pose as one another.
+ */
+static void attach_shm(server_channel chan, int fd, struct message* msg)
+{
+	struct ucred cred;
+	socklen_t cred_size = sizeof(cred);
+	int fds[2] = { -1, chan->doorbell_fd };
+	int slot = -1, i;
+
+	if(chan->shm && shm_slot_of(chan, fd) == -1 && fd < chan->fd_slot_size &&
+		 !getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_size))
+	{
+		for(i = 0; i < SHM_MAX_CLIENTS; i++)
+			if(!__atomic_load_n(&chan->shm_region[i], __ATOMIC_ACQUIRE))
+			{
+				slot = i;
+				break;
+			}
+		if(slot != -1 && (fds[0] = create_shm_region(chan, slot)) == -1)
+			slot = -1;
+	}
+
+	msg->sender_pid = getpid();
+	msg->body.channel = slot;
+	if(slot == -1)
+	{
+		// Clients expect descriptors either way
+		fds[0] = chan->doorbell_fd;
+		send_message_fds(fd, msg, fds, 2);
+		return;
+	}
+
+	if(send_message_fds(fd, msg, fds, 2) == SUCCESS)
+	{
+		chan->shm_owner[slot] = fd;
+		chan->shm_pid[slot] = cred.pid;
+		__atomic_store_n(&chan->fd_slot[fd], slot, __ATOMIC_RELEASE);
+		chan->shm_active++;
+	}
+	else
+	{
+		munmap(chan->shm_region[slot], sizeof(struct shm_region));
+		__atomic_store_n(&chan->shm_region[slot], NULL, __ATOMIC_RELEASE);
+	}
+	close(fds[0]);
+}
+
+/*
+ * Stop polling a client's rings when its socket goes away.  Replies can still
+ * be sent into its region until the connection is closed.
+ */
+static inline void detach_shm(server_channel chan, int fd)
+{
+	int slot = shm_slot_of(chan, fd);
+	if(slot == -1 || chan->shm_owner[slot] != fd) return;
+	chan->shm_owner[slot] = -1;
+	chan->shm_active--;
+}
+
+/*
+ * Release a client's region once its connection is closed.  May be called from
+ * a different thread than the one listening, so the slot is only handed out
+ * again once the region is gone.
+ */
+static inline void release_shm(server_channel chan, int fd)
+{
+	int slot = shm_slot_of(chan, fd);
+	if(slot == -1) return;
+	__atomic_store_n(&chan->fd_slot[fd], -1, __ATOMIC_RELEASE);
+	munmap(chan->shm_region[slot], sizeof(struct shm_region));
+	__atomic_store_n(&chan->shm_region[slot], NULL, __ATOMIC_RELEASE);
+}
+
+/*
+ * Poll shared-memory request rings for a message, starting where we left off
+ * last time so no client starves.
+ */
+static inline bool poll_shm(server_channel chan, struct connection* conn)
+{
+	int i, slot;
+
+	if(!chan->shm_active) return false;
+	for(i = 0; i < SHM_MAX_CLIENTS; i++)
+	{
+		slot = (chan->shm_next + i) % SHM_MAX_CLIENTS;
+		if(chan->shm_owner[slot] != -1 &&
+			 ring_pop(&chan->shm_region[slot]->slot.request, &conn->msg))
+		{
+			conn->fd = chan->shm_owner[slot];
+			conn->msg.sender_pid = chan->shm_pid[slot];
+			chan->shm_next = slot + 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Tell shared-memory clients whether the server is about to sleep.
+ */
+static inline void set_sleeping(server_channel chan, uint32_t sleeping,
+																int order)
+{
+	int i;
+	for(i = 0; i < SHM_MAX_CLIENTS; i++)
+		if(chan->shm_owner[i] != -1)
+			__atomic_store_n(&chan->shm_region[i]->server_sleeping, sleeping, order);
+}
+
+/*
+ * Block until there are events.  Shared-memory clients only ring the doorbell
+ * if they see the server is asleep, so advertise that & re-check the rings
+ * before actually blocking.
+ */
+static inline int wait_for_events(server_channel chan, struct connection* conn,
+																	bool* got_msg)
+{
+	*got_msg = false;
+	if(chan->shm_active)
+	{
+		set_sleeping(chan, 1, __ATOMIC_SEQ_CST);
+		if(poll_shm(chan, conn))
+		{
+			set_sleeping(chan, 0, __ATOMIC_RELAXED);
+			*got_msg = true;
+			return 0;
+		}
+	}
+
+	chan->next_ready = 0;
+	chan->num_ready = epoll_wait(chan->epoll_fd, chan->ready,
+															 SERVER_MAX_EVENTS, -1);
+	if(chan->shm_active) set_sleeping(chan, 0, __ATOMIC_RELAXED);
+	if(chan->num_ready == -1)
+	{
+		chan->num_ready = 0;
+		return -1;
+	}
+	return 0;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Server API
 ///////////////////////////////////////////////////////////////////////////////
@@ -141,7 +723,8 @@ static inline int close_ipc_file(const struct sockaddr_un* addr)
  * Open server's IPC channel.  Opens a socket on which to listen for
  * connections and binds it to the specified file.
  *
- * @param socket_fname file for which to bind the socket for listening
+ * @param socket_fname file for which to bind the socket for listening, or
+ *                     an abstract name starting with SOCKET_ABSTRACT
  * @return a server IPC channel or NULL if something went wrong
  */
 server_channel open_server_channel(const char* socket_fname)
@@ -162,7 +745,8 @@ server_channel open_server_channel(const char* socket_fname)
 
 	// Bind socket file descriptor to file
 	sock_size = setup_sockaddr(&chan->addr, socket_fname);
-	if(bind(chan->listen_fd, (struct sockaddr*)&chan->addr, sock_size))
+	if(!sock_size ||
+		 bind(chan->listen_fd, (struct sockaddr*)&chan->addr, sock_size))
 	{
 #ifdef _VERBOSE
 		perror("Could not bind socket to file");
@@ -173,6 +757,46 @@ server_channel open_server_channel(const char* socket_fname)
 		return NULL;
 	}
 
+	// Start listening once -- clients keep their connections open across
+	// messages, so we only need to accept new clients as they show up
+	if(listen(chan->listen_fd, SERVER_QUEUE_SIZE) == -1)
+	{
+#ifdef _VERBOSE
+		perror("Server could not listen on socket");
+#endif
+		close_socket(chan->listen_fd);
+		close_ipc_file(&chan->addr);
+		free(chan);
+		return NULL;
+	}
+
+	// Set up the event loop, initially only watching for new connections
+	chan->num_ready = chan->next_ready = 0;
+	chan->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	chan->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(chan->epoll_fd == -1 || chan->wakeup_fd == -1 ||
+		 watch_fd(chan->epoll_fd, chan->listen_fd) ||
+		 watch_fd(chan->epoll_fd, chan->wakeup_fd))
+	{
+#ifdef _VERBOSE
+		perror("Could not set up server event loop");
+#endif
+		if(chan->epoll_fd != -1) close(chan->epoll_fd);
+		if(chan->wakeup_fd != -1) close(chan->wakeup_fd);
+		close_socket(chan->listen_fd);
+		close_ipc_file(&chan->addr);
+		free(chan);
+		return NULL;
+	}
+
+	// Shared-memory transport is optional, clients fall back to the socket
+	if(open_shm(chan))
+	{
+#ifdef _VERBOSE
+		perror("Could not set up shared-memory transport");
+#endif
+	}
+
 	return chan;
 }
 
@@ -188,7 +812,10 @@ int close_server_channel(server_channel chan)
 
 	if(!chan) return BAD_IPC_CHANNEL;
 
-	retval = close_socket(chan->listen_fd);
+	close_shm(chan);
+	retval = close(chan->epoll_fd);
+	retval |= close(chan->wakeup_fd);
+	retval |= close_socket(chan->listen_fd);
 	retval |= close_ipc_file(&chan->addr);
 
 	free(chan);
@@ -198,8 +825,14 @@ int close_server_channel(server_channel chan)
 }
 
 /*
- * Listen on the Unix socket for a connection.  Return a connection struct
- * when client contacts server with a request.
+ * Wait for a message from any client.  Connections are persistent, so rather
+ * than accepting a connection per message the server multiplexes all client
+ * connections (and the listening socket) through a single epoll instance.
+ * Clients attached to the shared-memory transport are polled before blocking.
+ * New connections are accepted internally.  Hung-up connections are no longer
+ * watched & are reported with a CLIENT_HANGUP message but are left open, so
+ * their descriptor can't be handed to another client while the caller still
+ * refers to it; close them with server_close_connection().
  *
  * @param chan server channel handle on which to listen for connections
  * @side_effect conn struct containing file-descriptor & received message
@@ -207,57 +840,151 @@ int close_server_channel(server_channel chan)
  */
 int server_listen(server_channel chan, struct connection* conn)
 {
-	struct sockaddr_un remote_addr;
-	socklen_t remote_size = sizeof(remote_addr);
+	int fd, retval;
+	uint64_t rings;
+	bool got_msg;
 
 	if(!chan) return BAD_IPC_CHANNEL;
 	if(!conn) return IPC_RECV_ERR;
 
-	//Wait for a connection
-	if(listen(chan->listen_fd, SERVER_QUEUE_SIZE) == -1)
+	while(true)
 	{
+		if(poll_shm(chan, conn)) return SUCCESS;
+
+		// Get the next batch of ready file descriptors
+		if(chan->next_ready >= chan->num_ready)
+		{
+			if(wait_for_events(chan, conn, &got_msg))
+			{
 #ifdef _VERBOSE
-		perror("Server could not listen on socket");
+				if(errno != EINTR) perror("Server could not wait for events");
 #endif
-		return IPC_RECV_ERR;
-	}
+				return IPC_RECV_ERR;
+			}
+			if(got_msg) return SUCCESS;
+			continue;
+		}
 
-	//Accept the incoming connection, saving the file descriptor
-	conn->fd = accept(chan->listen_fd,
-										(struct sockaddr*)&remote_addr,
-										&remote_size);
-	if(conn->fd == -1)
-	{
+		fd = chan->ready[chan->next_ready++].data.fd;
+		if(fd == -1) continue;
+		else if(fd == chan->wakeup_fd)
+		{
+			// Let the caller check whatever it was woken up for
+			if(read(fd, &rings, sizeof(rings))) {}
+			errno = EINTR;
+			return IPC_RECV_ERR;
+		}
+		else if(chan->shm && fd == chan->doorbell_fd)
+		{
+			// Just a wakeup, messages are in the rings
+			if(read(fd, &rings, sizeof(rings))) {}
+			continue;
+		}
+		else if(fd == chan->listen_fd)
+		{
+			// Accept the incoming connection & watch it for messages
+			fd = accept(chan->listen_fd, NULL, NULL);
+			if(fd == -1)
+			{
 #ifdef _VERBOSE
-		perror("Server could not accept connection");
+				perror("Server could not accept connection");
 #endif
-		return IPC_RECV_ERR;
+				continue;
+			}
+			if(watch_fd(chan->epoll_fd, fd))
+			{
+#ifdef _VERBOSE
+				perror("Server could not watch connection");
+#endif
+				close_socket(fd);
+			}
+			continue;
+		}
+
+		// Level-triggered, so if the client queued up multiple messages we'll
+		// be told about the connection again on the next call
+		conn->fd = fd;
+		retval = receive_message(fd, &conn->msg);
+		if(retval == SUCCESS && conn->msg.type != CLIENT_HANGUP)
+		{
+			// Transport negotiation is handled entirely in the IPC layer
+			if(conn->msg.type != SHM_ATTACH) return SUCCESS;
+			attach_shm(chan, fd, &conn->msg);
+			continue;
+		}
+
+		// Client hung up (or the connection is broken) -- stop watching it &
+		// let the caller clean up before the descriptor is closed
+		detach_shm(chan, fd);
+		forget_fd(chan, fd);
+		conn->msg.sender_pid = 0;
+		conn->msg.type = CLIENT_HANGUP;
+		return SUCCESS;
 	}
+}
 
-	return receive_message(conn->fd, &conn->msg);
+/*
+ * Return a descriptor which interrupts server_listen() when written to (with
+ * an 8-byte count, as for eventfd()).  server_listen() then fails with errno
+ * set to EINTR, as if interrupted by a signal.  Writing to it is
+ * async-signal-safe, so signal handlers can use it to make sure the server
+ * notices them even if the signal arrives just before it starts waiting, or
+ * is delivered to another thread.
+ *
+ * @param chan server channel handle
+ * @return the descriptor, or -1 if chan is invalid
+ */
+int server_wakeup_fd(const server_channel chan)
+{
+	if(!chan) return -1;
+	return chan->wakeup_fd;
 }
 
 /*
  * Send a message over the specified connection.
  *
+ * @param chan server channel handle on which the connection was received
  * @param conn a struct encapsulating the data to send.  Note that the user is
  *             expected to have previously opened this connection & they have
  *             filled the message contained therein with a response.
+ * @return 0 if successful, or an error code otherwise.  Failures only affect
+ *         this client, which has hung up (or is hung up on if its
+ *         shared-memory replies aren't being read).
  */
-int server_send(const struct connection* conn)
+int server_send(const server_channel chan, const struct connection* conn)
 {
+	int slot;
+
+	if(!chan) return BAD_IPC_CHANNEL;
 	if(!conn || conn->fd == -1) return IPC_SEND_ERR;
+
+	// Reply over shared memory if the client is attached
+	slot = shm_slot_of(chan, conn->fd);
+	if(slot != -1)
+	{
+		if(ring_push(&chan->shm_region[slot]->slot.response, &conn->msg))
+			return SUCCESS;
+
+		// A client which follows the protocol always has room, so this one has
+		// stopped reading.  Hang up on it rather than leave it waiting for a
+		// lost reply; the hangup is reported like any other.
+		shutdown(conn->fd, SHUT_RDWR);
+		return IPC_SEND_ERR;
+	}
 	return send_message(conn->fd, &conn->msg);
 }
 
 /*
  * Closes a connection held open by the server.
  *
+ * @param chan server channel handle on which the connection was received
  * @param conn a struct encapsulating a connection to close.
  */
-int server_close_connection(struct connection* conn)
+int server_close_connection(server_channel chan, struct connection* conn)
 {
+	if(!chan) return BAD_IPC_CHANNEL;
 	if(!conn || conn->fd == -1) return IPC_CLEANUP_ERR;
+	release_shm(chan, conn->fd);
 	int retval = close_socket(conn->fd);
 	conn->fd = -1;
 	return retval;
@@ -270,7 +997,7 @@ int server_close_connection(struct connection* conn)
 /*
  * Open a channel for communicating with the server.
  *
- * @param socket_fname Unix socket filename
+ * @param socket_fname Unix socket filename or abstract name
  * @return an IPC channel to the server, or NULL if something went wrong
  */
 client_channel open_client_channel(const char* socket_fname)
@@ -288,8 +1015,12 @@ client_channel open_client_channel(const char* socket_fname)
 		return NULL;
 	}
 
+	chan->shm = NULL;
+	chan->slot = NULL;
+	chan->doorbell_fd = -1;
 	chan->addr_size = setup_sockaddr(&chan->addr, socket_fname);
-	if(connect(chan->conn_fd,
+	if(!chan->addr_size ||
+		 connect(chan->conn_fd,
 						 (struct sockaddr*)&chan->addr,
 						 chan->addr_size) == -1)
 	{
@@ -348,6 +1079,15 @@ int close_client_connection(client_channel chan)
 
 	if(!chan) return BAD_IPC_CHANNEL;
 
+	if(chan->shm)
+	{
+		munmap(chan->shm, sizeof(struct shm_region));
+		close(chan->doorbell_fd);
+		chan->shm = NULL;
+		chan->slot = NULL;
+		chan->doorbell_fd = -1;
+	}
+
 	retval = close_socket(chan->conn_fd);
 	chan->conn_fd = -1;
 
@@ -375,6 +1115,96 @@ int close_client_channel(client_channel chan)
 	else return SUCCESS;
 }
 
+/*
+ * Switch the connection over to the shared-memory transport.  The socket stays
+ * open so the server can tell when the client goes away.  If the server can't
+ * hand out a slot the channel keeps using the socket.
+ *
+ * @param chan a client channel handle
+ * @return 0 if the channel now uses shared memory or an error code otherwise
+ */
+int client_attach_shm(client_channel chan)
+{
+	struct pollfd pfd;
+	struct message msg;
+	int fds[2];
+
+	if(!chan || chan->conn_fd == -1) return BAD_IPC_CHANNEL;
+	if(chan->shm) return SUCCESS;
+
+	msg.sender_pid = getpid();
+	msg.type = SHM_ATTACH;
+	if(send_message(chan->conn_fd, &msg) != SUCCESS) return IPC_SEND_ERR;
+
+	// Don't hang on servers which don't know about the shared-memory transport
+	pfd.fd = chan->conn_fd;
+	pfd.events = POLLIN;
+	if(poll(&pfd, 1, SHM_ATTACH_TIMEOUT_MS) != 1) return IPC_SETUP_ERR;
+	if(receive_message_fds(chan->conn_fd, &msg, fds, 2) != SUCCESS)
+		return IPC_RECV_ERR;
+
+	if(msg.type == SHM_ATTACH && msg.body.channel != -1)
+	{
+		chan->shm = (struct shm_region*)mmap(NULL, sizeof(struct shm_region),
+																				 PROT_READ | PROT_WRITE, MAP_SHARED,
+																				 fds[0], 0);
+		if(chan->shm == MAP_FAILED) chan->shm = NULL;
+	}
+	close(fds[0]);
+
+	if(!chan->shm)
+	{
+		close(fds[1]);
+		return IPC_SETUP_ERR;
+	}
+
+	// Spinning only helps if the server can run at the same time
+	chan->slot = &chan->shm->slot;
+	chan->doorbell_fd = fds[1];
+	chan->spin_iters = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SHM_SPIN_ITERS : 0;
+	return SUCCESS;
+}
+
+/*
+ * Wake the server if it went to sleep waiting for shared-memory messages.
+ */
+static inline int kick_server(client_channel chan)
+{
+	uint64_t kick = 1;
+	if(__atomic_load_n(&chan->shm->server_sleeping, __ATOMIC_SEQ_CST))
+		if(write(chan->doorbell_fd, &kick, sizeof(kick)) != sizeof(kick))
+			return IPC_SEND_ERR;
+	return SUCCESS;
+}
+
+/*
+ * Add a message to the request ring once the server makes room, making sure
+ * it's awake to drain the ring.  Spin for a while, then wait in short sleeps
+ * so we notice if the server went away & give up after SHM_SEND_TIMEOUT_MS.
+ */
+static int ring_wait_push(client_channel chan, const struct message* msg)
+{
+	struct pollfd pfd = { .fd = chan->conn_fd, .events = POLLIN };
+	int i;
+
+	for(i = 0; i < chan->spin_iters; i++)
+	{
+		if(ring_push(&chan->slot->request, msg)) return SUCCESS;
+		cpu_relax();
+	}
+
+	for(i = 0; i < SHM_SEND_TIMEOUT_MS; i++)
+	{
+		if(ring_push(&chan->slot->request, msg)) return SUCCESS;
+		if(kick_server(chan) != SUCCESS) return IPC_SEND_ERR;
+
+		// The server never writes to the socket once we've attached, so any
+		// activity means it hung up
+		if(poll(&pfd, 1, 1) > 0) return IPC_HANGUP;
+	}
+	return ring_push(&chan->slot->request, msg) ? SUCCESS : IPC_TIMEOUT;
+}
+
 /*
  * Send a message to server.
  *
@@ -384,9 +1214,42 @@ int close_client_channel(client_channel chan)
  */
 int client_send(client_channel chan, struct message* msg)
 {
+	int retval;
+
 	if(!chan) return BAD_IPC_CHANNEL;
 	if(!msg) return IPC_SEND_ERR;
-	return send_message(chan->conn_fd, msg);
+	if(!chan->shm) return send_message(chan->conn_fd, msg);
+
+	// Only a syscall if the server is asleep (or the ring is full)
+	if(!ring_push(&chan->slot->request, msg) &&
+		 (retval = ring_wait_push(chan, msg)) != SUCCESS)
+		return retval;
+	return kick_server(chan);
+}
+
+/*
+ * Send several messages to the server at once.  Socket connections write all
+ * messages with a single call & the shared-memory transport rings the doorbell
+ * at most once.
+ *
+ * @param chan client IPC channel
+ * @param msgs messages to send to server
+ * @param num number of messages
+ * @return 0 if successfully sent or an error code otherwise
+ */
+int client_send_many(client_channel chan, struct message* msgs, int num)
+{
+	int i, retval;
+
+	if(!chan) return BAD_IPC_CHANNEL;
+	if(!msgs || num <= 0) return IPC_SEND_ERR;
+	if(!chan->shm) return send_messages(chan->conn_fd, msgs, num);
+
+	for(i = 0; i < num; i++)
+		if(!ring_push(&chan->slot->request, &msgs[i]) &&
+			 (retval = ring_wait_push(chan, &msgs[i])) != SUCCESS)
+			return retval;
+	return kick_server(chan);
 }
 
 /*
@@ -400,6 +1263,38 @@ int client_receive(client_channel chan, struct message* msg)
 {
 	if(!chan) return BAD_IPC_CHANNEL;
 	if(!msg) return IPC_RECV_ERR;
+	if(!chan->shm) return receive_message(chan->conn_fd, msg);
+	return ring_wait_pop(&chan->slot->response, msg, chan->conn_fd,
+											 chan->spin_iters, -1);
+}
+
+/*
+ * Receive a message from the server, giving up after a timeout.
+ *
+ * @param chan client IPC channel
+ * @param msg storage for received message
+ * @param timeout_ms milliseconds to wait (0 to poll, negative to block)
+ * @return 0 if successfully received, IPC_TIMEOUT if no message arrived in
+ *         time or an error code otherwise
+ */
+int client_receive_timeout(client_channel chan, struct message* msg,
+													 int timeout_ms)
+{
+	struct pollfd pfd;
+	int retval;
+
+	if(!chan) return BAD_IPC_CHANNEL;
+	if(!msg) return IPC_RECV_ERR;
+	if(chan->shm)
+		return ring_wait_pop(&chan->slot->response, msg, chan->conn_fd,
+												 chan->spin_iters, timeout_ms);
+
+	pfd.fd = chan->conn_fd;
+	pfd.events = POLLIN;
+	do retval = poll(&pfd, 1, timeout_ms);
+	while(retval == -1 && errno == EINTR);
+	if(retval == -1) return IPC_RECV_ERR;
+	if(retval == 0) return IPC_TIMEOUT;
 	return receive_message(chan->conn_fd, msg);
 }
 
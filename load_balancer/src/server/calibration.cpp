@@ -0,0 +1,179 @@
+/*
+ * Implementation of online predictor calibration.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+
+#include "server/server.h"
+#include "server/calibration.h"
+
+/* 64-bit FNV-1a */
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+static inline uint64_t fnv1a(uint64_t hash, const void* data, size_t size)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for(size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+/* Hash fields individually, the struct has padding after the kernel */
+uint64_t Calibration::signature(const struct kernel_features& feats)
+{
+	uint64_t hash = fnv1a(FNV_OFFSET, &feats.kernel, sizeof(feats.kernel));
+	return fnv1a(hash, feats.feature, sizeof(feats.feature));
+}
+
+bool Calibration::correct(Job* job)
+{
+	Predictions& predictions = job->predictions;
+	size_t s, num = predictions.size(), samples = 0;
+	double unit, logSum = 0.0;
+
+	std::lock_guard<std::mutex> guard(lock);
+	std::unordered_map<uint64_t, Entry>::const_iterator it =
+		entries.find(signature(job->features));
+	if(it == entries.end()) return false;
+	const Entry& entry = it->second;
+
+	// Find the runtime of the default CPU
+	if(default_cpu < num && entry.count[default_cpu] >= CALIBRATION_MIN_SAMPLES)
+		unit = entry.runtime[default_cpu];
+	else
+	{
+		for(s = 0; s < num; s++)
+		{
+			if(entry.count[s] < CALIBRATION_MIN_SAMPLES ||
+				 !std::isfinite(predictions[s]) || predictions[s] <= 0.0f)
+				continue;
+			logSum += log((double)entry.runtime[s] * predictions[s]);
+			samples++;
+		}
+		if(!samples) return false;
+		unit = exp(logSum / samples);
+	}
+
+	// Replace predictions by observed speedups (unusable slots stay unusable)
+	for(s = 0; s < num; s++)
+		if(entry.count[s] >= CALIBRATION_MIN_SAMPLES &&
+			 std::isfinite(predictions[s]) && predictions[s] > 0.0f)
+			predictions[s] = unit / entry.runtime[s];
+	numCorrected++;
+	return true;
+}
+
+void Calibration::observe(const Job* job, size_t slot)
+{
+	if(slot >= MAX_PREDICTION_SLOTS || job->endTime() <= job->startTime())
+		return;
+
+	float runtime = (float)(job->endTime() - job->startTime());
+	uint64_t sig = signature(job->features);
+
+	std::lock_guard<std::mutex> guard(lock);
+	std::unordered_map<uint64_t, Entry>::iterator it = entries.find(sig);
+	if(it == entries.end())
+	{
+		if(entries.size() >= CALIBRATION_MAX_SIGNATURES) return;
+		Entry entry;
+		memset(&entry, 0, sizeof(Entry));
+		it = entries.insert(std::make_pair(sig, entry)).first;
+	}
+
+	Entry& entry = it->second;
+	if(entry.count[slot]) entry.runtime[slot] += CALIBRATION_WEIGHT *
+																				 (runtime - entry.runtime[slot]);
+	else entry.runtime[slot] = runtime;
+	if(entry.count[slot] < UINT32_MAX) entry.count[slot]++;
+	numObserved++;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Persistence
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * State files are text: a header line with the magic, version & number of
+ * prediction slots, then a line per signature with its hash & a count &
+ * average runtime per slot.
+ */
+bool Calibration::load(const std::string& filename)
+{
+	char magic[32];
+	unsigned version;
+	size_t slots, s;
+	uint64_t sig;
+	Entry entry;
+	std::unordered_map<uint64_t, Entry> loaded;
+
+	FILE* fp = fopen(filename.c_str(), "r");
+	if(!fp) return false;
+	if(fscanf(fp, "%31s %u %zu", magic, &version, &slots) != 3 ||
+		 strcmp(magic, CALIBRATION_MAGIC) || version != CALIBRATION_VERSION ||
+		 slots != prediction_slots)
+	{
+		fclose(fp);
+		return false;
+	}
+
+	memset(&entry, 0, sizeof(Entry));
+	while(fscanf(fp, "%" SCNx64, &sig) == 1 &&
+				loaded.size() < CALIBRATION_MAX_SIGNATURES)
+	{
+		for(s = 0; s < slots; s++)
+			if(fscanf(fp, "%u %f", &entry.count[s], &entry.runtime[s]) != 2)
+				break;
+		if(s < slots) break;
+		loaded[sig] = entry;
+	}
+	bool success = feof(fp) || loaded.size() == CALIBRATION_MAX_SIGNATURES;
+	fclose(fp);
+	if(!success) return false;
+
+	std::lock_guard<std::mutex> guard(lock);
+	entries.swap(loaded);
+	return true;
+}
+
+/* Write a temporary file & rename it so a crash never leaves partial state */
+bool Calibration::save(const std::string& filename)
+{
+	std::string tmp = filename + ".tmp";
+	bool success = true;
+	size_t s;
+
+	FILE* fp = fopen(tmp.c_str(), "w");
+	if(!fp) return false;
+
+	std::unique_lock<std::mutex> guard(lock);
+	fprintf(fp, "%s %u %zu\n", CALIBRATION_MAGIC, CALIBRATION_VERSION,
+					prediction_slots);
+	for(const std::pair<const uint64_t, Entry>& it : entries)
+	{
+		fprintf(fp, "%016" PRIx64, it.first);
+		for(s = 0; s < prediction_slots; s++)
+			fprintf(fp, " %u %.9g", it.second.count[s], it.second.runtime[s]);
+		fprintf(fp, "\n");
+	}
+	guard.unlock();
+
+	if(ferror(fp)) success = false;
+	if(fclose(fp)) success = false;
+	if(success && rename(tmp.c_str(), filename.c_str())) success = false;
+	if(!success) unlink(tmp.c_str());
+	return success;
+}
+
+size_t Calibration::numSignatures()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return entries.size();
+}
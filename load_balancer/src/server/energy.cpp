@@ -0,0 +1,224 @@
+/*
+ * Implementation of device energy measurement.
+ */
+
+#include <cstdio>
+#include <ctime>
+
+#include "server/server.h"
+#include "server/energy.h"
+
+static inline unsigned long now_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return toNS(now);
+}
+
+static inline bool same_type(cl_device_type clType, devtype_t powerType)
+{
+	return (clType == CL_DEVICE_TYPE_CPU && powerType == CPU) ||
+				 (clType == CL_DEVICE_TYPE_GPU && powerType == GPU);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Public API
+///////////////////////////////////////////////////////////////////////////////
+
+size_t EnergyMeter::start(unsigned long periodMS)
+{
+	std::vector<std::pair<size_t, size_t> > measurable;
+	std::vector<bool> used;
+	struct timespec sampling;
+	size_t p, d, i;
+	Device dev;
+
+	if(handle) return devices.size();
+
+	// Devices powerlib can measure, in enumeration order
+	for(i = 0; i < powerlib_num_managers(); i++)
+		for(d = 0; d < powerlib_num_devices(i); d++)
+			if(powerlib_device_supported(i, d))
+				measurable.push_back(std::pair<size_t, size_t>(i, d));
+	used.assign(measurable.size(), false);
+
+	// Give each OpenCL device the first unused powerlib device of its type
+	for(p = 0; p < get_num_platforms(); p++)
+	{
+		for(d = 0; d < get_num_devices(p); d++)
+		{
+			cl_device_type type = get_device_type(cl_rt, p, d);
+			for(i = 0; i < measurable.size(); i++)
+			{
+				if(used[i] || !same_type(type, powerlib_device_type(
+						measurable[i].first, measurable[i].second)))
+					continue;
+				used[i] = true;
+				dev.platform = p;
+				dev.device = d;
+				dev.manager = measurable[i].first;
+				dev.index = measurable[i].second;
+				devices.push_back(dev);
+				break;
+			}
+		}
+	}
+	if(devices.empty()) return 0;
+
+	if(!(handle = powerlib_initialize()))
+	{
+		devices.clear();
+		return 0;
+	}
+	for(Device& cur : devices)
+	{
+		if(powerlib_add_device(handle, cur.manager, cur.index) < 0)
+		{
+			stop();
+			return 0;
+		}
+	}
+
+	period = periodMS * 1000000UL;
+	sampling.tv_sec = periodMS / 1000;
+	sampling.tv_nsec = (periodMS % 1000) * 1000000;
+	if(powerlib_start_monitoring(handle, &sampling))
+	{
+		stop();
+		return 0;
+	}
+
+	unsigned long now = now_ns();
+	for(Device& cur : devices)
+	{
+		cur.cap = 0.0;
+		cur.counter = cur.attributed = cur.power = cur.windowEnergy = 0.0;
+		cur.windowStart = now;
+	}
+	return devices.size();
+}
+
+void EnergyMeter::stop()
+{
+	if(!handle) return;
+	powerlib_stop_monitoring(handle);
+	powerlib_shutdown(handle);
+	handle = NULL;
+	devices.clear();
+}
+
+bool EnergyMeter::setCap(size_t platform, size_t device, double watts)
+{
+	Device* dev = find(platform, device);
+	if(!dev) return false;
+	dev->cap = watts > 0.0 ? watts : 0.0;
+	return true;
+}
+
+void EnergyMeter::attribute(size_t platform, size_t device)
+{
+	Device* dev = find(platform, device);
+	if(!dev) return;
+
+	double before = dev->counter;
+	sample(*dev);
+	double consumed = dev->counter - before;
+	unsigned units = runningUnits(*dev);
+	if(consumed <= 0.0 || !units) return;
+
+	for(HWQueue* queue : queues)
+	{
+		if(queue->platform() != platform || queue->device() != device) continue;
+		for(Job* job = queue->firstRunning(); job; job = JobList::next(job))
+			job->energy += consumed * job->alloc.compute_units / units;
+	}
+	dev->attributed += consumed;
+}
+
+bool EnergyMeter::throttle(size_t platform, size_t device)
+{
+	bool released = false, throttled;
+	Device* dev = find(platform, device);
+	if(!dev || dev->cap <= 0.0) return false;
+
+	unsigned units = runningUnits(*dev);
+	for(HWQueue* queue : queues)
+	{
+		if(queue->platform() != platform || queue->device() != device) continue;
+		throttled = units &&
+			dev->power * (units + queue->computeUnits()) / units > dev->cap;
+		if(queue->isThrottled() && !throttled) released = true;
+		queue->setThrottled(throttled);
+	}
+	return released;
+}
+
+void EnergyMeter::printConfiguration() const
+{
+	printf("Energy measurement: ");
+	if(!handle)
+	{
+		printf("disabled\n");
+		return;
+	}
+	printf("%lu device(s), sampled every %lu ms\n", devices.size(),
+				 period / 1000000UL);
+	for(const Device& dev : devices)
+	{
+		printf("  %lu/%lu: %s", dev.platform, dev.device,
+					 powerlib_device_info(dev.manager, dev.index));
+		if(dev.cap > 0.0) printf(", capped at %.1f W", dev.cap);
+		printf("\n");
+	}
+}
+
+void EnergyMeter::printStatistics() const
+{
+	printf("Energy measurement:\n");
+	for(const Device& dev : devices)
+		printf("  %lu/%lu: %.1f J consumed, %.1f J attributed to jobs\n",
+					 dev.platform, dev.device,
+					 powerlib_energy(handle, dev.manager, dev.index), dev.attributed);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Internals
+///////////////////////////////////////////////////////////////////////////////
+
+EnergyMeter::Device* EnergyMeter::find(size_t platform, size_t device)
+{
+	for(Device& dev : devices)
+		if(dev.platform == platform && dev.device == device) return &dev;
+	return NULL;
+}
+
+/*
+ * Read a device's energy counter, which powerlib's sampling thread advances
+ * once per period, & update its power once the window spans a few periods.
+ */
+void EnergyMeter::sample(Device& dev)
+{
+	unsigned long now = now_ns();
+	dev.counter = powerlib_energy(handle, dev.manager, dev.index);
+	if(now - dev.windowStart >= ENERGY_POWER_WINDOW * period)
+	{
+		dev.power = (dev.counter - dev.windowEnergy) * 1e9 /
+								(now - dev.windowStart);
+		dev.windowEnergy = dev.counter;
+		dev.windowStart = now;
+	}
+}
+
+/* Compute units of all jobs running on a device, across its HW queues */
+unsigned EnergyMeter::runningUnits(const Device& dev) const
+{
+	unsigned units = 0;
+	for(HWQueue* queue : queues)
+	{
+		if(queue->platform() != dev.platform || queue->device() != dev.device)
+			continue;
+		for(Job* job = queue->firstRunning(); job; job = JobList::next(job))
+			units += job->alloc.compute_units;
+	}
+	return units;
+}
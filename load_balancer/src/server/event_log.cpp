@@ -0,0 +1,153 @@
+/*
+ * Implementation of the per-job lifecycle event log.  The ring is a bounded
+ * multi-producer queue: each slot carries a sequence number which producers
+ * compare against the position they claim, so a slot is only written once the
+ * flusher has consumed its previous contents.
+ */
+
+#include <cstring>
+#include <chrono>
+
+#include "server/server.h"
+#include "server/event_log.h"
+
+static inline uint64_t now_ns(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return toNS(ts);
+}
+
+EventLog::EventLog()
+	: ring(NULL), head(0), tail(0), dropped(0), written(0), fp(NULL),
+		running(false)
+{
+	static_assert(!(EVENT_LOG_SIZE & (EVENT_LOG_SIZE - 1)),
+								"event log size must be a power of 2");
+}
+
+EventLog::~EventLog()
+{
+	close();
+}
+
+bool EventLog::open(const std::string& file)
+{
+	struct event_log_header header;
+
+	if(fp || !(fp = fopen(file.c_str(), "wb"))) return false;
+
+	memset(&header, 0, sizeof(struct event_log_header));
+	strncpy(header.magic, EVENT_LOG_MAGIC, sizeof(header.magic));
+	header.version = EVENT_LOG_VERSION;
+	header.event_size = sizeof(struct event);
+	header.realtime = now_ns(CLOCK_REALTIME);
+	header.monotonic = now_ns(CLOCK_MONOTONIC);
+	if(fwrite(&header, sizeof(struct event_log_header), 1, fp) != 1)
+	{
+		fclose(fp);
+		fp = NULL;
+		return false;
+	}
+
+	ring = new Cell[EVENT_LOG_SIZE];
+	for(size_t i = 0; i < EVENT_LOG_SIZE; i++)
+		ring[i].seq.store(i, std::memory_order_relaxed);
+	head.store(0, std::memory_order_relaxed);
+	tail = 0;
+	running.store(true);
+	flusher = std::thread(&EventLog::flush, this);
+	return true;
+}
+
+void EventLog::close()
+{
+	if(!fp) return;
+	running.store(false);
+	flusher.join();
+	fclose(fp);
+	fp = NULL;
+	delete [] ring;
+	ring = NULL;
+}
+
+void EventLog::record(enum event_type type, const Job* job,
+											const struct timespec& time, size_t queue)
+{
+	uint64_t pos = head.load(std::memory_order_relaxed), seq;
+	Cell* cell;
+
+	// Claim the slot at 'pos', unless the flusher hasn't consumed it yet
+	for(;;)
+	{
+		cell = &ring[pos & (EVENT_LOG_SIZE - 1)];
+		seq = cell->seq.load(std::memory_order_acquire);
+		if(seq == pos)
+		{
+			if(head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if(seq < pos)
+		{
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		else pos = head.load(std::memory_order_relaxed);
+	}
+
+	struct event& ev = cell->ev;
+	ev.time = toNS(time);
+	ev.pid = job->client;
+	ev.batch_index = job->batchIndex;
+	ev.type = type;
+	ev.queue = queue < EVENT_NO_QUEUE ? queue : EVENT_NO_QUEUE;
+	ev.kernel = job->features.kernel;
+	ev.platform = job->alloc.platform;
+	ev.device = job->alloc.device;
+	ev.compute_units = job->alloc.compute_units;
+	ev.reserved = 0;
+	cell->seq.store(pos + 1, std::memory_order_release);
+}
+
+/*
+ * Copy filled slots, oldest first, stopping at the first slot still being
+ * written.  Only called by the flusher thread.
+ */
+size_t EventLog::drain(struct event* buf, size_t max)
+{
+	size_t num;
+
+	for(num = 0; num < max; num++, tail++)
+	{
+		Cell& cell = ring[tail & (EVENT_LOG_SIZE - 1)];
+		if(cell.seq.load(std::memory_order_acquire) != tail + 1) break;
+		buf[num] = cell.ev;
+		cell.seq.store(tail + EVENT_LOG_SIZE, std::memory_order_release);
+	}
+	return num;
+}
+
+/*
+ * Flusher thread.  Periodically writes buffered events, & everything left
+ * once logging stops.
+ */
+void EventLog::flush()
+{
+	const size_t max = EVENT_LOG_SIZE / 4;
+	struct event* buf = new struct event[max];
+	size_t num;
+	bool stop;
+
+	do
+	{
+		stop = !running.load();
+		while((num = drain(buf, max)))
+			written += fwrite(buf, sizeof(struct event), num, fp);
+		fflush(fp);
+		if(!stop)
+			std::this_thread::sleep_for(
+				std::chrono::milliseconds(EVENT_LOG_FLUSH_MS));
+	} while(!stop);
+
+	delete [] buf;
+}
@@ -1,6 +1,11 @@
 #include <iostream>
+#include <cassert>
+#include <cmath>
 #include "server/server.h"
 
+/* Running jobs of all queues, by client PID */
+JobIndex HWQueue::runningByPID;
+
 ///////////////////////////////////////////////////////////////////////////////
 // HWQueue implementation
 ///////////////////////////////////////////////////////////////////////////////
@@ -14,10 +19,18 @@ void HWQueue::printConfiguration() const
 		<< (config->dynamicPartitioning ? "enabled" : "disabled")  << std::endl;
 }
 
-bool HWQueue::canRun(Job* job) const
+float HWQueue::work(const Job* job) const
+{
+	if(predSlot == NO_PREDICTION_SLOT) return 0.0f;
+	float prediction = job->predictions[predSlot];
+	if(!std::isfinite(prediction) || prediction <= 0.0f) return 0.0f;
+	return 1.0f / prediction;
+}
+
+bool HWQueue::canRun(const Job* job) const
 {	
 	// For now, check based on the max number allowed to run
-	if(runningJobs.size() < config->maxRunning)
+	if(!draining && !throttled && runningJobs.size() < config->maxRunning)
 		return true;
 	else
 		return false;
@@ -29,68 +42,96 @@ void HWQueue::running(Job* job)
 	job->alloc.platform = this->config->platform;
 	job->alloc.device = this->config->device;
 	job->alloc.compute_units = this->config->computeUnits;
+	job->work = work(job);
+	job->queue = this;
 	runningJobs.push_back(job);
+	runningByPID.insert(job);
 }
 
 void HWQueue::enqueue(Job* job)
 {
 	clock_gettime(CLOCK_MONOTONIC, &job->queued);
-	waitingJobs.push_back(job);
+	job->work = work(job);
+	job->queue = this;
+	waitingJobs.push(job);
+	stealIndex.insert(job, predSlot);
+	waitingTime += job->estimate;
+}
+
+void HWQueue::adopt(Job* job)
+{
+	job->queue->runningJobs.erase(job);
+	job->queue = this;
+	runningJobs.push_back(job);
 }
 
 bool HWQueue::isRunning(pid_t clientPID) const
 {
-	for(Job* job : runningJobs)
-		if(job->client == clientPID)
-			return true;
-	return false;
+	return runningByPID.find(clientPID, this) != NULL;
+}
+
+Job* HWQueue::findRunning(pid_t clientPID, const struct resource_alloc& alloc)
+{
+	return runningByPID.find(clientPID, alloc);
 }
 
 Job* HWQueue::finished(pid_t clientPID)
 {
-	Job* job;
-	std::vector<Job*>::iterator it;
-	for(it = runningJobs.begin(); it != runningJobs.end(); it++)
-		if((*it)->client == clientPID)
-			break;
-	if(it == runningJobs.end()) return NULL;
-	job = *it;
+	Job* job = runningByPID.find(clientPID, this);
+	if(!job) return NULL;
+	return finished(job);
+}
 
+Job* HWQueue::finished(Job* job)
+{
+	assert(job->queue == this && "job not running on this queue");
 	clock_gettime(CLOCK_MONOTONIC, &job->end);
-	runningJobs.erase(it);
+	runningByPID.erase(job);
+	runningJobs.erase(job);
+	job->queue = NULL;
 	return job;
 }
 
 Job* HWQueue::dequeue()
 {
-	Job* job = waitingJobs.front();
-	waitingJobs.erase(waitingJobs.begin());
+	Job* job = waitingJobs.pop();
+	if(!job) return NULL;
+	stealIndex.erase(job);
+	job->queue = NULL;
+	removedWork(job);
 	return job;
 }
 
 Job* HWQueue::remove(size_t num)
 {
-	if(num <= 0 || waitingJobs.size() <= num) return NULL;
+	Job* job = waitingJobs.at(num);
+	if(!job) return NULL;
+	return remove(job);
+}
 
-	Job* job = waitingJobs[num];
-	std::vector<Job*>::iterator it;
-	for(it = waitingJobs.begin(); num > 0; num--, it++);
-	waitingJobs.erase(it);
+Job* HWQueue::remove(Job* job)
+{
+	assert(job->queue == this && "job not waiting on this queue");
+	waitingJobs.erase(job);
+	stealIndex.erase(job);
+	job->queue = NULL;
+	removedWork(job);
 	return job;
 }
 
 void HWQueue::clear()
 {
-	while(!waitingJobs.empty())
-	{
-		delete waitingJobs.back();
-		waitingJobs.pop_back();
-	}
+	Job* job;
+
+	while((job = waitingJobs.pop()))
+		delete job;
+	stealIndex.clear();
+	waitingTime = 0.0;
 
-	while(!runningJobs.empty())
+	while((job = runningJobs.pop_front()))
 	{
-		delete runningJobs.back();
-		runningJobs.pop_back();
+		runningByPID.erase(job);
+		delete job;
 	}
 }
 
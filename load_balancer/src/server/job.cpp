@@ -1,15 +1,78 @@
 #include <assert.h>
+#include <atomic>
+#include <mutex>
 
 #include "message.h"
 #include "server/server.h"
 
+///////////////////////////////////////////////////////////////////////////////
+// Job pool
+///////////////////////////////////////////////////////////////////////////////
+
+/* Number of jobs allocated at once when the pool runs dry */
+#define JOB_SLAB_SIZE 64
+
+/* Unused job storage, linked through the storage itself */
+struct FreeJob {
+	FreeJob* next;
+};
+
+/*
+ * Jobs are created by the I/O thread & destroyed by the scheduler, so the free
+ * list is shared.  Slabs are never returned to the system.
+ */
+static std::mutex pool_lock;
+static FreeJob* free_jobs = NULL;
+
+void* Job::operator new(size_t size)
+{
+	std::lock_guard<std::mutex> lock(pool_lock);
+	assert(size == sizeof(Job) && "cannot pool derived jobs");
+
+	if(!free_jobs)
+	{
+		char* slab = (char*)::operator new(sizeof(Job) * JOB_SLAB_SIZE);
+		for(size_t i = 0; i < JOB_SLAB_SIZE; i++)
+		{
+			FreeJob* job = (FreeJob*)(slab + (i * sizeof(Job)));
+			job->next = free_jobs;
+			free_jobs = job;
+		}
+	}
+
+	FreeJob* job = free_jobs;
+	free_jobs = job->next;
+	return job;
+}
+
+void Job::operator delete(void* ptr)
+{
+	if(!ptr) return;
+	std::lock_guard<std::mutex> lock(pool_lock);
+	FreeJob* job = (FreeJob*)ptr;
+	job->next = free_jobs;
+	free_jobs = job;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Job implementation
 ///////////////////////////////////////////////////////////////////////////////
 
+/* Arrival order of jobs, created by both the I/O & scheduler threads */
+static std::atomic<uint64_t> arrivals(0);
+
 Job::Job(struct connection conn) :
-	fd(conn.fd), client(conn.msg.sender_pid), predictions(prediction_slots)
+	fd(conn.fd), client(conn.msg.sender_pid), batchIndex(0), batchSize(1),
+	priority(AIRA_PRIORITY_NORMAL), deadline(0),
+	order(arrivals.fetch_add(1, std::memory_order_relaxed)),
+	predictions(prediction_slots), predicted(false), work(0.0f),
+	estimate(0.0f), energy(0.0f), slowdown(0.0f), queue(NULL), prev(NULL),
+	next(NULL), nextByPID(NULL), heapIndex(0)
 {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	arrival = toNS(now);
+
 	memset(&queued, 0, sizeof(struct timespec));
 	memset(&start, 0, sizeof(struct timespec));
 	memset(&end, 0, sizeof(struct timespec));
@@ -18,12 +81,29 @@ Job::Job(struct connection conn) :
 		memset(&features, 0, sizeof(struct kernel_features));
 		memcpy(&alloc, &conn.msg.body.alloc, sizeof(struct resource_alloc));
 	}
-	else if(conn.msg.type == HW_REQUEST)
+	else if(conn.msg.type == HW_REQUEST || conn.msg.type == HW_REQUEST_CLASS)
+	{
+		memcpy(&features, &conn.msg.body.features, sizeof(struct kernel_features));
+		memset(&alloc, 0, sizeof(struct resource_alloc));
+	}
+	else if(conn.msg.type == HW_REQUEST_BATCH)
 	{
 		memcpy(&features, &conn.msg.body.features, sizeof(struct kernel_features));
 		memset(&alloc, 0, sizeof(struct resource_alloc));
+		batchIndex = conn.msg.ext.batch_index;
+		batchSize = conn.msg.ext.batch_count;
 	}
 	else
 		assert(false && "Shouldn't be in here!");
+
+	// Plain HW_REQUESTs, e.g., from clients which don't know about priority
+	// classes, are in the default class
+	if(conn.msg.type == HW_REQUEST_CLASS || conn.msg.type == HW_REQUEST_BATCH)
+	{
+		if(conn.msg.ext.rclass.priority < AIRA_NUM_PRIORITIES)
+			priority = conn.msg.ext.rclass.priority;
+		if(conn.msg.ext.rclass.deadline_us)
+			deadline = arrival + conn.msg.ext.rclass.deadline_us * 1000UL;
+	}
 }
 
@@ -0,0 +1,304 @@
+/*
+ * Implementation of dynamic CPU device partitioning.
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cassert>
+
+#include "server/server.h"
+#include "server/util.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Helpers
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Return whether or not the OpenCL runtime can split the device into
+ * sub-devices with the specified number of compute units.
+ */
+static bool can_fission(size_t platform, size_t device, size_t units)
+{
+	if(!cl_rt) return true; // No runtime (e.g. simulation), trust the config
+	if(get_device_type(cl_rt, platform, device) != CL_DEVICE_TYPE_CPU ||
+		 units > get_num_compute_units(cl_rt, platform, device))
+		return false;
+
+	// Sub-devices are cached by the runtime, so this also warms it up
+	cl_device_id sub = get_subdevice(cl_rt, platform, device, units);
+	return sub != get_device(cl_rt, platform, device);
+}
+
+/*
+ * Sum the predicted runtime (inverse of predicted performance) of a job on
+ * each of the prediction slots.  Slots without a usable prediction (e.g.
+ * missing training data) are treated as infinitely slow.
+ */
+static inline void add_times(const Job* job, const size_t* slots, size_t num,
+														 float* times)
+{
+	for(size_t i = 0; i < num; i++)
+	{
+		float prediction = job->predictions[slots[i]];
+		if(std::isfinite(prediction) && prediction > 0.0f)
+			times[i] += 1.0f / prediction;
+		else
+			times[i] = INFINITY;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PartitionedDevice implementation
+///////////////////////////////////////////////////////////////////////////////
+
+PartitionedDevice::PartitionedDevice(size_t p_platform,
+																		 size_t p_device,
+																		 size_t p_computeUnits,
+																		 size_t p_maxRunning,
+																		 size_t p_partitions)
+	: plat(p_platform), dev(p_device), units(p_computeUnits),
+		maxRunning(p_maxRunning), numAllowed(0), current(p_partitions),
+		target(p_partitions), proposal(p_partitions), streak(0)
+{
+	lastChange.tv_sec = 0;
+	lastChange.tv_nsec = 0;
+}
+
+/*
+ * Find devices with dynamic partitioning enabled.  All of a device's queues
+ * must be the same size, and the device can be split into any number of
+ * partitions for which the system has a prediction slot.
+ */
+std::vector<PartitionedDevice*> PartitionedDevice::discover()
+{
+	std::vector<PartitionedDevice*> devices;
+
+	for(size_t i = 0; i < queues.size(); i++)
+	{
+		if(!queues[i]->canPartition()) continue;
+
+		bool found = false;
+		for(PartitionedDevice* device : devices)
+			if(device->owns(queues[i])) found = true;
+		if(found) continue;
+
+		size_t num = 0;
+		bool uniform = true;
+		for(size_t j = i; j < queues.size(); j++)
+		{
+			if(queues[j]->platform() != queues[i]->platform() ||
+				 queues[j]->device() != queues[i]->device()) continue;
+			num++;
+			if(queues[j]->computeUnits() != queues[i]->computeUnits())
+				uniform = false;
+		}
+		if(!uniform)
+		{
+			fprintf(stderr, "Warning: partitions of %lu/%lu differ in size, "
+							"disabling dynamic partitioning\n",
+							queues[i]->platform(), queues[i]->device());
+			continue;
+		}
+
+		// The current partitioning must be valid, or the server couldn't have
+		// made predictions for its queues
+		size_t total = queues[i]->computeUnits() * num;
+		PartitionedDevice* device = new PartitionedDevice(queues[i]->platform(),
+			queues[i]->device(), total, queues[i]->maxRunning(), num);
+		if(!device->allow(num))
+		{
+			delete device;
+			continue;
+		}
+		for(size_t n = 1; n <= total; n++)
+			if(n != num && queues.size() - num + n <= MAX_QUEUES)
+				device->allow(n);
+
+		if(device->numPartitionings() > 1) devices.push_back(device);
+		else delete device;
+	}
+
+	return devices;
+}
+
+void PartitionedDevice::printConfiguration() const
+{
+	std::cout << "  " << plat << "/" << dev << ": " << units
+		<< " compute unit(s), dynamically partitioned into";
+	for(size_t i = 0; i < numAllowed; i++)
+		std::cout << (i ? ", " : " ") << allowed[i];
+	std::cout << " partition(s), currently " << current << std::endl;
+}
+
+/*
+ * Allow the device to be split into the specified number of partitions.  The
+ * partitions must evenly divide the device, have a prediction slot & be
+ * supported by the OpenCL runtime.
+ */
+bool PartitionedDevice::allow(size_t partitions)
+{
+	if(numAllowed == MAX_PARTITIONINGS || !partitions || units % partitions)
+		return false;
+
+	size_t s, subUnits = units / partitions;
+	for(s = 0; s < prediction_slots; s++)
+		if(system_devices[s].platform == plat &&
+			 system_devices[s].device == dev &&
+			 system_devices[s].compute_units == subUnits)
+			break;
+	if(s == prediction_slots) return false;
+	if(partitions > 1 && !can_fission(plat, dev, subUnits)) return false;
+
+	allowed[numAllowed] = partitions;
+	slots[numAllowed] = s;
+	numAllowed++;
+	return true;
+}
+
+bool PartitionedDevice::owns(const HWQueue* queue) const
+{
+	return queue->platform() == plat && queue->device() == dev;
+}
+
+bool PartitionedDevice::idle() const
+{
+	for(HWQueue* queue : queues)
+		if(owns(queue) && queue->numRunning()) return false;
+	return true;
+}
+
+size_t PartitionedDevice::slot(size_t partitions) const
+{
+	for(size_t i = 0; i < numAllowed; i++)
+		if(allowed[i] == partitions) return i;
+	assert(false && "partitioning not allowed");
+	return 0;
+}
+
+/*
+ * Sum the predicted runtime of the device's running jobs & first
+ * PARTITION_WINDOW waiting jobs under each allowed partitioning.
+ */
+static size_t sample(const PartitionedDevice* device, const size_t* slots,
+										 size_t numSlots, float* times)
+{
+	size_t num = 0, waiting = 0;
+	const Job* job;
+
+	for(size_t i = 0; i < numSlots; i++) times[i] = 0.0f;
+	for(HWQueue* queue : queues)
+	{
+		if(!device->owns(queue)) continue;
+		for(job = queue->firstRunning(); job; job = JobList::next(job), num++)
+			add_times(job, slots, numSlots, times);
+		for(size_t i = 0; (job = queue->queued(i)) && waiting < PARTITION_WINDOW;
+				i++, num++, waiting++)
+			add_times(job, slots, numSlots, times);
+	}
+	return num;
+}
+
+/*
+ * Predicted throughput, in jobs per unit of predicted runtime.  Partitions run
+ * jobs concurrently, but each job runs on fewer compute units.
+ */
+float PartitionedDevice::throughput(size_t partitions) const
+{
+	float times[MAX_PARTITIONINGS];
+	size_t i = slot(partitions);
+	size_t num = sample(this, slots, numAllowed, times);
+	if(!num) return 0.0f;
+	size_t concurrent = std::min(partitions * maxRunning, num);
+	return (float)concurrent * (float)num / times[i];
+}
+
+bool PartitionedDevice::evaluate(const struct timespec& now)
+{
+	float times[MAX_PARTITIONINGS];
+	size_t i, num, cur, best = current;
+
+	if(numAllowed < 2) return false;
+	cur = slot(current);
+	if(!(num = sample(this, slots, numAllowed, times))) return false;
+
+	// Find the partitioning with the best throughput, if it's sufficiently
+	// better than the current partitioning
+	float thr, bestThr = (1.0f + PARTITION_MIN_GAIN) *
+		(float)std::min(current * maxRunning, num) * (float)num / times[cur];
+	for(i = 0; i < numAllowed; i++)
+	{
+		if(allowed[i] == current) continue;
+		thr = (float)std::min(allowed[i] * maxRunning, num) * (float)num /
+					times[i];
+		if(thr > bestThr)
+		{
+			best = allowed[i];
+			bestThr = thr;
+		}
+	}
+
+	// Only change target once enough decisions agree, & don't repartition too
+	// often (cancelling a pending change is always allowed)
+	if(best == proposal) streak++;
+	else
+	{
+		proposal = best;
+		streak = 1;
+	}
+	if(streak < PARTITION_HYSTERESIS || proposal == target) return false;
+	if(proposal != current &&
+		 (toNS(now) - toNS(lastChange)) / 1000000 < PARTITION_MIN_INTERVAL_MS)
+		return false;
+
+	target = proposal;
+	return true;
+}
+
+void PartitionedDevice::apply(const struct timespec& now,
+															std::vector<Job*>& waiting)
+{
+	std::vector<HWQueue*> kept;
+	size_t i, pos = queues.size();
+	Job* job;
+
+	assert(idle() && "cannot repartition a device with running jobs");
+
+	// Remove the old partitions, keeping their waiting jobs
+	waiting.clear();
+	for(HWQueue* queue : queues)
+	{
+		if(owns(queue))
+		{
+			if(pos == queues.size()) pos = kept.size();
+			while((job = queue->dequeue())) waiting.push_back(job);
+			delete queue;
+		}
+		else kept.push_back(queue);
+	}
+	if(pos > kept.size()) pos = kept.size();
+	std::stable_sort(waiting.begin(), waiting.end(),
+		[](const Job* a, const Job* b)
+		{ return a->queuedTime() < b->queuedTime(); });
+
+	// Add the new partitions where the old ones were
+	for(i = 0; i < target; i++)
+	{
+		HWQueueConfig* config = new HWQueueConfig();
+		config->platform = plat;
+		config->device = dev;
+		config->computeUnits = units / target;
+		config->maxRunning = maxRunning;
+		config->dynamicPartitioning = true;
+		kept.insert(kept.begin() + pos + i, new CPUQueue(config));
+	}
+
+	queues.swap(kept);
+	for(i = 0; i < queues.size(); i++)
+		queues[i]->setIndex(i);
+	utility::build_slot_tables();
+
+	current = proposal = target;
+	streak = 0;
+	lastChange = now;
+}
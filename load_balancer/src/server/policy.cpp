@@ -0,0 +1,322 @@
+/*
+ * Implementation of resource allocation policies.
+ */
+
+#include <cmath>
+#include <algorithm>
+
+#include "server/server.h"
+#include "server/util.h"
+#include "server/policy.h"
+
+const char* policyNames[] = {
+#define X(a, b) b,
+POLICIES
+#undef X
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Policy implementation
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Jobs in a more urgent class, or with an earlier deadline, are stolen ahead
+ * of the queue's own waiting jobs.  Otherwise, as when all jobs are in the
+ * same class without deadlines, the queue's own jobs run first.
+ */
+Job* Policy::next(size_t q)
+{
+	Job* own = queues[q]->firstQueued(), *best = NULL, *cand;
+	size_t from = q;
+
+	if(!own) return steal(q);
+
+	// Search for more urgent jobs in other queues.  Note: this searches each
+	// queue for its most urgent job within the performance threshold, as the
+	// queue has jobs of its own to run.
+	auto stealable = [q](const Job* job) {
+		size_t i = job->queue->index();
+		return utility::within_threshold(utility::get_prediction((Job*)job, i),
+																		 utility::get_prediction((Job*)job, q));
+	};
+	for(size_t i = 0; i < queues.size(); i++)
+	{
+		if(i == q || !queues[i]->numQueued()) continue;
+		if(!JobHeap::urgent(queues[i]->firstQueued(), own)) continue;
+		if(best && !JobHeap::urgent(queues[i]->firstQueued(), best)) continue;
+		cand = queues[i]->waiting().find(stealable);
+		if(!cand || !JobHeap::urgent(cand, own)) continue;
+		if(!best || JobHeap::urgent(cand, best))
+		{
+			best = cand;
+			from = i;
+		}
+	}
+
+	if(!best) return queues[q]->dequeue();
+	queues[from]->remove(best);
+	best->slowdown = StealIndex::slowdown(best, queues[from]->slot(),
+																				queues[q]->slot());
+	return best;
+}
+
+/*
+ * Each queue's steal index has the job which slows down least on top, so this
+ * only looks at one job per queue & class.
+ */
+Job* Policy::steal(size_t q)
+{
+	size_t slot = queues[q]->slot(), from = q;
+	float slowdown, least = INFINITY;
+	Job* best = NULL, *cand;
+
+	if(slot == NO_PREDICTION_SLOT) return NULL;
+	for(unsigned rank = 0; rank < AIRA_NUM_PRIORITIES && !best; rank++)
+	{
+		for(size_t i = 0; i < queues.size(); i++)
+		{
+			if(i == q || !(cand = queues[i]->leastSlowdown(slot, rank, slowdown)))
+				continue;
+			if(slowdown < least && utility::within_threshold(slowdown, 1.0f))
+			{
+				best = cand;
+				least = slowdown;
+				from = i;
+			}
+		}
+	}
+
+	if(!best) return NULL;
+	queues[from]->remove(best);
+	best->slowdown = least;
+	return best;
+}
+
+float Policy::completion(const Job* job, size_t q, unsigned long now) const
+{
+	return queues[q]->canRun(job) ? runtime(job, q) : INFINITY;
+}
+
+/*
+ * Queues without a usable prediction for the job are only considered if the
+ * job was a candidate for them anyway.
+ */
+size_t Policy::expedite(Job* job, size_t q, const Candidates& candidates,
+												unsigned long now)
+{
+	if(!job->deadline) return q;
+
+	float time, bestTime = completion(job, q, now);
+	size_t best = q;
+	if(job->deadline > now && bestTime <= (float)(job->deadline - now))
+		return q;
+
+	for(size_t i = 0; i < queues.size(); i++)
+	{
+		if(queues[i]->work(job) <= 0.0f &&
+			 std::find(candidates.begin(), candidates.end(), i) == candidates.end())
+			continue;
+		if((time = completion(job, i, now)) < bestTime)
+		{
+			best = i;
+			bestTime = time;
+		}
+	}
+
+	if(best != q) job->estimate = runtime(job, best);
+	return best;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// FirstFitPolicy implementation
+///////////////////////////////////////////////////////////////////////////////
+
+size_t FirstFitPolicy::place(Job* job, const Candidates& candidates,
+														 unsigned long now)
+{
+	/*
+	 * 1. Check if our preferred architecture (or one within a suitable
+	 *    performance threshold) is available.  If so, start running.
+	 */
+	for(size_t candidate : candidates)
+		if(queues[candidate]->canRun(job))
+			return candidate;
+
+	/*
+	 * 2. If no candidates can run the job, enqueue on our preferred architecture.
+	 *    If there are multiple copies of our preferred architecture, choose the
+	 *    one with the shortest run-queue length.
+	 */
+	size_t shortest = candidates[0];
+	size_t shortestLength = queues[shortest]->numQueued();
+	for(size_t i = 1; i < candidates.size(); i++)
+	{
+		if(!utility::same_device(candidates[0], candidates[i])) break;
+		if(queues[candidates[i]]->numQueued() < shortestLength)
+		{
+			shortest = candidates[i];
+			shortestLength = queues[candidates[i]]->numQueued();
+		}
+	}
+	return shortest;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ShortestCompletionPolicy implementation
+///////////////////////////////////////////////////////////////////////////////
+
+ShortestCompletionPolicy::ShortestCompletionPolicy()
+{
+	for(size_t i = 0; i <= POLICY_SCALES; i++)
+		scales[i] = POLICY_INITIAL_SCALE;
+}
+
+size_t ShortestCompletionPolicy::scaleIndex(const Job* job)
+{
+	if(0 <= job->features.kernel && job->features.kernel < POLICY_SCALES)
+		return job->features.kernel;
+	return POLICY_SCALES;
+}
+
+/*
+ * Queues without a usable prediction for the job are never chosen, unless
+ * there's no other option.
+ */
+size_t ShortestCompletionPolicy::place(Job* job, const Candidates& candidates,
+																			 unsigned long now)
+{
+	size_t q, best = candidates[0];
+	float work, minWork = INFINITY, time, bestTime = INFINITY;
+	float scale = scales[scaleIndex(job)];
+
+	for(q = 0; q < queues.size(); q++)
+		if((work = queues[q]->work(job)) > 0.0f) minWork = std::min(minWork, work);
+
+	for(q = 0; q < queues.size(); q++)
+	{
+		if((work = queues[q]->work(job)) <= 0.0f) continue;
+		time = completion(job, q, now) + scale * (work - minWork);
+		if(time < bestTime)
+		{
+			best = q;
+			bestTime = time;
+		}
+	}
+
+	job->estimate = scale * queues[best]->work(job);
+	return best;
+}
+
+float ShortestCompletionPolicy::runtime(const Job* job, size_t q) const
+{
+	return scales[scaleIndex(job)] * queues[q]->work(job);
+}
+
+/*
+ * A job starts immediately if the queue has a free slot.  Otherwise it waits
+ * for the queue's backlog, i.e. the remaining runtime of running jobs plus the
+ * estimated runtime of waiting jobs, spread across the queue's slots.
+ */
+float ShortestCompletionPolicy::completion(const Job* job, size_t q,
+																					 unsigned long now) const
+{
+	const HWQueue* queue = queues[q];
+	float time = runtime(job, q);
+	if(queue->canRun(job)) return time;
+
+	float backlog = (float)queue->queuedEstimate(), elapsed;
+	for(const Job* cur = queue->firstRunning(); cur; cur = JobList::next(cur))
+	{
+		elapsed = (float)(now - cur->startTime());
+		backlog += std::max(scales[scaleIndex(cur)] * cur->work - elapsed, 0.0f);
+	}
+	return backlog / queue->maxRunning() + time;
+}
+
+void ShortestCompletionPolicy::finished(const Job* job)
+{
+	if(job->work <= 0.0f || job->endTime() <= job->startTime()) return;
+	float sample = (float)(job->endTime() - job->startTime()) / job->work;
+	float& scale = scales[scaleIndex(job)];
+	scale += POLICY_SCALE_WEIGHT * (sample - scale);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// MinEDPPolicy implementation
+///////////////////////////////////////////////////////////////////////////////
+
+MinEDPPolicy::MinEDPPolicy()
+{
+	for(size_t i = 0; i <= POLICY_SCALES; i++)
+		for(size_t s = 0; s < MAX_PREDICTION_SLOTS; s++)
+			joules[i][s] = 0.0f;
+	for(size_t s = 0; s < MAX_PREDICTION_SLOTS; s++)
+		watts[s] = 0.0f;
+}
+
+/*
+ * As for shortest-completion, running a job on a slower device than necessary
+ * is charged for the capacity it takes away from later jobs.
+ */
+size_t MinEDPPolicy::place(Job* job, const Candidates& candidates,
+													 unsigned long now)
+{
+	size_t q, s, measured = 0, best = candidates[0];
+	float work, minWork = INFINITY, time, edp, bestEDP = INFINITY;
+	float scale = scales[scaleIndex(job)], fallback = 0.0f;
+
+	for(s = 0; s < prediction_slots; s++)
+	{
+		if(watts[s] <= 0.0f) continue;
+		fallback += watts[s];
+		measured++;
+	}
+	fallback = measured ? fallback / measured : 1.0f;
+
+	for(q = 0; q < queues.size(); q++)
+		if((work = queues[q]->work(job)) > 0.0f) minWork = std::min(minWork, work);
+
+	for(q = 0; q < queues.size(); q++)
+	{
+		if((work = queues[q]->work(job)) <= 0.0f) continue;
+		time = completion(job, q, now) + scale * (work - minWork);
+		edp = energy(job, q, fallback) * time;
+		if(edp < bestEDP)
+		{
+			best = q;
+			bestEDP = edp;
+		}
+	}
+
+	job->estimate = scale * queues[best]->work(job);
+	return best;
+}
+
+float MinEDPPolicy::energy(const Job* job, size_t q, float fallback) const
+{
+	size_t slot = queues[q]->slot();
+	float work = queues[q]->work(job);
+	if(slot == NO_PREDICTION_SLOT || work <= 0.0f) return 0.0f;
+	if(joules[scaleIndex(job)][slot] > 0.0f) return joules[scaleIndex(job)][slot];
+
+	float power = watts[slot] > 0.0f ? watts[slot] : fallback;
+	return power * scales[scaleIndex(job)] * work / 1e9f;
+}
+
+void MinEDPPolicy::finished(const Job* job)
+{
+	ShortestCompletionPolicy::finished(job);
+
+	size_t slot = utility::alloc_to_slot(job->alloc);
+	if(slot == NO_PREDICTION_SLOT || job->energy <= 0.0f ||
+		 job->endTime() <= job->startTime())
+		return;
+
+	float& energy = joules[scaleIndex(job)][slot];
+	float& power = watts[slot];
+	float sample = job->energy * 1e9f / (job->endTime() - job->startTime());
+	energy = energy > 0.0f ?
+		energy + POLICY_ENERGY_WEIGHT * (job->energy - energy) : job->energy;
+	power = power > 0.0f ?
+		power + POLICY_ENERGY_WEIGHT * (sample - power) : sample;
+}
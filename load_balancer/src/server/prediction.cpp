@@ -1,4 +1,6 @@
 #include <iostream>
+#include <string>
+#include <stdexcept>
 
 /* Heterogeneous load-balancer */
 #include "server/server.h"
@@ -13,7 +15,7 @@
 
 /* Set CPU predictions so they appear significantly faster than GPU */
 void AlwaysCPU::predict(struct kernel_features& feats,
-												std::vector<float>& predictions)
+												Predictions& predictions)
 {
 	for(size_t i = 0; i < predictions.size(); i++)
 	{
@@ -30,7 +32,7 @@ void AlwaysCPU::predict(struct kernel_features& feats,
 
 /* Set GPU predictions so they appear significantly faster than CPU */
 void AlwaysGPU::predict(struct kernel_features& feats,
-												std::vector<float>& predictions)
+												Predictions& predictions)
 {
 	for(size_t i = 0; i < predictions.size(); i++)
 	{
@@ -47,7 +49,7 @@ void AlwaysGPU::predict(struct kernel_features& feats,
 
 /* Return exact runtime based on static training data */
 void ExactRuntime::predict(struct kernel_features& feats,
-													 std::vector<float>& predictions)
+													 Predictions& predictions)
 {
 	for(size_t i = 0; i < predictions.size(); i++) {
 		if(i != default_cpu)
@@ -70,7 +72,7 @@ void ExactRuntime::predict(struct kernel_features& feats,
 
 /* Return exact energy consumption based on static training data */
 void ExactEnergy::predict(struct kernel_features& feats,
-													std::vector<float>& predictions)
+													Predictions& predictions)
 {
 	for(size_t i = 0; i < predictions.size(); i++) {
 		if(i != default_cpu)
@@ -93,7 +95,7 @@ void ExactEnergy::predict(struct kernel_features& feats,
 
 /* Return exact energy consumption based on static training data */
 void ExactEDP::predict(struct kernel_features& feats,
-											 std::vector<float>& predictions)
+											 Predictions& predictions)
 {
 	float defaultEDP = runtime[default_cpu][feats.kernel] *
 										 energy[default_cpu][feats.kernel];
@@ -121,16 +123,26 @@ void ExactEDP::predict(struct kernel_features& feats,
 /* Constructor */
 NeuralNetPredictor::NeuralNetPredictor(std::string& modelFN,
 																			 std::string& transFN,
-																			 int numDevices)
-	: Predictor(numDevices), numInputs(NUM_FEATURES)
+																			 const ModelOutputs& p_layout)
+	: Predictor(p_layout.slots.size()), numInputs(NUM_FEATURES),
+		layout(p_layout)
 {
 	model.load(modelFN);
 	trans.load(transFN);
+
+	// Evaluate the model once, predict() doesn't check its number of outputs
+	Row32F probe(numInputs);
+	size_t num = model.predict(trans.apply(probe)).cols();
+	for(int i = 0; i < numDevices; i++)
+		if(layout.slots[i] == NO_MODEL_OUTPUT || layout.slots[i] >= num)
+			throw std::runtime_error("model has " + std::to_string(num) +
+															 " output(s), none for prediction slot " +
+															 std::to_string(i));
 }
 
 /* Make performance prediction using ML model */
 void NeuralNetPredictor::predict(struct kernel_features& feats,
-																 std::vector<float>& predictions)
+																 Predictions& predictions)
 {
 	// 1. Populate input vector
 	Row32F inputs(numInputs);
@@ -145,7 +157,8 @@ void NeuralNetPredictor::predict(struct kernel_features& feats,
 
 	// 4. Copy predictions to buffer
 	for(int i = 0; i < numDevices; i++)
-		predictions[i] = ((outputs.at(i) * (rt_max - rt_min)) + rt_min) + rt_mean;
+		predictions[i] = ((outputs.at(layout.slots[i]) * (layout.max - layout.min)) +
+											layout.min) + layout.mean;
 
 #ifdef _SERVER_VERBOSE
 	std::cout << "NN predictions:" << std::fixed << predictions[0];
@@ -0,0 +1,207 @@
+/*
+ * Implementation of the prediction cache.  Entries live in a fixed array &
+ * are indexed by a linear-probing hash table at most half full, which uses
+ * backward-shift deletion so there are no tombstones.
+ */
+
+#include <cmath>
+#include <cstring>
+
+#include "server/server.h"
+#include "server/prediction_cache.h"
+
+/* Empty hash table bucket & end of the LRU list */
+#define NONE UINT32_MAX
+
+/* Quantized value of 0 (& NaN), never produced for other values */
+#define ZERO INT64_MIN
+
+/* 64-bit mixing function (MurmurHash3 finalizer) */
+static inline uint64_t mix(uint64_t hash, uint64_t val)
+{
+	hash ^= val;
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+bool PredictionCache::Key::operator==(const Key& rhs) const
+{
+	return kernel == rhs.kernel && !memcmp(feature, rhs.feature, sizeof(feature));
+}
+
+PredictionCache::PredictionCache(size_t capacity, double tolerance)
+	: tol(tolerance), logStep(log1p(tolerance)), entries(capacity), mask(0),
+		used(0), head(NONE), tail(NONE), hits(0), misses(0), evictions(0)
+{
+	size_t buckets = 1;
+	while(buckets < 2 * capacity) buckets <<= 1;
+	table.assign(buckets, NONE);
+	mask = buckets - 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Public API
+///////////////////////////////////////////////////////////////////////////////
+
+bool PredictionCache::lookup(const struct kernel_features& feats,
+														 Predictions& predictions)
+{
+	Key key;
+	uint64_t hash;
+
+	if(entries.empty()) return false;
+	makeKey(feats, key, hash);
+
+	std::lock_guard<std::mutex> guard(lock);
+	size_t bucket = find(key, hash);
+	if(table[bucket] == NONE)
+	{
+		misses++;
+		return false;
+	}
+
+	uint32_t entry = table[bucket];
+	predictions = entries[entry].predictions;
+	unlink(entry);
+	pushFront(entry);
+	hits++;
+	return true;
+}
+
+/*
+ * Two threads may miss on the same features & both insert, in which case the
+ * second refreshes the first's entry.
+ */
+void PredictionCache::insert(const struct kernel_features& feats,
+														 const Predictions& predictions)
+{
+	Key key;
+	uint64_t hash;
+	uint32_t entry;
+
+	if(entries.empty()) return;
+	makeKey(feats, key, hash);
+
+	std::lock_guard<std::mutex> guard(lock);
+	size_t bucket = find(key, hash);
+	if(table[bucket] != NONE)
+	{
+		entry = table[bucket];
+		unlink(entry);
+	}
+	else
+	{
+		// Unused entries are always at the end, so reuse the LRU entry if full
+		if(used == entries.size())
+		{
+			entry = tail;
+			remove(find(entries[entry].key, entries[entry].hash));
+			unlink(entry);
+			evictions++;
+			bucket = find(key, hash);
+		}
+		else entry = used++;
+		table[bucket] = entry;
+		entries[entry].key = key;
+		entries[entry].hash = hash;
+	}
+	entries[entry].predictions = predictions;
+	pushFront(entry);
+}
+
+void PredictionCache::clear()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	table.assign(table.size(), NONE);
+	used = 0;
+	head = tail = NONE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Internals
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Exact keys use the features' bit patterns, otherwise features are replaced
+ * by the index of their logarithmic bucket, with the sign in the low bit.
+ */
+void PredictionCache::makeKey(const struct kernel_features& feats, Key& key,
+															uint64_t& hash) const
+{
+	hash = mix(0, (uint64_t)feats.kernel);
+	key.kernel = feats.kernel;
+	for(size_t i = 0; i < NUM_FEATURES; i++)
+	{
+		double val = feats.feature[i];
+		if(val == 0.0) val = 0.0; // -0.0 matches 0.0
+		if(tol <= 0.0) memcpy(&key.feature[i], &val, sizeof(double));
+		else if(val == 0.0 || std::isnan(val)) key.feature[i] = ZERO;
+		else
+		{
+			int64_t bucket = (int64_t)floor(log(fabs(val)) / logStep);
+			key.feature[i] = bucket * 2 + (val < 0.0 ? 1 : 0);
+		}
+		hash = mix(hash, (uint64_t)key.feature[i]);
+	}
+}
+
+/* Returns the key's bucket, or the empty bucket where it would go */
+size_t PredictionCache::find(const Key& key, uint64_t hash) const
+{
+	size_t bucket = hash & mask;
+	while(table[bucket] != NONE)
+	{
+		const Entry& entry = entries[table[bucket]];
+		if(entry.hash == hash && entry.key == key) break;
+		bucket = (bucket + 1) & mask;
+	}
+	return bucket;
+}
+
+/*
+ * Empty a bucket, shifting later entries of the same probe sequence back so
+ * lookups never stop early.
+ */
+void PredictionCache::remove(size_t bucket)
+{
+	size_t cur = bucket, home;
+
+	table[bucket] = NONE;
+	while(true)
+	{
+		cur = (cur + 1) & mask;
+		if(table[cur] == NONE) return;
+		home = entries[table[cur]].hash & mask;
+
+		// Entries whose home is cyclically in (bucket, cur] stay put
+		if(bucket <= cur ? (bucket < home && home <= cur)
+										 : (bucket < home || home <= cur))
+			continue;
+		table[bucket] = table[cur];
+		table[cur] = NONE;
+		bucket = cur;
+	}
+}
+
+void PredictionCache::unlink(uint32_t entry)
+{
+	Entry& cur = entries[entry];
+	if(cur.prev != NONE) entries[cur.prev].next = cur.next;
+	else head = cur.next;
+	if(cur.next != NONE) entries[cur.next].prev = cur.prev;
+	else tail = cur.prev;
+}
+
+void PredictionCache::pushFront(uint32_t entry)
+{
+	Entry& cur = entries[entry];
+	cur.prev = NONE;
+	cur.next = head;
+	if(head != NONE) entries[head].prev = entry;
+	else tail = entry;
+	head = entry;
+}
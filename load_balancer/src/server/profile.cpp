@@ -0,0 +1,467 @@
+/*
+ * Implementation of runtime system profiling.
+ */
+
+#include <cmath>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <ctime>
+
+#include "server/server.h"
+#include "server/profile.h"
+
+static_assert(SYSTEM_MAX_SLOTS <= MAX_PREDICTION_SLOTS,
+							"system tables have more slots than jobs have predictions");
+
+/* 64-bit FNV-1a */
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+static inline uint64_t fnv1a(uint64_t hash, const void* data, size_t size)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for(size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Micro-kernels
+///////////////////////////////////////////////////////////////////////////////
+
+#define STRINGIFY( x ) #x
+#define TO_STRING( x ) STRINGIFY(x)
+
+/* Four dependent multiply-adds per iteration, i.e. 8 flops */
+#define COMPUTE_FLOPS 8.0
+
+/* Triad reads two & writes one float per item */
+#define STREAM_BYTES 12.0
+
+static const char* source =
+"__kernel void compute(__global float* out, float x)\n"
+"{\n"
+"	size_t i = get_global_id(0);\n"
+"	float a = i, b = a + 1.0f, c = a + 2.0f, d = a + 3.0f;\n"
+"	for(int j = 0; j < " TO_STRING(PROFILE_COMPUTE_ITERS) "; j++)\n"
+"	{\n"
+"		a = mad(a, x, b);\n"
+"		b = mad(b, x, c);\n"
+"		c = mad(c, x, d);\n"
+"		d = mad(d, x, a);\n"
+"	}\n"
+"	out[i] = a + b + c + d;\n"
+"}\n"
+"\n"
+"__kernel void stream(__global float* a, __global const float* b,\n"
+"                     __global const float* c, float s)\n"
+"{\n"
+"	size_t i = get_global_id(0);\n"
+"	a[i] = b[i] + s * c[i];\n"
+"}\n"
+"\n"
+"__kernel void launch(__global float* out) {}\n";
+
+/*
+ * Time a kernel, keeping the fastest of several repetitions.  Each repetition
+ * enqueues the kernel 'launches' times, waiting for it after each launch if
+ * 'wait' is set.  The first launch is not timed as it may include lazy
+ * initialization.
+ *
+ * @return seconds per launch, or a negative value if the kernel failed
+ */
+static double time_kernel(cl_command_queue queue, cl_kernel kernel,
+													size_t items, size_t launches, bool wait)
+{
+	struct timespec start, end;
+	double best = INFINITY, elapsed;
+	size_t rep, i;
+
+	if(clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &items, NULL, 0, NULL,
+														NULL) != CL_SUCCESS || clFinish(queue) != CL_SUCCESS)
+		return -1.0;
+
+	for(rep = 0; rep < PROFILE_REPS; rep++)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for(i = 0; i < launches; i++)
+		{
+			if(clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &items, NULL, 0, NULL,
+																NULL) != CL_SUCCESS)
+				return -1.0;
+			if(wait && clFinish(queue) != CL_SUCCESS) return -1.0;
+		}
+		if(clFinish(queue) != CL_SUCCESS) return -1.0;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		elapsed = (double)(toNS(end) - toNS(start)) / 1e9 / launches;
+		if(elapsed < best) best = elapsed;
+	}
+
+	// Guard against timers too coarse for the kernel
+	return best > 1e-9 ? best : 1e-9;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// NPB characterization
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Coarse characterization of the NPB benchmarks: data moved by class S (GB),
+ * arithmetic intensity (flops per byte) & kernel launches per run.  Classes
+ * grow the data moved but not the number of launches.  These are hand-picked
+ * guesses at each benchmark's character, not measurements -- they only need
+ * to rank slots sensibly.  Replace them with measured values (e.g. from
+ * hardware counters) where accuracy matters.
+ */
+static const struct {
+	float volume;
+	float intensity;
+	unsigned launches;
+} npb[SYSTEM_NUM_BENCHMARKS / 5] = {
+	{ 0.05f, 2.0f, 1200 }, // BT
+	{ 0.02f, 0.25f, 750 }, // CG
+	{ 0.002f, 64.0f, 1 }, // EP
+	{ 0.02f, 0.5f, 60 }, // FT
+	{ 0.01f, 0.1f, 110 }, // IS
+	{ 0.05f, 1.5f, 2500 }, // LU
+	{ 0.01f, 0.5f, 400 }, // MG
+	{ 0.05f, 1.5f, 2000 } // SP
+};
+
+/* Data moved by each class (S, W, A, B, C) relative to class S */
+static const float npb_class_scale[5] = { 1.0f, 4.0f, 32.0f, 128.0f, 512.0f };
+
+///////////////////////////////////////////////////////////////////////////////
+// SystemProfile implementation
+///////////////////////////////////////////////////////////////////////////////
+
+/* Hash a string-valued device or platform property */
+static uint64_t hash_info(uint64_t hash, cl_platform_id platform,
+													cl_device_id device, cl_uint param)
+{
+	char info[256];
+	size_t size = 0;
+	cl_int err;
+
+	if(device) err = clGetDeviceInfo(device, param, sizeof(info), info, &size);
+	else err = clGetPlatformInfo(platform, param, sizeof(info), info, &size);
+	if(err != CL_SUCCESS) size = 0;
+	else if(size > sizeof(info)) size = sizeof(info);
+	return fnv1a(hash, info, size);
+}
+
+uint64_t SystemProfile::devices(cl_runtime rt)
+{
+	uint64_t hash = FNV_OFFSET;
+	cl_uint p, d, units;
+	cl_device_type type;
+
+	for(p = 0; p < get_num_platforms(); p++)
+	{
+		cl_platform_id platform = get_platform(rt, p);
+		hash = hash_info(hash, platform, NULL, CL_PLATFORM_NAME);
+		hash = hash_info(hash, platform, NULL, CL_PLATFORM_VERSION);
+		for(d = 0; d < get_num_devices(p); d++)
+		{
+			cl_device_id device = get_device(rt, p, d);
+			hash = hash_info(hash, NULL, device, CL_DEVICE_NAME);
+			hash = hash_info(hash, NULL, device, CL_DRIVER_VERSION);
+			type = get_device_type(rt, p, d);
+			units = get_num_compute_units(rt, p, d);
+			hash = fnv1a(hash, &type, sizeof(type));
+			hash = fnv1a(hash, &units, sizeof(units));
+		}
+	}
+	return hash;
+}
+
+/* Only CPUs are split into sub-devices by the server */
+static bool can_fission(cl_runtime rt, cl_uint platform, cl_uint device)
+{
+	if(get_device_type(rt, platform, device) != CL_DEVICE_TYPE_CPU)
+		return false;
+
+	cl_device_id dev = get_device(rt, platform, device);
+#ifdef CL_VERSION_1_2
+	cl_uint max = 0;
+	if(clGetDeviceInfo(dev, CL_DEVICE_PARTITION_MAX_SUB_DEVICES, sizeof(max),
+										 &max, NULL) != CL_SUCCESS)
+		return false;
+	return max > 1;
+#else
+	char extensions[4096];
+	if(clGetDeviceInfo(dev, CL_DEVICE_EXTENSIONS, sizeof(extensions),
+										 extensions, NULL) != CL_SUCCESS)
+		return false;
+	extensions[sizeof(extensions) - 1] = '\0';
+	return strstr(extensions, "cl_ext_device_fission") != NULL;
+#endif
+}
+
+size_t SystemProfile::discover(cl_runtime rt)
+{
+	cl_uint p, d;
+
+	profiled.clear();
+	fingerprint = devices(rt);
+	for(p = 0; p < get_num_platforms(); p++)
+		for(d = 0; d < get_num_devices(p); d++)
+			addDevice(p, d, get_device_type(rt, p, d),
+								get_num_compute_units(rt, p, d), can_fission(rt, p, d));
+	return profiled.size();
+}
+
+void SystemProfile::addDevice(cl_uint platform, cl_uint device,
+															cl_device_type type, cl_uint units, bool fission)
+{
+	Slot slot = { platform, device, units, type, 0.0, 0.0, 0.0 };
+
+	if(type != CL_DEVICE_TYPE_CPU && type != CL_DEVICE_TYPE_GPU) return;
+	if(profiled.size() >= SYSTEM_MAX_SLOTS) return;
+	profiled.push_back(slot);
+
+	if(!fission) return;
+	for(cl_uint parts = 2; parts <= units / 2; parts++)
+	{
+		if(units % parts) continue;
+		if(profiled.size() >= SYSTEM_MAX_SLOTS) return;
+		slot.units = units / parts;
+		profiled.push_back(slot);
+	}
+}
+
+/*
+ * Build the micro-kernels for the slot's (sub-)device in a context of its
+ * own, as sub-devices don't belong to the runtime's contexts.
+ */
+bool SystemProfile::time(cl_runtime rt, Slot& slot)
+{
+	cl_device_id device = get_device(rt, slot.platform, slot.device);
+	cl_context context = NULL;
+	cl_command_queue queue = NULL;
+	cl_program program = NULL;
+	cl_kernel compute = NULL, stream = NULL, launch = NULL;
+	cl_mem a = NULL, b = NULL, c = NULL;
+	double seconds;
+	bool success = false;
+	cl_int err;
+
+	if(slot.units != get_num_compute_units_by_dev(device))
+		device = get_subdevice(rt, slot.platform, slot.device, slot.units);
+
+	cl_context_properties props[] = {
+		CL_CONTEXT_PLATFORM,
+		(cl_context_properties)get_platform(rt, slot.platform), 0
+	};
+	context = clCreateContext(props, 1, &device, NULL, NULL, &err);
+	if(err != CL_SUCCESS) goto release;
+#ifdef CL_VERSION_2_0
+	queue = clCreateCommandQueueWithProperties(context, device, NULL, &err);
+#else
+	queue = clCreateCommandQueue(context, device, 0, &err);
+#endif
+	if(err != CL_SUCCESS) goto release;
+
+	program = clCreateProgramWithSource(context, 1, &source, NULL, &err);
+	if(err != CL_SUCCESS ||
+		 clBuildProgram(program, 1, &device, NULL, NULL, NULL) != CL_SUCCESS)
+		goto release;
+	compute = clCreateKernel(program, "compute", &err);
+	if(err != CL_SUCCESS) goto release;
+	stream = clCreateKernel(program, "stream", &err);
+	if(err != CL_SUCCESS) goto release;
+	launch = clCreateKernel(program, "launch", &err);
+	if(err != CL_SUCCESS) goto release;
+
+	a = clCreateBuffer(context, CL_MEM_READ_WRITE,
+										 sizeof(float) * PROFILE_STREAM_ITEMS, NULL, &err);
+	if(err != CL_SUCCESS) goto release;
+	b = clCreateBuffer(context, CL_MEM_READ_WRITE,
+										 sizeof(float) * PROFILE_STREAM_ITEMS, NULL, &err);
+	if(err != CL_SUCCESS) goto release;
+	c = clCreateBuffer(context, CL_MEM_READ_WRITE,
+										 sizeof(float) * PROFILE_STREAM_ITEMS, NULL, &err);
+	if(err != CL_SUCCESS) goto release;
+
+	{
+		float x = 0.999f, s = 3.0f;
+		if(clSetKernelArg(compute, 0, sizeof(cl_mem), &a) != CL_SUCCESS ||
+			 clSetKernelArg(compute, 1, sizeof(float), &x) != CL_SUCCESS ||
+			 clSetKernelArg(stream, 0, sizeof(cl_mem), &a) != CL_SUCCESS ||
+			 clSetKernelArg(stream, 1, sizeof(cl_mem), &b) != CL_SUCCESS ||
+			 clSetKernelArg(stream, 2, sizeof(cl_mem), &c) != CL_SUCCESS ||
+			 clSetKernelArg(stream, 3, sizeof(float), &s) != CL_SUCCESS ||
+			 clSetKernelArg(launch, 0, sizeof(cl_mem), &a) != CL_SUCCESS)
+			goto release;
+	}
+
+	seconds = time_kernel(queue, compute, PROFILE_COMPUTE_ITEMS, 1, false);
+	if(seconds < 0.0) goto release;
+	slot.gflops = COMPUTE_FLOPS * PROFILE_COMPUTE_ITERS *
+								PROFILE_COMPUTE_ITEMS / seconds / 1e9;
+
+	seconds = time_kernel(queue, stream, PROFILE_STREAM_ITEMS, 1, false);
+	if(seconds < 0.0) goto release;
+	slot.gbps = STREAM_BYTES * PROFILE_STREAM_ITEMS / seconds / 1e9;
+
+	seconds = time_kernel(queue, launch, 1, PROFILE_LAUNCHES, true);
+	if(seconds < 0.0) goto release;
+	slot.launch = seconds;
+	success = true;
+
+release:
+	if(a) clReleaseMemObject(a);
+	if(b) clReleaseMemObject(b);
+	if(c) clReleaseMemObject(c);
+	if(compute) clReleaseKernel(compute);
+	if(stream) clReleaseKernel(stream);
+	if(launch) clReleaseKernel(launch);
+	if(program) clReleaseProgram(program);
+	if(queue) clReleaseCommandQueue(queue);
+	if(context) clReleaseContext(context);
+	return success;
+}
+
+bool SystemProfile::calibrate(cl_runtime rt)
+{
+	std::vector<Slot> usable;
+
+	for(Slot& slot : profiled)
+	{
+		if(time(rt, slot)) usable.push_back(slot);
+		else fprintf(stderr, "Warning: could not profile %u/%u with %u compute "
+								 "unit(s), dropping it\n", slot.platform, slot.device,
+								 slot.units);
+	}
+	profiled.swap(usable);
+	return !profiled.empty();
+}
+
+bool SystemProfile::load(const std::string& filename, cl_runtime rt)
+{
+	char magic[32];
+	unsigned version;
+	uint64_t fp_hash;
+	size_t num, i;
+	unsigned long type;
+	Slot slot;
+	std::vector<Slot> loaded;
+
+	FILE* fp = fopen(filename.c_str(), "r");
+	if(!fp) return false;
+	if(fscanf(fp, "%31s %u %" SCNx64 " %zu", magic, &version, &fp_hash,
+						&num) != 4 || strcmp(magic, PROFILE_MAGIC) ||
+		 version != PROFILE_VERSION || (rt && fp_hash != devices(rt)) ||
+		 !num || num > SYSTEM_MAX_SLOTS)
+	{
+		fclose(fp);
+		return false;
+	}
+
+	for(i = 0; i < num; i++)
+	{
+		if(fscanf(fp, "%u %u %u %lu %lf %lf %lf", &slot.platform, &slot.device,
+							&slot.units, &type, &slot.gflops, &slot.gbps,
+							&slot.launch) != 7 || !(slot.gflops > 0.0) ||
+			 !(slot.gbps > 0.0) || !(slot.launch > 0.0))
+			break;
+		slot.type = type;
+		loaded.push_back(slot);
+	}
+	fclose(fp);
+	if(i < num) return false;
+
+	fingerprint = fp_hash;
+	profiled.swap(loaded);
+	return true;
+}
+
+/* Write a temporary file & rename it so a crash never leaves a partial one */
+bool SystemProfile::save(const std::string& filename) const
+{
+	std::string tmp = filename + ".tmp";
+	bool success = true;
+
+	FILE* fp = fopen(tmp.c_str(), "w");
+	if(!fp) return false;
+
+	fprintf(fp, "%s %u %016" PRIx64 " %zu\n", PROFILE_MAGIC, PROFILE_VERSION,
+					fingerprint, profiled.size());
+	for(const Slot& slot : profiled)
+		fprintf(fp, "%u %u %u %lu %.9g %.9g %.9g\n", slot.platform, slot.device,
+						slot.units, (unsigned long)slot.type, slot.gflops, slot.gbps,
+						slot.launch);
+
+	if(ferror(fp)) success = false;
+	if(fclose(fp)) success = false;
+	if(success && rename(tmp.c_str(), filename.c_str())) success = false;
+	if(!success) unlink(tmp.c_str());
+	return success;
+}
+
+float SystemProfile::estimate(const Slot& slot, size_t benchmark)
+{
+	double gb = npb[benchmark / 5].volume * npb_class_scale[benchmark % 5];
+	return (float)(gb / slot.gbps + gb * npb[benchmark / 5].intensity /
+								 slot.gflops + npb[benchmark / 5].launches * slot.launch);
+}
+
+/*
+ * A device's whole slot precedes its sub-device slots, so the default CPU is
+ * the first CPU slot (or the first slot on systems without one).  Energy
+ * assumes 1W everywhere.  The runtime & energy statistics are recomputed from
+ * the new tables.
+ */
+void SystemProfile::install() const
+{
+	size_t s, k;
+	double sum = 0.0;
+
+	assert(!profiled.empty() && profiled.size() <= SYSTEM_MAX_SLOTS &&
+				 "invalid system profile");
+
+	prediction_slots = profiled.size();
+	default_cpu = 0;
+	for(s = 0; s < prediction_slots; s++)
+	{
+		if(profiled[s].type == CL_DEVICE_TYPE_CPU)
+		{
+			default_cpu = s;
+			break;
+		}
+	}
+
+	for(s = 0; s < prediction_slots; s++)
+	{
+		device_types[s] = profiled[s].type;
+		system_devices[s].platform = profiled[s].platform;
+		system_devices[s].device = profiled[s].device;
+		system_devices[s].compute_units = profiled[s].units;
+		for(k = 0; k < SYSTEM_NUM_BENCHMARKS; k++)
+		{
+			runtime[s][k] = estimate(profiled[s], k);
+			energy[s][k] = runtime[s][k];
+			if(!s && !k) rt_max = rt_min = runtime[s][k];
+			else if(runtime[s][k] > rt_max) rt_max = runtime[s][k];
+			else if(runtime[s][k] < rt_min) rt_min = runtime[s][k];
+			sum += runtime[s][k];
+		}
+	}
+	rt_mean = (float)(sum / (prediction_slots * SYSTEM_NUM_BENCHMARKS));
+	energy_mean = rt_mean;
+	energy_max = rt_max;
+	energy_min = rt_min;
+}
+
+void SystemProfile::print() const
+{
+	for(const Slot& slot : profiled)
+		printf("  %u/%u: %u compute unit(s), %.1f GFLOP/s, %.1f GB/s, %.1f us "
+					 "launch latency\n", slot.platform, slot.device, slot.units,
+					 slot.gflops, slot.gbps, slot.launch * 1e6);
+}
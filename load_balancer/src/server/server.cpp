@@ -11,6 +11,13 @@
 #include <ctime>
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <future>
 #include <unistd.h>
 #include <signal.h>
 #include <errno.h>
@@ -25,6 +32,15 @@
 /* Server-specific includes */
 #include "server/server.h"
 #include "server/util.h"
+#include "server/work_queue.h"
+#include "server/policy.h"
+#include "server/event_log.h"
+#include "server/stats.h"
+#include "server/calibration.h"
+#include "server/prediction_cache.h"
+#include "server/rcu.h"
+#include "server/energy.h"
+#include "server/profile.h"
 
 ///////////////////////////////////////////////////////////////////////////////
 // Server state
@@ -44,7 +60,39 @@ const char* help_text = "aira-lb - heterogeneous load-balancing daemon\n\n"
 "  -m model file     : File specifying a model for estimating performance\n"
 "  -t transform file : File specifying transformations to apply to features\n"
 "  -p predictor      : Type of predictor - see below\n"
-"  -c config file    : File containing queue configuration information\n\n"
+"  -c config file    : File containing queue configuration information\n"
+"  -s policy         : Resource allocation policy - see below\n"
+"  -w threads        : Number of prediction worker threads (default: number"
+" of CPUs, 0 predicts on the scheduler thread)\n"
+"  -e event log      : Record each job's lifecycle events to a binary log (see"
+" lb-events in utility to convert it)\n"
+"  -k state file     : Calibrate runtime predictions with observed runtimes,"
+" loading & saving learned state in the file\n"
+"  -r entries        : Number of feature vectors whose predictions are cached"
+" (default: 4096 for nn, otherwise 0, which disables caching)\n"
+"  -q tolerance      : Relative difference below which features share cached"
+" predictions (default: 0, i.e., identical features only)\n"
+"  -P plat/dev:watts : Cap a device's measured power, queueing jobs rather than"
+" starting them while it would be exceeded (may be repeated)\n"
+"  -S socket file    : Listen for clients on this socket, or in the abstract"
+" namespace if it starts with '@' (default: $" SOCKET_ENV " or " SOCKET_FILE
+"), clients select it with " SOCKET_ENV "\n"
+"  -i PID file       : Store the server's PID in this file (default: $" PID_ENV
+" or " SERVER_PID_FILE ")\n"
+"  -n stats page     : Name of the statistics page (default: $" STATS_SHM_ENV
+" or " STATS_SHM_NAME ")\n"
+"  -a profile file   : Profile the devices at startup rather than using the"
+" compiled-in system tables, caching the profile in the file (devices are"
+" re-profiled if they change).  Neural-net models must have an output for"
+" every profiled device.  The exact-* predictors replay the compiled-in"
+" system's measurements & can't be used with a profile\n\n"
+
+"Root privileges are only required for the default socket & PID files.  Give"
+" each instance its own socket, PID file & statistics page to run several,"
+" e.g., one per NUMA node configured with that node's devices.\n\n"
+
+"Send SIGUSR2 to re-read the model, transform & configuration files without"
+" restarting.  Waiting jobs are migrated to the new HW queues.\n\n"
 
 "Valid predictors:\n"
 "  nn           : use an artificial neural network to make predictions\n"
@@ -52,7 +100,18 @@ const char* help_text = "aira-lb - heterogeneous load-balancing daemon\n\n"
 "  always-gpu   : always \"predict\" applications run fastest on the GPU\n"
 "  exact-rt     : use hard-coded static runtimes\n"
 "  exact-energy : use hard-coded static energy consumptions\n"
-"  exact-edp    : use both hard-coded static runtimes & energy consumptions to calculate the energy-delay product\n\n";
+"  exact-edp    : use both hard-coded static runtimes & energy consumptions to calculate the energy-delay product\n\n"
+
+"Valid policies:\n"
+"  first-fit           : run on the first candidate device with a free slot,"
+" otherwise wait on the preferred device (default)\n"
+"  shortest-completion : run or wait where the job's predicted completion"
+" time, including the queued backlog, is earliest\n"
+"  min-edp             : run or wait where the product of the job's measured"
+" energy & predicted completion time is lowest\n\n"
+
+"Device power is measured when the min-edp policy is used or a power cap is"
+" set.\n\n";
 
 /*
  * Hardware queues.  Make global so they can be accessed by utility
@@ -65,17 +124,122 @@ std::vector<HWQueue*> queues;
  */
 cl_runtime cl_rt = NULL;
 
+/* CPU devices which are dynamically split into sub-devices */
+static std::vector<PartitionedDevice*> partitioned;
+
 /* Process & IPC state */
 static pid_t server_pid = 0;
 static server_channel channel = NULL;
 static volatile sig_atomic_t cleanup_flag = 0;
+static volatile sig_atomic_t exit_flag = 0;
+static volatile sig_atomic_t clear_flag = 0;
+static volatile sig_atomic_t reload_flag = 0;
+static int wakeup_fd = -1; /* Interrupts the I/O thread's event loop */
 
 /* Configuration */
 static std::string model_fn = "model.xml";
 static std::string transform_fn = "trans.xml";
 static std::string config_fn = "n/a";
 static enum predictor predictor_type = NN;
-static Predictor* predictor = NULL;
+static enum policy policy_type = FIRST_FIT;
+static Policy* policy = NULL;
+static size_t num_workers = std::thread::hardware_concurrency();
+static std::string events_fn = "";
+static std::string calibration_fn = "";
+static std::string profile_fn = "";
+static std::string socket_fn = SOCKET_FILE;
+static std::string pid_fn = SERVER_PID_FILE;
+static std::string stats_fn = STATS_SHM_NAME;
+static ssize_t cache_size = -1;
+static double cache_tolerance = 0.0;
+
+/* Power caps requested on the command line */
+struct PowerCap {
+	size_t platform, device;
+	double watts;
+};
+static std::vector<PowerCap> power_caps;
+
+/* Job lifecycle events, or NULL if not logging */
+static EventLog* events = NULL;
+
+/*
+ * The predictor & the cache of its output.  Prediction workers read them
+ * through an RCU pointer so they can be replaced while serving requests (see
+ * "Hot reloading" below).
+ */
+struct Model {
+	Predictor* predictor;
+	PredictionCache* cache; /* Memoized predictor output, or NULL */
+};
+static RCUPointer<Model>* model = NULL;
+
+/* RCU reader slot of the calling thread (workers, then the scheduler) */
+static thread_local size_t reader_slot = 0;
+
+/* Corrects predictions with observed runtimes, or NULL if not calibrating */
+static Calibration* calibration = NULL;
+
+/* Profiled system description, NULL if using the compiled-in system */
+static SystemProfile* profile = NULL;
+
+/* Neural-net model output for each prediction slot */
+static ModelOutputs model_outputs;
+
+/* Live statistics for monitoring tools (see utility/lb-top) */
+static StatsPage stats;
+
+/* Device energy measurement, or NULL if not measuring */
+static EnergyMeter* meter = NULL;
+
+/*
+ * Threading.  The main thread performs all socket/shared-memory I/O and
+ * forwards messages, in arrival order, to a single scheduler thread which owns
+ * the hardware queues.  Predictions for allocation requests are evaluated in
+ * parallel by a pool of workers; the scheduler waits for a request's
+ * predictions only when that request reaches the head of its queue, so
+ * admission decisions are made in the same order as a single-threaded server.
+ */
+struct Reload;
+struct Command {
+	struct connection conn; /* Message received from the client */
+	Job* job;               /* Job for HW_REQUEST(_CLASS, _BATCH), or NULL */
+	Reload* reload;         /* Replacements for RELOAD_SERVER, or NULL */
+};
+
+static WorkQueue<Command> commands;
+static WorkQueue<Job*> predictions;
+static std::mutex predicted_lock;
+static std::condition_variable predicted_cond;
+static std::thread scheduler;
+static std::vector<std::thread> workers;
+
+/*
+ * Partially-received batched requests, by client socket.  Entries are kept
+ * (empty) when clients disconnect, so only a new descriptor allocates.
+ */
+typedef InlineVector<Job*, MAX_BATCH> Batch;
+static std::unordered_map<int, Batch> batches;
+
+/*
+ * Hot reloading.  RELOAD_SIG starts a reloader thread which re-reads the
+ * model, transform & queue configuration files & builds a new predictor & HW
+ * queues off the request path.  The scheduler swaps them in between two
+ * requests & migrates jobs onto the new queues, then the reloader waits until
+ * no prediction worker can still be using the old predictor & deletes it.
+ */
+struct Reload {
+	Model* model;                 /* New predictor & cache */
+	std::vector<HWQueue*> queues; /* New HW queues, or empty to keep them */
+	std::promise<Model*> swapped; /* Replaced model, or 'model' if rejected */
+	unsigned long swapTime;       /* Time the scheduler spent swapping (ns) */
+	size_t numWaiting, numRunning; /* Migrated jobs */
+};
+static std::thread reloader;
+static std::atomic<bool> reloading(false);
+
+/* Counters of prediction caches which have been replaced */
+static uint64_t cacheHits = 0, cacheMisses = 0, cacheEvictions = 0;
 
 /* Serving statistics */
 #ifdef _SERVER_STATISTICS
@@ -85,9 +249,19 @@ static size_t numAssigns = 0;
 static size_t numReleases = 0;
 static size_t numGetTables = 0;
 static size_t numClears = 0;
+static size_t numRepartitions = 0;
+static size_t numReloads = 0;
+static size_t numSteals = 0;
+static size_t classFinished[AIRA_NUM_PRIORITIES] = { 0 };
+static size_t classDeadlines[AIRA_NUM_PRIORITIES] = { 0 };
+static size_t classMissed[AIRA_NUM_PRIORITIES] = { 0 };
 
 static unsigned long long assignTime = 0;
 static unsigned long long releaseTime = 0;
+static unsigned long long repartitionTime = 0;
+static unsigned long long reloadTime = 0;
+static double stealSlowdown = 0.0;
+static std::atomic<unsigned long long> predictTime(0);
 #endif
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -98,7 +272,17 @@ static unsigned long long releaseTime = 0;
 static int parse_args(int argc, char** argv);
 static void print_configuration();
 static inline int start_job(Job& job);
+static inline int run_job(HWQueue* queue, Job* job);
+static void drop_running(Job* job);
+static inline void energy_before(const HWQueue* queue);
+static inline void energy_after(const HWQueue* queue);
+static inline void log_event(enum event_type type, const Job* job,
+														 const struct timespec& time,
+														 size_t queue = EVENT_NO_QUEUE);
 static int adjust_queues();
+static void repartition(PartitionedDevice* device,
+												const struct timespec& now);
+static void resume_queue(HWQueue* queue);
 
 /* Initialization */
 static int initialize();
@@ -107,21 +291,49 @@ static int check_root();
 static int store_pid();
 static int setup_signals();
 static int initialize_queues();
+static void profile_system();
+static void map_model_outputs(const std::vector<resource_alloc>& trained);
+static int build_queues(std::vector<HWQueue*>& built);
+static Model* new_model();
+static void delete_model(Model* old);
+
+/* Threading */
+static int start_threads();
+static void stop_threads();
+static void schedule_requests();
+static void predict_jobs(size_t slot);
+static inline void predict_job(Job* job);
+static inline void wait_for_prediction(Job* job);
 
 /* Main functionality */
 static int handle_requests();
 static int notify_resources(struct connection& conn);
-static int assign_resources(struct connection& conn);
+static int place_job(Job* job, const Candidates& candidates);
+static int assign_resources(Job* job);
+static int assign_batch(Batch& batch);
+static int add_to_batch(Job* job);
 static int release_resources(struct connection& conn);
+static void run_next(size_t q);
+static int disconnect_client(struct connection& conn);
 static int send_queues(struct connection& conn);
 static int clear_queues(struct connection& conn);
 
+/* Hot reloading */
+static void start_reload();
+static void reload();
+static void reload_server(Reload* reload);
+static bool has_prediction_slot(const HWQueue* queue);
+static HWQueue* find_queue(const std::vector<HWQueue*>& candidates,
+													 const struct resource_alloc& alloc);
+
 /* Cleanup */
 static int cleanup();
 
 /* Signal handlers */
 static void exit_sig(int sig);
 static void clear_sig(int sig);
+static void reload_sig(int sig);
+static void wake_io_thread();
 
 ///////////////////////////////////////////////////////////////////////////////
 // Entry point
@@ -142,13 +354,19 @@ int main(int argc, char** argv)
 ///////////////////////////////////////////////////////////////////////////////
 
 /*
- * Parse command-line arguments to configure the server.
+ * Parse command-line arguments to configure the server.  The socket, PID file
+ * & statistics page can also be set in the environment.
  */
 static int parse_args(int argc, char** argv)
 {
 	int arg = 0;
+	const char* env;
 
-	while((arg = getopt(argc, argv, "hm:t:p:c:")) != -1)
+	if((env = getenv(SOCKET_ENV)) && *env) socket_fn = env;
+	if((env = getenv(PID_ENV)) && *env) pid_fn = env;
+	if((env = getenv(STATS_SHM_ENV)) && *env) stats_fn = env;
+
+	while((arg = getopt(argc, argv, "hm:t:p:c:s:w:e:k:r:q:P:a:S:i:n:")) != -1)
 	{
 		switch(arg) {
 		case 'h':
@@ -182,12 +400,75 @@ static int parse_args(int argc, char** argv)
 		case 'c':
 			config_fn = optarg;
 			break;
+		case 's':
+			if(!strcmp("first-fit", optarg))
+				policy_type = FIRST_FIT;
+			else if(!strcmp("shortest-completion", optarg))
+				policy_type = SHORTEST_COMPLETION;
+			else if(!strcmp("min-edp", optarg))
+				policy_type = MIN_EDP;
+			else
+			{
+				policy_type = FIRST_FIT;
+				printf("Unknown policy '%s', reverting to 'first-fit'\n", optarg);
+			}
+			break;
+		case 'w':
+			num_workers = strtoul(optarg, NULL, 10);
+			break;
+		case 'e':
+			events_fn = optarg;
+			break;
+		case 'k':
+			calibration_fn = optarg;
+			break;
+		case 'a':
+			profile_fn = optarg;
+			break;
+		case 'S':
+			socket_fn = optarg;
+			break;
+		case 'i':
+			pid_fn = optarg;
+			break;
+		case 'n':
+			stats_fn = optarg;
+			break;
+		case 'r':
+			cache_size = atol(optarg);
+			break;
+		case 'q':
+			cache_tolerance = atof(optarg);
+			break;
+		case 'P':
+		{
+			PowerCap cap;
+			if(sscanf(optarg, "%lu/%lu:%lf", &cap.platform, &cap.device,
+								&cap.watts) != 3 || cap.watts <= 0.0)
+			{
+				fprintf(stderr, "Invalid power cap '%s'\n", optarg);
+				return SERVER_SETUP_ERR;
+			}
+			power_caps.push_back(cap);
+			break;
+		}
 		default:
 			fprintf(stderr, "Unknown argument %c\n", arg);
 			return SERVER_SETUP_ERR;
 		}
 	}
 
+	// Profiled tables are estimates from the NPB characterization, replaying
+	// them as exact runtimes or energies would be meaningless
+	if(profile_fn != "" && (predictor_type == EXACT_RT ||
+		 predictor_type == EXACT_ENERGY || predictor_type == EXACT_EDP))
+	{
+		fprintf(stderr, "Predictor '%s' replays the compiled-in system's "
+						"measurements, it can't be used with a profile (-a)\n",
+						predictorNames[predictor_type]);
+		return SERVER_SETUP_ERR;
+	}
+
 	return SUCCESS;
 }
 
@@ -197,31 +478,124 @@ static int parse_args(int argc, char** argv)
 static void print_configuration()
 {
 	printf("\n*** Server Configuration ***\n");
+	printf("Socket: %s\n", socket_fn.c_str());
+	printf("PID file: %s\n", pid_fn.c_str());
 	printf("Model file: %s\n", model_fn.c_str());
 	printf("Transform file: %s\n", transform_fn.c_str());
 	printf("Predictor type: %s\n", predictorNames[predictor_type]);
+	printf("Allocation policy: %s\n", policyNames[policy_type]);
+	printf("Prediction workers: %lu\n", num_workers);
+	printf("Event log: %s\n", events ? events_fn.c_str() : "disabled");
+	PredictionCache* cache = model->get()->cache;
+	if(cache)
+		printf("Prediction cache: %lu entries, tolerance %g\n",
+					 cache->capacity(), cache->tolerance());
+	else printf("Prediction cache: disabled\n");
+	if(calibration)
+		printf("Calibration: %s (%lu signature(s) loaded)\n",
+					 calibration_fn.c_str(), calibration->numSignatures());
+	else printf("Calibration: disabled\n");
+	printf("Statistics page: %s\n", stats_fn.c_str());
+	if(profile)
+	{
+		printf("System: profiled, cached in %s (%lu prediction slot(s))\n",
+					 profile_fn.c_str(), prediction_slots);
+		profile->print();
+	}
+	else printf("System: compiled-in (%lu prediction slot(s))\n",
+							prediction_slots);
+	if(meter) meter->printConfiguration();
+	else printf("Energy measurement: disabled\n");
 	printf("Using %lu device(s):\n", queues.size());
 	for(HWQueue* q : queues)
 		q->printConfiguration();
+	for(PartitionedDevice* d : partitioned)
+		d->printConfiguration();
 	printf("\n");
 }
 
 /*
- * Start the specified job by notifying the client it can begin running.
+ * Start the specified job by notifying the client it can begin running.  The
+ * client's connection stays open for its subsequent messages.  If the client
+ * can't be notified it has gone away, although its hangup may not have reached
+ * the scheduler yet, so free the job's device as if the job had finished.
  */
 static inline int start_job(Job& job)
 {
 	struct connection conn;
+	size_t q;
+	int retval;
 
 	conn.fd = job.fd;
 	conn.msg.sender_pid = server_pid;
-	conn.msg.type = HW_ASSIGN;
+	conn.msg.type = job.batchSize > 1 ? HW_ASSIGN_BATCH : HW_ASSIGN;
 	conn.msg.body.alloc = job.alloc;
+	conn.msg.ext.batch_index = job.batchIndex;
+	log_event(EVENT_STARTED, &job, job.start, job.queue->index());
+	stats.started(&job, job.queue->index());
 
-	CHECK_ERR(server_send(&conn));
-	CHECK_ERR(server_close_connection(&conn));
+	retval = server_send(channel, &conn);
+	if(retval != SUCCESS)
+	{
+		q = job.queue->index();
+		drop_running(&job);
+		run_next(q);
+	}
+	return retval;
+}
 
-	return SUCCESS;
+/*
+ * Release the device of a running job whose client has gone away & delete
+ * the job.  Unlike a finished job, it tells the policy nothing.
+ */
+static void drop_running(Job* job)
+{
+	size_t q = job->queue->index();
+	energy_before(queues[q]);
+	queues[q]->finished(job);
+	energy_after(queues[q]);
+	delete job;
+}
+
+/*
+ * Run a job on a queue which can run it & notify the client.
+ */
+static inline int run_job(HWQueue* queue, Job* job)
+{
+	energy_before(queue);
+	queue->running(job);
+	energy_after(queue);
+	return start_job(*job);
+}
+
+/*
+ * Account for the jobs running on a queue's device changing.  The energy the
+ * device consumed until now belongs to the jobs which were running, & the new
+ * jobs may change whether its queues are throttled by a power cap.  Queues
+ * which are no longer throttled start their waiting jobs, as nothing else
+ * would until one of their own jobs finishes.
+ */
+static inline void energy_before(const HWQueue* queue)
+{
+	if(meter) meter->attribute(queue->platform(), queue->device());
+}
+
+static inline void energy_after(const HWQueue* queue)
+{
+	if(!meter || !meter->throttle(queue->platform(), queue->device())) return;
+	for(HWQueue* cur : queues)
+		if(cur != queue && cur->platform() == queue->platform() &&
+			 cur->device() == queue->device())
+			resume_queue(cur);
+}
+
+/*
+ * Record a job lifecycle event if event logging is enabled.
+ */
+static inline void log_event(enum event_type type, const Job* job,
+														 const struct timespec& time, size_t queue)
+{
+	if(events) events->record(type, job, time, queue);
 }
 
 /*
@@ -231,13 +605,88 @@ static inline int start_job(Job& job)
  */
 static int adjust_queues()
 {
-	// TODO
+	struct timespec now;
+
+	/*
+	 * Repartition CPU devices when predicted throughput says so.  Running jobs
+	 * can't be moved, so devices stop starting jobs (drain) & are repartitioned
+	 * once idle.
+	 */
+	if(!partitioned.empty()) clock_gettime(CLOCK_MONOTONIC, &now);
+	for(PartitionedDevice* device : partitioned)
+	{
+		if(device->evaluate(now))
+		{
+			for(HWQueue* queue : queues)
+			{
+				if(!device->owns(queue)) continue;
+				queue->setDraining(device->pending());
+				if(!device->pending()) resume_queue(queue);
+			}
+#ifdef _SERVER_VERBOSE
+			printf(", %lu/%lu: %s %lu -> %lu partition(s)",
+				device->platform(), device->device(),
+				device->pending() ? "draining for" : "cancelled",
+				device->numPartitions(), device->targetPartitions());
+#endif
+		}
+		if(device->pending() && device->idle()) repartition(device, now);
+	}
+
 #ifdef _SERVER_VERBOSE
 	printf(", queues: %s\n", utility::queue_sizes().c_str());
 #endif
 	return SUCCESS;
 }
 
+/*
+ * Start waiting jobs on a queue which stopped draining.  Nothing else would
+ * start them, as they're only started when a job on the same queue finishes.
+ */
+static void resume_queue(HWQueue* queue)
+{
+	while(queue->numQueued() && queue->canRun(queue->firstQueued()))
+	{
+		run_job(queue, queue->dequeue());
+	}
+}
+
+/*
+ * Split or merge an idle device's partitions & place the jobs which were
+ * waiting on the old partitions.  The list of waiting jobs is reused between
+ * repartitions (only the scheduler calls this), although building the new
+ * partitions' queues still allocates.
+ */
+static void repartition(PartitionedDevice* device, const struct timespec& now)
+{
+	static std::vector<Job*> waiting;
+#ifdef _SERVER_VERBOSE
+	size_t old = device->numPartitions();
+#endif
+
+	device->apply(now, waiting);
+	for(Job* job : waiting)
+	{
+		struct timespec queued = job->queued;
+		Candidates candidates;
+		utility::get_candidates(job, candidates);
+		// Keep original queueing time for statistics
+		if(place_job(job, candidates) == SUCCESS) job->queued = queued;
+	}
+
+#ifdef _SERVER_STATISTICS
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	numRepartitions++;
+	repartitionTime += toNS(end) - toNS(now);
+#endif
+#ifdef _SERVER_VERBOSE
+	printf(", %lu/%lu: repartitioned %lu -> %lu, migrated %lu job(s)",
+		device->platform(), device->device(), old, device->numPartitions(),
+		waiting.size());
+#endif
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Initialization
 ///////////////////////////////////////////////////////////////////////////////
@@ -253,34 +702,74 @@ static int initialize()
 	CHECK_ERR(check_prev_server());
 	CHECK_ERR(check_root());
 	CHECK_ERR(store_pid());
-	channel = open_server_channel(SOCKET_FILE);
+	channel = open_server_channel(socket_fn.c_str());
 	CHECK_ERR(!channel ? IPC_SETUP_ERR : SUCCESS);
+	wakeup_fd = server_wakeup_fd(channel);
 	CHECK_ERR(setup_signals());
 	CHECK_ERR(initialize_queues());
 
-	switch(predictor_type)
+	// Hard-coded predictors are cheaper than a cache lookup
+	if(cache_size < 0)
+		cache_size = predictor_type == NN ? PREDICTION_CACHE_SIZE : 0;
+	Model* initial = new_model();
+	CHECK_ERR(!initial ? MODEL_INIT_ERR : SUCCESS);
+	model = new RCUPointer<Model>(num_workers + 1, initial);
+
+	switch(policy_type)
 	{
-	case NN:
-		predictor = new NeuralNetPredictor(model_fn, transform_fn);
-		break;
-	case ALWAYS_CPU:
-		predictor = new AlwaysCPU();
-		break;
-	case ALWAYS_GPU:
-		predictor = new AlwaysGPU();
+	case FIRST_FIT:
+		policy = new FirstFitPolicy();
 		break;
-	case EXACT_RT:
-		predictor = new ExactRuntime();
+	case SHORTEST_COMPLETION:
+		policy = new ShortestCompletionPolicy();
 		break;
-	case EXACT_ENERGY:
-		predictor = new ExactEnergy();
+	case MIN_EDP:
+		policy = new MinEDPPolicy();
 		break;
-	case EXACT_EDP:
-		predictor = new ExactEDP();
 	default:
 		assert(false && "Shouldn't be in here...\n");
 	}
 
+	// Without measurements min-edp still works, assuming equal power
+	if(policy_type == MIN_EDP || !power_caps.empty())
+	{
+		meter = new EnergyMeter();
+		if(!meter->start())
+		{
+			fprintf(stderr, "Warning: no device's power can be measured\n");
+			delete meter;
+			meter = NULL;
+		}
+		for(const PowerCap& cap : power_caps)
+			if(!meter || !meter->setCap(cap.platform, cap.device, cap.watts))
+				fprintf(stderr, "Warning: ignoring power cap for unmeasured device "
+								"%lu/%lu\n", cap.platform, cap.device);
+	}
+
+	if(events_fn != "")
+	{
+		events = new EventLog();
+		if(!events->open(events_fn))
+		{
+			fprintf(stderr, "Could not open event log '%s'\n", events_fn.c_str());
+			return SERVER_SETUP_ERR;
+		}
+	}
+
+	// Learned state is optional, start from scratch if there's none
+	if(calibration_fn != "")
+	{
+		calibration = new Calibration();
+		if(!calibration->load(calibration_fn) &&
+			 !access(calibration_fn.c_str(), F_OK))
+			fprintf(stderr, "Warning: ignoring unusable calibration state '%s'\n",
+							calibration_fn.c_str());
+	}
+
+	if(!stats.open(stats_fn, predictorNames[predictor_type]))
+		fprintf(stderr, "Warning: could not create statistics page '%s'\n",
+						stats_fn.c_str());
+
 	print_configuration();
 
 	return SUCCESS;
@@ -291,18 +780,37 @@ static int initialize()
  */
 static int check_prev_server()
 {
-	if(!access(SERVER_PID_FILE, F_OK))
+	if(!access(pid_fn.c_str(), F_OK))
 	{
-		FILE* fp = fopen(SERVER_PID_FILE, "r");
+		FILE* fp = fopen(pid_fn.c_str(), "r");
+		struct stat st;
 		pid_t serv_pid = 0;
 		if(!fp || (fscanf(fp, "%d", &serv_pid) < 1))
 		{	
 			fprintf(stderr, "Found existing server PID file (could not read PID)\n");
+			if(fp) fclose(fp);
 			return SERVER_RUNNING;
 		}
+		fclose(fp);
+
+		// The server died without cleaning up, take over.  Its socket file would
+		// make binding fail, so remove it too (abstract sockets have no file).
+		if(kill(serv_pid, 0) && errno == ESRCH)
+		{
+			fprintf(stderr, "Warning: removing stale PID file '%s' (pid %d)\n",
+							pid_fn.c_str(), serv_pid);
+			if(remove(pid_fn.c_str())) return SERVER_RUNNING;
+			if(socket_fn[0] != SOCKET_ABSTRACT && !lstat(socket_fn.c_str(), &st) &&
+				 S_ISSOCK(st.st_mode))
+			{
+				fprintf(stderr, "Warning: removing stale socket '%s'\n",
+								socket_fn.c_str());
+				if(unlink(socket_fn.c_str())) return SERVER_RUNNING;
+			}
+			return SUCCESS;
+		}
 
 		fprintf(stderr, "Existing server running (pid %d)\n", serv_pid);
-		fclose(fp);
 		return SERVER_RUNNING;
 	}
 
@@ -310,14 +818,19 @@ static int check_prev_server()
 }
 
 /*
- * Make sure the server was started with root privileges.  This is necessary to
- * create the PID & socket file, and to change the permissions so that user-land
- * applications can communicate with the server.
+ * Make sure the server was started with root privileges if it uses the default
+ * PID & socket files.  This is necessary to create them under /var/run, and to
+ * change the permissions so that user-land applications can communicate with
+ * the server.  Other paths only need to be writable.
  */
 static int check_root()
 {
-	if(geteuid() != 0)
+	if(geteuid() != 0 &&
+		 (pid_fn == SERVER_PID_FILE || socket_fn == SOCKET_FILE))
+	{
+		fprintf(stderr, "Use -S & -i to run without root privileges\n");
 		return NOT_ROOT;
+	}
 	else
 		return SUCCESS;
 }
@@ -332,7 +845,7 @@ static int store_pid()
 	pid_t my_pid = getpid();
 
 	// Open file
-	FILE* pid_file = fopen(SERVER_PID_FILE, "w");
+	FILE* pid_file = fopen(pid_fn.c_str(), "w");
 	if(!pid_file)
 	{
 		perror("Error opening PID file");
@@ -382,6 +895,7 @@ static int setup_signals()
 {
 	struct sigaction exit;
 	struct sigaction clear;
+	struct sigaction reload;
 
 	exit.sa_handler = exit_sig;
 	exit.sa_flags = 0;
@@ -401,6 +915,15 @@ static int setup_signals()
 		return SIGNAL_SETUP_ERR;
 	}
 
+	reload.sa_handler = reload_sig;
+	reload.sa_flags = 0;
+	sigemptyset(&reload.sa_mask);
+	if(sigaction(RELOAD_SIG, &reload, NULL) < 0)
+	{
+		perror("Could not register signal handler: reload signal");
+		return SIGNAL_SETUP_ERR;
+	}
+
 	return SUCCESS;
 }
 
@@ -410,27 +933,107 @@ static int setup_signals()
  */
 static int initialize_queues()
 {
+	int retval;
+
+	// Neural nets are trained for the compiled-in system
+	std::vector<struct resource_alloc> trained(system_devices,
+																						 system_devices + prediction_slots);
+	model_outputs.mean = rt_mean;
+	model_outputs.max = rt_max;
+	model_outputs.min = rt_min;
+
 	cl_rt = new_cl_runtime(false);
+	if(profile_fn != "") profile_system();
+	map_model_outputs(trained);
+	if((retval = build_queues(queues)) != SUCCESS) return retval;
 
-	if(config_fn != "n/a") // User supplied configuration file
+	if(prediction_slots > MAX_PREDICTION_SLOTS)
 	{
-		std::vector<HWQueueConfig*> configs = ConfigParser::parseConfig(config_fn);
-		queues.resize(0);
-		for(HWQueueConfig* config : configs)
+		fprintf(stderr, "Too many prediction slots (%lu, at most %d)\n",
+						prediction_slots, MAX_PREDICTION_SLOTS);
+		return SERVER_SETUP_ERR;
+	}
+	for(size_t i = 0; i < queues.size(); i++)
+		queues[i]->setIndex(i);
+	utility::build_slot_tables();
+	partitioned = PartitionedDevice::discover();
+
+	return SUCCESS;
+}
+
+/*
+ * Replace the compiled-in system tables with a profile of the devices, loaded
+ * from the cache if it was taken on the same devices.  Falls back to the
+ * compiled-in system if the devices can't be profiled.
+ */
+static void profile_system()
+{
+	profile = new SystemProfile();
+	if(!profile->load(profile_fn, cl_rt))
+	{
+		printf("Profiling devices, caching the profile in '%s'\n",
+					 profile_fn.c_str());
+		if(!profile->discover(cl_rt) || !profile->calibrate(cl_rt))
 		{
-			switch(get_device_type(cl_rt, config->platform, config->device))
+			fprintf(stderr, "Warning: could not profile devices, using the "
+							"compiled-in system\n");
+			delete profile;
+			profile = NULL;
+			return;
+		}
+		if(!profile->save(profile_fn))
+			fprintf(stderr, "Warning: could not save system profile '%s'\n",
+							profile_fn.c_str());
+	}
+	profile->install();
+}
+
+/*
+ * Match each prediction slot with the model output for the same device &
+ * number of compute units.  Without a profile the slots are those the model
+ * was trained for.
+ */
+static void map_model_outputs(const std::vector<resource_alloc>& trained)
+{
+	size_t s, t;
+
+	model_outputs.slots.assign(prediction_slots, NO_MODEL_OUTPUT);
+	for(s = 0; s < prediction_slots; s++)
+	{
+		for(t = 0; t < trained.size(); t++)
+		{
+			if(trained[t].platform == system_devices[s].platform &&
+				 trained[t].device == system_devices[s].device &&
+				 trained[t].compute_units == system_devices[s].compute_units)
 			{
-			case CL_DEVICE_TYPE_CPU:
-				queues.push_back(new CPUQueue(config));
+				model_outputs.slots[s] = t;
 				break;
-			case CL_DEVICE_TYPE_GPU:
-				queues.push_back(new GPUQueue(config));
-				break;
-			default:
-				assert(false && "unsupported device type!");
 			}
 		}
 	}
+}
+
+/*
+ * Create HW queues from the configuration file, or if there's none, one per
+ * OpenCL device.  Errors in the configuration are reported rather than fatal
+ * so that reloading a bad file leaves the server running.
+ */
+static int build_queues(std::vector<HWQueue*>& built)
+{
+	std::vector<HWQueueConfig*> configs;
+	HWQueueConfig* config;
+
+	built.clear();
+	if(config_fn != "n/a") // User supplied configuration file
+	{
+		try { configs = ConfigParser::parseConfig(config_fn); }
+		catch(std::exception& e)
+		{
+			fprintf(stderr, "Could not parse configuration '%s': %s\n",
+							config_fn.c_str(), e.what());
+			return SERVER_SETUP_ERR;
+		}
+	}
 	else // Query the OpenCL runtime for device information
 	{
 		size_t numDevices = 0;
@@ -438,12 +1041,9 @@ static int initialize_queues()
 			numDevices += get_num_devices(i);
 		assert(numDevices < MAX_ARCHES && "found too many devices!");
 
-		HWQueueConfig* config;
-		size_t devIndex = 0;
-		queues.resize(numDevices);
 		for(size_t i = 0; i < get_num_platforms(); i++)
 		{
-			for(size_t j = 0; j < get_num_devices(i); j++, devIndex++)
+			for(size_t j = 0; j < get_num_devices(i); j++)
 			{
 				config = new HWQueueConfig();
 				config->platform = i;
@@ -451,86 +1051,357 @@ static int initialize_queues()
 				config->computeUnits = get_num_compute_units(cl_rt, i, j);
 				config->maxRunning = 1;
 				config->dynamicPartitioning = false;
-				switch(get_device_type(cl_rt, i, j))
-				{
-				case CL_DEVICE_TYPE_CPU:
-					queues[devIndex] = new CPUQueue(config);
-					break;
-				case CL_DEVICE_TYPE_GPU:
-					queues[devIndex] = new GPUQueue(config);
-					break;
-				default:
-					assert(false && "unsupported device type!");
-				}
+				configs.push_back(config);
 			}
 		}
 	}
 
+	for(size_t i = 0; i < configs.size(); i++)
+	{
+		config = configs[i];
+		switch(get_device_type(cl_rt, config->platform, config->device))
+		{
+		case CL_DEVICE_TYPE_CPU:
+			built.push_back(new CPUQueue(config));
+			break;
+		case CL_DEVICE_TYPE_GPU:
+			built.push_back(new GPUQueue(config));
+			break;
+		default:
+			fprintf(stderr, "Unsupported device %lu/%lu in configuration\n",
+							config->platform, config->device);
+			for(size_t j = i; j < configs.size(); j++)
+				delete configs[j];
+			configs.clear();
+			break;
+		}
+	}
+
+	if(configs.empty() || built.size() != configs.size() ||
+		 built.size() > MAX_QUEUES)
+	{
+		if(built.size() > MAX_QUEUES) fprintf(stderr, "Too many HW queues\n");
+		for(HWQueue* queue : built) delete queue;
+		built.clear();
+		return SERVER_SETUP_ERR;
+	}
 	return SUCCESS;
 }
 
+/*
+ * Build the selected predictor & an empty cache for its output.  Returns NULL
+ * if the model or transform files can't be loaded.
+ */
+static Model* new_model()
+{
+	Predictor* predictor = NULL;
+
+	try
+	{
+		switch(predictor_type)
+		{
+		case NN:
+			if(access(model_fn.c_str(), R_OK) || access(transform_fn.c_str(), R_OK))
+			{
+				fprintf(stderr, "Could not read model '%s' or transforms '%s'\n",
+								model_fn.c_str(), transform_fn.c_str());
+				return NULL;
+			}
+			for(size_t s = 0; s < prediction_slots; s++)
+			{
+				if(model_outputs.slots[s] != NO_MODEL_OUTPUT) continue;
+				fprintf(stderr, "Model '%s' has no output for device %u/%u with %u "
+								"compute unit(s), it was trained for the compiled-in "
+								"system\n", model_fn.c_str(), system_devices[s].platform,
+								system_devices[s].device, system_devices[s].compute_units);
+				return NULL;
+			}
+			predictor = new NeuralNetPredictor(model_fn, transform_fn, model_outputs);
+			break;
+		case ALWAYS_CPU:
+			predictor = new AlwaysCPU();
+			break;
+		case ALWAYS_GPU:
+			predictor = new AlwaysGPU();
+			break;
+		case EXACT_RT:
+			predictor = new ExactRuntime();
+			break;
+		case EXACT_ENERGY:
+			predictor = new ExactEnergy();
+			break;
+		case EXACT_EDP:
+			predictor = new ExactEDP();
+			break;
+		default:
+			assert(false && "Shouldn't be in here...\n");
+		}
+	}
+	catch(std::exception& e)
+	{
+		fprintf(stderr, "Could not load model: %s\n", e.what());
+		return NULL;
+	}
+
+	Model* built = new Model;
+	built->predictor = predictor;
+	built->cache = cache_size ?
+								 new PredictionCache(cache_size, cache_tolerance) : NULL;
+	return built;
+}
+
+static void delete_model(Model* old)
+{
+	if(old->cache)
+	{
+		cacheHits += old->cache->numHits();
+		cacheMisses += old->cache->numMisses();
+		cacheEvictions += old->cache->numEvictions();
+		delete old->cache;
+	}
+	delete old->predictor;
+	delete old;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
-// Main functionality 
+// Threading
 ///////////////////////////////////////////////////////////////////////////////
 
 /*
- * Handle requests until we are told to exit.
+ * Start the scheduler & prediction worker threads.  Signals are blocked in
+ * all helper threads so they are only ever delivered to the I/O thread.
  */
-static int handle_requests()
+static int start_threads()
 {
-	int retval = 0;
-	struct connection conn;
+	sigset_t block, old;
 
-	retval = server_listen(channel, &conn);
-	if(retval != SUCCESS && errno != EINTR)
-		CHECK_ERR(retval);
+	sigemptyset(&block);
+	sigaddset(&block, EXIT_SIG);
+	sigaddset(&block, CLEAR_SIG);
+	sigaddset(&block, RELOAD_SIG);
+	if(pthread_sigmask(SIG_BLOCK, &block, &old))
+		return SERVER_SETUP_ERR;
 
-	while(conn.msg.type != STOP_SERVER || errno == EINTR)
+	scheduler = std::thread(schedule_requests);
+	for(size_t i = 0; i < num_workers; i++)
+		workers.push_back(std::thread(predict_jobs, i));
+
+	if(pthread_sigmask(SIG_SETMASK, &old, NULL))
+		return SERVER_SETUP_ERR;
+	return SUCCESS;
+}
+
+/*
+ * Drain outstanding requests & join all helper threads.  The scheduler is
+ * stopped first as it may still be waiting on in-flight predictions.
+ */
+static void stop_threads()
+{
+	Command stop;
+
+	memset(&stop.conn, 0, sizeof(struct connection));
+	stop.conn.msg.type = STOP_SERVER;
+	stop.job = NULL;
+	stop.reload = NULL;
+	commands.push(stop);
+	scheduler.join();
+
+	for(size_t i = 0; i < workers.size(); i++)
+		predictions.push(NULL);
+	for(std::thread& worker : workers)
+		worker.join();
+	workers.clear();
+}
+
+/*
+ * Scheduler thread.  Applies requests to the hardware queues in the order in
+ * which they were received.
+ */
+static void schedule_requests()
+{
+	Command cmd;
+	uint64_t requests = 0;
+
+	reader_slot = num_workers;
+	while((cmd = commands.pop()).conn.msg.type != STOP_SERVER)
 	{
-		if(retval == SUCCESS)
-		{
 #ifdef _SERVER_VERBOSE
-			printf("%d: ", conn.msg.sender_pid);
+		printf("%d: ", cmd.conn.msg.sender_pid);
 #endif
 
-			switch(conn.msg.type) {
-			case HW_NOTIFY:
-				notify_resources(conn);
-				break;
-			case HW_REQUEST:
-				assign_resources(conn);
-				break;
-			case KERNEL_FINISH:
-				release_resources(conn);
-				break;
-			case GET_QUEUES:
-				send_queues(conn);
-				break;
-			case CLR_QUEUES:
-				clear_queues(conn);
-				break;
-			case HW_ASSIGN:
-			case RET_QUEUES:
+		switch(cmd.conn.msg.type) {
+		case HW_NOTIFY:
+			notify_resources(cmd.conn);
+			break;
+		case HW_REQUEST:
+		case HW_REQUEST_CLASS:
+			if(num_workers) wait_for_prediction(cmd.job);
+			else predict_job(cmd.job);
+			assign_resources(cmd.job);
+			break;
+		case HW_REQUEST_BATCH:
+			if(num_workers) wait_for_prediction(cmd.job);
+			else predict_job(cmd.job);
+			add_to_batch(cmd.job);
+			break;
+		case KERNEL_FINISH:
+			release_resources(cmd.conn);
+			break;
+		case GET_QUEUES:
+			send_queues(cmd.conn);
+			break;
+		case CLR_QUEUES:
+			clear_queues(cmd.conn);
+			break;
+		case RELOAD_SERVER:
+			if(cmd.reload) reload_server(cmd.reload);
+			break;
+		case CLIENT_HANGUP:
+			disconnect_client(cmd.conn);
+			break;
+		case HW_ASSIGN:
+		case HW_ASSIGN_BATCH:
+		case RET_QUEUES:
 #ifdef _SERVER_VERBOSE
-				fprintf(stderr, "client sent server-only message '%s'\n",
-								message_type_str[conn.msg.type]);
+			fprintf(stderr, "client sent server-only message '%s'\n",
+							message_type_str[cmd.conn.msg.type]);
 #endif
-				break;
-			default:
+			break;
+		default:
 #ifdef _SERVER_VERBOSE
-				fprintf(stderr, "unknown message type %d\n", conn.msg.type);
+			fprintf(stderr, "unknown message type %d\n", cmd.conn.msg.type);
 #endif
-				break;
-			}
+			break;
+		}
+
+		numRequestsServed++;
+		stats.publishQueues(++requests);
+	}
+}
+
+/*
+ * Prediction worker thread.  Evaluates predictions for allocation requests
+ * until handed a NULL job.
+ */
+static void predict_jobs(size_t slot)
+{
+	Job* job;
 
-			numRequestsServed++;
+	reader_slot = slot;
+	while((job = predictions.pop()))
+	{
+		predict_job(job);
+		{
+			std::lock_guard<std::mutex> lock(predicted_lock);
+			job->predicted = true;
 		}
+		predicted_cond.notify_one();
+	}
+}
 
-		// Get next message
-		retval = server_listen(channel, &conn);
-		if(retval != SUCCESS && errno != EINTR)
-			CHECK_ERR(retval);
+/*
+ * Evaluate the predictor for a job.
+ */
+static inline void predict_job(Job* job)
+{
+	struct timespec predictStart, predictEnd;
+	clock_gettime(CLOCK_MONOTONIC, &predictStart);
+
+	// Cache raw predictor output, calibration changes as jobs finish
+	Model* cur = model->read(reader_slot);
+	if(!cur->cache) cur->predictor->predict(job->features, job->predictions);
+	else if(cur->cache->lookup(job->features, job->predictions))
+		stats.cached(true);
+	else
+	{
+		cur->predictor->predict(job->features, job->predictions);
+		cur->cache->insert(job->features, job->predictions);
+		stats.cached(false);
 	}
+	model->done(reader_slot);
+	if(calibration) calibration->correct(job);
+
+	clock_gettime(CLOCK_MONOTONIC, &predictEnd);
+	stats.predicted(toNS(predictEnd) - toNS(predictStart));
+#ifdef _SERVER_STATISTICS
+	predictTime += toNS(predictEnd) - toNS(predictStart);
+#endif
+	log_event(EVENT_PREDICTED, job, predictEnd);
+}
+
+/*
+ * Block until a worker has filled in the job's predictions.
+ */
+static inline void wait_for_prediction(Job* job)
+{
+	std::unique_lock<std::mutex> lock(predicted_lock);
+	predicted_cond.wait(lock, [job]{ return job->predicted; });
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Main functionality 
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Receive requests & forward them to the scheduler until we are told to exit.
+ * Allocation requests are additionally handed to the prediction workers.
+ */
+static int handle_requests()
+{
+	int retval = 0;
+	Command cmd;
+	struct timespec received;
+
+	CHECK_ERR(start_threads());
+
+	while(!exit_flag)
+	{
+		// Signals may arrive while handling a message rather than listening.
+		// Handlers also wake the event loop, so one arriving just before we
+		// start waiting is seen on the next pass.
+		if(reload_flag)
+		{
+			reload_flag = 0;
+			start_reload();
+		}
+		if(clear_flag)
+		{
+			clear_flag = 0;
+			memset(&cmd.conn, 0, sizeof(struct connection));
+			cmd.conn.msg.type = CLR_QUEUES;
+			cmd.job = NULL;
+			cmd.reload = NULL;
+			commands.push(cmd);
+		}
+
+		retval = server_listen(channel, &cmd.conn);
+		if(retval != SUCCESS)
+		{
+			if(errno != EINTR) CHECK_ERR(retval);
+			continue;
+		}
+		if(cmd.conn.msg.type == STOP_SERVER) break;
+
+		cmd.job = NULL;
+		cmd.reload = NULL;
+		if(cmd.conn.msg.type == HW_REQUEST ||
+			 cmd.conn.msg.type == HW_REQUEST_CLASS ||
+			 cmd.conn.msg.type == HW_REQUEST_BATCH)
+		{
+			cmd.job = new Job(cmd.conn);
+			if(events)
+			{
+				clock_gettime(CLOCK_MONOTONIC, &received);
+				log_event(EVENT_RECEIVED, cmd.job, received);
+			}
+			if(num_workers) predictions.push(cmd.job);
+		}
+		commands.push(cmd);
+	}
+
+	// The reloader needs the scheduler to finish a reload
+	if(reloader.joinable()) reloader.join();
+	stop_threads();
 
 	return SUCCESS;
 }
@@ -544,33 +1415,33 @@ static int notify_resources(struct connection& conn)
 
 	// Must add to device's running list (cannot apply policies when daemon is
 	// notified of resource usage by application).
-	std::vector<size_t> indexes = utility::alloc_to_index(job->alloc);
-	queues[indexes[0]]->running(job);
+	size_t q = utility::alloc_to_queue(job->alloc);
+	if(q >= queues.size())
+	{
+		delete job;
+		return ALLOC_ERR;
+	}
 #ifdef _SERVER_VERBOSE
 	printf("notify -> running on %lu, queues: %s\n",
-		indexes[0], utility::queue_sizes().c_str());
+		q, utility::queue_sizes().c_str());
 #endif
 
 	// Although client notified server, ack assignment
 #ifdef _SERVER_STATISTICS
 	numNotifies++;
 #endif
-	return start_job(*job);
+	return run_job(queues[q], job);
 }
 
 /*
- * Assign hardware to client & update internal queues.
+ * Start the job on the HW queue chosen by the allocation policy, or enqueue it
+ * if that queue can't run it yet.  The job is deleted if it was started but
+ * its client couldn't be notified (see start_job()).
  */
-static int assign_resources(struct connection& conn)
+static int place_job(Job* job, const Candidates& candidates)
 {
-	bool startedRunning = false;
-	Job* job = new Job(conn);
-#ifdef _SERVER_STATISTICS
-	struct timespec assignStart, assignEnd;
-	clock_gettime(CLOCK_MONOTONIC, &assignStart);
-#endif
-	predictor->predict(job->features, job->predictions);
-
+	int retval = SUCCESS;
+	struct timespec now;
 #ifdef _SERVER_VERBOSE
 	printf("assign (%s) -> predictions:",
 		npb_kernel_names[job->features.kernel]);
@@ -579,63 +1450,128 @@ static int assign_resources(struct connection& conn)
 	printf(", ");
 #endif
 
-	/*
-	 * 1. Check if our preferred architecture (or one within a suitable
-	 *    performance threshold) is available.  If so, start running.
-	 */
-	// Get all candidate architectures (i.e. HW queues)
-	std::vector<size_t> candidates = utility::get_candidates(job);
-
-	// See if any candidates can begin running the job
-	for(size_t candidate : candidates)
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	size_t q = policy->place(job, candidates, toNS(now));
+	if(job->deadline) q = policy->expedite(job, q, candidates, toNS(now));
+	if(queues[q]->canRun(job))
 	{
-		if(queues[candidate]->canRun(job))
-		{
 #ifdef _SERVER_VERBOSE
-			printf("running on %lu", candidate);
+		printf("running on %lu", q);
+#endif
+		retval = run_job(queues[q], job);
+	}
+	else
+	{
+		queues[q]->enqueue(job);
+		log_event(EVENT_ENQUEUED, job, job->queued, q);
+#ifdef _SERVER_VERBOSE
+		printf("enqueued on %lu", q);
 #endif
-			queues[candidate]->running(job);
-			startedRunning = true;
-			start_job(*job);
-			break;
-		}
 	}
+	return retval;
+}
+
+/*
+ * Assign hardware to client & update internal queues.  The job's predictions
+ * must already have been evaluated.
+ */
+static int assign_resources(Job* job)
+{
+#ifdef _SERVER_STATISTICS
+	struct timespec assignStart, assignEnd;
+	clock_gettime(CLOCK_MONOTONIC, &assignStart);
+#endif
+
+	/* 1. Get all candidate architectures (i.e. HW queues) & place the job */
+	Candidates candidates;
+	utility::get_candidates(job, candidates);
+	place_job(job, candidates);
+
+	/* 2. Check heuristic to load balance & adjust devices */
+	adjust_queues();
+
+#ifdef _SERVER_STATISTICS
+	numAssigns++;
+	clock_gettime(CLOCK_MONOTONIC, &assignEnd);
+	assignTime += toNS(assignEnd) - toNS(assignStart);
+#endif
+	return SUCCESS;
+}
+
+/*
+ * Assign hardware to all kernels of a batched request.  Kernels with the
+ * fewest acceptable devices are placed first so that flexible kernels don't
+ * take the only device on which another kernel in the batch runs well.
+ */
+static int assign_batch(Batch& batch)
+{
+	InlineVector<std::pair<size_t, Candidates>, MAX_BATCH> plan(batch.size());
+#ifdef _SERVER_STATISTICS
+	struct timespec assignStart, assignEnd;
+	clock_gettime(CLOCK_MONOTONIC, &assignStart);
+#endif
 
 	/*
-	 * 2. If no candidates can run the job, enqueue on our preferred architecture.
-	 *    If there are multiple copies of our preferred architecture, choose the
-	 *    one with the shortest run-queue length.
+	 * 1. Get each kernel's candidates & order from least to most flexible.
+	 *    Batches are small, so an insertion sort (stable, & unlike
+	 *    std::stable_sort it doesn't need a temporary buffer) is enough.
 	 */
-	if(!startedRunning)
+	for(size_t i = 0; i < batch.size(); i++)
+	{
+		plan[i].first = i;
+		utility::get_candidates(batch[i], plan[i].second);
+		for(size_t j = i; j && plan[j].second.size() < plan[j - 1].second.size();
+				j--)
+			std::swap(plan[j], plan[j - 1]);
+	}
+
+	/* 2. Place kernels */
+	for(size_t i = 0; i < plan.size(); i++)
 	{
-		size_t shortest = candidates[0];
-		size_t shortestLength = queues[shortest]->numQueued();
-		for(size_t i = 1; i < candidates.size(); i++)
-		{
-			if(!utility::same_device(shortest, i)) break;
-			if(queues[candidates[i]]->numQueued() < shortestLength)
-			{
-				shortest = i;
-				shortestLength = queues[candidates[i]]->numQueued();
-			}
-		}
-		queues[shortest]->enqueue(job);
 #ifdef _SERVER_VERBOSE
-		printf("enqueued on %lu", shortest);
+		if(i) printf("; ");
 #endif
+		place_job(batch[plan[i].first], plan[i].second);
 	}
 
 	/* 3. Check heuristic to load balance & adjust devices */
 	adjust_queues();
 
 #ifdef _SERVER_STATISTICS
-	numAssigns++;
+	numAssigns += batch.size();
 	clock_gettime(CLOCK_MONOTONIC, &assignEnd);
 	assignTime += toNS(assignEnd) - toNS(assignStart);
 #endif
 	return SUCCESS;
 }
 
+/*
+ * Collect kernels of a batched request as they arrive from the I/O thread &
+ * assign hardware once the whole batch is available.
+ */
+static int add_to_batch(Job* job)
+{
+	// Malformed batches are placed kernel-by-kernel
+	if(job->batchSize > MAX_BATCH || job->batchIndex >= job->batchSize)
+		return assign_resources(job);
+
+	Batch& batch = batches[job->fd];
+
+	// A new batch replaces any left behind by a client which went away
+	if(job->batchIndex == 0)
+	{
+		for(Job* stale : batch) delete stale;
+		batch.clear();
+	}
+
+	batch.push_back(job);
+	if(batch.size() < job->batchSize) return SUCCESS;
+
+	assign_batch(batch);
+	batch.clear();
+	return SUCCESS;
+}
+
 /*
  * After a kernel has finished, update the run queue for the appropriate
  * architecture.
@@ -643,21 +1579,25 @@ static int assign_resources(struct connection& conn)
 static int release_resources(struct connection& conn)
 {
 	size_t q;
-	float bestPred, curPred;
 	Job* job = NULL;
 #ifdef _SERVER_STATISTICS
 	struct timespec releaseStart, releaseEnd;
 	clock_gettime(CLOCK_MONOTONIC, &releaseStart);
 #endif
 
-	/* 1. Clean up the just-finished job */
-	for(q = 0; q < queues.size(); q++) {
-		if(queues[q]->isRunning(conn.msg.sender_pid)) {
-			job = queues[q]->finished(conn.msg.sender_pid);
-			break;
-		}
-	}
+	/*
+	 * 1. Clean up the just-finished job.  Clients may have several kernels
+	 *    running, so prefer the one on the device they report.
+	 */
+	job = HWQueue::findRunning(conn.msg.sender_pid, conn.msg.body.alloc);
 	if(!job) return CLEANUP_ERR;
+	q = job->queue->index();
+	energy_before(queues[q]);
+	queues[q]->finished(job);
+	energy_after(queues[q]);
+	log_event(EVENT_FINISHED, job, job->end, q);
+	stats.finished(job, q);
+	if(calibration) calibration->observe(job, queues[q]->slot());
 
 #ifdef _SERVER_VERBOSE
 	printf("finished");
@@ -667,56 +1607,119 @@ static int release_resources(struct connection& conn)
 		job->queuedTime(), job->startTime(), job->endTime());
 #endif
 #endif
-	CHECK_ERR(server_close_connection(&conn));
+	policy->finished(job);
+#ifdef _SERVER_STATISTICS
+	classFinished[job->priority]++;
+	if(job->deadline) classDeadlines[job->priority]++;
+	if(job->missedDeadline()) classMissed[job->priority]++;
+#endif
 	delete job;
 	job = NULL;
 
-	/* 2. Find other job to run */
-	if(queues[q]->numQueued() > 0) // Start another job from same queue
-		job = queues[q]->dequeue();
-	else // Search for available jobs in other queues
-	{
-		// Note: this searches for the first job it can find that is within the
-		// performance threshold.  We don't want to waste time exhaustively
-		// searching for the *best* job to steal.
-		for(size_t i = 0; i < queues.size(); i++) {
-			for(size_t j = 0; j < queues[i]->numQueued(); j++) {
-				curPred = utility::get_prediction(i, j, q);
-				bestPred = utility::get_prediction(i, j, i);
-				if(utility::within_threshold(bestPred, curPred))
-				{
-					job = queues[i]->remove(j);
-					break;
-				}
-			}
-			if(job) break;
-		}
-	}
+	/* 2. Find other job to run (unless the device is being repartitioned) */
+	run_next(q);
+
+	/* 3. Check heuristic to load balance & adjust devices */
+	adjust_queues();
+
+#ifdef _SERVER_STATISTICS
+	numReleases++;
+	clock_gettime(CLOCK_MONOTONIC, &releaseEnd);
+	releaseTime += toNS(releaseEnd) - toNS(releaseStart);
+#endif
+	return SUCCESS;
+}
+
+/*
+ * Start the next job on a queue which has freed up, unless the device is being
+ * repartitioned or is at its power cap.
+ */
+static void run_next(size_t q)
+{
+	Job* job = NULL;
+
+	if(!queues[q]->isDraining() && !queues[q]->isThrottled())
+		job = policy->next(q);
 
 	// If job is not null, we found another -- start it
 	if(job)
 	{
+		if(job->slowdown > 0.0f)
+		{
+			stats.stolen(job, q);
+#ifdef _SERVER_STATISTICS
+			numSteals++;
+			stealSlowdown += job->slowdown;
+#endif
+		}
 #ifdef _SERVER_VERBOSE
 		printf(", %d (%s) running on %lu",
 			job->client, npb_kernel_names[job->features.kernel], q);
 #endif
-		queues[q]->running(job);
-		start_job(*job);
+		run_job(queues[q], job);
 	}
 #ifdef _SERVER_VERBOSE
 	else
 		printf(", %lu going idle", q);
 #endif
+}
 
-	/* 3. Check heuristic to load balance & adjust devices */
+/*
+ * Forget a client which hung up.  The IPC layer leaves its connection open so
+ * the descriptor isn't reused by another client while jobs still refer to it.
+ * Drop the client's waiting jobs & partially-received batch, release the
+ * devices its kernels were running on, & only then close the connection.
+ *
+ * Clients built against the original protocol open a connection per message,
+ * so they hang up while their kernels run & report them finished on a new
+ * connection.  Running kernels of a process which still exists are therefore
+ * kept until they're reported finished, just no longer tied to a connection.
+ * Hangups are rare, so each also checks whether the processes owning such
+ * kernels still exist.
+ */
+static int disconnect_client(struct connection& conn)
+{
+	const int fd = conn.fd;
+	auto ofClient = [fd](const Job* job) { return job->fd == fd; };
+	Job* job, *next;
+	size_t q, freed, dropped = 0, released = 0;
+
+	auto batch = batches.find(fd);
+	if(batch != batches.end())
+	{
+		for(Job* stale : batch->second) delete stale;
+		dropped += batch->second.size();
+		batch->second.clear();
+	}
+
+	for(q = 0; q < queues.size(); q++)
+	{
+		while((job = queues[q]->waiting().find(ofClient)))
+		{
+			delete queues[q]->remove(job);
+			dropped++;
+		}
+
+		for(freed = 0, job = queues[q]->firstRunning(); job; job = next)
+		{
+			next = JobList::next(job);
+			if(job->fd != fd && job->fd != -1) continue;
+			if(kill(job->client, 0) == -1 && errno == ESRCH)
+			{
+				drop_running(job);
+				freed++;
+			}
+			else job->fd = -1;
+		}
+		for(released += freed; freed; freed--) run_next(q);
+	}
 	adjust_queues();
 
-#ifdef _SERVER_STATISTICS
-	numReleases++;
-	clock_gettime(CLOCK_MONOTONIC, &releaseEnd);
-	releaseTime += toNS(releaseEnd) - toNS(releaseStart);
+#ifdef _SERVER_VERBOSE
+	printf("hung up, dropped %lu waiting & %lu running kernel(s)\n", dropped,
+				 released);
 #endif
-	return SUCCESS;
+	return server_close_connection(channel, &conn);
 }
 
 /*
@@ -731,13 +1734,14 @@ static int send_queues(struct connection& conn)
 	conn.msg.sender_pid = server_pid;
 	conn.msg.type = RET_QUEUES;
 	size_t i;
-	for(i = 0; i < queues.size(); i++)
+	for(i = 0; i < queues.size() && i < MAX_ARCHES; i++)
 		conn.msg.body.num_allocs[i] = queues[i]->numRunning();
 	for(; i < MAX_ARCHES; i++)
 		conn.msg.body.num_allocs[i] = -1;
 
-	CHECK_ERR(server_send(&conn));
-	CHECK_ERR(server_close_connection(&conn));
+	// A client which went away is forgotten when its hangup arrives
+	int retval = server_send(channel, &conn);
+	if(retval != SUCCESS) return retval;
 
 #ifdef _SERVER_STATISTICS
 	numGetTables++;
@@ -757,14 +1761,203 @@ static int clear_queues(struct connection& conn)
 	for(size_t i = 0; i < queues.size(); i++)
 		queues[i]->clear();
 
-	CHECK_ERR(server_close_connection(&conn));
-
 #ifdef _SERVER_STATISTICS
 	numClears++;
 #endif
 	return SUCCESS;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Hot reloading
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Start a reloader thread (I/O thread).  Reloads requested while one is in
+ * progress are ignored, as it already re-reads the files.
+ */
+static void start_reload()
+{
+	sigset_t block, old;
+
+	if(reloading.exchange(true)) return;
+	if(reloader.joinable()) reloader.join();
+
+	// Signals are handled by the I/O thread
+	sigemptyset(&block);
+	sigaddset(&block, EXIT_SIG);
+	sigaddset(&block, CLEAR_SIG);
+	sigaddset(&block, RELOAD_SIG);
+	pthread_sigmask(SIG_BLOCK, &block, &old);
+	reloader = std::thread(reload);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/*
+ * Build a new predictor & HW queues, have the scheduler swap them in & delete
+ * whatever they replaced (reloader thread).  Queues are only rebuilt if they
+ * came from a configuration file.
+ */
+static void reload()
+{
+	struct timespec start, built;
+	std::future<Model*> swapped;
+	Reload request;
+	Model* old;
+	Command cmd;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	printf("Reloading model '%s', transforms '%s' & configuration '%s'\n",
+				 model_fn.c_str(), transform_fn.c_str(), config_fn.c_str());
+	request.model = new_model();
+	if(!request.model ||
+		 (config_fn != "n/a" && build_queues(request.queues) != SUCCESS) ||
+		 !std::all_of(request.queues.begin(), request.queues.end(),
+									has_prediction_slot))
+	{
+		fprintf(stderr, "Reload failed, keeping the current configuration\n");
+		if(request.model) delete_model(request.model);
+		for(HWQueue* queue : request.queues) delete queue;
+		reloading = false;
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &built);
+
+	// Swap
+	memset(&cmd.conn, 0, sizeof(struct connection));
+	cmd.conn.msg.type = RELOAD_SERVER;
+	cmd.job = NULL;
+	cmd.reload = &request;
+	swapped = request.swapped.get_future();
+	commands.push(cmd);
+	old = swapped.get();
+
+	// Wait until no worker is using the old predictor
+	model->synchronize();
+	if(old == request.model)
+		fprintf(stderr, "Reload rejected, keeping the current configuration\n");
+	else
+		printf("Reloaded: built in %.1f ms, swapped in %.1f us, migrated %lu "
+					 "waiting & %lu running job(s)\n",
+					 (toNS(built) - toNS(start)) / 1e6, request.swapTime / 1e3,
+					 request.numWaiting, request.numRunning);
+	delete_model(old);
+	for(HWQueue* queue : request.queues) delete queue;
+	reloading = false;
+}
+
+/*
+ * Return true if a HW queue matches one of the predictor's output slots.
+ * Policies assume every queue has predictions, so a reloaded configuration
+ * may not introduce queues without one.
+ */
+static bool has_prediction_slot(const HWQueue* queue)
+{
+	struct resource_alloc alloc;
+	alloc.platform = queue->platform();
+	alloc.device = queue->device();
+	alloc.compute_units = queue->computeUnits();
+	if(utility::alloc_to_slot(alloc) != NO_PREDICTION_SLOT) return true;
+	fprintf(stderr, "HW queue %lu/%lu with %lu compute unit(s) has no "
+					"prediction slot\n", queue->platform(), queue->device(),
+					queue->computeUnits());
+	return false;
+}
+
+/*
+ * Swap in a new predictor & HW queues between two requests (scheduler).
+ * Waiting jobs keep their predictions & are placed again, oldest first, on
+ * the new queues.  Running jobs move to a new queue for the same device, so
+ * the reload is rejected if a device with running jobs has been removed.
+ */
+static void reload_server(Reload* reload)
+{
+	struct timespec start, end;
+	std::vector<Job*> waiting;
+	Job* job;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	reload->numWaiting = reload->numRunning = 0;
+	if(!reload->queues.empty())
+	{
+		for(HWQueue* queue : queues)
+		{
+			for(job = queue->firstRunning(); job; job = JobList::next(job))
+			{
+				if(find_queue(reload->queues, job->alloc)) continue;
+				fprintf(stderr, "Device %u/%u has running jobs but no HW queue\n",
+								job->alloc.platform, job->alloc.device);
+				reload->swapTime = 0;
+				reload->swapped.set_value(reload->model);
+				return;
+			}
+		}
+	}
+
+	Model* old = model->exchange(reload->model);
+	if(!reload->queues.empty())
+	{
+		for(HWQueue* queue : queues)
+		{
+			while((job = queue->dequeue())) waiting.push_back(job);
+			while((job = queue->firstRunning()))
+			{
+				find_queue(reload->queues, job->alloc)->adopt(job);
+				reload->numRunning++;
+			}
+			delete queue;
+		}
+		for(PartitionedDevice* device : partitioned)
+			delete device;
+
+		queues.swap(reload->queues);
+		reload->queues.clear();
+		for(size_t i = 0; i < queues.size(); i++)
+			queues[i]->setIndex(i);
+		utility::build_slot_tables();
+		partitioned = PartitionedDevice::discover();
+
+		std::stable_sort(waiting.begin(), waiting.end(),
+			[](const Job* a, const Job* b)
+			{ return a->queuedTime() < b->queuedTime(); });
+		for(Job* migrated : waiting)
+		{
+			struct timespec queued = migrated->queued;
+			Candidates candidates;
+			utility::get_candidates(migrated, candidates);
+			// Keep original queueing time
+			if(place_job(migrated, candidates) == SUCCESS)
+				migrated->queued = queued;
+		}
+		reload->numWaiting = waiting.size();
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	reload->swapTime = toNS(end) - toNS(start);
+#ifdef _SERVER_STATISTICS
+	numReloads++;
+	reloadTime += reload->swapTime;
+#endif
+	reload->swapped.set_value(old);
+}
+
+/*
+ * Find the HW queue for a running job's device, preferring one with the same
+ * number of compute units.
+ */
+static HWQueue* find_queue(const std::vector<HWQueue*>& candidates,
+													 const struct resource_alloc& alloc)
+{
+	HWQueue* found = NULL;
+	for(HWQueue* queue : candidates)
+	{
+		if(queue->platform() != alloc.platform || queue->device() != alloc.device)
+			continue;
+		if(queue->computeUnits() == alloc.compute_units) return queue;
+		if(!found) found = queue;
+	}
+	return found;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Cleanup
 ///////////////////////////////////////////////////////////////////////////////
@@ -779,14 +1972,51 @@ static int cleanup()
 		return SUCCESS;
 	cleanup_flag = 1;
 
+	// Write out remaining events
+	if(events)
+	{
+		events->close();
+		printf("Event log: %lu event(s) written, %lu dropped\n",
+			events->numWritten(), events->numDropped());
+		delete events;
+	}
+
+	// Keep what was learned for the next server
+	if(calibration)
+	{
+		if(calibration->save(calibration_fn))
+			printf("Calibration: %lu signature(s) saved, %lu of %lu prediction(s) "
+						 "corrected\n", calibration->numSignatures(),
+						 calibration->numCorrections(), numAssigns);
+		else
+			fprintf(stderr, "Warning: could not save calibration state '%s'\n",
+							calibration_fn.c_str());
+		delete calibration;
+	}
+
 	// Destroy predictors + runtimes
-	delete predictor;
+	bool caching = model->get()->cache != NULL;
+	delete_model(model->get());
+	delete model;
+	if(caching)
+		printf("Prediction cache: %lu hit(s), %lu miss(es), %lu eviction(s)\n",
+					 cacheHits, cacheMisses, cacheEvictions);
+	stats.close();
+	if(meter)
+	{
+		meter->printStatistics();
+		delete meter;
+	}
+	delete policy;
+	delete profile;
+	for(size_t i = 0; i < partitioned.size(); i++)
+		delete partitioned[i];
 	for(size_t i = 0; i < queues.size(); i++)
 		delete queues[i];
 	delete_cl_runtime(cl_rt);
 
 	// Close & remove PID/socket file - warn if not completed correctly
-	if(remove(SERVER_PID_FILE)) {
+	if(remove(pid_fn.c_str())) {
 #ifdef _SERVER_VERBOSE
 		perror("Error deleting PID file");
 #endif
@@ -804,12 +2034,29 @@ static int cleanup()
 				 "  Number of assigns: %lu\n"
 				 "  Number of releases: %lu\n"
 				 "  Number of get-tables: %lu\n"
-				 "  Number of clears: %lu\n\n"
+				 "  Number of clears: %lu\n"
+				 "  Number of repartitions: %lu\n"
+				 "  Number of reloads: %lu\n"
+				 "  Number of steals: %lu\n\n"
 
 				 "  Average 'assign' overhead: %llu\n"
-				 "  Average 'release' overhead: %llu\n",
+				 "  Average 'release' overhead: %llu\n"
+				 "  Average prediction time: %llu\n"
+				 "  Average repartition time: %llu\n"
+				 "  Average reload time: %llu\n"
+				 "  Average steal slowdown: %.3f\n",
 		numRequestsServed, numNotifies, numAssigns, numReleases, numGetTables,
-		numClears, assignTime / numAssigns, releaseTime / numReleases);
+		numClears, numRepartitions, numReloads, numSteals, assignTime / numAssigns,
+		releaseTime / numReleases, predictTime.load() / numAssigns,
+		numRepartitions ? repartitionTime / numRepartitions : 0,
+		numReloads ? reloadTime / numReloads : 0,
+		numSteals ? stealSlowdown / numSteals : 0.0);
+
+	printf("\n  Finished jobs by priority class:\n");
+	for(size_t i = 0; i < AIRA_NUM_PRIORITIES; i++)
+		printf("    %s: %lu, %lu of %lu deadline(s) missed\n",
+					 stats_class_name(i), classFinished[i], classMissed[i],
+					 classDeadlines[i]);
 #endif
 
 	return SUCCESS;
@@ -820,24 +2067,42 @@ static int cleanup()
 ///////////////////////////////////////////////////////////////////////////////
 
 /*
- * Signal handler for EXIT_SIG, sends a message that tells the server to exit.
+ * Signal handler for EXIT_SIG, tells the I/O thread to shut the server down.
  */
 static void exit_sig(int sig)
 {
-	cleanup();
-	exit(SUCCESS);
+	exit_flag = 1;
+	wake_io_thread();
 }
 
 /*
- * Signal handler for CLEAR_SIG, clears the run queues in the server.
+ * Signal handler for CLEAR_SIG, tells the I/O thread to have the scheduler
+ * clear the run queues.
  */
 static void clear_sig(int sig)
 {
-#ifdef _SERVER_VERBOSE
-	printf("clear queues\n");
-#endif
+	clear_flag = 1;
+	wake_io_thread();
+}
 
-	for(size_t i = 0; i < queues.size(); i++)
-		queues[i]->clear();
+/*
+ * Signal handler for RELOAD_SIG, tells the I/O thread to start a reload.
+ */
+static void reload_sig(int sig)
+{
+	reload_flag = 1;
+	wake_io_thread();
 }
 
+/*
+ * Make sure the I/O thread sees a flag set by a signal handler.  The signal
+ * may have been delivered to another thread, or just before the I/O thread
+ * started waiting for events, so interrupting its wait isn't enough.
+ */
+static void wake_io_thread()
+{
+	uint64_t wake = 1;
+	int saved = errno;
+	if(wakeup_fd != -1 && write(wakeup_fd, &wake, sizeof(wake))) {}
+	errno = saved;
+}
@@ -0,0 +1,236 @@
+/*
+ * Implementation of the live statistics page.
+ */
+
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <cerrno>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "server/server.h"
+#include "server/stats.h"
+
+#define inc(field, val) __atomic_fetch_add(&(field), (val), __ATOMIC_RELAXED)
+#define set(field, val) __atomic_store_n(&(field), (val), __ATOMIC_RELAXED)
+
+static inline uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return toNS(ts);
+}
+
+StatsPage::StatsPage() : page(NULL)
+{
+	static_assert(STATS_CLASSES == AIRA_NUM_PRIORITIES,
+								"stats page must have a table entry per priority class");
+	for(size_t i = 0; i <= STATS_KERNELS; i++) scales[i] = 0.0;
+}
+
+StatsPage::~StatsPage()
+{
+	close();
+}
+
+/*
+ * Return the PID of the running server which publishes an existing page, or 0
+ * if there's no page or its server has exited.
+ */
+static pid_t page_owner(const std::string& name)
+{
+	struct stat st;
+	pid_t pid = 0;
+	void* mem;
+
+	int fd = shm_open(name.c_str(), O_RDONLY, 0);
+	if(fd == -1) return 0;
+	if(!fstat(fd, &st) && (size_t)st.st_size >= sizeof(struct stats_page))
+	{
+		mem = mmap(NULL, sizeof(struct stats_page), PROT_READ, MAP_SHARED, fd, 0);
+		if(mem != MAP_FAILED)
+		{
+			pid = ((const struct stats_page*)mem)->server_pid;
+			munmap(mem, sizeof(struct stats_page));
+		}
+	}
+	::close(fd);
+
+	if(pid <= 0 || pid == getpid() || (kill(pid, 0) && errno == ESRCH))
+		return 0;
+	return pid;
+}
+
+/*
+ * The page is world-readable so that unprivileged users can monitor the
+ * server, but only the server can write it.  Pages of running servers are
+ * never replaced, so another instance can't steal the page by name.
+ */
+bool StatsPage::open(const std::string& name, const char* predictor)
+{
+	if(page) return false;
+
+	pid_t owner = page_owner(name);
+	if(owner)
+	{
+		fprintf(stderr, "Statistics page '%s' belongs to a running server "
+						"(pid %d)\n", name.c_str(), owner);
+		return false;
+	}
+	shm_unlink(name.c_str());
+	int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL,
+										S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if(fd == -1) return false;
+	fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH); // Ignore umask
+	if(ftruncate(fd, sizeof(struct stats_page)))
+	{
+		::close(fd);
+		shm_unlink(name.c_str());
+		return false;
+	}
+	page = (struct stats_page*)mmap(NULL, sizeof(struct stats_page),
+																	PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if(page == MAP_FAILED)
+	{
+		page = NULL;
+		shm_unlink(name.c_str());
+		return false;
+	}
+
+	shmName = name;
+	memset(page, 0, sizeof(struct stats_page));
+	page->server_pid = getpid();
+	page->start_time = now_ns();
+	strncpy(page->predictor, predictor, sizeof(page->predictor) - 1);
+	page->num_slots = prediction_slots < STATS_MAX_SLOTS ?
+										prediction_slots : STATS_MAX_SLOTS;
+	__atomic_store_n(&page->version, STATS_VERSION, __ATOMIC_RELEASE);
+	return true;
+}
+
+void StatsPage::close()
+{
+	if(!page) return;
+	munmap(page, sizeof(struct stats_page));
+	shm_unlink(shmName.c_str());
+	page = NULL;
+}
+
+void StatsPage::add(struct stats_histogram& hist, uint64_t ns)
+{
+	inc(hist.buckets[stats_bucket(ns)], 1);
+	inc(hist.sum, ns);
+	inc(hist.count, 1);
+}
+
+void StatsPage::publishQueues(uint64_t requests)
+{
+	if(!page) return;
+
+	size_t i, num = queues.size() < STATS_MAX_QUEUES ?
+									queues.size() : STATS_MAX_QUEUES;
+	uint64_t seq = page->seq;
+
+	set(page->seq, seq + 1);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	for(i = 0; i < num; i++)
+	{
+		struct stats_queue& entry = page->queues[i];
+		set(entry.platform, (uint32_t)queues[i]->platform());
+		set(entry.device, (uint32_t)queues[i]->device());
+		set(entry.compute_units, (uint32_t)queues[i]->computeUnits());
+		set(entry.max_running, (uint32_t)queues[i]->maxRunning());
+		set(entry.running, (uint32_t)queues[i]->numRunning());
+		set(entry.queued, (uint32_t)queues[i]->numQueued());
+	}
+	set(page->num_queues, (uint32_t)num);
+	set(page->update_time, now_ns());
+	set(page->requests, requests);
+	__atomic_store_n(&page->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* Jobs which started without waiting have no queueing time */
+void StatsPage::started(const Job* job, size_t queue)
+{
+	if(!page || queue >= STATS_MAX_QUEUES) return;
+	struct stats_queue_times& times = page->times[queue];
+	uint64_t wait = 0;
+	if(job->queuedTime() && job->startTime() >= job->queuedTime())
+		wait = job->startTime() - job->queuedTime();
+	inc(times.started, 1);
+	add(times.wait, wait);
+
+	if(job->priority >= STATS_CLASSES) return;
+	struct stats_class& cls = page->classes[job->priority];
+	inc(cls.started, 1);
+	add(cls.wait, wait);
+}
+
+void StatsPage::finished(const Job* job, size_t queue)
+{
+	if(!page || queue >= STATS_MAX_QUEUES) return;
+	if(job->endTime() < job->startTime()) return;
+
+	uint64_t observed = job->endTime() - job->startTime();
+	struct stats_queue_times& times = page->times[queue];
+	inc(times.finished, 1);
+	add(times.service, observed);
+
+	if(job->priority < STATS_CLASSES)
+	{
+		struct stats_class& cls = page->classes[job->priority];
+		inc(cls.finished, 1);
+		if(job->endTime() >= job->arrival)
+			add(cls.turnaround, job->endTime() - job->arrival);
+		if(job->deadline)
+		{
+			if(job->missedDeadline()) inc(cls.deadlines_missed, 1);
+			else inc(cls.deadlines_met, 1);
+		}
+	}
+
+	// Compare the predicted & observed runtime, then learn from the job
+	size_t slot = queues[queue]->slot();
+	size_t kernel = (0 <= job->features.kernel &&
+									 job->features.kernel < STATS_KERNELS) ?
+									job->features.kernel : STATS_KERNELS;
+	if(job->work <= 0.0f || !observed || slot >= page->num_slots) return;
+	double& scale = scales[kernel];
+	if(scale > 0.0)
+	{
+		double ratio = scale * job->work / observed;
+		double error = fabs(ratio - 1.0);
+		struct stats_accuracy& accuracy = page->accuracy[slot];
+		inc(accuracy.sum_error_ppm, (uint64_t)(error * 1e6));
+		inc(accuracy.sum_ratio_ppm, (uint64_t)(ratio * 1e6));
+		if(error <= STATS_ERROR_LOW) inc(accuracy.within_low, 1);
+		if(error <= STATS_ERROR_HIGH) inc(accuracy.within_high, 1);
+		inc(accuracy.count, 1);
+		scale += STATS_SCALE_WEIGHT * (observed / job->work - scale);
+	}
+	else scale = observed / job->work;
+}
+
+void StatsPage::stolen(const Job* job, size_t queue)
+{
+	if(!page || queue >= STATS_MAX_QUEUES) return;
+	inc(page->times[queue].stolen, 1);
+	inc(page->times[queue].sum_slowdown_ppm, (uint64_t)(job->slowdown * 1e6));
+}
+
+void StatsPage::predicted(uint64_t ns)
+{
+	if(page) add(page->prediction, ns);
+}
+
+void StatsPage::cached(bool hit)
+{
+	if(!page) return;
+	if(hit) inc(page->cache_hits, 1);
+	else inc(page->cache_misses, 1);
+}
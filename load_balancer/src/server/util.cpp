@@ -23,6 +23,12 @@
  */
 static float perf_threshold = 0.2f;
 
+/*
+ * Prediction slot -> HW queues table, rebuilt whenever the set of HW queues
+ * changes.
+ */
+static std::vector<std::vector<size_t> > slot_queues;
+
 /*
  * Set the acceptable performance difference between two architectures.  This
  * determines how willing the load-balancer is to switch execution between
@@ -54,13 +60,30 @@ bool utility::better_candidate(const std::pair<int, float>& a,
 	else return false;
 }
 
+/*
+ * Build the tables mapping prediction slots to HW queues & vice versa.  Must
+ * be called whenever the set of HW queues changes.
+ */
+void utility::build_slot_tables()
+{
+	slot_queues.assign(prediction_slots, std::vector<size_t>());
+	for(HWQueue* queue : queues)
+		queue->setSlot(NO_PREDICTION_SLOT);
+	for(size_t i = 0; i < prediction_slots; i++)
+	{
+		slot_queues[i] = utility::alloc_to_index(system_devices[i]);
+		for(size_t q : slot_queues[i])
+			queues[q]->setSlot(i);
+	}
+}
+
 /*
  * Return true if a given prediction slot has an available HW queue, or false
  * otherwise.
  */
 bool utility::is_available(size_t pred_slot)
 {
-	return utility::alloc_to_index(system_devices[pred_slot]).size() != 0;
+	return !slot_queues[pred_slot].empty();
 }
 
 /*
@@ -107,6 +130,34 @@ std::vector<size_t> utility::alloc_to_index(struct resource_alloc alloc)
 	return indexes;
 }
 
+/*
+ * Convert a platform/device/CU configuration into the first matching queue
+ * index, or -1 if there is none.
+ */
+size_t utility::alloc_to_queue(struct resource_alloc alloc)
+{
+	for(size_t i = 0; i < queues.size(); i++)
+		if(alloc.platform == queues[i]->platform() &&
+			 alloc.device == queues[i]->device() &&
+			 alloc.compute_units == queues[i]->computeUnits())
+			return i;
+	return (size_t)-1;
+}
+
+/*
+ * Convert a platform/device/CU configuration into the prediction slot for
+ * that device, or NO_PREDICTION_SLOT if there is none.
+ */
+size_t utility::alloc_to_slot(const struct resource_alloc& alloc)
+{
+	for(size_t i = 0; i < prediction_slots; i++)
+		if(alloc.platform == system_devices[i].platform &&
+			 alloc.device == system_devices[i].device &&
+			 alloc.compute_units == system_devices[i].compute_units)
+			return i;
+	return NO_PREDICTION_SLOT;
+}
+
 /*
  * Convert a raw index into a platform + device number.
  */
@@ -129,22 +180,24 @@ struct resource_alloc utility::index_to_alloc(size_t index)
  */
 float utility::get_prediction(size_t q, size_t j, size_t q_to_predict)
 {
-	// Find prediction slot
-	for(size_t i = 0; i < prediction_slots; i++) {
-		if(queues[q_to_predict]->platform() == system_devices[i].platform &&
-			 queues[q_to_predict]->device() == system_devices[i].device &&
-			 queues[q_to_predict]->computeUnits() == system_devices[i].compute_units) {
-			return queues[q]->queued(j)->predictions[i];
-		}
-	}
-	CHECK_ERR(FAILURE); // Couldn't find the prediction
-	return -1.0;
+	return get_prediction(queues[q]->queued(j), q_to_predict);
+}
+
+/*
+ * Get a job's prediction for queue 'q_to_predict'
+ */
+float utility::get_prediction(Job* job, size_t q_to_predict)
+{
+	size_t slot = queues[q_to_predict]->slot();
+	if(slot == NO_PREDICTION_SLOT)
+		CHECK_ERR(FAILURE); // Couldn't find the prediction
+	return job->predictions[slot];
 }
 
 /*
  * Find candidate HW queues, sorted from best to worst.
  */
-std::vector<size_t> utility::get_candidates(Job* job)
+void utility::get_candidates(Job* job, Candidates& hwQueues)
 {
 	// Get the best (i.e. preferred) architecture
 	std::pair<size_t, float> best(0, -1000.0f);
@@ -155,7 +208,7 @@ std::vector<size_t> utility::get_candidates(Job* job)
 	}
 
 	// Find candidate prediction slots
-	std::vector<std::pair<size_t, float> > candidates;
+	InlineVector<std::pair<size_t, float>, MAX_PREDICTION_SLOTS> candidates;
 	candidates.push_back(best);
 	for(size_t i = 0; i < job->predictions.size(); i++)
 		if(i != best.first && is_available(i) &&
@@ -163,15 +216,10 @@ std::vector<size_t> utility::get_candidates(Job* job)
 			candidates.push_back(std::pair<size_t, float>(i, job->predictions[i]));
 	std::sort(candidates.begin(), candidates.end(), utility::better_candidate);
 
-	// Convert prediction slots into HW queues & return candidates
-	std::vector<size_t> queues;
+	// Convert prediction slots into HW queues
+	hwQueues.clear();
 	for(std::pair<size_t, float> pair : candidates)
-	{
-		struct resource_alloc tmp = system_devices[pair.first];
-		std::vector<size_t> tmp_queues = utility::alloc_to_index(tmp);
-		for(size_t i : tmp_queues)
-			queues.push_back(i);
-	}
-	return queues;
+		for(size_t i : slot_queues[pair.first])
+			hwQueues.push_back(i);
 }
 
@@ -8,13 +8,13 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 /* Number of predictor output slots */
-const size_t prediction_slots = 6;
+size_t prediction_slots = 6;
 
 /* Default CPU device in the system (used to convert statistics into ratios) */
-const size_t default_cpu = 0;
+size_t default_cpu = 0;
 
 /* Device types of predictor output slots */
-const cl_device_type device_types[] = {
+cl_device_type device_types[SYSTEM_MAX_SLOTS] = {
 	CL_DEVICE_TYPE_CPU, // Xeon E5-1650 v2 12C
 	CL_DEVICE_TYPE_CPU, // '' 6C
 	CL_DEVICE_TYPE_CPU, // '' 4C
@@ -24,7 +24,7 @@ const cl_device_type device_types[] = {
 };
 
 /* Map prediction output slots to struct resource_allocation */
-const struct resource_alloc system_devices[] = {
+struct resource_alloc system_devices[SYSTEM_MAX_SLOTS] = {
 	{ // Xeon E5-1650 v2 12C
 		.platform = 0,
 		.device = 0,
@@ -67,12 +67,12 @@ const struct resource_alloc system_devices[] = {
 ///////////////////////////////////////////////////////////////////////////////
 
 /* NPB runtime statistics */
-const float rt_mean = 0.0f;
-const float rt_max = 0.0f;
-const float rt_min = 0.0f;
+float rt_mean = 0.0f;
+float rt_max = 0.0f;
+float rt_min = 0.0f;
 
 /* NPB benchmark runtimes on each architecture -- values are in seconds. */
-const float runtime [][40] = {
+float runtime [SYSTEM_MAX_SLOTS][SYSTEM_NUM_BENCHMARKS] = {
 	{ // Xeon E5-1650 v2 12C
 		0.055f, 0.418f,  9.176f,  37.230f, 151.854f, // BT (S, W, A, B, C)
 		0.076f, 0.123f,  0.540f,  17.309f,  46.575f, // CG
@@ -145,13 +145,13 @@ const float runtime [][40] = {
 };
 
 /* NPB energy consumption statistics */
-const float energy_mean = 0.0f;
-const float energy_max = 0.0f;
-const float energy_min = 0.0f;
+float energy_mean = 0.0f;
+float energy_max = 0.0f;
+float energy_min = 0.0f;
 
 /* NPB benchmark energy consumption on each architecture -- values are in
  * joules. */
-const float energy [][40] = {
+float energy [SYSTEM_MAX_SLOTS][SYSTEM_NUM_BENCHMARKS] = {
 	{ // Xeon E5-1650 v2 12C
 		13.616f,  61.980f, 1210.679f,  5304.680f, 23232.412f, // BT (S, W, A, B, C)
 		14.581f,  23.400f,   72.104f,  2099.540f,  5964.362f, // CG
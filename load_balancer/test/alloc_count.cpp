@@ -0,0 +1,165 @@
+/*
+ * Checks that the building blocks of the server's request path -- work
+ * queues, predictors, candidate lists, HW queues, policies & the job pool --
+ * don't touch the heap once they have warmed up.  Each iteration hands a
+ * request between threads' work queues, predicts it, places it on a HW queue
+ * (running or waiting) & releases a running job, starting or stealing a
+ * waiting job in its place.  These steps mirror assign_resources() &
+ * release_resources(), which are private to the server, so the scheduler's
+ * own bookkeeping (batches, repartitioning, events & statistics) isn't
+ * covered.  Global operator new/delete are replaced to count allocations.
+ */
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <new>
+#include <vector>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "server_fixture.h"
+#include "kernels.h"
+#include "server/util.h"
+#include "server/work_queue.h"
+#include "server/policy.h"
+
+static const char* help =
+"alloc_count - check request path data structures for heap allocations\n\n"
+"Usage: ./alloc_count [ OPTIONS ]\n"
+"Options:\n"
+"  -h     : print help & exit\n"
+"  -i num : number of request/release pairs (default: 1000000)\n"
+"  -d num : number of outstanding jobs (default: 32)\n";
+
+///////////////////////////////////////////////////////////////////////////////
+// Allocation counting
+///////////////////////////////////////////////////////////////////////////////
+
+static std::atomic<unsigned long> num_allocs(0);
+
+// Not inlined, otherwise GCC flags the malloc/free pairing as mismatched
+__attribute__((noinline)) void* operator new(size_t size)
+{
+	num_allocs++;
+	void* ptr = malloc(size ? size : 1);
+	if(!ptr) throw std::bad_alloc();
+	return ptr;
+}
+
+__attribute__((noinline)) void operator delete(void* ptr) noexcept
+{
+	free(ptr);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Scheduler steps
+///////////////////////////////////////////////////////////////////////////////
+
+/* Running jobs' client PIDs, so releases can find them like clients do */
+static pid_t running_pids[MAX_QUEUES];
+static size_t num_running = 0;
+
+static void start(size_t q, Job* job)
+{
+	queues[q]->running(job);
+	running_pids[num_running++] = job->client;
+}
+
+/* Predict & place a job, mirroring assign_resources() */
+static void assign(Predictor* model, Policy* policy, Job* job)
+{
+	Candidates candidates;
+
+	model->predict(job->features, job->predictions);
+	utility::get_candidates(job, candidates);
+	size_t q = policy->place(job, candidates, 0);
+	if(queues[q]->canRun(job)) start(q, job);
+	else queues[q]->enqueue(job);
+}
+
+/* Release a running job & find another to run, mirroring release_resources() */
+static void release(Policy* policy, size_t which)
+{
+	pid_t pid = running_pids[which];
+	running_pids[which] = running_pids[--num_running];
+
+	Job* job = HWQueue::findRunning(pid, utility::index_to_alloc(0));
+	assert(job && "could not find running job");
+	size_t q = job->queue->index();
+	queues[q]->finished(job);
+	policy->finished(job);
+	delete job;
+
+	job = policy->next(q);
+	if(job) start(q, job);
+}
+
+int main(int argc, char** argv)
+{
+	int c;
+	size_t iterations = 1000000, depth = 32, i, p;
+	unsigned long allocs;
+	pid_t pid = 1;
+	WorkQueue<Job*> work;
+
+	while((c = getopt(argc, argv, "hi:d:")) != -1)
+	{
+		switch(c)
+		{
+		case 'h':
+			printf("%s", help);
+			return 0;
+		case 'i':
+			iterations = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			depth = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			printf("Warning: unknown argument '%c'\n", c);
+			break;
+		}
+	}
+
+	// Mirror the default queues on frankenstein: 12C CPU & Titan
+	add_queue(0, 12);
+	add_queue(1, 14);
+	utility::build_slot_tables();
+	Predictor* model = new ExactRuntime();
+	Policy* policies[] = { new FirstFitPolicy(), new ShortestCompletionPolicy(),
+												 new MinEDPPolicy() };
+
+	// Warm up: fill the queues & let pools and buffers reach steady state
+	for(i = 0; i < depth; i++)
+		assign(model, policies[0], new_job(pid++, i % (SP_C + 1)));
+	for(p = 0; p < NUM_POLICIES; p++)
+	{
+		for(i = 0; i < 1000; i++)
+		{
+			work.push(new_job(pid++, i % (SP_C + 1)));
+			assign(model, policies[p], work.pop());
+			release(policies[p], i % num_running);
+		}
+
+		allocs = num_allocs;
+		for(i = 0; i < iterations; i++)
+		{
+			work.push(new_job(pid++, (i * 7) % (SP_C + 1)));
+			assign(model, policies[p], work.pop());
+			release(policies[p], i % num_running);
+		}
+		allocs = num_allocs - allocs;
+
+		printf("%s: %lu allocation(s) over %lu request/release pair(s)\n",
+					 policyNames[p], allocs, iterations);
+		if(allocs)
+		{
+			printf("Request path allocated!\n");
+			return 1;
+		}
+	}
+	printf("All tests passed\n");
+	return 0;
+}
@@ -0,0 +1,156 @@
+/*
+ * Exercises the asynchronous allocation API: submit/poll, wait with a
+ * timeout, completion callbacks & batched requests.  Reports how much host
+ * work was overlapped with waiting for the daemon.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <assert.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "aira_runtime.h"
+#include "kernels.h"
+
+static const char* help =
+"async_alloc - test asynchronous & batched allocation requests\n\n"
+"Usage: ./async_alloc [ OPTIONS ]\n"
+"Options:\n"
+"  -h     : print help & exit\n"
+"  -i num : number of requests per test (default: 1000)\n"
+"  -b num : kernels per batched request (default: 4)\n";
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int num_called = 0;
+
+static void print_alloc(const char* test, struct resource_alloc alloc)
+{
+	printf("%s: platform %u, device %u, %u compute unit(s)\n", test,
+				 alloc.platform, alloc.device, alloc.compute_units);
+}
+
+/* "Run" each kernel as soon as it's assigned */
+static void callback(aira_conn conn, int index, struct resource_alloc alloc,
+										 void* data)
+{
+	aira_kernel_finish_batch(conn, index);
+
+	pthread_mutex_lock(&lock);
+	num_called++;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&lock);
+}
+
+int main(int argc, char** argv)
+{
+	int c, i, index, status, num_batch = 4, num_entries;
+	int entries[AIRA_MAX_BATCH];
+	unsigned long iterations = 1000, n, polls = 0;
+	struct kernel_features feats[AIRA_MAX_BATCH];
+	struct resource_alloc alloc, allocs[AIRA_MAX_BATCH];
+	aira_conn conn;
+
+	while((c = getopt(argc, argv, "hi:b:")) != -1)
+	{
+		switch(c)
+		{
+		case 'h':
+			printf("%s", help);
+			return 0;
+		case 'i':
+			iterations = strtoul(optarg, NULL, 10);
+			break;
+		case 'b':
+			num_batch = atoi(optarg);
+			break;
+		default:
+			printf("Warning: unknown argument '%c'\n", c);
+			break;
+		}
+	}
+	assert(0 < num_batch && num_batch <= AIRA_MAX_BATCH);
+	for(i = 0; i < AIRA_MAX_BATCH; i++)
+		feats[i].kernel = (EP_C + (i * 5)) % (SP_C + 1);
+
+	conn = aira_init_conn();
+	assert(conn);
+
+	// Submit & poll, overlapping "host work" with the request
+	for(n = 0; n < iterations; n++)
+	{
+		status = aira_alloc_resources_async(conn, &feats[0]);
+		assert(status == AIRA_ALLOC_PENDING);
+		while((status = aira_alloc_poll(conn, allocs)) == AIRA_ALLOC_PENDING)
+			polls++;
+		assert(status == AIRA_ALLOC_READY);
+		aira_kernel_finish(conn);
+	}
+	print_alloc("poll", allocs[0]);
+	printf("poll: %lu poll(s) returned pending over %lu request(s)\n",
+				 polls, iterations);
+
+	// Wait with a timeout
+	for(n = 0; n < iterations; n++)
+	{
+		status = aira_alloc_resources_async(conn, &feats[1]);
+		assert(status == AIRA_ALLOC_PENDING);
+		status = aira_alloc_wait(conn, 1000, allocs);
+		assert(status == AIRA_ALLOC_READY);
+		aira_kernel_finish(conn);
+	}
+	print_alloc("wait", allocs[0]);
+
+	// Query the queues while a request is outstanding; the assignment may
+	// arrive first & must not be lost
+	aira_get_current_alloc(conn, &num_entries, NULL);
+	assert(num_entries <= AIRA_MAX_BATCH);
+	for(n = 0; n < iterations; n++)
+	{
+		status = aira_alloc_resources_async(conn, &feats[1]);
+		assert(status == AIRA_ALLOC_PENDING);
+		aira_get_current_alloc(conn, &num_entries, entries);
+		assert(entries[0] >= 0);
+		status = aira_alloc_wait(conn, 1000, allocs);
+		assert(status == AIRA_ALLOC_READY);
+		aira_kernel_finish(conn);
+	}
+	printf("queues: %d entries while requests were outstanding\n", num_entries);
+
+	// Completion callback, finishing kernels from inside the callback.  The
+	// batch may be larger than the number of devices, so kernels must finish
+	// before the rest can be assigned.
+	status = aira_alloc_resources_batch_async(conn, num_batch, feats);
+	assert(status == AIRA_ALLOC_PENDING);
+	status = aira_alloc_set_callback(conn, callback, NULL);
+	assert(status == AIRA_ALLOC_PENDING);
+	pthread_mutex_lock(&lock);
+	while(num_called < num_batch) pthread_cond_wait(&cond, &lock);
+	pthread_mutex_unlock(&lock);
+	printf("callback: %d kernel(s) assigned\n", num_called);
+
+	// Batched requests, starting kernels in the order they're assigned
+	for(n = 0; n < iterations; n++)
+	{
+		status = aira_alloc_resources_batch_async(conn, num_batch, feats);
+		assert(status == AIRA_ALLOC_PENDING);
+		for(i = 0; i < num_batch; i++)
+		{
+			status = aira_alloc_next(conn, 1000, &index, &allocs[i]);
+			assert(status == AIRA_ALLOC_READY);
+			aira_kernel_finish_batch(conn, index);
+		}
+		status = aira_alloc_next(conn, 0, &index, &alloc);
+		assert(status == AIRA_ALLOC_ERROR && index == -1);
+	}
+	status = aira_alloc_wait(conn, 0, allocs);
+	assert(status == AIRA_ALLOC_READY);
+	for(i = 0; i < num_batch; i++)
+		print_alloc(npb_kernel_names[feats[i].kernel], allocs[i]);
+
+	aira_free_conn(conn);
+	printf("All tests passed\n");
+	return 0;
+}
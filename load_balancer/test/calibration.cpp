@@ -0,0 +1,105 @@
+/*
+ * Checks online predictor calibration: a kernel whose predictions are wrong
+ * must be re-ranked by its observed runtimes, other kernels must be left
+ * alone, & learned state must survive a save/load round trip.
+ */
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <unistd.h>
+
+#include "server_fixture.h"
+#include "server/calibration.h"
+
+/* Observed runtimes (ns) of the mis-predicted kernel on slots 0 & 1 */
+#define CPU_RUNTIME 4000000
+#define GPU_RUNTIME 1000000
+
+/* A kernel with distinct features & predictions for slots 0 & 1 */
+static Job* new_request(int kernel, float cpu, float gpu)
+{
+	Job* job = new_job(0, kernel);
+	for(size_t i = 0; i < NUM_FEATURES; i++)
+		job->features.feature[i] = kernel * 10.0 + i;
+	for(size_t i = 0; i < job->predictions.size(); i++)
+		job->predictions[i] = -1.0f;
+	job->predictions[0] = cpu;
+	job->predictions[1] = gpu;
+	return job;
+}
+
+static void run(Calibration& calibration, int kernel, size_t slot,
+								long runtime)
+{
+	Job* job = new_request(kernel, 1.0f, 1.0f);
+	job->start.tv_sec = 1;
+	job->start.tv_nsec = 0;
+	job->end.tv_sec = 1 + runtime / 1000000000;
+	job->end.tv_nsec = runtime % 1000000000;
+	calibration.observe(job, slot);
+	delete job;
+}
+
+/* The model claims the CPU is 4x faster, it's actually 4x slower */
+static void check_corrected(Calibration& calibration)
+{
+	Job* job = new_request(1, 1.0f, 0.25f);
+	assert(calibration.correct(job) && "kernel not calibrated");
+	printf("Corrected predictions: %.3f %.3f\n", job->predictions[0],
+				 job->predictions[1]);
+	assert(fabs(job->predictions[0] - 1.0f) < 1e-3 &&
+				 fabs(job->predictions[1] - 4.0f) < 1e-2 && "bad correction");
+	assert(job->predictions[2] == -1.0f && "unusable slot changed");
+	delete job;
+}
+
+int main(int argc, char** argv)
+{
+	std::string file = "/tmp/aira-lb-calibration.test";
+	Calibration calibration, reloaded;
+	Job* job;
+
+	// Nothing observed, nothing corrected
+	job = new_request(1, 1.0f, 0.25f);
+	assert(!calibration.correct(job) && job->predictions[1] == 0.25f);
+	delete job;
+
+	// A single observation isn't trusted
+	run(calibration, 1, 0, CPU_RUNTIME);
+	run(calibration, 1, 1, GPU_RUNTIME);
+	job = new_request(1, 1.0f, 0.25f);
+	assert(!calibration.correct(job) && "corrected too early");
+	delete job;
+
+	run(calibration, 1, 0, CPU_RUNTIME);
+	run(calibration, 1, 1, GPU_RUNTIME);
+	check_corrected(calibration);
+
+	// Runtimes on only the GPU are scaled by the model's CPU runtime
+	run(calibration, 2, 1, GPU_RUNTIME);
+	run(calibration, 2, 1, GPU_RUNTIME);
+	job = new_request(2, 1.0f, 2.0f);
+	assert(calibration.correct(job) &&
+				 fabs(job->predictions[1] - 2.0f) < 1e-3 &&
+				 "single-slot kernel changed");
+	delete job;
+
+	// Other kernels are untouched
+	job = new_request(3, 1.0f, 0.25f);
+	assert(!calibration.correct(job) && job->predictions[1] == 0.25f);
+	delete job;
+
+	// Round trip
+	assert(calibration.save(file) && "could not save");
+	assert(reloaded.load(file) && "could not load");
+	assert(reloaded.numSignatures() == calibration.numSignatures());
+	check_corrected(reloaded);
+	unlink(file.c_str());
+	assert(!reloaded.load(file) && "loaded missing file");
+
+	printf("All tests passed\n");
+	return 0;
+}
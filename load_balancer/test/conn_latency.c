@@ -0,0 +1,107 @@
+/*
+ * Measures round-trip latency of resource allocation requests to the server.
+ * Each thread opens its own connection and repeatedly requests an allocation
+ * & immediately finishes the "kernel", so the numbers reflect communication &
+ * scheduling overhead only.  Optionally re-opens the connection for every
+ * request to compare against connect-per-message.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+#include <assert.h>
+#include <getopt.h>
+#include <omp.h>
+
+#include "aira_runtime.h"
+#include "kernels.h"
+
+#define toNS( ts ) ((ts.tv_sec * 1000000000UL) + ts.tv_nsec)
+
+static const char* help =
+"conn_latency - measure allocation round-trip latency\n\n"
+"Usage: ./conn_latency [ OPTIONS ]\n"
+"Options:\n"
+"  -h     : print help & exit\n"
+"  -i num : number of requests per thread (default: 10000)\n"
+"  -t num : number of client threads (default: 1)\n"
+"  -r     : re-open the connection for every request\n";
+
+int main(int argc, char** argv)
+{
+	int c;
+	unsigned long iterations = 10000, total_ns = 0, min_ns = -1UL, max_ns = 0;
+	int threads = 1;
+	bool reconnect = false;
+	struct timespec start, end;
+
+	while((c = getopt(argc, argv, "hi:t:r")) != -1)
+	{
+		switch(c)
+		{
+		case 'h':
+			printf("%s", help);
+			return 0;
+		case 'i':
+			iterations = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'r':
+			reconnect = true;
+			break;
+		default:
+			printf("Warning: unknown argument '%c'\n", c);
+			break;
+		}
+	}
+
+	printf("Running %lu requests on %d thread(s), %s connections...\n",
+				 iterations, threads, reconnect ? "per-message" : "persistent");
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+#pragma omp parallel num_threads(threads) \
+	reduction(+:total_ns) reduction(min:min_ns) reduction(max:max_ns)
+	{
+		struct kernel_features feats = { .kernel = EP_S };
+		struct timespec req_start, req_end;
+		unsigned long i, cur;
+		aira_conn conn = NULL;
+
+		if(!reconnect)
+		{
+			conn = aira_init_conn();
+			assert(conn && "could not connect");
+		}
+		for(i = 0; i < iterations; i++)
+		{
+			clock_gettime(CLOCK_MONOTONIC, &req_start);
+			if(reconnect)
+			{
+				conn = aira_init_conn();
+				assert(conn && "could not connect");
+			}
+			aira_alloc_resources(conn, &feats);
+			aira_kernel_finish(conn);
+			if(reconnect) aira_free_conn(conn);
+			clock_gettime(CLOCK_MONOTONIC, &req_end);
+
+			cur = toNS(req_end) - toNS(req_start);
+			total_ns += cur;
+			if(cur < min_ns) min_ns = cur;
+			if(cur > max_ns) max_ns = cur;
+		}
+		if(!reconnect) aira_free_conn(conn);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("Round trip (ns): average %lu, min %lu, max %lu\n",
+				 total_ns / (iterations * threads), min_ns, max_ns);
+	printf("Throughput: %.1f requests/s\n",
+				 (double)(iterations * threads) /
+				 ((double)(toNS(end) - toNS(start)) / 1e9));
+
+	return 0;
+}
@@ -0,0 +1,126 @@
+/*
+ * Stress-tests the job lifecycle event log.  Several threads record events
+ * concurrently; every event must either be written intact or counted as
+ * dropped, & each thread's events must appear in the order it recorded them.
+ */
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "server_fixture.h"
+#include "server/event_log.h"
+
+static const char* help =
+"event_log - stress-test the job lifecycle event log\n\n"
+"Usage: ./event_log [ OPTIONS ]\n"
+"Options:\n"
+"  -h       : print help & exit\n"
+"  -t num   : number of recording threads (default: 4)\n"
+"  -n num   : number of events per thread (default: 200000)\n"
+"  -f file  : log file (default: /tmp/aira-lb-events.test)\n";
+
+static EventLog events;
+
+/* Events recorded between pauses, which let the flusher catch up */
+#define BURST 4096
+
+/*
+ * Record events whose time is their sequence number within the thread.  Bursts
+ * are paced so that the ring wraps around many times.
+ */
+static void record(int thread, size_t num)
+{
+	struct connection conn;
+	memset(&conn, 0, sizeof(struct connection));
+	conn.fd = -1;
+	conn.msg.sender_pid = thread;
+	conn.msg.type = HW_REQUEST;
+	Job* job = new Job(conn);
+
+	for(size_t i = 0; i < num; i++)
+	{
+		struct timespec time = { 0, (long)i };
+		events.record((enum event_type)(i % NUM_EVENT_TYPES), job, time, i % 4);
+		if(i % BURST == BURST - 1) usleep(2 * EVENT_LOG_FLUSH_MS * 1000);
+	}
+	delete job;
+}
+
+int main(int argc, char** argv)
+{
+	int c, num_threads = 4;
+	size_t num_events = 200000;
+	std::string file = "/tmp/aira-lb-events.test";
+	std::vector<std::thread> threads;
+
+	while((c = getopt(argc, argv, "ht:n:f:")) != -1)
+	{
+		switch(c)
+		{
+		case 'h':
+			printf("%s", help);
+			return 0;
+		case 't':
+			num_threads = atoi(optarg);
+			break;
+		case 'n':
+			num_events = strtoul(optarg, NULL, 10);
+			break;
+		case 'f':
+			file = optarg;
+			break;
+		default:
+			printf("Warning: unknown argument '%c'\n", c);
+			break;
+		}
+	}
+
+	if(!events.open(file))
+	{
+		fprintf(stderr, "Could not open '%s'\n", file.c_str());
+		return 1;
+	}
+	for(int i = 0; i < num_threads; i++)
+		threads.push_back(std::thread(record, i, num_events));
+	for(std::thread& thread : threads)
+		thread.join();
+	events.close();
+
+	uint64_t total = num_threads * num_events;
+	printf("%lu event(s) recorded, %lu written, %lu dropped\n", total,
+				 events.numWritten(), events.numDropped());
+	assert(events.numWritten() + events.numDropped() == total &&
+				 "events went missing");
+	assert((total <= EVENT_LOG_SIZE || events.numWritten() > EVENT_LOG_SIZE) &&
+				 "ring never wrapped around");
+
+	// Check the file: header, then intact events in per-thread order
+	struct event_log_header header;
+	struct event ev;
+	std::vector<long> last(num_threads, -1);
+	uint64_t num = 0;
+	FILE* fp = fopen(file.c_str(), "rb");
+	assert(fp && fread(&header, sizeof(header), 1, fp) == 1);
+	assert(!strcmp(header.magic, EVENT_LOG_MAGIC) &&
+				 header.event_size == sizeof(struct event) && "bad header");
+	while(fread(&ev, sizeof(struct event), 1, fp) == 1)
+	{
+		assert(0 <= ev.pid && ev.pid < num_threads && "corrupt event");
+		assert((long)ev.time > last[ev.pid] && "events out of order");
+		assert(ev.type == ev.time % NUM_EVENT_TYPES && ev.queue == ev.time % 4 &&
+					 "corrupt event");
+		last[ev.pid] = ev.time;
+		num++;
+	}
+	fclose(fp);
+	unlink(file.c_str());
+	assert(num == events.numWritten() && "written count doesn't match file");
+
+	printf("All tests passed\n");
+	return 0;
+}
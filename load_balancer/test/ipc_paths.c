@@ -0,0 +1,105 @@
+/*
+ * Checks the server's socket paths: sockets may be bound to any writable file
+ * (removed again on close) or to a name in the abstract namespace (no file),
+ * & names which don't fit in a socket address are rejected.  Doesn't need a
+ * running server or root privileges.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include "kernels.h"
+#include "message.h"
+#include "ipc.h"
+
+/*
+ * Send a request from a client & make sure the server gets it, then that the
+ * server is told when the client hangs up.
+ */
+static void round_trip(server_channel server, const char* name)
+{
+	struct message msg = { .sender_pid = getpid(), .type = HW_REQUEST };
+	struct connection conn;
+	client_channel client;
+	int fd, err;
+
+	msg.body.features.kernel = EP_S;
+	client = open_client_channel(name);
+	assert(client && "client could not connect");
+	err = client_send(client, &msg);
+	assert(!err && "client could not send");
+	err = server_listen(server, &conn);
+	assert(!err && "server didn't receive");
+	assert(conn.msg.type == HW_REQUEST && conn.msg.sender_pid == getpid() &&
+				 conn.msg.body.features.kernel == EP_S && "wrong message");
+	close_client_channel(client);
+
+	fd = conn.fd;
+	err = server_listen(server, &conn);
+	assert(!err && "server didn't see hangup");
+	assert(conn.msg.type == CLIENT_HANGUP && conn.fd == fd &&
+				 "hangup not reported for the client's connection");
+	err = server_close_connection(server, &conn);
+	assert(!err && "could not close connection");
+}
+
+static void check_abstract()
+{
+	server_channel server, other;
+	char name[64];
+
+	snprintf(name, sizeof(name), "@aira-lb-test.%d", getpid());
+	server = open_server_channel(name);
+	assert(server && "could not bind abstract socket");
+	assert(access(name, F_OK) && access(name + 1, F_OK) &&
+				 "abstract socket created a file");
+	round_trip(server, name);
+
+	other = open_server_channel(name);
+	assert(!other && "two servers bound the same name");
+	assert(!close_server_channel(server) && "could not close");
+	printf("abstract: clients connect, no file, names are exclusive\n");
+}
+
+static void check_file()
+{
+	char dir[] = "/tmp/aira-lb-test.XXXXXX", name[64];
+	server_channel server;
+
+	assert(mkdtemp(dir) && "could not create directory");
+	snprintf(name, sizeof(name), "%s/aira-lb.sock", dir);
+	server = open_server_channel(name);
+	assert(server && "could not bind socket file");
+	assert(!access(name, F_OK) && "no socket file");
+	round_trip(server, name);
+
+	assert(!close_server_channel(server) && "could not close");
+	assert(access(name, F_OK) && "socket file not removed");
+	rmdir(dir);
+	printf("file: clients connect, file removed on close\n");
+}
+
+static void check_too_long()
+{
+	char name[256];
+
+	memset(name, 'a', sizeof(name) - 1);
+	name[0] = '/';
+	name[sizeof(name) - 1] = '\0';
+	assert(!open_server_channel(name) && "bound a truncated path");
+	assert(!open_client_channel(name) && "connected to a truncated path");
+	printf("too long: rejected rather than truncated\n");
+}
+
+int main(int argc, char** argv)
+{
+	check_abstract();
+	check_file();
+	check_too_long();
+
+	printf("All tests passed\n");
+	return 0;
+}
@@ -0,0 +1,539 @@
+/*
+ * Load generator & latency benchmark.  Spawns client processes which request
+ * resources for kernels drawn from a mix of NPB kernels, arriving either
+ * back-to-back (closed loop) or on a schedule (open loop), & "run" each kernel
+ * by sleeping.  Reports allocation latency (request to assignment, as seen by
+ * the client), queueing delay (from the server's statistics page) & the
+ * server's overhead, i.e. the latency not spent queueing, & throughput.
+ * Results can be written as JSON & raw samples as CSV.
+ *
+ * Run against a dedicated server, e.g. one started by scripts/lb-bench on a
+ * temporary socket, as other clients' jobs skew queueing delays.
+ */
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "aira_runtime.h"
+#include "kernels.h"
+#include "ipc.h"
+#include "server/stats.h"
+
+#define toNS( ts ) ((ts.tv_sec * 1000000000ULL) + ts.tv_nsec)
+
+#define NUM_KERNELS (SP_C + 1)
+
+/* Attempts to open the statistics page of a starting server */
+#define STATS_OPEN_TRIES 20
+#define STATS_OPEN_WAIT_MS 50
+
+static const char* help =
+"load_gen - generate load on a server & measure allocation latency\n\n"
+"Usage: ./load_gen [ OPTIONS ]\n"
+"Options:\n"
+"  -h        : print help & exit\n"
+"  -n num    : number of client processes (default: 4)\n"
+"  -i num    : number of requests per process (default: 1000)\n"
+"  -a dist   : arrivals - closed, fixed, uniform or poisson (default: closed)\n"
+"  -r rate   : mean requests per second per process for open-loop arrivals"
+" (default: 100)\n"
+"  -m mix    : kernels to request, either 'all' or a comma-separated list of"
+" names with optional weights, e.g. EP.S:3,CG.W (default: all)\n"
+"  -t us     : simulated runtime of class S kernels, doubling per class"
+" (default: 100)\n"
+"  -e seed   : random seed (default: 1)\n"
+"  -s socket : server socket (default: $" SOCKET_ENV " or " SOCKET_FILE ")\n"
+"  -p name   : server's statistics page, or 'none' (default: $" STATS_SHM_ENV
+" or " STATS_SHM_NAME ")\n"
+"  -o file   : write results as JSON ('-' for stdout)\n"
+"  -R file   : write raw samples as CSV\n\n"
+"Closed-loop clients request the next kernel as soon as the previous one "
+"finishes.  Open-loop clients request kernels on a schedule, but wait for "
+"each one to be assigned & finish, so requests may start late -- lag reports "
+"by how much.\n";
+
+/* Arrival distributions */
+enum arrival {
+	CLOSED = 0,
+	FIXED,
+	UNIFORM,
+	POISSON
+};
+
+static const char* arrival_names[] = {
+	"closed", "fixed", "uniform", "poisson"
+};
+
+/* One request, times relative to the start of the run */
+struct sample {
+	uint64_t scheduled; /* When the request should have been made */
+	uint64_t submitted; /* When it was made */
+	uint64_t latency; /* From request to assignment */
+	int32_t kernel;
+	int32_t process;
+};
+
+/* Configuration */
+static unsigned long num_procs = 4;
+static unsigned long num_requests = 1000;
+static enum arrival arrivals = CLOSED;
+static double rate = 100.0;
+static std::string mix_spec = "all";
+static unsigned long kernel_us = 100;
+static unsigned long seed = 1;
+static std::string stats_name = STATS_SHM_NAME;
+static std::string json_fn = "";
+static std::string raw_fn = "";
+
+/* Kernel mix as cumulative weights */
+static std::vector<int> mix_kernels;
+static std::vector<double> mix_weights;
+
+///////////////////////////////////////////////////////////////////////////////
+// Helpers
+///////////////////////////////////////////////////////////////////////////////
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return toNS(ts);
+}
+
+static void sleep_ns(uint64_t ns)
+{
+	struct timespec ts;
+	ts.tv_sec = ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+	while(nanosleep(&ts, &ts) == -1);
+}
+
+static int kernel_index(const std::string& name)
+{
+	for(int k = 0; k < NUM_KERNELS; k++)
+		if(name == npb_kernel_names[k]) return k;
+	return -1;
+}
+
+/* Parse "all" or "name[:weight],..." */
+static bool parse_mix(const std::string& spec)
+{
+	double total = 0.0, weight;
+	size_t start = 0, end, colon;
+	int k;
+
+	mix_kernels.clear();
+	mix_weights.clear();
+	if(spec == "all")
+	{
+		for(k = 0; k < NUM_KERNELS; k++)
+		{
+			mix_kernels.push_back(k);
+			mix_weights.push_back(k + 1.0);
+		}
+		return true;
+	}
+
+	while(start < spec.size())
+	{
+		end = spec.find(',', start);
+		if(end == std::string::npos) end = spec.size();
+		std::string entry = spec.substr(start, end - start);
+		colon = entry.find(':');
+		weight = colon == std::string::npos ? 1.0 :
+						 atof(entry.substr(colon + 1).c_str());
+		if((k = kernel_index(entry.substr(0, colon))) < 0 || !(weight > 0.0))
+		{
+			fprintf(stderr, "Invalid kernel in mix: '%s'\n", entry.c_str());
+			return false;
+		}
+		total += weight;
+		mix_kernels.push_back(k);
+		mix_weights.push_back(total);
+		start = end + 1;
+	}
+	return !mix_kernels.empty();
+}
+
+static int pick_kernel(std::mt19937_64& gen)
+{
+	std::uniform_real_distribution<double> dist(0.0, mix_weights.back());
+	size_t i = std::upper_bound(mix_weights.begin(), mix_weights.end(),
+															dist(gen)) - mix_weights.begin();
+	return mix_kernels[std::min(i, mix_kernels.size() - 1)];
+}
+
+/* Time until the next request of an open-loop client */
+static uint64_t interarrival(std::mt19937_64& gen)
+{
+	double mean = 1e9 / rate;
+	switch(arrivals)
+	{
+	case FIXED:
+		return (uint64_t)mean;
+	case UNIFORM:
+		return (uint64_t)std::uniform_real_distribution<double>(0.0,
+																														2.0 * mean)(gen);
+	case POISSON:
+		return (uint64_t)std::exponential_distribution<double>(1.0 / mean)(gen);
+	default:
+		return 0;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Statistics page
+///////////////////////////////////////////////////////////////////////////////
+
+static const struct stats_page* stats = NULL;
+
+/* The server creates its page after it starts listening, so allow it time */
+static void open_stats()
+{
+	int fd = -1;
+
+	if(stats_name == "none") return;
+	for(int i = 0; i < STATS_OPEN_TRIES && fd == -1; i++)
+	{
+		if(i) sleep_ns(STATS_OPEN_WAIT_MS * 1000000ULL);
+		fd = shm_open(stats_name.c_str(), O_RDONLY, 0);
+	}
+	if(fd == -1) return;
+	void* page = mmap(NULL, sizeof(struct stats_page), PROT_READ, MAP_SHARED,
+										fd, 0);
+	close(fd);
+	if(page == MAP_FAILED) return;
+	stats = (const struct stats_page*)page;
+	if(stats->version != STATS_VERSION)
+	{
+		munmap(page, sizeof(struct stats_page));
+		stats = NULL;
+	}
+}
+
+/* Queueing delay of all classes */
+static struct stats_histogram total_wait()
+{
+	struct stats_histogram wait;
+	memset(&wait, 0, sizeof(wait));
+	for(size_t c = 0; c < STATS_CLASSES; c++)
+	{
+		const struct stats_histogram& hist = stats->classes[c].wait;
+		wait.count += hist.count;
+		wait.sum += hist.sum;
+		for(size_t b = 0; b < STATS_HIST_BUCKETS; b++)
+			wait.buckets[b] += hist.buckets[b];
+	}
+	return wait;
+}
+
+/* Upper bound of the bucket containing the p-th percentile */
+static uint64_t hist_percentile(const struct stats_histogram& hist, double p)
+{
+	uint64_t target = (uint64_t)ceil(hist.count * p), seen = 0;
+	for(size_t b = 0; b < STATS_HIST_BUCKETS; b++)
+	{
+		seen += hist.buckets[b];
+		if(seen >= target && seen) return b ? 1ULL << b : 0;
+	}
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Clients
+///////////////////////////////////////////////////////////////////////////////
+
+/* Make a client's requests, filling in its samples */
+static void client(unsigned long proc, uint64_t start, struct sample* samples)
+{
+	struct kernel_features feats;
+	std::mt19937_64 gen(seed * 1000003 + proc);
+	uint64_t scheduled = 0, now, assigned;
+	aira_conn conn;
+
+	memset(&feats, 0, sizeof(feats));
+	if(!(conn = aira_init_conn()))
+	{
+		fprintf(stderr, "Client %lu could not connect to the server\n", proc);
+		exit(1);
+	}
+
+	// Stagger open-loop clients so they don't all arrive together
+	if(arrivals != CLOSED) scheduled = interarrival(gen);
+	for(unsigned long i = 0; i < num_requests; i++)
+	{
+		struct sample& sample = samples[i];
+		feats.kernel = pick_kernel(gen);
+
+		now = now_ns() - start;
+		if(arrivals != CLOSED && now < scheduled)
+		{
+			sleep_ns(scheduled - now);
+			now = now_ns() - start;
+		}
+		sample.scheduled = arrivals != CLOSED ? scheduled : now;
+		sample.submitted = now;
+		aira_alloc_resources(conn, &feats);
+		assigned = now_ns() - start;
+		sample.latency = assigned - now;
+		sample.kernel = feats.kernel;
+		sample.process = proc;
+
+		sleep_ns(kernel_us * 1000ULL << (feats.kernel % 5));
+		aira_kernel_finish(conn);
+		if(arrivals != CLOSED) scheduled += interarrival(gen);
+	}
+	aira_free_conn(conn);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Results
+///////////////////////////////////////////////////////////////////////////////
+
+struct summary {
+	double mean;
+	uint64_t p50, p90, p99, max;
+};
+
+static struct summary summarize(std::vector<uint64_t>& values)
+{
+	struct summary sum = { 0.0, 0, 0, 0, 0 };
+	if(values.empty()) return sum;
+	std::sort(values.begin(), values.end());
+	for(uint64_t value : values) sum.mean += value;
+	sum.mean /= values.size();
+	sum.p50 = values[values.size() / 2];
+	sum.p90 = values[(values.size() * 90) / 100];
+	sum.p99 = values[(values.size() * 99) / 100];
+	sum.max = values.back();
+	return sum;
+}
+
+static void print_summary(const char* what, const struct summary& sum)
+{
+	printf("%-18s: mean %.0f ns, p50 %lu ns, p90 %lu ns, p99 %lu ns, "
+				 "max %lu ns\n", what, sum.mean, sum.p50, sum.p90, sum.p99, sum.max);
+}
+
+static void json_summary(FILE* fp, const char* what, const struct summary& sum)
+{
+	fprintf(fp, "  \"%s\": { \"mean\": %.0f, \"p50\": %lu, \"p90\": %lu, "
+					"\"p99\": %lu, \"max\": %lu },\n", what, sum.mean, sum.p50, sum.p90,
+					sum.p99, sum.max);
+}
+
+static bool write_raw(const struct sample* samples, size_t num)
+{
+	FILE* fp = fopen(raw_fn.c_str(), "w");
+	if(!fp) return false;
+	fprintf(fp, "process,kernel,scheduled_ns,submitted_ns,latency_ns\n");
+	for(size_t i = 0; i < num; i++)
+		fprintf(fp, "%d,%s,%lu,%lu,%lu\n", samples[i].process,
+						npb_kernel_names[samples[i].kernel], samples[i].scheduled,
+						samples[i].submitted, samples[i].latency);
+	return !fclose(fp);
+}
+
+int main(int argc, char** argv)
+{
+	struct stats_histogram wait_before, wait;
+	uint64_t requests_before = 0, start, end;
+	std::vector<uint64_t> latencies, lags;
+	std::vector<pid_t> children;
+	struct sample* samples;
+	size_t num, i;
+	bool failed = false;
+	const char* env = getenv(STATS_SHM_ENV);
+	int c, status;
+
+	if(env && *env) stats_name = env;
+	while((c = getopt(argc, argv, "hn:i:a:r:m:t:e:s:p:o:R:")) != -1)
+	{
+		switch(c)
+		{
+		case 'h':
+			printf("%s", help);
+			return 0;
+		case 'n':
+			num_procs = strtoul(optarg, NULL, 10);
+			break;
+		case 'i':
+			num_requests = strtoul(optarg, NULL, 10);
+			break;
+		case 'a':
+			for(i = 0; i <= POISSON; i++)
+				if(!strcmp(optarg, arrival_names[i])) break;
+			if(i > POISSON)
+			{
+				fprintf(stderr, "Unknown arrival distribution '%s'\n", optarg);
+				return 1;
+			}
+			arrivals = (enum arrival)i;
+			break;
+		case 'r':
+			rate = atof(optarg);
+			break;
+		case 'm':
+			mix_spec = optarg;
+			break;
+		case 't':
+			kernel_us = strtoul(optarg, NULL, 10);
+			break;
+		case 'e':
+			seed = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			setenv(SOCKET_ENV, optarg, 1);
+			break;
+		case 'p':
+			stats_name = optarg;
+			break;
+		case 'o':
+			json_fn = optarg;
+			break;
+		case 'R':
+			raw_fn = optarg;
+			break;
+		default:
+			printf("Warning: unknown argument '%c'\n", c);
+			break;
+		}
+	}
+	if(!num_procs || !num_requests || !(rate > 0.0) || !parse_mix(mix_spec))
+	{
+		fprintf(stderr, "Invalid configuration, see -h\n");
+		return 1;
+	}
+
+	num = num_procs * num_requests;
+	samples = (struct sample*)mmap(NULL, sizeof(struct sample) * num,
+																 PROT_READ | PROT_WRITE,
+																 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(samples == MAP_FAILED)
+	{
+		perror("Could not allocate samples");
+		return 1;
+	}
+
+	open_stats();
+	if(stats)
+	{
+		wait_before = total_wait();
+		requests_before = stats->requests;
+	}
+
+	// Clients write their samples straight into shared memory
+	fflush(stdout);
+	start = now_ns();
+	for(unsigned long p = 0; p < num_procs; p++)
+	{
+		pid_t pid = fork();
+		if(pid == 0)
+		{
+			client(p, start, &samples[p * num_requests]);
+			_exit(0);
+		}
+		else if(pid < 0)
+		{
+			perror("Could not start client");
+			failed = true;
+			break;
+		}
+		children.push_back(pid);
+	}
+	for(pid_t pid : children)
+		if(waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+			 WEXITSTATUS(status))
+			failed = true;
+	end = now_ns();
+	if(failed)
+	{
+		fprintf(stderr, "Client(s) failed, is the server running?\n");
+		return 1;
+	}
+
+	for(i = 0; i < num; i++)
+	{
+		latencies.push_back(samples[i].latency);
+		lags.push_back(samples[i].submitted - samples[i].scheduled);
+	}
+	struct summary latency = summarize(latencies), lag = summarize(lags);
+	double seconds = (end - start) / 1e9, throughput = num / seconds;
+
+	printf("%lu process(es) x %lu request(s), %s arrivals", num_procs,
+				 num_requests, arrival_names[arrivals]);
+	if(arrivals != CLOSED) printf(" at %.1f/s per process", rate);
+	printf(", mix %s\n", mix_spec.c_str());
+	printf("Duration: %.3f s, throughput: %.1f kernel(s)/s\n", seconds,
+				 throughput);
+	print_summary("Allocation latency", latency);
+	if(arrivals != CLOSED) print_summary("Lag", lag);
+
+	// Queueing delay percentiles are upper bounds (power-of-2 buckets)
+	double overhead = 0.0, daemon_rate = 0.0;
+	if(stats)
+	{
+		wait = total_wait();
+		wait.count -= wait_before.count;
+		wait.sum -= wait_before.sum;
+		for(size_t b = 0; b < STATS_HIST_BUCKETS; b++)
+			wait.buckets[b] -= wait_before.buckets[b];
+		double mean_wait = wait.count ? (double)wait.sum / wait.count : 0.0;
+		overhead = latency.mean - mean_wait;
+		daemon_rate = (stats->requests - requests_before) / seconds;
+		printf("%-18s: mean %.0f ns, p50 <%lu ns, p99 <%lu ns (%lu job(s))\n",
+					 "Queueing delay", mean_wait, hist_percentile(wait, 0.5),
+					 hist_percentile(wait, 0.99), wait.count);
+		printf("%-18s: mean %.0f ns\n", "Server overhead", overhead);
+		printf("%-18s: %.1f message(s)/s\n", "Server throughput", daemon_rate);
+	}
+	else printf("Statistics page '%s' unavailable, queueing delay not measured\n",
+							stats_name.c_str());
+
+	if(json_fn != "")
+	{
+		FILE* fp = json_fn == "-" ? stdout : fopen(json_fn.c_str(), "w");
+		if(!fp)
+		{
+			fprintf(stderr, "Could not write results to '%s'\n", json_fn.c_str());
+			return 1;
+		}
+		fprintf(fp, "{\n  \"processes\": %lu,\n  \"requests\": %lu,\n"
+						"  \"arrivals\": \"%s\",\n  \"rate\": %g,\n  \"mix\": \"%s\",\n"
+						"  \"kernel_us\": %lu,\n  \"seed\": %lu,\n  \"duration_s\": %.6f,\n"
+						"  \"throughput\": %.3f,\n", num_procs, num_requests,
+						arrival_names[arrivals], rate, mix_spec.c_str(), kernel_us, seed,
+						seconds, throughput);
+		json_summary(fp, "latency_ns", latency);
+		json_summary(fp, "lag_ns", lag);
+		if(stats)
+			fprintf(fp, "  \"queueing_ns\": { \"mean\": %.0f, \"p50\": %lu, "
+							"\"p99\": %lu, \"count\": %lu },\n  \"overhead_ns\": %.0f,\n"
+							"  \"server_messages_per_s\": %.3f\n}\n",
+							wait.count ? (double)wait.sum / wait.count : 0.0,
+							hist_percentile(wait, 0.5), hist_percentile(wait, 0.99),
+							wait.count, overhead, daemon_rate);
+		else
+			fprintf(fp, "  \"queueing_ns\": null,\n  \"overhead_ns\": null,\n"
+							"  \"server_messages_per_s\": null\n}\n");
+		if(fp != stdout) fclose(fp);
+	}
+	if(raw_fn != "" && !write_raw(samples, num))
+		fprintf(stderr, "Could not write samples to '%s'\n", raw_fn.c_str());
+
+	munmap(samples, sizeof(struct sample) * num);
+	return 0;
+}
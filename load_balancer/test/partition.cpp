@@ -0,0 +1,167 @@
+/*
+ * Exercises dynamic CPU partitioning decisions.  A flood of jobs should split
+ * the CPU into sub-devices, a single job should merge it back, and changes
+ * should be subject to hysteresis (agreeing decisions & a minimum interval)
+ * so that fluctuating load doesn't thrash the device.
+ */
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "server_fixture.h"
+#include "kernels.h"
+#include "server/util.h"
+
+static const char* help =
+"partition - test dynamic CPU partitioning decisions\n\n"
+"Usage: ./partition [ OPTIONS ]\n"
+"Options:\n"
+"  -h     : print help & exit\n"
+"  -k num : kernel to submit (default: CG.C)\n";
+
+static Predictor* model;
+static pid_t next_pid = 1;
+
+static Job* new_request(int kernel)
+{
+	Job* job = new_job(next_pid++, kernel);
+	model->predict(job->features, job->predictions);
+	return job;
+}
+
+/* Number of decisions before the device's target changes, or -1 if never */
+static int decisions(PartitionedDevice* device, const struct timespec& now,
+										 int max)
+{
+	for(int i = 1; i <= max; i++)
+		if(device->evaluate(now)) return i;
+	return -1;
+}
+
+/* Finish all running jobs & drop waiting jobs, leaving the device empty */
+static void drain(PartitionedDevice* device)
+{
+	Job* job;
+	for(HWQueue* queue : queues)
+	{
+		if(!device->owns(queue)) continue;
+		while((job = queue->firstRunning())) delete queue->finished(job);
+		while((job = queue->dequeue())) delete job;
+	}
+}
+
+/* Start one job per partition & queue the rest round-robin */
+static void submit(PartitionedDevice* device, int kernel, size_t num)
+{
+	std::vector<HWQueue*> parts;
+	for(HWQueue* queue : queues)
+		if(device->owns(queue)) parts.push_back(queue);
+	for(size_t i = 0; i < num; i++)
+	{
+		HWQueue* queue = parts[i % parts.size()];
+		if(queue->canRun(NULL)) queue->running(new_request(kernel));
+		else queue->enqueue(new_request(kernel));
+	}
+}
+
+static size_t num_cpu_queues()
+{
+	size_t num = 0;
+	for(HWQueue* queue : queues)
+		if(queue->platform() == 0) num++;
+	return num;
+}
+
+int main(int argc, char** argv)
+{
+	int c, kernel = CG_C, num;
+	struct timespec now = { 1000, 0 };
+	std::vector<Job*> waiting;
+
+	while((c = getopt(argc, argv, "hk:")) != -1)
+	{
+		switch(c)
+		{
+		case 'h':
+			printf("%s", help);
+			return 0;
+		case 'k':
+			kernel = atoi(optarg);
+			break;
+		default:
+			printf("Warning: unknown argument '%c'\n", c);
+			break;
+		}
+	}
+
+	// 12C CPU which can be partitioned & Titan
+	model = new ExactRuntime();
+	add_queue(0, 12, true);
+	add_queue(1, 14, false);
+	utility::build_slot_tables();
+	std::vector<PartitionedDevice*> devices = PartitionedDevice::discover();
+	assert(devices.size() == 1 && "should find one partitionable device");
+	PartitionedDevice* cpu = devices[0];
+	cpu->printConfiguration();
+
+	// 1. A flood of jobs splits the device, but only after enough decisions
+	submit(cpu, kernel, 16);
+	printf("%s: 1 partition %.4f, 2 partitions %.4f (16 jobs)\n",
+				 npb_kernel_names[kernel], cpu->throughput(1), cpu->throughput(2));
+	num = decisions(cpu, now, 100);
+	assert(num == PARTITION_HYSTERESIS && cpu->pending() &&
+				 cpu->targetPartitions() == 2 && "flood should split the device");
+	assert(!cpu->idle() && "running jobs must finish first");
+	while(Job* job = queues[0]->firstRunning()) delete queues[0]->finished(job);
+	cpu->apply(now, waiting);
+	assert(num_cpu_queues() == 2 && queues[0]->computeUnits() == 6 &&
+				 queues[2]->platform() == 1 && queues[2]->index() == 2 &&
+				 "device should be split into 2x6C");
+	assert(waiting.size() == 15 && "waiting jobs should be migrated");
+	for(Job* job : waiting) delete job;
+	printf("flood: split into %lu partition(s) after %d decision(s)\n",
+				 cpu->numPartitions(), num);
+
+	// 2. A single job merges the device back, but not too soon after a split
+	submit(cpu, kernel, 1);
+	printf("%s: 1 partition %.4f, 2 partitions %.4f (single job)\n",
+				 npb_kernel_names[kernel], cpu->throughput(1), cpu->throughput(2));
+	assert(decisions(cpu, now, 100) == -1 && "repartitioned too soon");
+	now.tv_nsec = (PARTITION_MIN_INTERVAL_MS + 1) * 1000000;
+	assert(decisions(cpu, now, 1) == 1 && cpu->targetPartitions() == 1 &&
+				 "single job should merge the device");
+	drain(cpu);
+	cpu->apply(now, waiting);
+	assert(num_cpu_queues() == 1 && queues[0]->computeUnits() == 12 &&
+				 "device should be merged into 1x12C");
+	printf("single: merged into %lu partition(s)\n", cpu->numPartitions());
+
+	// 3. Fluctuating load never builds enough agreement to repartition
+	now.tv_sec++;
+	for(int i = 0; i < 1000; i++)
+	{
+		drain(cpu);
+		submit(cpu, kernel, (i % 2) ? 16 : 1);
+		assert(!cpu->evaluate(now) && "fluctuating load thrashed the device");
+	}
+	printf("fluctuating: stayed at %lu partition(s) over 1000 decisions\n",
+				 cpu->numPartitions());
+
+	// 4. A pending change is cancelled if load goes away before it's applied
+	drain(cpu);
+	submit(cpu, kernel, 16);
+	assert(decisions(cpu, now, 100) > 0 && cpu->pending());
+	drain(cpu);
+	submit(cpu, kernel, 1);
+	assert(decisions(cpu, now, 100) > 0 && !cpu->pending() &&
+				 "pending split should be cancelled");
+	printf("cancel: split cancelled, %lu partition(s)\n", cpu->numPartitions());
+
+	drain(cpu);
+	printf("All tests passed\n");
+	return 0;
+}
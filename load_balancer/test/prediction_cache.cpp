@@ -0,0 +1,137 @@
+/*
+ * Checks the prediction cache: exact & tolerant matching, LRU eviction &
+ * clearing, then compares it against a simple reference LRU over many random
+ * operations to exercise hash table deletion.
+ */
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <vector>
+#include <algorithm>
+#include <getopt.h>
+
+#include "server_fixture.h"
+#include "server/prediction_cache.h"
+
+static const char* help =
+"prediction_cache - check the prediction cache\n\n"
+"Usage: ./prediction_cache [ OPTIONS ]\n"
+"Options:\n"
+"  -h       : print help & exit\n"
+"  -n num   : number of random operations (default: 1000000)\n"
+"  -c num   : cache capacity for random operations (default: 256)\n";
+
+static struct kernel_features features(int kernel, double scale)
+{
+	struct kernel_features feats;
+	feats.kernel = kernel;
+	for(size_t i = 0; i < NUM_FEATURES; i++)
+		feats.feature[i] = (i + 1) * scale;
+	return feats;
+}
+
+static Predictions predictions(float val)
+{
+	Predictions preds(prediction_slots);
+	for(size_t i = 0; i < preds.size(); i++) preds[i] = val + i;
+	return preds;
+}
+
+static void check_basic()
+{
+	PredictionCache exact(2), tolerant(2, 0.01);
+	Predictions preds;
+
+	// Exact matching
+	assert(!exact.lookup(features(1, 1.0), preds) && exact.numMisses() == 1);
+	exact.insert(features(1, 1.0), predictions(1.0f));
+	assert(exact.lookup(features(1, 1.0), preds) && preds[1] == 2.0f);
+	assert(!exact.lookup(features(1, 1.0000001), preds) && "inexact match");
+	assert(!exact.lookup(features(2, 1.0), preds) && "kernel ignored");
+
+	// Tolerant matching
+	tolerant.insert(features(1, 1.0), predictions(1.0f));
+	assert(tolerant.lookup(features(1, 1.0000001), preds) && preds[0] == 1.0f);
+	assert(!tolerant.lookup(features(1, 1.5), preds) && "tolerance too wide");
+
+	// LRU eviction: 1 is used more recently than 2, so 2 is evicted
+	exact.insert(features(2, 1.0), predictions(2.0f));
+	assert(exact.lookup(features(1, 1.0), preds));
+	exact.insert(features(3, 1.0), predictions(3.0f));
+	assert(exact.numEvictions() == 1 && exact.size() == 2);
+	assert(!exact.lookup(features(2, 1.0), preds) && "evicted wrong entry");
+	assert(exact.lookup(features(1, 1.0), preds) && preds[0] == 1.0f);
+	assert(exact.lookup(features(3, 1.0), preds) && preds[0] == 3.0f);
+
+	// Re-inserting refreshes rather than duplicating
+	exact.insert(features(3, 1.0), predictions(4.0f));
+	assert(exact.size() == 2 && exact.lookup(features(3, 1.0), preds) &&
+				 preds[0] == 4.0f);
+
+	exact.clear();
+	assert(exact.size() == 0 && !exact.lookup(features(1, 1.0), preds));
+}
+
+/* Random lookups & insertions over a key space larger than the cache */
+static void check_random(size_t ops, size_t capacity)
+{
+	PredictionCache cache(capacity);
+	std::list<int> lru; // Most recent first
+	Predictions preds;
+
+	srand(1);
+	for(size_t i = 0; i < ops; i++)
+	{
+		int key = rand() % (capacity * 2);
+		std::list<int>::iterator it = std::find(lru.begin(), lru.end(), key);
+		bool hit = cache.lookup(features(key, 1.0), preds);
+
+		assert(hit == (it != lru.end()) && "cache disagrees with reference");
+		if(hit)
+		{
+			assert(preds[0] == (float)key && "wrong predictions");
+			lru.erase(it);
+		}
+		else
+		{
+			cache.insert(features(key, 1.0), predictions((float)key));
+			if(lru.size() == capacity) lru.pop_back();
+		}
+		lru.push_front(key);
+	}
+	printf("%lu operation(s): %lu hit(s), %lu miss(es), %lu eviction(s)\n", ops,
+				 cache.numHits(), cache.numMisses(), cache.numEvictions());
+}
+
+int main(int argc, char** argv)
+{
+	int c;
+	size_t ops = 1000000, capacity = 256;
+
+	while((c = getopt(argc, argv, "hn:c:")) != -1)
+	{
+		switch(c)
+		{
+		case 'h':
+			printf("%s", help);
+			return 0;
+		case 'n':
+			ops = strtoul(optarg, NULL, 10);
+			break;
+		case 'c':
+			capacity = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			printf("Warning: unknown argument '%c'\n", c);
+			break;
+		}
+	}
+
+	check_basic();
+	check_random(ops, capacity);
+
+	printf("All tests passed\n");
+	return 0;
+}
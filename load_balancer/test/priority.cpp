@@ -0,0 +1,161 @@
+/*
+ * Checks priority classes & deadlines: waiting jobs must start in priority
+ * order, jobs which don't specify a class must start in arrival order as
+ * before, more urgent jobs must be stolen ahead of a queue's own jobs, & jobs
+ * which would miss their deadline must be moved to a queue which can run
+ * them.
+ */
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+
+#include "server_fixture.h"
+#include "kernels.h"
+#include "server/util.h"
+#include "server/policy.h"
+
+static Job* new_request(pid_t pid, int priority, unsigned deadline_us,
+												float cpu = 1.0f, float gpu = 1.0f)
+{
+	return set_predictions(new_job(pid, 0, priority, deadline_us), cpu, gpu);
+}
+
+/* Dequeue all waiting jobs, checking they come out in client PID order */
+static void check_order(HWQueue* queue, size_t num, const char* what)
+{
+	Job* job;
+	pid_t expected = 1;
+
+	while((job = queue->dequeue()))
+	{
+		if(job->client != expected)
+		{
+			printf("%s: job %d started in place of job %d\n", what, job->client,
+						 expected);
+			exit(1);
+		}
+		expected++;
+		delete job;
+	}
+	assert((size_t)expected == num + 1 && "lost waiting jobs");
+	printf("%s: %lu job(s) started in order\n", what, num);
+}
+
+/* Jobs without a class start in arrival order, even around removals */
+static void check_fifo()
+{
+	std::vector<Job*> removed;
+	size_t i;
+
+	for(i = 1; i <= 1000; i++)
+	{
+		Job* job = new_request(i, AIRA_PRIORITY_NORMAL, 0);
+		queues[0]->enqueue(job);
+		if(i % 7 == 0) removed.push_back(job);
+	}
+	for(Job* job : removed) delete queues[0]->remove(job);
+
+	pid_t expected = 1;
+	Job* job;
+	while((job = queues[0]->dequeue()))
+	{
+		while(expected % 7 == 0) expected++;
+		assert(job->client == expected && "jobs without a class reordered");
+		expected++;
+		delete job;
+	}
+	printf("no class: %lu job(s) started in arrival order\n",
+				 1000 - removed.size());
+}
+
+/* Classes first, then deadlines (earliest first, none last), then arrival */
+static void check_classes()
+{
+	queues[0]->enqueue(new_request(10, AIRA_PRIORITY_BATCH, 0));
+	queues[0]->enqueue(new_request(6, AIRA_PRIORITY_NORMAL, 0));
+	queues[0]->enqueue(new_request(3, AIRA_PRIORITY_INTERACTIVE, 0));
+	queues[0]->enqueue(new_request(5, AIRA_PRIORITY_NORMAL, 2000000));
+	queues[0]->enqueue(new_request(9, AIRA_PRIORITY_BATCH, 1000));
+	queues[0]->enqueue(new_request(2, AIRA_PRIORITY_INTERACTIVE, 2000000));
+	queues[0]->enqueue(new_request(4, AIRA_PRIORITY_NORMAL, 1000000));
+	queues[0]->enqueue(new_request(1, AIRA_PRIORITY_INTERACTIVE, 1000000));
+	queues[0]->enqueue(new_request(7, AIRA_PRIORITY_NORMAL, 0));
+	queues[0]->enqueue(new_request(8, 200, 0)); // Unknown classes are normal
+	check_order(queues[0], 10, "classes & deadlines");
+}
+
+/*
+ * A queue runs its own waiting jobs unless a job waiting elsewhere is more
+ * urgent & runs nearly as well on it.
+ */
+static void check_steal(Policy* policy)
+{
+	Job* job;
+
+	queues[0]->enqueue(new_request(1, AIRA_PRIORITY_NORMAL, 0));
+	queues[1]->enqueue(new_request(2, AIRA_PRIORITY_NORMAL, 0));
+	job = policy->next(0);
+	assert(job->client == 1 && "stole a job which isn't more urgent");
+	delete job;
+
+	queues[0]->enqueue(new_request(3, AIRA_PRIORITY_BATCH, 0));
+	queues[1]->enqueue(new_request(4, AIRA_PRIORITY_INTERACTIVE, 0, 1.0f, 4.0f));
+	queues[1]->enqueue(new_request(5, AIRA_PRIORITY_INTERACTIVE, 0));
+	job = policy->next(0);
+	assert(job->client == 5 && "didn't steal the more urgent job");
+	delete job;
+	job = policy->next(0);
+	assert(job->client == 2 && "didn't steal the older normal job");
+	delete job;
+	job = policy->next(0);
+	assert(job->client == 3 && "didn't run its own job");
+	delete job;
+	assert(!policy->next(0) && "stole a job which runs poorly");
+	delete queues[1]->dequeue();
+	printf("stealing: more urgent jobs stolen first\n");
+}
+
+/* Jobs which would miss their deadline waiting move to an idle queue */
+static void check_expedite(Policy* policy)
+{
+	Candidates candidates;
+	struct timespec now;
+	Job* running = new_request(1, AIRA_PRIORITY_NORMAL, 0, 1.0f, 2.0f);
+	Job* job = new_request(2, AIRA_PRIORITY_INTERACTIVE, 1000, 1.0f, 2.0f);
+
+	queues[1]->running(running);
+	utility::get_candidates(job, candidates);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	size_t q = policy->place(job, candidates, toNS(now));
+	assert(q == 1 && "job not placed on its preferred queue");
+	q = policy->expedite(job, q, candidates, toNS(now));
+	assert(q == 0 && "job not moved to a queue which can run it");
+
+	job->deadline = 0;
+	assert(policy->expedite(job, 1, candidates, toNS(now)) == 1 &&
+				 "job without a deadline moved");
+	delete job;
+	delete queues[1]->finished(running);
+	printf("deadlines: late job moved to idle queue\n");
+}
+
+int main(int argc, char** argv)
+{
+	// Mirror the default queues on frankenstein: 12C CPU & Titan
+	add_queue(0, 12);
+	add_queue(1, 14);
+	utility::build_slot_tables();
+	FirstFitPolicy policy;
+
+	check_fifo();
+	check_classes();
+	check_steal(&policy);
+	check_expedite(&policy);
+
+	for(HWQueue* queue : queues) delete queue;
+	printf("All tests passed\n");
+	return 0;
+}
@@ -0,0 +1,126 @@
+/*
+ * Checks runtime system profiling: CPUs which support fission must get a slot
+ * for every even split, the profile must replace the compiled-in system
+ * tables & rank faster slots ahead of slower ones, & it must survive a
+ * save/load round trip.  Uses made-up measurements, no devices required.
+ */
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+
+#include "server_fixture.h"
+#include "kernels.h"
+#include "server/profile.h"
+
+/* Check the generated slots' compute units */
+static void check_units(const SystemProfile& profile, const cl_uint* units,
+												size_t num)
+{
+	assert(profile.slots().size() == num && "wrong number of slots");
+	for(size_t i = 0; i < num; i++)
+		assert(profile.slots()[i].units == units[i] && "wrong slot");
+}
+
+/* Slots mirror frankenstein: a fissionable 12C CPU & a Titan */
+static void check_slots(SystemProfile& profile)
+{
+	const cl_uint units[] = { 12, 6, 4, 3, 2, 14 };
+	SystemProfile other;
+
+	profile.addDevice(0, 0, CL_DEVICE_TYPE_CPU, 12, true);
+	profile.addDevice(1, 0, CL_DEVICE_TYPE_GPU, 14, false);
+	profile.addDevice(2, 0, CL_DEVICE_TYPE_ACCELERATOR, 8, false);
+	check_units(profile, units, 6);
+
+	// Without fission a CPU is used whole, & slots are capped
+	other.addDevice(0, 0, CL_DEVICE_TYPE_CPU, 12, false);
+	other.addDevice(0, 1, CL_DEVICE_TYPE_CPU, 7, true);
+	assert(other.slots().size() == 2 && "prime CPU was split");
+	for(cl_uint i = 0; i < SYSTEM_MAX_SLOTS; i++)
+		other.addDevice(1, i, CL_DEVICE_TYPE_GPU, 16, false);
+	assert(other.slots().size() == SYSTEM_MAX_SLOTS && "slots not capped");
+	printf("slots: CPUs split evenly, unsupported devices skipped\n");
+}
+
+/* Throughput scales with compute units, the GPU is fastest */
+static void measure(SystemProfile& profile, const char* file)
+{
+	FILE* fp = fopen(file, "w");
+	assert(fp && "could not write profile");
+	fprintf(fp, "%s %u %016x %lu\n", PROFILE_MAGIC, PROFILE_VERSION, 0,
+					profile.slots().size());
+	for(const SystemProfile::Slot& slot : profile.slots())
+	{
+		bool gpu = slot.type == CL_DEVICE_TYPE_GPU;
+		fprintf(fp, "%u %u %u %lu %f %f %f\n", slot.platform, slot.device,
+						slot.units, (unsigned long)slot.type,
+						slot.units * (gpu ? 100.0 : 20.0), slot.units * (gpu ? 20.0 : 4.0),
+						gpu ? 2e-5 : 5e-6);
+	}
+	fclose(fp);
+	assert(profile.load(file, NULL) && "could not load profile");
+}
+
+static void check_install(const SystemProfile& profile)
+{
+	size_t s, k;
+
+	profile.install();
+	assert(prediction_slots == 6 && default_cpu == 0 && "wrong slots");
+	assert(device_types[5] == CL_DEVICE_TYPE_GPU && "wrong device type");
+	assert(system_devices[1].compute_units == 6 && "wrong sub-device");
+	for(k = 0; k < SYSTEM_NUM_BENCHMARKS; k++)
+	{
+		for(s = 1; s < 5; s++)
+			assert(runtime[s][k] > runtime[s - 1][k] &&
+						 "fewer compute units predicted faster");
+		assert(energy[0][k] == runtime[0][k] && "energy isn't equal power");
+		for(s = 0; s < 6; s++)
+			assert(rt_min <= runtime[s][k] && runtime[s][k] <= rt_max &&
+						 "runtime outside statistics");
+	}
+	assert(runtime[5][EP_C] < runtime[0][EP_C] && "GPU slower on EP");
+	assert(runtime[0][BT_C] > runtime[0][BT_S] && "larger class faster");
+	assert(rt_min < rt_mean && rt_mean < rt_max && "stale runtime statistics");
+	printf("install: tables replaced, faster slots ranked ahead\n");
+}
+
+static void check_cache(const SystemProfile& profile, const char* file)
+{
+	SystemProfile reloaded;
+
+	assert(profile.save(file) && "could not save");
+	assert(reloaded.load(file, NULL) && "could not load");
+	assert(reloaded.slots().size() == profile.slots().size());
+	for(size_t s = 0; s < profile.slots().size(); s++)
+		assert(SystemProfile::estimate(reloaded.slots()[s], CG_B) ==
+					 SystemProfile::estimate(profile.slots()[s], CG_B) &&
+					 "profile changed across save/load");
+
+	FILE* fp = fopen(file, "w");
+	fprintf(fp, "%s %u 0 1\n0 0 12 2 -1 1 1\n", PROFILE_MAGIC, PROFILE_VERSION);
+	fclose(fp);
+	assert(!reloaded.load(file, NULL) && "loaded bad measurements");
+	assert(reloaded.slots().size() == profile.slots().size() &&
+				 "failed load changed the profile");
+	unlink(file);
+	assert(!reloaded.load(file, NULL) && "loaded missing file");
+	printf("cache: profile survives save/load, bad files rejected\n");
+}
+
+int main(int argc, char** argv)
+{
+	const char* file = "/tmp/aira-lb-system.test";
+	SystemProfile profile;
+
+	check_slots(profile);
+	measure(profile, file);
+	check_install(profile);
+	check_cache(profile, file);
+
+	printf("All tests passed\n");
+	return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * Measures the cost of the server's release path against queue depth.  Each
+ * iteration finishes a running job (looked up by client PID), starts the job
+ * at the head of the waiting queue & re-enqueues the finished job so that
+ * the number of running & waiting jobs stays constant.
+ */
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "server_fixture.h"
+#include "server/util.h"
+
+static const char* help =
+"release_latency - measure job release cost against queue depth\n\n"
+"Usage: ./release_latency [ OPTIONS ]\n"
+"Options:\n"
+"  -h     : print help & exit\n"
+"  -i num : number of releases per depth (default: 1000000)\n"
+"  -d num : maximum depth, i.e. running & waiting jobs (default: 10000)\n";
+
+int main(int argc, char** argv)
+{
+	int c;
+	size_t iterations = 1000000, max_depth = 10000, depth, i;
+	struct timespec start, end;
+	std::vector<pid_t> running;
+	Job* job;
+
+	while((c = getopt(argc, argv, "hi:d:")) != -1)
+	{
+		switch(c)
+		{
+		case 'h':
+			printf("%s", help);
+			return 0;
+		case 'i':
+			iterations = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			max_depth = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			printf("Warning: unknown argument '%c'\n", c);
+			break;
+		}
+	}
+
+	printf("%8s %16s\n", "depth", "release (ns)");
+	for(depth = 1; depth <= max_depth; depth *= 10)
+	{
+		add_queue(0, 12, false, depth);
+
+		// Fill the device & the waiting queue, one job per client
+		running.clear();
+		for(i = 0; i < depth; i++)
+		{
+			queues[0]->running(new_job(i + 1));
+			running.push_back(i + 1);
+		}
+		for(i = 0; i < depth; i++)
+			queues[0]->enqueue(new_job(depth + i + 1));
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for(i = 0; i < iterations; i++)
+		{
+			pid_t& pid = running[(i * 7919) % depth];
+			job = HWQueue::findRunning(pid, utility::index_to_alloc(0));
+			queues[0]->finished(job);
+
+			Job* next = queues[0]->dequeue();
+			queues[0]->running(next);
+			queues[0]->enqueue(job);
+			pid = next->client;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		printf("%8lu %16.1f\n", depth,
+					 (double)(toNS(end) - toNS(start)) / iterations);
+
+		delete queues[0];
+		queues.clear();
+	}
+
+	return 0;
+}
@@ -0,0 +1,74 @@
+/*
+ * Shared setup for tests which link directly against the server's objects,
+ * no daemon required.  Defines the globals the server's objects expect, so
+ * include it from exactly one file of each test.
+ */
+
+#ifndef _SERVER_FIXTURE_H
+#define _SERVER_FIXTURE_H
+
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+
+#include "aira_definitions.h"
+#include "message.h"
+#include "server/server.h"
+
+/* Required by the server's objects */
+std::vector<HWQueue*> queues;
+cl_runtime cl_rt = NULL;
+
+/*
+ * Append a HW queue for device 0 of a platform (platform 0 is the CPU, the
+ * others are GPUs).
+ */
+static inline HWQueue* add_queue(size_t platform, size_t units,
+																 bool partition = false,
+																 size_t max_running = 1)
+{
+	HWQueueConfig* config = new HWQueueConfig();
+	config->platform = platform;
+	config->device = 0;
+	config->computeUnits = units;
+	config->maxRunning = max_running;
+	config->dynamicPartitioning = partition;
+	HWQueue* queue;
+	if(platform) queue = new GPUQueue(config);
+	else queue = new CPUQueue(config);
+	queue->setIndex(queues.size());
+	queues.push_back(queue);
+	return queue;
+}
+
+/* Build a client's request for a kernel, as received from the I/O thread */
+static inline Job* new_job(pid_t pid, int kernel = 0,
+													 int priority = AIRA_PRIORITY_NORMAL,
+													 unsigned deadline_us = 0)
+{
+	struct connection conn;
+	memset(&conn, 0, sizeof(struct connection));
+	conn.fd = -1;
+	conn.msg.sender_pid = pid;
+	conn.msg.type = HW_REQUEST_CLASS;
+	conn.msg.ext.rclass.priority = priority;
+	conn.msg.ext.rclass.deadline_us = deadline_us;
+	conn.msg.body.features.kernel = kernel;
+	return new Job(conn);
+}
+
+/*
+ * Give a job made-up predictions for the first two queues (added as the CPU &
+ * a GPU), & none for the others.
+ */
+static inline Job* set_predictions(Job* job, float cpu, float gpu)
+{
+	for(size_t i = 0; i < job->predictions.size(); i++)
+		job->predictions[i] = -1.0f;
+	job->predictions[queues[0]->slot()] = cpu;
+	job->predictions[queues[1]->slot()] = gpu;
+	job->predicted = true;
+	return job;
+}
+
+#endif /* _SERVER_FIXTURE_H */
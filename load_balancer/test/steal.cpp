@@ -0,0 +1,135 @@
+/*
+ * Checks cost-aware work stealing: an idle queue must steal the waiting job
+ * which slows down least, in priority class order, & never a job which runs
+ * much worse on it.  Then measures the cost of a steal against the number of
+ * waiting jobs.
+ */
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <ctime>
+#include <vector>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "server_fixture.h"
+#include "kernels.h"
+#include "server/util.h"
+#include "server/policy.h"
+
+static const char* help =
+"steal - check & measure stealing by idle queues\n\n"
+"Usage: ./steal [ OPTIONS ]\n"
+"Options:\n"
+"  -h     : print help & exit\n"
+"  -i num : number of steals per depth (default: 1000000)\n"
+"  -d num : maximum number of waiting jobs (default: 100000)\n";
+
+static Job* new_request(pid_t pid, int priority, float cpu, float gpu)
+{
+	return set_predictions(new_job(pid, 0, priority), cpu, gpu);
+}
+
+/* Steal for the idle queue & check which job was stolen */
+static void check_steal(Policy& policy, pid_t expected, float slowdown)
+{
+	Job* job = policy.next(2);
+	if(!job || job->client != expected)
+	{
+		printf("Stole job %d instead of job %d\n", job ? job->client : -1,
+					 expected);
+		exit(1);
+	}
+	assert(fabsf(job->slowdown - slowdown) < 1e-3 && "wrong slowdown recorded");
+	delete job;
+}
+
+/*
+ * Queue 2 is idle.  Jobs waiting on the CPU slow down by their CPU/GPU
+ * performance ratio when stolen, jobs waiting on the other GPU queue don't.
+ */
+static void check_choice()
+{
+	FirstFitPolicy policy;
+
+	queues[0]->enqueue(new_request(1, AIRA_PRIORITY_NORMAL, 1.0f, 0.9f));
+	queues[0]->enqueue(new_request(2, AIRA_PRIORITY_NORMAL, 1.0f, 2.0f));
+	queues[0]->enqueue(new_request(3, AIRA_PRIORITY_NORMAL, 1.0f, 0.5f));
+	queues[0]->enqueue(new_request(4, AIRA_PRIORITY_BATCH, 1.0f, 4.0f));
+	queues[1]->enqueue(new_request(5, AIRA_PRIORITY_NORMAL, 1.0f, 1.0f));
+	queues[1]->enqueue(new_request(6, AIRA_PRIORITY_INTERACTIVE, 1.0f, 1.0f));
+
+	check_steal(policy, 6, 1.0f);
+	check_steal(policy, 2, 0.5f);
+	check_steal(policy, 5, 1.0f);
+	check_steal(policy, 1, 1.0f / 0.9f);
+	check_steal(policy, 4, 0.25f);
+	assert(!policy.next(2) && "stole a job which runs much worse");
+	assert(queues[0]->numQueued() == 1 && "lost waiting jobs");
+	delete queues[0]->dequeue();
+	printf("Steal order: least slowdown first, by priority class\n");
+}
+
+int main(int argc, char** argv)
+{
+	int c;
+	size_t iterations = 1000000, max_depth = 100000, depth, i;
+	struct timespec start, end;
+	Job* job;
+
+	while((c = getopt(argc, argv, "hi:d:")) != -1)
+	{
+		switch(c)
+		{
+		case 'h':
+			printf("%s", help);
+			return 0;
+		case 'i':
+			iterations = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			max_depth = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			printf("Warning: unknown argument '%c'\n", c);
+			break;
+		}
+	}
+
+	// 12C CPU & a Titan split between two queues
+	add_queue(0, 12);
+	add_queue(1, 14);
+	add_queue(1, 14);
+	utility::build_slot_tables();
+	FirstFitPolicy policy;
+
+	check_choice();
+
+	// Keep the number of waiting jobs constant by re-enqueueing stolen jobs
+	printf("%8s %16s\n", "depth", "steal (ns)");
+	srand(1);
+	for(depth = 1; depth <= max_depth; depth *= 10)
+	{
+		for(i = 0; i < depth; i++)
+			queues[0]->enqueue(new_request(i + 1, AIRA_PRIORITY_NORMAL, 1.0f,
+																	 1.0f + (rand() % 1000) / 1000.0f));
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for(i = 0; i < iterations; i++)
+		{
+			job = policy.next(2);
+			queues[0]->enqueue(job);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		printf("%8lu %16.1f\n", depth,
+					 (double)(toNS(end) - toNS(start)) / iterations);
+		while((job = queues[0]->dequeue())) delete job;
+	}
+
+	for(HWQueue* queue : queues) delete queue;
+	printf("All tests passed\n");
+	return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * Compares HW_REQUEST -> HW_ASSIGN round-trip latency of the socket &
+ * shared-memory transports.  Only the allocation request is timed, the
+ * "kernel" finishes immediately afterwards.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <assert.h>
+#include <getopt.h>
+
+#include "aira_runtime.h"
+#include "kernels.h"
+
+#define toNS( ts ) ((ts.tv_sec * 1000000000UL) + ts.tv_nsec)
+
+static const char* help =
+"transport_latency - compare allocation latency of socket & shared-memory "
+"transports\n\n"
+"Usage: ./transport_latency [ OPTIONS ]\n"
+"Options:\n"
+"  -h     : print help & exit\n"
+"  -i num : number of requests per transport (default: 100000)\n";
+
+static int compare(const void* a, const void* b)
+{
+	unsigned long x = *(const unsigned long*)a, y = *(const unsigned long*)b;
+	return (x > y) - (x < y);
+}
+
+static void run(const char* transport, unsigned long iterations,
+								unsigned long* samples)
+{
+	struct kernel_features feats = { .kernel = EP_S };
+	struct timespec start, end;
+	unsigned long i;
+	aira_conn conn;
+
+	setenv("AIRA_LB_TRANSPORT", transport, 1);
+	conn = aira_init_conn();
+	assert(conn && "could not connect");
+
+	for(i = 0; i < iterations; i++)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		aira_alloc_resources(conn, &feats);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		aira_kernel_finish(conn);
+		samples[i] = toNS(end) - toNS(start);
+	}
+	aira_free_conn(conn);
+
+	qsort(samples, iterations, sizeof(unsigned long), compare);
+	printf("%-6s: p50 %lu ns, p99 %lu ns, max %lu ns\n", transport,
+				 samples[iterations / 2], samples[(iterations * 99) / 100],
+				 samples[iterations - 1]);
+}
+
+int main(int argc, char** argv)
+{
+	int c;
+	unsigned long iterations = 100000, *samples;
+
+	while((c = getopt(argc, argv, "hi:")) != -1)
+	{
+		switch(c)
+		{
+		case 'h':
+			printf("%s", help);
+			return 0;
+		case 'i':
+			iterations = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			printf("Warning: unknown argument '%c'\n", c);
+			break;
+		}
+	}
+
+	assert(iterations > 0);
+	samples = (unsigned long*)malloc(sizeof(unsigned long) * iterations);
+	assert(samples);
+
+	printf("Timing %lu allocation requests per transport...\n", iterations);
+	run("socket", iterations, samples);
+	run("shm", iterations, samples);
+
+	free(samples);
+	return 0;
+}
@@ -0,0 +1,207 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "kernels.h"
+#include "server/event_log.h"
+
+static const char* help =
+"lb-events - convert an aira-lb event log (see the server's -e option) into a "
+"Chrome trace (load in chrome://tracing or Perfetto) or CSV.\n\n"
+
+"Usage: ./lb-events [ OPTIONS ] <event log>\n\n"
+
+"Options:\n"
+"  -h        : print help & exit\n"
+"  -f format : output format, 'chrome' or 'csv' (default: chrome)\n"
+"  -o file   : output file (default: stdout)\n\n"
+
+"Chrome traces show one track per client process & kernel of a batch, with "
+"the phases of each job (predict, schedule, wait, run) as slices.\n";
+
+static const char* event_names[] = {
+#define X(a, b) b,
+EVENT_TYPES
+#undef X
+};
+
+static std::string log_fn = "";
+static std::string out_fn = "";
+static bool chrome = true;
+
+static const char* kernel_name(int kernel)
+{
+	if(kernel < 0 || kernel > SP_C) return "unknown";
+	return npb_kernel_names[kernel];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Output formats
+///////////////////////////////////////////////////////////////////////////////
+
+static void write_csv(FILE* out, const std::vector<struct event>& events,
+											uint64_t origin)
+{
+	fprintf(out, "time_ns,event,pid,batch_index,kernel,queue,platform,device,"
+							 "compute_units\n");
+	for(const struct event& ev : events)
+	{
+		fprintf(out, "%lu,%s,%d,%u,%s,", (unsigned long)(ev.time - origin),
+						ev.type < NUM_EVENT_TYPES ? event_names[ev.type] : "unknown",
+						ev.pid, ev.batch_index, kernel_name(ev.kernel));
+		if(ev.queue != EVENT_NO_QUEUE) fprintf(out, "%u", ev.queue);
+		if(ev.type == EVENT_STARTED || ev.type == EVENT_FINISHED)
+			fprintf(out, ",%u,%u,%u\n", ev.platform, ev.device, ev.compute_units);
+		else fprintf(out, ",,,\n");
+	}
+}
+
+/* Name of the phase which ends with an event, given the job's previous event */
+static const char* phase(uint8_t prev, uint8_t cur)
+{
+	switch(cur)
+	{
+	case EVENT_PREDICTED: return "predict";
+	case EVENT_ENQUEUED: return "schedule";
+	case EVENT_STARTED: return prev == EVENT_ENQUEUED ? "wait" : "schedule";
+	case EVENT_FINISHED: return "run";
+	default: return NULL;
+	}
+}
+
+/*
+ * Convert each pair of consecutive events of a job into a complete ("X")
+ * slice.  Jobs are identified by client PID & batch index, which is unique
+ * among a client's outstanding kernels.
+ */
+static void write_chrome(FILE* out, const std::vector<struct event>& events,
+												 uint64_t origin)
+{
+	std::unordered_map<uint64_t, const struct event*> last;
+	bool first = true;
+	const char* name;
+
+	fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	for(const struct event& ev : events)
+	{
+		uint64_t key = ((uint64_t)(uint32_t)ev.pid << 16) | ev.batch_index;
+		if(ev.type == EVENT_RECEIVED ||
+			 (ev.type == EVENT_STARTED && !last.count(key))) // Notified by client
+		{
+			last[key] = &ev;
+			continue;
+		}
+		auto it = last.find(key);
+		if(it == last.end()) continue;
+
+		const struct event& prev = *it->second;
+		if((name = phase(prev.type, ev.type)) && ev.time >= prev.time)
+		{
+			fprintf(out, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+							"\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u,"
+							"\"args\":{\"kernel\":\"%s\"", first ? "" : ",", name,
+							kernel_name(ev.kernel), (prev.time - origin) / 1e3,
+							(ev.time - prev.time) / 1e3, ev.pid, ev.batch_index,
+							kernel_name(ev.kernel));
+			if(ev.queue != EVENT_NO_QUEUE) fprintf(out, ",\"queue\":%u", ev.queue);
+			if(ev.type == EVENT_FINISHED)
+				fprintf(out, ",\"device\":\"%u/%u\",\"compute units\":%u",
+								ev.platform, ev.device, ev.compute_units);
+			fprintf(out, "}}");
+			first = false;
+		}
+		if(ev.type == EVENT_FINISHED) last.erase(it);
+		else it->second = &ev;
+	}
+	fprintf(out, "\n]}\n");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Driver
+///////////////////////////////////////////////////////////////////////////////
+
+static void parse_args(int argc, char** argv)
+{
+	int c;
+
+	while((c = getopt(argc, argv, "hf:o:")) != -1)
+	{
+		switch(c)
+		{
+		case 'h':
+			std::cout << help;
+			exit(0);
+		case 'f':
+			if(!strcmp(optarg, "chrome")) chrome = true;
+			else if(!strcmp(optarg, "csv")) chrome = false;
+			else std::cerr << "Unknown format '" << optarg << "', using chrome"
+										 << std::endl;
+			break;
+		case 'o':
+			out_fn = optarg;
+			break;
+		default:
+			std::cerr << "Unknown argument '" << (char)c << "'" << std::endl;
+			break;
+		}
+	}
+
+	if(optind >= argc)
+	{
+		std::cerr << "Please specify an event log" << std::endl;
+		exit(1);
+	}
+	log_fn = argv[optind];
+}
+
+int main(int argc, char** argv)
+{
+	struct event_log_header header;
+	std::vector<struct event> events;
+	struct event buf[1024];
+	size_t num;
+
+	parse_args(argc, argv);
+
+	FILE* fp = fopen(log_fn.c_str(), "rb");
+	if(!fp)
+	{
+		std::cerr << "Could not open '" << log_fn << "'" << std::endl;
+		return 1;
+	}
+	if(fread(&header, sizeof(struct event_log_header), 1, fp) != 1 ||
+		 strncmp(header.magic, EVENT_LOG_MAGIC, sizeof(header.magic)) ||
+		 header.version != EVENT_LOG_VERSION ||
+		 header.event_size != sizeof(struct event))
+	{
+		std::cerr << "'" << log_fn << "' is not a version " << EVENT_LOG_VERSION
+							<< " event log" << std::endl;
+		return 1;
+	}
+	while((num = fread(buf, sizeof(struct event), 1024, fp)))
+		events.insert(events.end(), buf, buf + num);
+	fclose(fp);
+
+	// Events are flushed roughly in order, but threads race to fill the ring
+	std::stable_sort(events.begin(), events.end(),
+		[](const struct event& a, const struct event& b)
+		{ return a.time < b.time; });
+
+	FILE* out = stdout;
+	if(out_fn != "" && !(out = fopen(out_fn.c_str(), "w")))
+	{
+		std::cerr << "Could not open '" << out_fn << "'" << std::endl;
+		return 1;
+	}
+	if(chrome) write_chrome(out, events, header.monotonic);
+	else write_csv(out, events, header.monotonic);
+	if(out != stdout) fclose(out);
+
+	return 0;
+}
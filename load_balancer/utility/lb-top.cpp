@@ -0,0 +1,261 @@
+#include <iostream>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+
+#include "server/stats.h"
+
+static const char* help =
+"lb-top - monitor a running aira-lb server through its statistics page\n\n"
+
+"Usage: ./lb-top [ OPTIONS ]\n\n"
+
+"Options:\n"
+"  -h      : print help & exit\n"
+"  -i ms   : polling interval in milliseconds (default: 1000)\n"
+"  -n num  : exit after this many updates (default: run until interrupted)\n"
+"  -b      : batch mode, append updates rather than redrawing the screen\n"
+"  -s name : shared-memory name of the statistics page (default: $"
+STATS_SHM_ENV " or " STATS_SHM_NAME ")\n\n"
+
+"Latency percentiles are upper bounds, as histograms have power-of-2 "
+"buckets.  Prediction accuracy compares each job's predicted runtime against "
+"its observed runtime (see include/server/stats.h).  Slowdown is the mean "
+"predicted slowdown of jobs a queue stole from other queues.\n";
+
+static unsigned interval_ms = 1000;
+static unsigned long iterations = 0;
+static bool batch = false;
+static std::string shm_name = STATS_SHM_NAME;
+
+///////////////////////////////////////////////////////////////////////////////
+// Helpers
+///////////////////////////////////////////////////////////////////////////////
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/* Format a duration with a sensible unit */
+static std::string duration(double ns)
+{
+	char buf[32];
+	if(ns < 1e3) snprintf(buf, sizeof(buf), "%.0fns", ns);
+	else if(ns < 1e6) snprintf(buf, sizeof(buf), "%.1fus", ns / 1e3);
+	else if(ns < 1e9) snprintf(buf, sizeof(buf), "%.1fms", ns / 1e6);
+	else snprintf(buf, sizeof(buf), "%.2fs", ns / 1e9);
+	return std::string(buf);
+}
+
+/* Upper bound of the bucket containing the p-th percentile */
+static std::string percentile(const struct stats_histogram& hist, double p)
+{
+	uint64_t target = (uint64_t)(hist.count * p), cur = 0;
+	if(!hist.count) return "-";
+	for(size_t b = 0; b < STATS_HIST_BUCKETS; b++)
+	{
+		cur += hist.buckets[b];
+		if(cur > target || cur == hist.count)
+			return b ? duration((double)(1ULL << b)) : "0ns";
+	}
+	return "-";
+}
+
+static std::string mean(const struct stats_histogram& hist)
+{
+	if(!hist.count) return "-";
+	return duration((double)hist.sum / hist.count);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Display
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Copy the statistics page.  The queue table is retried until a consistent
+ * copy is read, the other counters are only individually consistent.
+ */
+static bool snapshot(const struct stats_page* page, struct stats_page& copy)
+{
+	uint64_t before, after;
+
+	if(__atomic_load_n(&page->version, __ATOMIC_ACQUIRE) != STATS_VERSION)
+		return false;
+	do
+	{
+		while((before = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE)) & 1)
+			usleep(10);
+		memcpy(&copy, page, sizeof(struct stats_page));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(&page->seq, __ATOMIC_RELAXED);
+	} while(before != after);
+	return true;
+}
+
+static void display(const struct stats_page& page, uint64_t prevRequests,
+										uint64_t prevTime)
+{
+	uint64_t now = now_ns(), up = (now - page.start_time) / 1000000000ULL;
+	double rate = 0.0;
+	size_t i;
+
+	if(prevTime && now > prevTime && page.requests >= prevRequests)
+		rate = (page.requests - prevRequests) / ((now - prevTime) / 1e9);
+
+	printf("aira-lb (PID %d), up %lu:%02lu:%02lu, predictor: %s\n"
+				 "%lu request(s), %.1f/s\n\n", page.server_pid, up / 3600,
+				 (up / 60) % 60, up % 60, page.predictor, page.requests, rate);
+
+	printf("%-5s %-7s %4s %8s %7s %9s %9s %9s %9s %9s %9s %8s %8s\n", "Queue",
+				 "Device", "CUs", "Run/Max", "Queued", "Started", "Finished",
+				 "Wait p50", "Wait p99", "Run mean", "Run p99", "Stolen", "Slowdown");
+	for(i = 0; i < page.num_queues && i < STATS_MAX_QUEUES; i++)
+	{
+		const struct stats_queue& queue = page.queues[i];
+		const struct stats_queue_times& times = page.times[i];
+		char device[16], running[16];
+		snprintf(device, sizeof(device), "%u/%u", queue.platform, queue.device);
+		snprintf(running, sizeof(running), "%u/%u", queue.running,
+						 queue.max_running);
+		printf("%-5lu %-7s %4u %8s %7u %9lu %9lu %9s %9s %9s %9s %8lu", i, device,
+					 queue.compute_units, running, queue.queued, times.started,
+					 times.finished, percentile(times.wait, 0.5).c_str(),
+					 percentile(times.wait, 0.99).c_str(), mean(times.service).c_str(),
+					 percentile(times.service, 0.99).c_str(), times.stolen);
+		if(times.stolen)
+			printf(" %8.3f\n", times.sum_slowdown_ppm / 1e6 / times.stolen);
+		else printf(" %8s\n", "-");
+	}
+
+	printf("\n%-12s %9s %9s %9s %9s %10s %10s %8s %8s\n", "Class", "Started",
+				 "Finished", "Wait p50", "Wait p99", "Turn mean", "Turn p99", "Met",
+				 "Missed");
+	for(i = 0; i < STATS_CLASSES; i++)
+	{
+		const struct stats_class& cls = page.classes[i];
+		if(!cls.started && !cls.finished) continue;
+		printf("%-12s %9lu %9lu %9s %9s %10s %10s %8lu %8lu\n",
+					 stats_class_name(i), cls.started, cls.finished,
+					 percentile(cls.wait, 0.5).c_str(),
+					 percentile(cls.wait, 0.99).c_str(), mean(cls.turnaround).c_str(),
+					 percentile(cls.turnaround, 0.99).c_str(), cls.deadlines_met,
+					 cls.deadlines_missed);
+	}
+
+	printf("\nPredictor latency: %lu prediction(s), mean %s, p50 %s, p99 %s\n\n",
+				 page.prediction.count, mean(page.prediction).c_str(),
+				 percentile(page.prediction, 0.5).c_str(),
+				 percentile(page.prediction, 0.99).c_str());
+	if(page.cache_hits + page.cache_misses)
+		printf("Prediction cache: %lu hit(s), %lu miss(es), %.1f%% hit rate\n\n",
+					 page.cache_hits, page.cache_misses, 100.0 * page.cache_hits /
+					 (page.cache_hits + page.cache_misses));
+
+	printf("%-5s %9s %11s %14s %8s %8s\n", "Slot", "Jobs", "Mean error",
+				 "Pred/observed", "<=10%", "<=25%");
+	for(i = 0; i < page.num_slots && i < STATS_MAX_SLOTS; i++)
+	{
+		const struct stats_accuracy& acc = page.accuracy[i];
+		if(!acc.count) continue;
+		printf("%-5lu %9lu %10.1f%% %14.3f %7.1f%% %7.1f%%\n", i, acc.count,
+					 acc.sum_error_ppm / 1e4 / acc.count,
+					 acc.sum_ratio_ppm / 1e6 / acc.count,
+					 100.0 * acc.within_low / acc.count,
+					 100.0 * acc.within_high / acc.count);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Driver
+///////////////////////////////////////////////////////////////////////////////
+
+static void parse_args(int argc, char** argv)
+{
+	const char* env = getenv(STATS_SHM_ENV);
+	int c;
+
+	if(env && *env) shm_name = env;
+	while((c = getopt(argc, argv, "hi:n:bs:")) != -1)
+	{
+		switch(c)
+		{
+		case 'h':
+			std::cout << help;
+			exit(0);
+		case 'i':
+			interval_ms = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 10);
+			break;
+		case 'b':
+			batch = true;
+			break;
+		case 's':
+			shm_name = optarg;
+			break;
+		default:
+			std::cerr << "Unknown argument '" << (char)c << "'" << std::endl;
+			break;
+		}
+	}
+}
+
+/*
+ * The page is mapped afresh for every update so that a restarted server's new
+ * page is picked up.
+ */
+int main(int argc, char** argv)
+{
+	struct stats_page* page = (struct stats_page*)malloc(sizeof(struct stats_page));
+	uint64_t prevRequests = 0, prevTime = 0;
+	int fd;
+
+	parse_args(argc, argv);
+
+	for(unsigned long i = 0; !iterations || i < iterations; i++)
+	{
+		if(i) usleep(interval_ms * 1000);
+		if(!batch) printf("\033[H\033[2J");
+		else if(i) printf("\n");
+
+		void* shared = MAP_FAILED;
+		if((fd = shm_open(shm_name.c_str(), O_RDONLY, 0)) != -1)
+		{
+			shared = mmap(NULL, sizeof(struct stats_page), PROT_READ, MAP_SHARED,
+										fd, 0);
+			close(fd);
+		}
+		if(shared == MAP_FAILED)
+		{
+			printf("No statistics page '%s' -- is aira-lb running?\n",
+						 shm_name.c_str());
+			prevTime = 0;
+		}
+		else
+		{
+			if(snapshot((const struct stats_page*)shared, *page))
+			{
+				display(*page, prevRequests, prevTime);
+				prevRequests = page->requests;
+				prevTime = now_ns();
+			}
+			else printf("Statistics page '%s' has an unsupported version\n",
+									shm_name.c_str());
+			munmap(shared, sizeof(struct stats_page));
+		}
+		fflush(stdout);
+	}
+
+	free(page);
+	return 0;
+}
@@ -16,12 +16,64 @@ extern "C" {
 /* OpenCL runtime library handle */
 typedef struct _cl_runtime* cl_runtime;
 
+/* How get_pool_queue() picks queues from a device's pool */
+enum queue_selection {
+	QUEUE_ROUND_ROBIN = 0, /* Hand out each queue in turn */
+	QUEUE_PER_THREAD /* Each host thread always gets the same queue */
+};
+
+/*
+ * Programs built by build_program_with_args() are cached as binaries in the
+ * directory named by PROGRAM_CACHE_ENV (default: PROGRAM_CACHE_DIR in $HOME)
+ * & reused while the source, the files it #includes (found next to it or in
+ * -I directories), build arguments, device & driver are unchanged.  Programs
+ * whose includes can't be followed (e.g. named by a macro) aren't cached.
+ * Set it to an empty string to disable caching, or use set_program_cache().
+ */
+#define PROGRAM_CACHE_ENV "OCL_RT_CACHE_DIR"
+#define PROGRAM_CACHE_DIR ".cache/ocl-rt"
+
+/*
+ * Buffer pools.  Each context (one per platform, plus one per sub-device) has
+ * a pool of buffers binned by power-of-2 size class, from BUFFER_POOL_MIN_SIZE
+ * bytes up to BUFFER_POOL_CLASSES classes.  Released buffers are kept for
+ * reuse until a pool holds BUFFER_POOL_MAX_IDLE bytes of idle buffers; larger
+ * buffers aren't pooled.
+ */
+#define BUFFER_POOL_MIN_SIZE 4096
+#define BUFFER_POOL_CLASSES 20
+#define BUFFER_POOL_MAX_IDLE (1UL << 28)
+
+/*
+ * Where a pooled buffer's memory lives.  Host memory is zero-copy on devices
+ * which share memory with the host (e.g. CPUs), i.e. map_buffer() &
+ * unmap_buffer() don't copy.
+ */
+enum buffer_memory {
+	BUFFER_DEVICE = 0, /* Device memory, accessed with reads & writes */
+	BUFFER_ALLOC_HOST, /* CL_MEM_ALLOC_HOST_PTR, driver-allocated host memory */
+	BUFFER_USE_HOST /* CL_MEM_USE_HOST_PTR, page-aligned host memory */
+};
+
+/* Buffer pool usage statistics */
+typedef struct buffer_pool_stats {
+	unsigned long acquires;
+	unsigned long hits; /* Acquires served by an idle buffer */
+	unsigned long releases;
+	size_t in_use; /* Bytes handed out */
+	size_t idle; /* Bytes kept for reuse */
+	size_t peak; /* Most bytes allocated at once, in use or idle */
+} buffer_pool_stats;
+
 ///////////////////////////////////////////////////////////////////////////////
 // Library functions
 ///////////////////////////////////////////////////////////////////////////////
 
 /* Handle constructors & destructors */
 cl_runtime new_cl_runtime(bool init_queues);
+cl_runtime new_cl_runtime_with_pools(cl_uint queues,
+																		 cl_command_queue_properties props,
+																		 enum queue_selection selection);
 void delete_cl_runtime(cl_runtime runtime);
 
 /* Generic getters */
@@ -33,6 +85,7 @@ cl_uint get_num_compute_units(cl_runtime runtime, cl_uint platform,
 															cl_uint device);
 cl_uint get_num_compute_units_by_dev(cl_device_id dev_id);
 size_t get_max_wg_size(cl_kernel kernel, cl_device_id dev_id);
+cl_uint get_num_queues(cl_runtime runtime);
 
 /* Handle getters */
 cl_platform_id get_platform(cl_runtime runtime, cl_uint platform);
@@ -42,8 +95,13 @@ cl_device_id get_subdevice(cl_runtime runtime, cl_uint platform,
 cl_context get_context_by_platform(cl_runtime runtime, cl_uint platform);
 cl_context get_context_by_dev(cl_runtime runtime, cl_device_id dev_id);
 cl_command_queue get_queue_by_dev(cl_runtime runtime,	cl_device_id dev_id);
+cl_platform_id get_platform_by_dev(cl_runtime runtime, cl_device_id dev_id);
+cl_command_queue get_pool_queue(cl_runtime runtime, cl_device_id dev_id);
+cl_command_queue get_queue_by_index(cl_runtime runtime, cl_device_id dev_id,
+																		cl_uint index);
 
 /* Convenience functions for general-purpose OpenCL programming */
+void set_program_cache(cl_runtime runtime, const char* dir);
 cl_program build_program_from_src(cl_runtime runtime, const char* fname,
 																	cl_device_id dev);
 cl_program build_program_with_args(cl_runtime runtime, const char* fname,
@@ -52,6 +110,22 @@ size_t save_binary(cl_runtime runtime, cl_program program, cl_uint device,
 									 const char* fname);
 cl_program load_binary(cl_runtime runtime, const char* fname,
 											 cl_device_id dev);
+cl_int enqueue_overlapped(cl_runtime runtime, cl_device_id dev,
+													cl_kernel kernel, size_t items, size_t local,
+													cl_uint chunks, cl_mem in, const void* host_in,
+													size_t in_size, cl_mem out, void* host_out,
+													size_t out_size);
+
+/* Buffer pools */
+cl_mem acquire_buffer(cl_runtime runtime, cl_device_id dev, cl_mem_flags flags,
+											enum buffer_memory memory, size_t size);
+void release_buffer(cl_runtime runtime, cl_device_id dev, cl_mem buf);
+void* map_buffer(cl_runtime runtime, cl_device_id dev, cl_mem buf,
+								 cl_map_flags flags);
+void unmap_buffer(cl_runtime runtime, cl_device_id dev, cl_mem buf, void* ptr);
+void get_buffer_pool_stats(cl_runtime runtime, cl_device_id dev,
+													 buffer_pool_stats* stats);
+void trim_buffer_pools(cl_runtime runtime);
 
 /* Error handling */
 const char* get_ocl_error(cl_int errcode);
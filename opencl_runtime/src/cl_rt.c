@@ -1,5 +1,11 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include <CL/cl.h>
 
 #include "cl_rt.h"
@@ -26,9 +32,15 @@ typedef struct contexts {
 	cl_context* contexts;
 } contexts;
 
+/*
+ * A device's queue pool.  The first queue is the device's default queue
+ * (returned by get_queue_by_dev()).
+ */
 typedef struct device_queue {
 	cl_device_id id;
 	cl_command_queue q;
+	cl_command_queue* pool;
+	cl_uint next; /* Next queue handed out round-robin */
 } device_queue;
 
 typedef struct device_queues {
@@ -37,13 +49,83 @@ typedef struct device_queues {
 	device_queue* queues;
 } device_queues;
 
+/*
+ * A buffer owned by a buffer pool, either idle in its size class' bin or
+ * handed out by acquire_buffer().
+ */
+typedef struct pooled_buffer {
+	cl_mem mem;
+	size_t size;
+	cl_mem_flags flags;
+	enum buffer_memory memory;
+	void* host; /* Host memory backing BUFFER_USE_HOST buffers */
+	struct pooled_buffer* next;
+} pooled_buffer;
+
+typedef struct buffer_pool {
+	cl_context context;
+	pooled_buffer* bins[BUFFER_POOL_CLASSES];
+	pooled_buffer* in_use;
+	buffer_pool_stats stats;
+	pthread_mutex_t lock;
+} buffer_pool;
+
+/*
+ * Sub-devices are cached by (platform, device, compute units) so repeated
+ * requests don't pay for device fission.  Sub-devices can't use their parent
+ * platform's context, so each gets its own context & command queue, created on
+ * first use.  Entries live until the runtime is deleted.
+ */
+typedef struct subdevice {
+	cl_uint platform;
+	cl_uint device;
+	cl_uint units;
+	cl_device_id id;
+	cl_context context;
+	cl_command_queue q;
+	buffer_pool* pool;
+} subdevice;
+
+typedef struct subdevices {
+	cl_uint num_subdevices;
+	cl_uint capacity;
+	subdevice* subdevices;
+	pthread_mutex_t lock;
+} subdevices;
+
+/*
+ * Device lookup table, an open-addressed hash table from a device ID (devices
+ * & cached sub-devices) to its platform, context & queue.  Entries are never
+ * removed & each is published by atomically storing its ID after its other
+ * fields, so lookups are lock-free.  Sub-devices' contexts & queues are
+ * published the same way once they're created.  Writers are serialized by
+ * the sub-device lock.  Devices which don't fit are found by scanning.
+ */
+#define DEVICE_TABLE_BITS 8
+#define DEVICE_TABLE_SIZE (1 << DEVICE_TABLE_BITS)
+
+typedef struct device_entry {
+	cl_device_id id;
+	cl_uint platform;
+	cl_context context;
+	cl_command_queue q;
+	device_queue* dq; /* Queue pool, NULL for sub-devices */
+} device_entry;
+
 /* Handle for all runtime state */
 struct _cl_runtime {
 	bool initialized;
+	cl_uint queues_per_device;
+	cl_command_queue_properties queue_props;
+	enum queue_selection selection;
 	platforms pf;
 	devices* dv;
 	contexts ctx;
+	buffer_pool* pools; /* One per platform context */
 	device_queues* qs;
+	subdevices sub;
+	device_entry table[DEVICE_TABLE_SIZE];
+	char* cache_dir; /* Program binary cache, NULL if disabled */
 };
 
 /* OpenCL device fission extension handling in OpenCL 1.1 */
@@ -59,16 +141,206 @@ if(!pfn_##name) { \
 	} \
 }
 static clCreateSubDevicesEXT_fn pfn_clCreateSubDevicesEXT = NULL;
+static clReleaseDeviceEXT_fn pfn_clReleaseDeviceEXT = NULL;
+#define RELEASE_SUBDEVICE( dev ) pfn_clReleaseDeviceEXT(dev)
 #else
 #define INIT_CL_EXT_FCN_PTR( name )
+#define RELEASE_SUBDEVICE( dev ) clReleaseDevice(dev)
 #endif
 
 /* Global library state */
 static cl_uint num_platforms = 0;
 static cl_uint* num_devices = 0;
 
+/* Per-thread queue pool slots, assigned on first use (0 is unassigned) */
+static __thread cl_uint thread_slot = 0;
+static cl_uint num_thread_slots = 0;
+
 #define BUILDLOG_SIZE 16384
 
+/* FNV-1a, used to key cached program binaries */
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+/* Deepest #include nesting followed when keying cached program binaries */
+#define CACHE_MAX_INCLUDE_DEPTH 16
+
+///////////////////////////////////////////////////////////////////////////////
+// Device lookup table
+///////////////////////////////////////////////////////////////////////////////
+
+static inline size_t hash_device(cl_device_id dev_id)
+{
+	uint64_t key = (uint64_t)(uintptr_t)dev_id;
+	return (key * 0x9e3779b97f4a7c15ULL) >> (64 - DEVICE_TABLE_BITS);
+}
+
+/*
+ * Find a device's entry in the lookup table.  Safe to call concurrently with
+ * add_device().
+ *
+ * @return the device's entry, or NULL if it's not in the table
+ */
+static device_entry* find_device(cl_runtime runtime, cl_device_id dev_id)
+{
+	size_t i, slot = hash_device(dev_id);
+	cl_device_id cur;
+
+	for(i = 0; i < DEVICE_TABLE_SIZE; i++)
+	{
+		cur = __atomic_load_n(&runtime->table[slot].id, __ATOMIC_ACQUIRE);
+		if(cur == dev_id) return &runtime->table[slot];
+		else if(!cur) return NULL;
+		slot = (slot + 1) & (DEVICE_TABLE_SIZE - 1);
+	}
+	return NULL;
+}
+
+/*
+ * Add a device to the lookup table.  Writers must be serialized.
+ */
+static void add_device(cl_runtime runtime, cl_device_id dev_id,
+											 cl_uint platform, cl_context ctx, cl_command_queue q,
+											 device_queue* dq)
+{
+	size_t i, slot = hash_device(dev_id);
+	device_entry* entry;
+
+	for(i = 0; i < DEVICE_TABLE_SIZE; i++)
+	{
+		entry = &runtime->table[slot];
+		if(!entry->id)
+		{
+			entry->platform = platform;
+			entry->context = ctx;
+			entry->q = q;
+			entry->dq = dq;
+			__atomic_store_n(&entry->id, dev_id, __ATOMIC_RELEASE);
+			return;
+		}
+		slot = (slot + 1) & (DEVICE_TABLE_SIZE - 1);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Command queues
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Create a command queue with the requested properties, dropping any the
+ * device doesn't support.
+ */
+static cl_command_queue create_queue(cl_context ctx, cl_device_id dev,
+																		 cl_command_queue_properties props)
+{
+	cl_command_queue_properties supported = 0;
+	cl_command_queue q;
+	cl_int err;
+
+	if(props)
+	{
+		OCLCHECK(clGetDeviceInfo(dev, CL_DEVICE_QUEUE_PROPERTIES,
+														 sizeof(supported), &supported, NULL));
+		if(props & ~supported)
+			fprintf(stderr, "OpenCL runtime warning: device doesn't support queue "
+											"properties 0x%lx, ignoring\n",
+							(unsigned long)(props & ~supported));
+		props &= supported;
+	}
+
+#ifdef CL_VERSION_2_0
+	cl_queue_properties qprops[] = { CL_QUEUE_PROPERTIES, props, 0 };
+	q = clCreateCommandQueueWithProperties(ctx, dev, props ? qprops : NULL, &err);
+#else
+	q = clCreateCommandQueue(ctx, dev, props, &err);
+#endif
+	OCLCHECK(err);
+	return q;
+}
+
+/*
+ * Select a queue from a device's pool.
+ */
+static cl_command_queue select_queue(cl_runtime runtime, device_queue* dq)
+{
+	cl_uint idx;
+
+	if(runtime->queues_per_device == 1) return dq->q;
+	if(runtime->selection == QUEUE_PER_THREAD)
+	{
+		if(!thread_slot)
+			thread_slot = __atomic_add_fetch(&num_thread_slots, 1, __ATOMIC_RELAXED);
+		idx = thread_slot - 1;
+	}
+	else idx = __atomic_fetch_add(&dq->next, 1, __ATOMIC_RELAXED);
+	return dq->pool[idx % runtime->queues_per_device];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Buffer pools
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Return the size class for a buffer, or BUFFER_POOL_CLASSES if it's too big
+ * to pool.
+ */
+static inline cl_uint buffer_class(size_t size)
+{
+	cl_uint cls = 0;
+	while(cls < BUFFER_POOL_CLASSES &&
+				((size_t)BUFFER_POOL_MIN_SIZE << cls) < size)
+		cls++;
+	return cls;
+}
+
+/*
+ * Release a pooled buffer & its host memory.
+ */
+static void free_pooled_buffer(pooled_buffer* pb)
+{
+	OCLCHECK(clReleaseMemObject(pb->mem));
+	free(pb->host);
+	free(pb);
+}
+
+/*
+ * Release a pool's idle buffers.  The caller must hold the pool's lock.
+ */
+static void trim_buffer_pool(buffer_pool* pool)
+{
+	pooled_buffer* pb;
+	cl_uint i;
+
+	for(i = 0; i < BUFFER_POOL_CLASSES; i++)
+	{
+		while((pb = pool->bins[i]))
+		{
+			pool->bins[i] = pb->next;
+			free_pooled_buffer(pb);
+		}
+	}
+	pool->stats.idle = 0;
+}
+
+/*
+ * Release all of a pool's buffers, including those still handed out.
+ */
+static void free_buffer_pool(buffer_pool* pool)
+{
+	pooled_buffer* pb;
+
+	trim_buffer_pool(pool);
+	if(pool->in_use)
+		fprintf(stderr, "OpenCL runtime warning: releasing %lu bytes of buffers "
+										"still in use\n", (unsigned long)pool->stats.in_use);
+	while((pb = pool->in_use))
+	{
+		pool->in_use = pb->next;
+		free_pooled_buffer(pb);
+	}
+	pthread_mutex_destroy(&pool->lock);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Library initialization & teardown
 ///////////////////////////////////////////////////////////////////////////////
@@ -85,6 +357,7 @@ init_ocl_rt()
 
 	// Enable sub-device creation in OpenCL 1.1
 	INIT_CL_EXT_FCN_PTR(clCreateSubDevicesEXT);
+	INIT_CL_EXT_FCN_PTR(clReleaseDeviceEXT);
 
 	// Query number of available platforms & devices
 	OCLCHECK(clGetPlatformIDs(0, NULL, &num_platforms));
@@ -114,9 +387,32 @@ dest_ocl_rt()
  * all devices.
  */
 cl_runtime new_cl_runtime(bool init_queues)
+{
+	return new_cl_runtime_with_pools(init_queues ? 1 : 0, 0, QUEUE_ROUND_ROBIN);
+}
+
+/*
+ * Setup the runtime environment with a pool of command queues per device.
+ * Queues are created with the requested properties (e.g. out-of-order
+ * execution or profiling) where the device supports them.  Sub-devices get a
+ * single queue with the same properties.
+ *
+ * @param queues number of queues per device, 0 for none
+ * @param props command queue properties
+ * @param selection how get_pool_queue() picks a queue from the pool
+ */
+cl_runtime new_cl_runtime_with_pools(cl_uint queues,
+																		 cl_command_queue_properties props,
+																		 enum queue_selection selection)
 {
 	cl_int i, j, err;
+	cl_uint k;
 	cl_runtime rt = (cl_runtime)malloc(sizeof(struct _cl_runtime));
+	bool init_queues = queues > 0;
+
+	rt->queues_per_device = queues;
+	rt->queue_props = props;
+	rt->selection = selection;
 
 	// Initialize platforms
 	rt->pf.num_platforms = num_platforms;
@@ -147,6 +443,31 @@ cl_runtime new_cl_runtime(bool init_queues)
 		OCLCHECK(err);
 	}
 
+	// Buffers are allocated into the pools on demand
+	rt->pools = (buffer_pool*)calloc(num_platforms, sizeof(buffer_pool));
+	for(i = 0; i < num_platforms; i++)
+	{
+		rt->pools[i].context = rt->ctx.contexts[i];
+		pthread_mutex_init(&rt->pools[i].lock, NULL);
+	}
+
+	// Cache program binaries unless disabled
+	rt->cache_dir = NULL;
+	const char* dir = getenv(PROGRAM_CACHE_ENV), *home = getenv("HOME");
+	char default_dir[PATH_MAX];
+	if(!dir && home)
+	{
+		snprintf(default_dir, PATH_MAX, "%s/%s", home, PROGRAM_CACHE_DIR);
+		dir = default_dir;
+	}
+	set_program_cache(rt, dir);
+
+	// Sub-devices are created on demand
+	rt->sub.num_subdevices = rt->sub.capacity = 0;
+	rt->sub.subdevices = NULL;
+	pthread_mutex_init(&rt->sub.lock, NULL);
+	memset(rt->table, 0, sizeof(rt->table));
+
 	// Initialize device queues (if requested)
 	rt->initialized = init_queues;
 	if(init_queues)
@@ -159,21 +480,24 @@ cl_runtime new_cl_runtime(bool init_queues)
 			rt->qs[i].queues = (device_queue*)malloc(sizeof(device_queue) * num_devices[i]);
 			for(j = 0; j < num_devices[i]; j++)
 			{
-				rt->qs[i].queues[j].id = rt->dv[i].devices[j];
-#ifdef CL_VERSION_2_0
-				rt->qs[i].queues[j].q = clCreateCommandQueueWithProperties(rt->qs[i].context,
-																																	 rt->qs[i].queues[j].id,
-																																	 NULL, &err);
-#else
-				rt->qs[i].queues[j].q = clCreateCommandQueue(rt->qs[i].context,
-																										 rt->qs[i].queues[j].id,
-																										 0, &err);
-#endif
-				OCLCHECK(err);
+				device_queue* dq = &rt->qs[i].queues[j];
+				dq->id = rt->dv[i].devices[j];
+				dq->next = 0;
+				dq->pool = (cl_command_queue*)malloc(sizeof(cl_command_queue) * queues);
+				for(k = 0; k < queues; k++)
+					dq->pool[k] = create_queue(rt->qs[i].context, dq->id, props);
+				dq->q = dq->pool[0];
 			}
 		}
 	}
 
+	// Build the device lookup table
+	for(i = 0; i < num_platforms; i++)
+		for(j = 0; j < num_devices[i]; j++)
+			add_device(rt, rt->dv[i].devices[j], i, rt->ctx.contexts[i],
+								 init_queues ? rt->qs[i].queues[j].q : NULL,
+								 init_queues ? &rt->qs[i].queues[j] : NULL);
+
 	return rt;
 }
 
@@ -183,22 +507,46 @@ cl_runtime new_cl_runtime(bool init_queues)
 void delete_cl_runtime(cl_runtime runtime)
 {
 	int i, j;
+	cl_uint k;
 
 	if(!runtime) return; // Semantically similar to free()
 
+	// Tear down sub-devices & their queues/contexts
+	for(i = 0; i < runtime->sub.num_subdevices; i++)
+	{
+		subdevice* sd = &runtime->sub.subdevices[i];
+		if(sd->pool)
+		{
+			free_buffer_pool(sd->pool);
+			free(sd->pool);
+		}
+		if(sd->q) OCLCHECK(clReleaseCommandQueue(sd->q));
+		if(sd->context) OCLCHECK(clReleaseContext(sd->context));
+		OCLCHECK(RELEASE_SUBDEVICE(sd->id));
+	}
+	free(runtime->sub.subdevices);
+	pthread_mutex_destroy(&runtime->sub.lock);
+
 	// Tear down device queues
 	if(runtime->initialized)
 	{
 		for(i = 0; i < num_platforms; i++)
 		{
 			for(j = 0; j < runtime->qs[i].num_queues; j++)
-				OCLCHECK(clReleaseCommandQueue(runtime->qs[i].queues[j].q));
+			{
+				for(k = 0; k < runtime->queues_per_device; k++)
+					OCLCHECK(clReleaseCommandQueue(runtime->qs[i].queues[j].pool[k]));
+				free(runtime->qs[i].queues[j].pool);
+			}
 			free(runtime->qs[i].queues);
 		}
 		free(runtime->qs);
 	}
 
-	// Tear down contexts
+	// Tear down buffer pools & contexts
+	for(i = 0; i < num_platforms; i++)
+		free_buffer_pool(&runtime->pools[i]);
+	free(runtime->pools);
 	for(i = 0; i < num_platforms; i++)
 		OCLCHECK(clReleaseContext(runtime->ctx.contexts[i]));
 	free(runtime->ctx.contexts);
@@ -210,6 +558,7 @@ void delete_cl_runtime(cl_runtime runtime)
 
 	// Tear down platforms & runtime
 	free(runtime->pf.platforms);
+	free(runtime->cache_dir);
 	free(runtime);
 }
 
@@ -322,9 +671,68 @@ cl_device_id get_device(cl_runtime runtime, cl_uint platform, cl_uint device)
 	return runtime->dv[platform].devices[device];
 }
 
+/*
+ * Find a cached sub-device by its ID.  The caller must hold the sub-device
+ * lock.
+ */
+static subdevice* find_subdevice(cl_runtime runtime, cl_device_id dev_id)
+{
+	cl_uint i;
+
+	for(i = 0; i < runtime->sub.num_subdevices; i++)
+		if(runtime->sub.subdevices[i].id == dev_id)
+			return &runtime->sub.subdevices[i];
+	return NULL;
+}
+
+/*
+ * Create a cached sub-device's context if it hasn't been created yet.  The
+ * caller must hold the sub-device lock.
+ */
+static cl_context get_subdevice_context(cl_runtime runtime, subdevice* sd)
+{
+	device_entry* entry;
+	cl_int err;
+
+	if(!sd->context)
+	{
+		cl_context_properties props[] = {
+			CL_CONTEXT_PLATFORM,
+			(cl_context_properties)runtime->pf.platforms[sd->platform], 0
+		};
+		sd->context = clCreateContext(props, 1, &sd->id, NULL, NULL, &err);
+		OCLCHECK(err);
+		if((entry = find_device(runtime, sd->id)))
+			__atomic_store_n(&entry->context, sd->context, __ATOMIC_RELEASE);
+	}
+	return sd->context;
+}
+
+/*
+ * Create a cached sub-device's command queue if it hasn't been created yet.
+ * The caller must hold the sub-device lock.
+ */
+static cl_command_queue get_subdevice_queue(cl_runtime runtime, subdevice* sd)
+{
+	device_entry* entry;
+
+	if(!sd->q)
+	{
+		sd->q = create_queue(get_subdevice_context(runtime, sd), sd->id,
+												 runtime->queue_props);
+		if((entry = find_device(runtime, sd->id)))
+			__atomic_store_n(&entry->q, sd->q, __ATOMIC_RELEASE);
+	}
+	return sd->q;
+}
+
 /*
  * Create a sub-device from the specified platform/device with the specified
- * number of compute units.
+ * number of compute units.  Sub-devices are cached, so asking for the same
+ * number of compute units again returns the same sub-device.
+ *
+ * NOTE: The application should NOT release the sub-device, as it will be
+ * cleaned up when the runtime is destroyed
  */
 cl_device_id get_subdevice(cl_runtime runtime, cl_uint platform, cl_uint device, cl_uint units)
 {
@@ -341,7 +749,7 @@ cl_device_id get_subdevice(cl_runtime runtime, cl_uint platform, cl_uint device,
 	return in_dev;
 #else
 	cl_device_id out_dev;
-	cl_uint num_ret = 0;
+	cl_uint num_ret = 0, i;
 #endif
 
 	// If no sub-device was requested, return the original device
@@ -355,6 +763,18 @@ cl_device_id get_subdevice(cl_runtime runtime, cl_uint platform, cl_uint device,
 	if(type == CL_DEVICE_TYPE_GPU || type == CL_DEVICE_TYPE_ACCELERATOR)
 		return in_dev;
 
+	pthread_mutex_lock(&runtime->sub.lock);
+	for(i = 0; i < runtime->sub.num_subdevices; i++)
+	{
+		subdevice* sd = &runtime->sub.subdevices[i];
+		if(sd->platform == platform && sd->device == device && sd->units == units)
+		{
+			out_dev = sd->id;
+			pthread_mutex_unlock(&runtime->sub.lock);
+			return out_dev;
+		}
+	}
+
 #if defined(CL_VERSION_1_2)
 	//OpenCL v1.2 or later
 	cl_device_partition_property pp[] = {
@@ -370,6 +790,26 @@ cl_device_id get_subdevice(cl_runtime runtime, cl_uint platform, cl_uint device,
 	};
 	OCLCHECK(pfn_clCreateSubDevicesEXT(in_dev, pp, 1, &out_dev, &num_ret));
 #endif
+
+	// Cache it
+	if(runtime->sub.num_subdevices == runtime->sub.capacity)
+	{
+		runtime->sub.capacity = runtime->sub.capacity ?
+														runtime->sub.capacity * 2 : 8;
+		runtime->sub.subdevices = (subdevice*)realloc(runtime->sub.subdevices,
+			sizeof(subdevice) * runtime->sub.capacity);
+		if(!runtime->sub.subdevices) OCLERR("could not cache sub-device");
+	}
+	subdevice* sd = &runtime->sub.subdevices[runtime->sub.num_subdevices++];
+	sd->platform = platform;
+	sd->device = device;
+	sd->units = units;
+	sd->id = out_dev;
+	sd->context = NULL;
+	sd->q = NULL;
+	sd->pool = NULL;
+	add_device(runtime, out_dev, platform, NULL, NULL, NULL);
+	pthread_mutex_unlock(&runtime->sub.lock);
 	return out_dev;
 }
 
@@ -385,7 +825,8 @@ cl_context get_context_by_platform(cl_runtime runtime, cl_uint platform)
 }
 
 /*
- * Return the device's context
+ * Return the device's context.  Sub-devices from get_subdevice() get their own
+ * context, created on first use.
  *
  * NOTE: The application should NOT destroy this context, as it will be cleaned
  * up when the runtime is destroyed
@@ -393,18 +834,33 @@ cl_context get_context_by_platform(cl_runtime runtime, cl_uint platform)
 cl_context get_context_by_dev(cl_runtime runtime, cl_device_id dev_id)
 {
 	cl_uint i, j;
+	cl_context ctx = NULL;
+	device_entry* entry;
+	subdevice* sd;
 
 	if(!runtime) OCLERR("passed bad runtime argument");
 
+	if((entry = find_device(runtime, dev_id)) &&
+		 (ctx = __atomic_load_n(&entry->context, __ATOMIC_ACQUIRE)))
+		return ctx;
+
+	// Slow path, devices which didn't fit in the table or sub-devices without
+	// a context yet
 	for(i = 0; i < num_platforms; i++)
 		for(j = 0; j < num_devices[i]; j++)
 			if(runtime->dv[i].devices[j] == dev_id)
 				return runtime->ctx.contexts[i];
-	return NULL;
+
+	pthread_mutex_lock(&runtime->sub.lock);
+	if((sd = find_subdevice(runtime, dev_id)))
+		ctx = get_subdevice_context(runtime, sd);
+	pthread_mutex_unlock(&runtime->sub.lock);
+	return ctx;
 }
 
 /*
- * Return a device's command queue
+ * Return a device's command queue.  Sub-devices from get_subdevice() get their
+ * own command queue, created on first use.
  *
  * NOTE: The application should NOT destroy this command queue, as it will be
  * cleaned up when the runtime is destroyed
@@ -412,21 +868,447 @@ cl_context get_context_by_dev(cl_runtime runtime, cl_device_id dev_id)
 cl_command_queue get_queue_by_dev(cl_runtime runtime, cl_device_id dev_id)
 {
 	int i, j;
+	cl_command_queue q = NULL;
+	device_entry* entry;
+	subdevice* sd;
 
 	if(!runtime) OCLCHECK(CL_INVALID_VALUE);
 	if(!runtime->initialized) OCLERR("cannot get queue for uninitialized runtime");
 
+	if((entry = find_device(runtime, dev_id)) &&
+		 (q = __atomic_load_n(&entry->q, __ATOMIC_ACQUIRE)))
+		return q;
+
+	// Slow path, devices which didn't fit in the table or sub-devices without
+	// a queue yet
 	for(i = 0; i < num_platforms; i++)
 		for(j = 0; j < num_devices[i]; j++)
 			if(runtime->dv[i].devices[j] == dev_id)
 				return runtime->qs[i].queues[j].q;
+
+	pthread_mutex_lock(&runtime->sub.lock);
+	if((sd = find_subdevice(runtime, dev_id)))
+		q = get_subdevice_queue(runtime, sd);
+	pthread_mutex_unlock(&runtime->sub.lock);
+	return q;
+}
+
+/*
+ * Find a device's queue pool.
+ */
+static device_queue* find_device_queue(cl_runtime runtime, cl_device_id dev_id)
+{
+	device_entry* entry;
+	cl_uint i, j;
+
+	if((entry = find_device(runtime, dev_id))) return entry->dq;
+	for(i = 0; i < num_platforms; i++)
+		for(j = 0; j < num_devices[i]; j++)
+			if(runtime->dv[i].devices[j] == dev_id)
+				return &runtime->qs[i].queues[j];
 	return NULL;
 }
 
+/*
+ * Return the number of command queues in each device's pool.
+ */
+cl_uint get_num_queues(cl_runtime runtime)
+{
+	if(!runtime) OCLERR("passed bad runtime argument");
+	return runtime->queues_per_device;
+}
+
+/*
+ * Return a command queue from a device's pool, either the next one in turn or
+ * the calling thread's, depending on how the runtime was created.
+ * Sub-devices only have a single queue.
+ *
+ * NOTE: The application should NOT destroy this command queue, as it will be
+ * cleaned up when the runtime is destroyed
+ */
+cl_command_queue get_pool_queue(cl_runtime runtime, cl_device_id dev_id)
+{
+	device_queue* dq;
+
+	if(!runtime) OCLCHECK(CL_INVALID_VALUE);
+	if(!runtime->initialized) OCLERR("cannot get queue for uninitialized runtime");
+
+	if((dq = find_device_queue(runtime, dev_id)))
+		return select_queue(runtime, dq);
+	return get_queue_by_dev(runtime, dev_id);
+}
+
+/*
+ * Return a specific command queue from a device's pool.  Indices wrap around
+ * the pool, & sub-devices only have a single queue.
+ *
+ * NOTE: The application should NOT destroy this command queue, as it will be
+ * cleaned up when the runtime is destroyed
+ */
+cl_command_queue get_queue_by_index(cl_runtime runtime, cl_device_id dev_id,
+																		cl_uint index)
+{
+	device_queue* dq;
+
+	if(!runtime) OCLCHECK(CL_INVALID_VALUE);
+	if(!runtime->initialized) OCLERR("cannot get queue for uninitialized runtime");
+
+	if((dq = find_device_queue(runtime, dev_id)))
+		return dq->pool[index % runtime->queues_per_device];
+	return get_queue_by_dev(runtime, dev_id);
+}
+
+/*
+ * Return the platform ID of a device or sub-device.
+ */
+cl_platform_id get_platform_by_dev(cl_runtime runtime, cl_device_id dev_id)
+{
+	cl_platform_id platform = NULL;
+	device_entry* entry;
+	subdevice* sd;
+	cl_uint i, j;
+
+	if(!runtime) OCLERR("passed bad runtime argument");
+
+	if((entry = find_device(runtime, dev_id)))
+		return runtime->pf.platforms[entry->platform];
+
+	for(i = 0; i < num_platforms; i++)
+		for(j = 0; j < num_devices[i]; j++)
+			if(runtime->dv[i].devices[j] == dev_id)
+				return runtime->pf.platforms[i];
+
+	pthread_mutex_lock(&runtime->sub.lock);
+	if((sd = find_subdevice(runtime, dev_id)))
+		platform = runtime->pf.platforms[sd->platform];
+	pthread_mutex_unlock(&runtime->sub.lock);
+	return platform;
+}
+
+/*
+ * Find the buffer pool for a device's context.  Sub-devices get their own
+ * pool, created on first use.
+ */
+static buffer_pool* find_buffer_pool(cl_runtime runtime, cl_device_id dev_id)
+{
+	cl_context ctx = get_context_by_dev(runtime, dev_id);
+	buffer_pool* pool = NULL;
+	subdevice* sd;
+	cl_uint i;
+
+	for(i = 0; i < num_platforms; i++)
+		if(runtime->pools[i].context == ctx)
+			return &runtime->pools[i];
+
+	pthread_mutex_lock(&runtime->sub.lock);
+	if((sd = find_subdevice(runtime, dev_id)))
+	{
+		if(!sd->pool)
+		{
+			sd->pool = (buffer_pool*)calloc(1, sizeof(buffer_pool));
+			if(!sd->pool) OCLERR("could not allocate buffer pool");
+			sd->pool->context = get_subdevice_context(runtime, sd);
+			pthread_mutex_init(&sd->pool->lock, NULL);
+		}
+		pool = sd->pool;
+	}
+	pthread_mutex_unlock(&runtime->sub.lock);
+	if(!pool) OCLCHECK(CL_INVALID_DEVICE);
+	return pool;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Convenience functions for general-purpose OpenCL programming
 ///////////////////////////////////////////////////////////////////////////////
 
+/*
+ * Hash data into a program binary cache key.
+ */
+static uint64_t hash_bytes(uint64_t hash, const void* data, size_t size)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	size_t i;
+
+	for(i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+/*
+ * Hash a device's string property into a program binary cache key.
+ */
+static uint64_t hash_device_info(uint64_t hash, cl_device_id dev,
+																 cl_device_info param)
+{
+	size_t size;
+	char* info;
+
+	if(clGetDeviceInfo(dev, param, 0, NULL, &size) != CL_SUCCESS) return hash;
+	info = (char*)malloc(size);
+	if(clGetDeviceInfo(dev, param, size, info, NULL) == CL_SUCCESS)
+		hash = hash_bytes(hash, info, size);
+	free(info);
+	return hash;
+}
+
+/*
+ * Read a whole file into a NUL-terminated buffer.
+ *
+ * @return the contents (free with free()), or NULL if it can't be read
+ */
+static char* read_file(const char* path, size_t* size)
+{
+	char* buf = NULL;
+	long len;
+	FILE* fp;
+
+	if(!(fp = fopen(path, "r"))) return NULL;
+	if(!fseek(fp, 0, SEEK_END) && (len = ftell(fp)) >= 0 &&
+		 !fseek(fp, 0, SEEK_SET) && (buf = (char*)malloc(len + 1)))
+	{
+		if(fread(buf, 1, len, fp) == (size_t)len)
+		{
+			buf[len] = '\0';
+			*size = len;
+		}
+		else
+		{
+			free(buf);
+			buf = NULL;
+		}
+	}
+	fclose(fp);
+	return buf;
+}
+
+/*
+ * Find an included file next to the including file (for "" includes), then in
+ * the -I directories of the build arguments.
+ *
+ * @return true if found (its path is in path), false otherwise
+ */
+static bool find_include(const char* name, bool quoted, const char* dir,
+												 const char* args, char* path)
+{
+	const char* cur, *end;
+	int len;
+
+	if(name[0] == '/')
+		return snprintf(path, PATH_MAX, "%s", name) < PATH_MAX &&
+					 !access(path, R_OK);
+	if(quoted && snprintf(path, PATH_MAX, "%s/%s", dir, name) < PATH_MAX &&
+		 !access(path, R_OK))
+		return true;
+
+	for(cur = args; cur && (cur = strstr(cur, "-I")); cur = end)
+	{
+		// Either "-Idir" or "-I dir"
+		if(cur != args && cur[-1] != ' ' && cur[-1] != '\t')
+		{
+			end = cur + 2;
+			continue;
+		}
+		for(cur += 2; *cur == ' ' || *cur == '\t'; cur++);
+		for(end = cur; *end && *end != ' ' && *end != '\t'; end++);
+		len = end - cur;
+		if(len && snprintf(path, PATH_MAX, "%.*s/%s", len, cur, name) < PATH_MAX &&
+			 !access(path, R_OK))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Hash the files a program source includes (& the files they include) into a
+ * program binary cache key, so that editing a header builds a new binary.
+ * Directives are found textually, so commented-out & conditionally-excluded
+ * includes are hashed too.
+ *
+ * @return true if every included file was hashed, false if one couldn't be
+ *         found or read, or is named by a macro (the key is then unreliable)
+ */
+static bool hash_includes(uint64_t* key, const char* src, const char* dir,
+													const char* args, int depth)
+{
+	char path[PATH_MAX], name[PATH_MAX], *inc, *slash;
+	const char* line, *cur, *end;
+	bool quoted, found = true;
+	size_t size;
+
+	if(depth > CACHE_MAX_INCLUDE_DEPTH) return false;
+	for(line = src; found && line && *line; line = strchr(line, '\n'))
+	{
+		if(*line == '\n') line++;
+		for(cur = line; *cur == ' ' || *cur == '\t'; cur++);
+		if(*cur++ != '#') continue;
+		for(; *cur == ' ' || *cur == '\t'; cur++);
+		if(strncmp(cur, "include", 7)) continue;
+		for(cur += 7; *cur == ' ' || *cur == '\t'; cur++);
+
+		if(*cur != '"' && *cur != '<') return false;
+		quoted = *cur++ == '"';
+		if(!(end = strchr(cur, quoted ? '"' : '>')) || end - cur >= PATH_MAX)
+			return false;
+		snprintf(name, PATH_MAX, "%.*s", (int)(end - cur), cur);
+		if(!find_include(name, quoted, dir, args, path) ||
+			 !(inc = read_file(path, &size)))
+			return false;
+
+		*key = hash_bytes(*key, path, strlen(path));
+		*key = hash_bytes(*key, inc, size);
+		if((slash = strrchr(path, '/'))) *slash = '\0';
+		else strcpy(path, ".");
+		found = hash_includes(key, inc, path, args, depth + 1);
+		free(inc);
+	}
+	return found;
+}
+
+/*
+ * Create a directory & its parents if they don't exist.
+ */
+static bool make_dirs(const char* dir)
+{
+	char path[PATH_MAX];
+	char* cur;
+
+	if(snprintf(path, PATH_MAX, "%s", dir) >= PATH_MAX) return false;
+	for(cur = path + 1; *cur; cur++)
+	{
+		if(*cur != '/') continue;
+		*cur = '\0';
+		if(mkdir(path, 0755) && errno != EEXIST) return false;
+		*cur = '/';
+	}
+	return !mkdir(path, 0755) || errno == EEXIST;
+}
+
+/*
+ * Load & build a cached program binary.  Binaries the driver rejects (e.g.
+ * from a different compiler version) are removed.
+ *
+ * @return the program, or NULL if there's no usable binary
+ */
+static cl_program load_cached_binary(const char* path, const char* args,
+																		 cl_context ctx, cl_device_id dev)
+{
+	cl_program program = NULL;
+	unsigned char* binary;
+	cl_int status, err;
+	long size;
+	FILE* fp;
+
+	if(!(fp = fopen(path, "r"))) return NULL;
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	binary = (unsigned char*)malloc(size > 0 ? size : 1);
+	if(size > 0 && fread(binary, 1, size, fp) == (size_t)size)
+	{
+		size_t binary_size = size;
+		program = clCreateProgramWithBinary(ctx, 1, &dev, &binary_size,
+																				(const unsigned char**)&binary,
+																				&status, &err);
+		if(err != CL_SUCCESS || status != CL_SUCCESS ||
+			 clBuildProgram(program, 1, &dev, args, NULL, NULL) != CL_SUCCESS)
+		{
+			if(program) clReleaseProgram(program);
+			program = NULL;
+		}
+	}
+	free(binary);
+	fclose(fp);
+
+	if(!program)
+	{
+		fprintf(stderr, "OpenCL runtime warning: rebuilding rejected binary "
+										"'%s'\n", path);
+		remove(path);
+	}
+	return program;
+}
+
+/*
+ * Save a program's binary for a device into the cache, creating the cache
+ * directory if necessary.  Binaries are written to a uniquely-named temporary
+ * file & renamed so concurrent builds (from other processes or threads) never
+ * see partial files.  Caching is best-effort, so failures are silently
+ * ignored.
+ */
+static void cache_binary(cl_program program, cl_device_id dev,
+												 const char* dir, const char* path)
+{
+	char tmp[PATH_MAX];
+	cl_uint num_devs, i, idx;
+	cl_device_id* devs;
+	size_t* sizes;
+	unsigned char** binaries;
+	FILE* fp;
+	int fd;
+
+	if(clGetProgramInfo(program, CL_PROGRAM_NUM_DEVICES, sizeof(cl_uint),
+											&num_devs, NULL) != CL_SUCCESS || !num_devs)
+		return;
+
+	// Some runtimes only hand out the binaries for all devices at once
+	devs = (cl_device_id*)malloc(sizeof(cl_device_id) * num_devs);
+	sizes = (size_t*)calloc(num_devs, sizeof(size_t));
+	binaries = (unsigned char**)calloc(num_devs, sizeof(unsigned char*));
+	if(clGetProgramInfo(program, CL_PROGRAM_DEVICES,
+											sizeof(cl_device_id) * num_devs, devs, NULL)
+		 != CL_SUCCESS ||
+		 clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES,
+											sizeof(size_t) * num_devs, sizes, NULL) != CL_SUCCESS)
+		goto cleanup;
+	for(idx = 0; idx < num_devs && devs[idx] != dev; idx++);
+	if(idx == num_devs || !sizes[idx]) goto cleanup;
+	for(i = 0; i < num_devs; i++)
+		binaries[i] = (unsigned char*)malloc(sizes[i] ? sizes[i] : 1);
+	if(clGetProgramInfo(program, CL_PROGRAM_BINARIES,
+											sizeof(unsigned char*) * num_devs, binaries, NULL)
+		 != CL_SUCCESS)
+		goto cleanup;
+
+	if(snprintf(tmp, PATH_MAX, "%s.XXXXXX", path) >= PATH_MAX ||
+		 !make_dirs(dir) || (fd = mkstemp(tmp)) == -1)
+		goto cleanup;
+	if(!(fp = fdopen(fd, "w")))
+	{
+		close(fd);
+		remove(tmp);
+		goto cleanup;
+	}
+	if(fwrite(binaries[idx], 1, sizes[idx], fp) != sizes[idx])
+	{
+		fclose(fp);
+		remove(tmp);
+		goto cleanup;
+	}
+	if(fclose(fp) || rename(tmp, path)) remove(tmp);
+
+cleanup:
+	for(i = 0; i < num_devs; i++)
+		free(binaries[i]);
+	free(binaries);
+	free(sizes);
+	free(devs);
+}
+
+/*
+ * Set the directory in which program binaries are cached.  NULL or an empty
+ * string disables caching.
+ */
+void set_program_cache(cl_runtime runtime, const char* dir)
+{
+	if(!runtime) OCLERR("passed bad runtime argument");
+
+	free(runtime->cache_dir);
+	runtime->cache_dir = dir && *dir ? strdup(dir) : NULL;
+}
+
 /*
  * Build the program from the specified file for the specified device
  */
@@ -447,6 +1329,7 @@ cl_program build_program_with_args(cl_runtime runtime, const char* fname,
 	cl_context ctx;
 	size_t fsize;
 	char* src;
+	char cache_fn[PATH_MAX], dir[PATH_MAX], *slash;
 	cl_int err;
 
 	if(!runtime) OCLERR("passed bad runtime argument");
@@ -469,6 +1352,34 @@ cl_program build_program_with_args(cl_runtime runtime, const char* fname,
 	}
 	src[fsize] = '\0';
 	fclose(fp);
+
+	// Reuse a cached binary built from the same source (including the files it
+	// includes), arguments, device & driver if there is one
+	cache_fn[0] = '\0';
+	if(runtime->cache_dir)
+	{
+		uint64_t key = hash_bytes(FNV_OFFSET, src, fsize + 1);
+		if(args) key = hash_bytes(key, args, strlen(args));
+		key = hash_device_info(key, dev, CL_DEVICE_NAME);
+		key = hash_device_info(key, dev, CL_DEVICE_VERSION);
+		key = hash_device_info(key, dev, CL_DRIVER_VERSION);
+
+		snprintf(dir, PATH_MAX, "%s", fname);
+		if((slash = strrchr(dir, '/'))) *slash = '\0';
+		else strcpy(dir, ".");
+		if(!hash_includes(&key, src, dir, args, 0))
+			fprintf(stderr, "OpenCL runtime warning: not caching '%s', could not "
+											"follow its includes\n", fname);
+		else if(snprintf(cache_fn, PATH_MAX, "%s/%016llx.bin", runtime->cache_dir,
+										 (unsigned long long)key) >= PATH_MAX)
+			cache_fn[0] = '\0';
+		else if((program = load_cached_binary(cache_fn, args, ctx, dev)))
+		{
+			free(src);
+			return program;
+		}
+	}
+
 	program = clCreateProgramWithSource(ctx, 1, (const char**)(&src), &fsize, &err);
 	OCLCHECK(err);
 
@@ -487,10 +1398,315 @@ cl_program build_program_with_args(cl_runtime runtime, const char* fname,
 		OCLCHECK(CL_BUILD_PROGRAM_FAILURE);
 	}
 
+	if(cache_fn[0]) cache_binary(program, dev, runtime->cache_dir, cache_fn);
 	free(src);
 	return program;
 }
 
+/*
+ * Run a 1-dimensional kernel in chunks, overlapping the transfers of each chunk
+ * with the computation of others.  Each chunk's input is copied to the device,
+ * its work-items run (using a global work offset, so the kernel indexes with
+ * get_global_id() as usual) & its output copied back.  Copies in, kernels &
+ * copies out are issued to separate queues from the device's pool (the first
+ * three) & chained with events.  The kernel's arguments must already be set,
+ * & work-item i must only read & write element i of the buffers.  Blocks until
+ * the output has been copied back.
+ *
+ * Pools of a single in-order queue serialize everything, so use at least
+ * three queues or out-of-order queues.
+ *
+ * @param dev the device
+ * @param kernel the kernel
+ * @param items total number of work-items, a multiple of local if set
+ * @param local work-group size, or 0 to let the runtime choose
+ * @param chunks number of chunks to split the work-items into
+ * @param in input buffer (NULL for none) & its host memory, in_size bytes per
+ *           work-item
+ * @param out output buffer (NULL for none) & its host memory, out_size bytes
+ *            per work-item
+ * @return CL_SUCCESS, or the first error
+ */
+cl_int enqueue_overlapped(cl_runtime runtime, cl_device_id dev,
+													cl_kernel kernel, size_t items, size_t local,
+													cl_uint chunks, cl_mem in, const void* host_in,
+													size_t in_size, cl_mem out, void* host_out,
+													size_t out_size)
+{
+	cl_command_queue h2d, compute, d2h;
+	cl_event* events;
+	size_t chunk, offset, num;
+	cl_uint i, num_events = 0;
+	cl_int err = CL_SUCCESS;
+
+	if(!runtime) OCLERR("passed bad runtime argument");
+	if(!items || !chunks || (local && items % local)) return CL_INVALID_VALUE;
+
+	h2d = get_queue_by_index(runtime, dev, 0);
+	compute = get_queue_by_index(runtime, dev, 1);
+	d2h = get_queue_by_index(runtime, dev, 2);
+	if(!h2d || !compute || !d2h) return CL_INVALID_DEVICE;
+
+	// Chunks are whole work-groups
+	chunk = (items + chunks - 1) / chunks;
+	if(local) chunk = (chunk + local - 1) / local * local;
+	events = (cl_event*)malloc(sizeof(cl_event) * chunks * 3);
+
+	for(offset = 0; offset < items; offset += chunk)
+	{
+		cl_event* copy_in = &events[num_events], *ran, *copy_out;
+		cl_uint waits = 0;
+
+		num = items - offset < chunk ? items - offset : chunk;
+		if(in)
+		{
+			err = clEnqueueWriteBuffer(h2d, in, CL_FALSE, offset * in_size,
+																 num * in_size,
+																 (const char*)host_in + offset * in_size,
+																 0, NULL, copy_in);
+			if(err != CL_SUCCESS) break;
+			num_events++;
+			waits = 1;
+		}
+
+		ran = &events[num_events];
+		err = clEnqueueNDRangeKernel(compute, kernel, 1, &offset, &num,
+																 local ? &local : NULL, waits,
+																 waits ? copy_in : NULL, ran);
+		if(err != CL_SUCCESS) break;
+		num_events++;
+
+		if(out)
+		{
+			copy_out = &events[num_events];
+			err = clEnqueueReadBuffer(d2h, out, CL_FALSE, offset * out_size,
+																num * out_size,
+																(char*)host_out + offset * out_size,
+																1, ran, copy_out);
+			if(err != CL_SUCCESS) break;
+			num_events++;
+		}
+	}
+
+	// Start all queues before waiting, otherwise they may not run concurrently
+	clFlush(h2d);
+	clFlush(compute);
+	clFlush(d2h);
+	if(num_events)
+	{
+		cl_int wait_err = clWaitForEvents(num_events, events);
+		if(err == CL_SUCCESS) err = wait_err;
+	}
+	for(i = 0; i < num_events; i++)
+		clReleaseEvent(events[i]);
+	free(events);
+	return err;
+}
+
+/*
+ * Get a buffer of at least size bytes from the device's buffer pool, reusing
+ * an idle buffer of the same size class, flags & memory if there is one.
+ * Pooled buffers are rounded up to their size class.  Buffers in host memory
+ * should be accessed with map_buffer() & unmap_buffer() to avoid copies.
+ *
+ * NOTE: The application should NOT release the buffer, but return it with
+ * release_buffer()
+ *
+ * @param dev the device
+ * @param flags memory flags (e.g. CL_MEM_READ_ONLY), host pointer flags are
+ *              set from memory
+ * @param memory where the buffer's memory lives
+ * @param size minimum size of the buffer in bytes
+ * @return the buffer
+ */
+cl_mem acquire_buffer(cl_runtime runtime, cl_device_id dev, cl_mem_flags flags,
+											enum buffer_memory memory, size_t size)
+{
+	buffer_pool* pool;
+	pooled_buffer* pb, **prev;
+	cl_uint cls;
+	size_t total;
+	cl_int err;
+
+	if(!runtime) OCLERR("passed bad runtime argument");
+	if(!size) OCLCHECK(CL_INVALID_BUFFER_SIZE);
+
+	pool = find_buffer_pool(runtime, dev);
+	flags &= ~(CL_MEM_ALLOC_HOST_PTR | CL_MEM_USE_HOST_PTR |
+						 CL_MEM_COPY_HOST_PTR);
+	cls = buffer_class(size);
+	if(cls < BUFFER_POOL_CLASSES) size = (size_t)BUFFER_POOL_MIN_SIZE << cls;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stats.acquires++;
+	if(cls < BUFFER_POOL_CLASSES)
+	{
+		for(prev = &pool->bins[cls]; (pb = *prev); prev = &pb->next)
+		{
+			if(pb->flags == flags && pb->memory == memory)
+			{
+				*prev = pb->next;
+				pool->stats.hits++;
+				pool->stats.idle -= pb->size;
+				goto found;
+			}
+		}
+	}
+
+	// Nothing to reuse, allocate a new buffer
+	if(!(pb = (pooled_buffer*)malloc(sizeof(pooled_buffer))))
+		OCLERR("could not allocate pooled buffer");
+	pb->size = size;
+	pb->flags = flags;
+	pb->memory = memory;
+	pb->host = NULL;
+	switch(memory)
+	{
+	case BUFFER_ALLOC_HOST: flags |= CL_MEM_ALLOC_HOST_PTR; break;
+	case BUFFER_USE_HOST:
+		if(posix_memalign(&pb->host, BUFFER_POOL_MIN_SIZE, size))
+			OCLERR("could not allocate host memory for buffer");
+		flags |= CL_MEM_USE_HOST_PTR;
+		break;
+	default: break;
+	}
+	pb->mem = clCreateBuffer(pool->context, flags, size, pb->host, &err);
+	OCLCHECK(err);
+
+found:
+	pb->next = pool->in_use;
+	pool->in_use = pb;
+	pool->stats.in_use += pb->size;
+	total = pool->stats.in_use + pool->stats.idle;
+	if(total > pool->stats.peak) pool->stats.peak = total;
+	pthread_mutex_unlock(&pool->lock);
+	return pb->mem;
+}
+
+/*
+ * Return a buffer from acquire_buffer() to the device's buffer pool.  It's
+ * kept for reuse unless it's too big or the pool already holds
+ * BUFFER_POOL_MAX_IDLE bytes of idle buffers.
+ */
+void release_buffer(cl_runtime runtime, cl_device_id dev, cl_mem buf)
+{
+	buffer_pool* pool;
+	pooled_buffer* pb, **prev;
+	cl_uint cls;
+
+	if(!runtime) OCLERR("passed bad runtime argument");
+
+	pool = find_buffer_pool(runtime, dev);
+	pthread_mutex_lock(&pool->lock);
+	for(prev = &pool->in_use; (pb = *prev); prev = &pb->next)
+		if(pb->mem == buf) break;
+	if(!pb)
+	{
+		pthread_mutex_unlock(&pool->lock);
+		OCLERR("released buffer which isn't from the device's pool");
+	}
+	*prev = pb->next;
+	pool->stats.releases++;
+	pool->stats.in_use -= pb->size;
+
+	cls = buffer_class(pb->size);
+	if(cls < BUFFER_POOL_CLASSES &&
+		 pool->stats.idle + pb->size <= BUFFER_POOL_MAX_IDLE)
+	{
+		pb->next = pool->bins[cls];
+		pool->bins[cls] = pb;
+		pool->stats.idle += pb->size;
+	}
+	else free_pooled_buffer(pb);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Map a whole buffer into host memory using the device's queue, blocking until
+ * it's mapped.  Doesn't copy for buffers in host memory on devices which share
+ * memory with the host.
+ *
+ * @param flags CL_MAP_READ and/or CL_MAP_WRITE
+ * @return host pointer to the buffer's contents
+ */
+void* map_buffer(cl_runtime runtime, cl_device_id dev, cl_mem buf,
+								 cl_map_flags flags)
+{
+	cl_command_queue q;
+	size_t size;
+	void* ptr;
+	cl_int err;
+
+	if(!runtime) OCLERR("passed bad runtime argument");
+
+	q = get_queue_by_dev(runtime, dev);
+	OCLCHECK(clGetMemObjectInfo(buf, CL_MEM_SIZE, sizeof(size), &size, NULL));
+	ptr = clEnqueueMapBuffer(q, buf, CL_TRUE, flags, 0, size, 0, NULL, NULL,
+													 &err);
+	OCLCHECK(err);
+	return ptr;
+}
+
+/*
+ * Unmap a buffer mapped by map_buffer(), blocking until it's unmapped.
+ */
+void unmap_buffer(cl_runtime runtime, cl_device_id dev, cl_mem buf, void* ptr)
+{
+	cl_event unmapped;
+
+	if(!runtime) OCLERR("passed bad runtime argument");
+
+	OCLCHECK(clEnqueueUnmapMemObject(get_queue_by_dev(runtime, dev), buf, ptr,
+																	 0, NULL, &unmapped));
+	OCLCHECK(clWaitForEvents(1, &unmapped));
+	OCLCHECK(clReleaseEvent(unmapped));
+}
+
+/*
+ * Get usage statistics for the device's buffer pool.
+ */
+void get_buffer_pool_stats(cl_runtime runtime, cl_device_id dev,
+													 buffer_pool_stats* stats)
+{
+	buffer_pool* pool;
+
+	if(!runtime) OCLERR("passed bad runtime argument");
+	if(!stats) OCLCHECK(CL_INVALID_VALUE);
+
+	pool = find_buffer_pool(runtime, dev);
+	pthread_mutex_lock(&pool->lock);
+	*stats = pool->stats;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Release all idle buffers held by the runtime's buffer pools.
+ */
+void trim_buffer_pools(cl_runtime runtime)
+{
+	cl_uint i;
+
+	if(!runtime) OCLERR("passed bad runtime argument");
+
+	for(i = 0; i < num_platforms; i++)
+	{
+		pthread_mutex_lock(&runtime->pools[i].lock);
+		trim_buffer_pool(&runtime->pools[i]);
+		pthread_mutex_unlock(&runtime->pools[i].lock);
+	}
+
+	pthread_mutex_lock(&runtime->sub.lock);
+	for(i = 0; i < runtime->sub.num_subdevices; i++)
+	{
+		buffer_pool* pool = runtime->sub.subdevices[i].pool;
+		if(!pool) continue;
+		pthread_mutex_lock(&pool->lock);
+		trim_buffer_pool(pool);
+		pthread_mutex_unlock(&pool->lock);
+	}
+	pthread_mutex_unlock(&runtime->sub.lock);
+}
+
 /*
  * Save a previously-compiled program for later use (avoid runtime compilation
  * overhead).
@@ -0,0 +1,165 @@
+/*
+ * Checks buffer pools reuse released buffers of the same size class, flags &
+ * memory, that host-memory buffers keep their contents across map/unmap & that
+ * usage statistics add up.  Reports the time to get a buffer from the pool
+ * versus creating one.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+#include <CL/cl.h>
+
+#include "cl_rt.h"
+
+#define ITERATIONS 10000
+#define SIZE (1 << 20)
+
+static unsigned long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000UL) + ts.tv_nsec;
+}
+
+static void check_reuse(cl_runtime rt, cl_device_id dev)
+{
+	cl_mem a, b, c;
+	size_t size;
+
+	a = acquire_buffer(rt, dev, CL_MEM_READ_WRITE, BUFFER_DEVICE, 5000);
+	clGetMemObjectInfo(a, CL_MEM_SIZE, sizeof(size), &size, NULL);
+	assert(size == 2 * BUFFER_POOL_MIN_SIZE && "not rounded to size class");
+	release_buffer(rt, dev, a);
+
+	b = acquire_buffer(rt, dev, CL_MEM_READ_WRITE, BUFFER_DEVICE, 8000);
+	assert(b == a && "idle buffer in same size class not reused");
+	c = acquire_buffer(rt, dev, CL_MEM_READ_WRITE, BUFFER_DEVICE, 8000);
+	assert(c != b && "buffer handed out twice");
+	release_buffer(rt, dev, c);
+	c = acquire_buffer(rt, dev, CL_MEM_READ_ONLY, BUFFER_DEVICE, 8000);
+	assert(c != a && "reused buffer with different flags");
+	release_buffer(rt, dev, c);
+	c = acquire_buffer(rt, dev, CL_MEM_READ_WRITE, BUFFER_ALLOC_HOST, 8000);
+	assert(c != a && "reused buffer in different memory");
+	release_buffer(rt, dev, c);
+	c = acquire_buffer(rt, dev, CL_MEM_READ_WRITE, BUFFER_DEVICE, 9000);
+	assert(c != a && "reused buffer from smaller size class");
+	release_buffer(rt, dev, c);
+	release_buffer(rt, dev, b);
+	printf("reuse: idle buffers reused by size class, flags & memory\n");
+}
+
+static void check_mapping(cl_runtime rt, cl_device_id dev,
+													enum buffer_memory memory)
+{
+	cl_mem buf = acquire_buffer(rt, dev, CL_MEM_READ_WRITE, memory, SIZE);
+	unsigned char* ptr;
+	size_t i;
+
+	ptr = (unsigned char*)map_buffer(rt, dev, buf, CL_MAP_WRITE);
+	assert(ptr && "could not map buffer");
+	if(memory == BUFFER_USE_HOST)
+		assert(((size_t)ptr % BUFFER_POOL_MIN_SIZE) == 0 &&
+					 "unaligned host memory");
+	for(i = 0; i < SIZE; i++)
+		ptr[i] = (unsigned char)i;
+	unmap_buffer(rt, dev, buf, ptr);
+
+	ptr = (unsigned char*)map_buffer(rt, dev, buf, CL_MAP_READ);
+	for(i = 0; i < SIZE; i++)
+		assert(ptr[i] == (unsigned char)i && "contents lost across map/unmap");
+	unmap_buffer(rt, dev, buf, ptr);
+	release_buffer(rt, dev, buf);
+}
+
+static void check_stats(cl_runtime rt, cl_device_id dev)
+{
+	buffer_pool_stats stats;
+	cl_mem a, b;
+
+	trim_buffer_pools(rt);
+	get_buffer_pool_stats(rt, dev, &stats);
+	assert(stats.idle == 0 && stats.in_use == 0 && "trim kept idle buffers");
+
+	a = acquire_buffer(rt, dev, CL_MEM_READ_WRITE, BUFFER_DEVICE, SIZE);
+	b = acquire_buffer(rt, dev, CL_MEM_READ_WRITE, BUFFER_DEVICE, SIZE);
+	get_buffer_pool_stats(rt, dev, &stats);
+	assert(stats.in_use == 2 * SIZE && stats.idle == 0 && "wrong in-use bytes");
+	release_buffer(rt, dev, a);
+	release_buffer(rt, dev, b);
+	get_buffer_pool_stats(rt, dev, &stats);
+	assert(stats.in_use == 0 && stats.idle == 2 * SIZE && "wrong idle bytes");
+	assert(stats.peak >= 2 * SIZE && "wrong peak");
+	assert(stats.hits < stats.acquires && stats.releases == stats.acquires &&
+				 "acquires/releases don't add up");
+	printf("stats: %lu acquires, %lu hits, %lu releases, peak %lu bytes\n",
+				 stats.acquires, stats.hits, stats.releases, (unsigned long)stats.peak);
+}
+
+static void time_acquire(cl_runtime rt, cl_device_id dev)
+{
+	cl_context ctx = get_context_by_dev(rt, dev);
+	unsigned long start, created, pooled;
+	cl_mem buf;
+	cl_int err;
+	int i;
+
+	start = now_ns();
+	for(i = 0; i < ITERATIONS; i++)
+	{
+		buf = clCreateBuffer(ctx, CL_MEM_READ_WRITE, SIZE, NULL, &err);
+		assert(err == CL_SUCCESS);
+		clReleaseMemObject(buf);
+	}
+	created = now_ns() - start;
+
+	start = now_ns();
+	for(i = 0; i < ITERATIONS; i++)
+		release_buffer(rt, dev, acquire_buffer(rt, dev, CL_MEM_READ_WRITE,
+																					 BUFFER_DEVICE, SIZE));
+	pooled = now_ns() - start;
+
+	printf("acquire: %.0f ns per created buffer, %.0f ns per pooled buffer\n",
+				 (double)created / ITERATIONS, (double)pooled / ITERATIONS);
+}
+
+int main(int argc, char** argv)
+{
+	cl_runtime rt = new_cl_runtime(true);
+	cl_device_id dev = get_device(rt, 0, 0), sub;
+	buffer_pool_stats stats;
+	cl_bool unified;
+
+	check_reuse(rt, dev);
+
+	clGetDeviceInfo(dev, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(unified),
+									&unified, NULL);
+	check_mapping(rt, dev, BUFFER_DEVICE);
+	check_mapping(rt, dev, BUFFER_ALLOC_HOST);
+	check_mapping(rt, dev, BUFFER_USE_HOST);
+	printf("mapping: contents kept in all memories (%s)\n",
+				 unified ? "host memory is zero-copy" : "device doesn't share memory");
+
+	check_stats(rt, dev);
+	time_acquire(rt, dev);
+
+	// Sub-devices have their own context & so their own pool
+	if(get_device_type(rt, 0, 0) == CL_DEVICE_TYPE_CPU &&
+		 get_num_compute_units(rt, 0, 0) >= 2)
+	{
+		sub = get_subdevice(rt, 0, 0, get_num_compute_units(rt, 0, 0) / 2);
+		release_buffer(rt, sub, acquire_buffer(rt, sub, CL_MEM_READ_WRITE,
+																					 BUFFER_USE_HOST, SIZE));
+		get_buffer_pool_stats(rt, sub, &stats);
+		assert(stats.acquires == 1 && stats.idle == SIZE &&
+					 "sub-device shares a pool");
+		printf("sub-device: has its own pool\n");
+	}
+
+	delete_cl_runtime(rt);
+	printf("All tests passed\n");
+	return 0;
+}
@@ -0,0 +1,90 @@
+/*
+ * Hammers the device lookup table from several threads while sub-devices are
+ * being created, checking every lookup returns the device's own context,
+ * queue & platform.  Reports the time per lookup.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <assert.h>
+#include <pthread.h>
+#include <CL/cl.h>
+
+#include "cl_rt.h"
+
+#define THREADS 4
+#define LOOKUPS 1000000
+
+static cl_runtime rt;
+static cl_device_id dev;
+static cl_context ctx;
+static cl_command_queue queue;
+static cl_platform_id platform;
+
+static unsigned long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000UL) + ts.tv_nsec;
+}
+
+static void* lookup(void* arg)
+{
+	unsigned long start = now_ns(), i;
+
+	for(i = 0; i < LOOKUPS; i++)
+	{
+		assert(get_context_by_dev(rt, dev) == ctx && "wrong context");
+		assert(get_queue_by_dev(rt, dev) == queue && "wrong queue");
+		assert(get_platform_by_dev(rt, dev) == platform && "wrong platform");
+	}
+	*(unsigned long*)arg = now_ns() - start;
+	return NULL;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned long elapsed[THREADS], total = 0;
+	pthread_t threads[THREADS];
+	cl_device_id sub;
+	cl_uint units;
+	int i;
+
+	rt = new_cl_runtime(true);
+	dev = get_device(rt, 0, 0);
+	ctx = get_context_by_platform(rt, 0);
+	queue = get_queue_by_dev(rt, dev);
+	platform = get_platform(rt, 0);
+
+	for(i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, lookup, &elapsed[i]);
+
+	// Sub-devices are added to the table while it's being read
+	if(get_device_type(rt, 0, 0) == CL_DEVICE_TYPE_CPU)
+	{
+		for(units = 1; units < get_num_compute_units(rt, 0, 0); units++)
+		{
+			sub = get_subdevice(rt, 0, 0, units);
+			if(sub == dev) break;
+			assert(get_context_by_dev(rt, sub) != ctx && "sub-device got "
+						 "platform's context");
+			assert(get_queue_by_dev(rt, sub) == get_queue_by_dev(rt, sub) &&
+						 "sub-device queue re-created");
+			assert(get_platform_by_dev(rt, sub) == platform && "wrong platform");
+		}
+		printf("sub-devices: %u added during lookups\n", units - 1);
+	}
+
+	for(i = 0; i < THREADS; i++)
+	{
+		pthread_join(threads[i], NULL);
+		total += elapsed[i];
+	}
+	printf("lookups: %.1f ns per context/queue/platform lookup (%d threads)\n",
+				 (double)total / (THREADS * LOOKUPS * 3UL), THREADS);
+
+	delete_cl_runtime(rt);
+	printf("All tests passed\n");
+	return 0;
+}
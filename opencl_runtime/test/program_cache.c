@@ -0,0 +1,161 @@
+/*
+ * Checks the program binary cache: rebuilding the same source with the same
+ * arguments loads the cached binary, changing the arguments or an included
+ * header builds a new one & binaries the driver rejects are replaced.  Reports
+ * cold & warm build times.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <CL/cl.h>
+
+#include "cl_rt.h"
+
+static const char* source =
+"__kernel void scale(__global float* a, float s)\n"
+"{\n"
+"	a[get_global_id(0)] *= s;\n"
+"}\n";
+
+static const char* including =
+"#include \"scale.h\"\n"
+"__kernel void scale(__global float* a)\n"
+"{\n"
+"	a[get_global_id(0)] *= SCALE;\n"
+"}\n";
+
+static void write_file(const char* fname, const char* contents)
+{
+	FILE* fp = fopen(fname, "w");
+	assert(fp && "could not write file");
+	fputs(contents, fp);
+	fclose(fp);
+}
+
+static unsigned long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000UL) + ts.tv_nsec;
+}
+
+/* Return the number of cached binaries & the name of the last one */
+static int cached(const char* dir, char* last, size_t size)
+{
+	struct dirent* ent;
+	int num = 0;
+	DIR* d;
+
+	d = opendir(dir);
+	assert(d && "no cache directory");
+	while((ent = readdir(d)))
+	{
+		if(ent->d_name[0] == '.') continue;
+		snprintf(last, size, "%s/%s", dir, ent->d_name);
+		num++;
+	}
+	closedir(d);
+	return num;
+}
+
+static unsigned long build(cl_runtime rt, const char* fname, const char* args,
+													 cl_device_id dev)
+{
+	unsigned long start = now_ns();
+	cl_program program = build_program_with_args(rt, fname, args, dev);
+	unsigned long end = now_ns();
+
+	assert(program && "no program");
+	clReleaseProgram(program);
+	return end - start;
+}
+
+int main(int argc, char** argv)
+{
+	char dir[] = "/tmp/ocl-rt-cache.XXXXXX", fname[64], bin[512];
+	char inc[64], header[128], inc_fname[64], inc_args[80];
+	unsigned long cold, warm;
+	cl_device_id dev;
+	cl_runtime rt;
+	FILE* fp;
+	int num;
+
+	if(!mkdtemp(dir))
+	{
+		perror("Could not create cache directory");
+		return 1;
+	}
+	snprintf(fname, sizeof(fname), "%s.cl", dir);
+	write_file(fname, source);
+
+	rt = new_cl_runtime(false);
+	set_program_cache(rt, dir);
+	dev = get_device(rt, 0, 0);
+
+	cold = build(rt, fname, "-DN=1", dev);
+	num = cached(dir, bin, sizeof(bin));
+	assert(num == 1 && "binary not cached");
+	warm = build(rt, fname, "-DN=1", dev);
+	num = cached(dir, bin, sizeof(bin));
+	assert(num == 1 && "cached binary not reused");
+	printf("hit: cold build %lu us, warm build %lu us\n", cold / 1000,
+				 warm / 1000);
+
+	build(rt, fname, "-DN=2", dev);
+	num = cached(dir, bin, sizeof(bin));
+	assert(num == 2 && "arguments not in key");
+	printf("miss: different arguments get their own binary\n");
+
+	// Headers found through -I are part of the key
+	snprintf(inc, sizeof(inc), "%s.inc", dir);
+	snprintf(header, sizeof(header), "%s/scale.h", inc);
+	snprintf(inc_fname, sizeof(inc_fname), "%s.inc.cl", dir);
+	snprintf(inc_args, sizeof(inc_args), "-I %s", inc);
+	mkdir(inc, 0755);
+	write_file(header, "#define SCALE 2.0f\n");
+	write_file(inc_fname, including);
+	build(rt, inc_fname, inc_args, dev);
+	build(rt, inc_fname, inc_args, dev);
+	num = cached(dir, bin, sizeof(bin));
+	assert(num == 3 && "binary with includes not cached");
+	write_file(header, "#define SCALE 3.0f\n");
+	build(rt, inc_fname, inc_args, dev);
+	num = cached(dir, bin, sizeof(bin));
+	assert(num == 4 && "included header not in key");
+	printf("miss: changing an included header builds a new binary\n");
+
+	// Corrupt every binary, they should be replaced
+	set_program_cache(rt, NULL);
+	build(rt, fname, "-DN=3", dev);
+	num = cached(dir, bin, sizeof(bin));
+	assert(num == 4 && "cached while disabled");
+	set_program_cache(rt, dir);
+	write_file(bin, "garbage");
+	build(rt, fname, "-DN=1", dev);
+	build(rt, fname, "-DN=2", dev);
+	build(rt, inc_fname, inc_args, dev);
+	num = cached(dir, bin, sizeof(bin));
+	assert(num == 4 && "rejected binary not replaced");
+	fp = fopen(bin, "r");
+	assert(fp && "could not open binary");
+	num = fgetc(fp);
+	assert(num != 'g' && "rejected binary kept");
+	fclose(fp);
+	printf("reject: rejected binaries are rebuilt & replaced\n");
+
+	delete_cl_runtime(rt);
+	while(cached(dir, bin, sizeof(bin))) unlink(bin);
+	rmdir(dir);
+	unlink(fname);
+	unlink(inc_fname);
+	unlink(header);
+	rmdir(inc);
+	printf("All tests passed\n");
+	return 0;
+}
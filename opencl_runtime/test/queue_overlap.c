@@ -0,0 +1,145 @@
+/*
+ * Checks command queue pools hand out queues round-robin & per thread, &
+ * measures how much enqueue_overlapped() gains by spreading copies & kernels
+ * over several queues (or an out-of-order queue) rather than one in-order
+ * queue.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <assert.h>
+#include <pthread.h>
+#include <CL/cl.h>
+
+#include "cl_rt.h"
+
+#define ITEMS (1 << 22)
+#define CHUNKS 8
+#define REPS 5
+
+static const char* source =
+"__kernel void scale(__global const float* in, __global float* out)\n"
+"{\n"
+"	size_t i = get_global_id(0);\n"
+"	out[i] = in[i] * 2.0f;\n"
+"}\n";
+
+static float host_in[ITEMS], host_out[ITEMS];
+
+static unsigned long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000UL) + ts.tv_nsec;
+}
+
+static void check_round_robin()
+{
+	cl_runtime rt = new_cl_runtime_with_pools(3, 0, QUEUE_ROUND_ROBIN);
+	cl_device_id dev = get_device(rt, 0, 0);
+	cl_command_queue a, b, c;
+
+	assert(get_num_queues(rt) == 3 && "wrong pool size");
+	a = get_pool_queue(rt, dev);
+	b = get_pool_queue(rt, dev);
+	c = get_pool_queue(rt, dev);
+	assert(a != b && b != c && a != c && "queue handed out twice");
+	assert(get_pool_queue(rt, dev) == a && "didn't wrap around");
+	assert(get_queue_by_dev(rt, dev) == get_queue_by_index(rt, dev, 0) &&
+				 "default queue isn't the first in the pool");
+	delete_cl_runtime(rt);
+	printf("round-robin: queues handed out in turn\n");
+}
+
+static cl_runtime per_thread_rt;
+
+static void* thread_queue(void* arg)
+{
+	cl_device_id dev = get_device(per_thread_rt, 0, 0);
+	cl_command_queue q = get_pool_queue(per_thread_rt, dev);
+
+	assert(get_pool_queue(per_thread_rt, dev) == q && "thread's queue changed");
+	*(cl_command_queue*)arg = q;
+	return NULL;
+}
+
+static void check_per_thread()
+{
+	cl_command_queue queues[2];
+	pthread_t threads[2];
+	int i;
+
+	per_thread_rt = new_cl_runtime_with_pools(2, 0, QUEUE_PER_THREAD);
+	for(i = 0; i < 2; i++)
+		pthread_create(&threads[i], NULL, thread_queue, &queues[i]);
+	for(i = 0; i < 2; i++)
+		pthread_join(threads[i], NULL);
+	assert(queues[0] != queues[1] && "threads share a queue");
+	delete_cl_runtime(per_thread_rt);
+	printf("per-thread: each thread keeps its own queue\n");
+}
+
+/* Best time to run the kernel over all items in chunks */
+static double time_overlapped(cl_uint queues,
+															cl_command_queue_properties props)
+{
+	cl_runtime rt = new_cl_runtime_with_pools(queues, props, QUEUE_ROUND_ROBIN);
+	cl_device_id dev = get_device(rt, 0, 0);
+	cl_context ctx = get_context_by_dev(rt, dev);
+	unsigned long start, best = ~0UL;
+	cl_program program;
+	cl_kernel kernel;
+	cl_mem in, out;
+	cl_int err;
+	int i;
+
+	program = clCreateProgramWithSource(ctx, 1, &source, NULL, &err);
+	assert(err == CL_SUCCESS &&
+				 clBuildProgram(program, 1, &dev, NULL, NULL, NULL) == CL_SUCCESS);
+	kernel = clCreateKernel(program, "scale", &err);
+	assert(err == CL_SUCCESS);
+	in = clCreateBuffer(ctx, CL_MEM_READ_ONLY, sizeof(host_in), NULL, &err);
+	assert(err == CL_SUCCESS);
+	out = clCreateBuffer(ctx, CL_MEM_WRITE_ONLY, sizeof(host_out), NULL, &err);
+	assert(err == CL_SUCCESS);
+	clSetKernelArg(kernel, 0, sizeof(cl_mem), &in);
+	clSetKernelArg(kernel, 1, sizeof(cl_mem), &out);
+
+	for(i = 0; i < REPS; i++)
+	{
+		start = now_ns();
+		err = enqueue_overlapped(rt, dev, kernel, ITEMS, 0, CHUNKS, in, host_in,
+														 sizeof(float), out, host_out, sizeof(float));
+		assert(err == CL_SUCCESS && "could not run overlapped");
+		if(now_ns() - start < best) best = now_ns() - start;
+	}
+
+	clReleaseMemObject(in);
+	clReleaseMemObject(out);
+	clReleaseKernel(kernel);
+	clReleaseProgram(program);
+	delete_cl_runtime(rt);
+	return best / 1e6;
+}
+
+int main(int argc, char** argv)
+{
+	double serial, pooled, ooo;
+	int i;
+
+	check_round_robin();
+	check_per_thread();
+
+	for(i = 0; i < ITEMS; i++)
+		host_in[i] = (float)i;
+	serial = time_overlapped(1, 0);
+	pooled = time_overlapped(3, 0);
+	ooo = time_overlapped(1, CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
+	printf("overlap (%d chunks): 1 in-order queue %.2f ms, 3 in-order queues "
+				 "%.2f ms (%.2fx), 1 out-of-order queue %.2f ms (%.2fx)\n", CHUNKS,
+				 serial, pooled, serial / pooled, ooo, serial / ooo);
+
+	printf("All tests passed\n");
+	return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * Measures the cost of device fission with & without the runtime's sub-device
+ * cache, & checks that cached sub-devices get a working context & queue.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <assert.h>
+#include <CL/cl.h>
+
+#include "cl_rt.h"
+
+#define ITERATIONS 1000
+
+static unsigned long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000UL) + ts.tv_nsec;
+}
+
+/* What every call to get_subdevice() used to cost */
+static double time_fission(cl_device_id dev, cl_uint units)
+{
+	cl_device_partition_property pp[] = {
+		CL_DEVICE_PARTITION_BY_COUNTS, units,
+		CL_DEVICE_PARTITION_BY_COUNTS_LIST_END, 0
+	};
+	unsigned long start, end;
+	cl_device_id sub;
+	cl_uint num_ret;
+	int i;
+
+	start = now_ns();
+	for(i = 0; i < ITERATIONS; i++)
+	{
+		if(clCreateSubDevices(dev, pp, 1, &sub, &num_ret) != CL_SUCCESS)
+			return -1.0;
+		clReleaseDevice(sub);
+	}
+	end = now_ns();
+	return (double)(end - start) / ITERATIONS;
+}
+
+static void test_device(cl_runtime rt, cl_uint platform, cl_uint device)
+{
+	cl_uint units = get_num_compute_units(rt, platform, device) / 2;
+	unsigned long start, first, end;
+	cl_device_id sub, again;
+	double uncached;
+	cl_context ctx;
+	cl_command_queue q;
+	int i;
+
+	uncached = time_fission(get_device(rt, platform, device), units);
+	if(uncached < 0.0)
+	{
+		printf("%u/%u: cannot subdivide\n", platform, device);
+		return;
+	}
+
+	start = now_ns();
+	sub = get_subdevice(rt, platform, device, units);
+	first = now_ns();
+	for(i = 0; i < ITERATIONS; i++)
+	{
+		again = get_subdevice(rt, platform, device, units);
+		assert(again == sub && "sub-device not cached");
+	}
+	end = now_ns();
+	assert(get_num_compute_units_by_dev(sub) == units && "wrong sub-device");
+
+	ctx = get_context_by_dev(rt, sub);
+	q = get_queue_by_dev(rt, sub);
+	assert(ctx && q && "no context/queue for sub-device");
+	assert(get_context_by_dev(rt, sub) == ctx && get_queue_by_dev(rt, sub) == q &&
+				 "context/queue re-created");
+	assert(clFinish(q) == CL_SUCCESS && "unusable queue");
+
+	printf("%u/%u: %u unit(s), fission %.0f ns per call uncached, "
+				 "%lu ns first call, %.0f ns per call cached\n",
+				 platform, device, units, uncached, first - start,
+				 (double)(end - first) / ITERATIONS);
+}
+
+int main(int argc, char** argv)
+{
+	cl_uint i, j;
+	cl_runtime rt = new_cl_runtime(true);
+
+	for(i = 0; i < get_num_platforms(); i++)
+		for(j = 0; j < get_num_devices(i); j++)
+			if(get_device_type(rt, i, j) == CL_DEVICE_TYPE_CPU &&
+				 get_num_compute_units(rt, i, j) >= 2)
+				test_device(rt, i, j);
+	delete_cl_runtime(rt);
+	return 0;
+}